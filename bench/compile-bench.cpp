@@ -0,0 +1,210 @@
+#include "codegen.hpp"
+#include "optimization.hpp"
+#include "parser.hpp"
+
+#include "catch2/catch.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+// The number of chunks in the synthetic programs
+constexpr size_t SYNTHETIC_CHUNKS = 100000;
+
+// The numbers of chunks in the programs that code generation is timed for, to
+// check that it takes time in proportion to the size of the program
+constexpr size_t SCALING_CHUNKS[] = {10000, 100000, 1000000};
+
+/**
+ * Reads in one of the example programs.
+ *
+ * @param name
+ *     The filename of the example in the examples directory
+ *
+ * @return
+ *     The source of the example
+ */
+std::string readExample(const std::string &name) {
+    std::ifstream file{std::string(XRF_EXAMPLES_DIR) + "/" + name};
+
+    REQUIRE(file);
+
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+/**
+ * Generates a program of random chunks, which mostly jump to chunks that
+ * aren't known until runtime. The same program is generated every time.
+ *
+ * @return
+ *     The source of the program
+ */
+std::string randomProgram() {
+    constexpr char HEX_DIGITS[] = "0123456789ABCDEF";
+
+    std::string source;
+    uint64_t state = 0x2545F4914F6CDD1D;
+
+    for (size_t i = 0; i < SYNTHETIC_CHUNKS; i++) {
+        for (size_t j = 0; j < xrf::COMMANDS_PER_CHUNK; j++) {
+            // A xorshift generator, so the program is the same everywhere
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+
+            source += HEX_DIGITS[state % 16];
+        }
+
+        source += i % 16 == 15 ? '\n' : ' ';
+    }
+
+    return source;
+}
+
+/**
+ * Generates a program where every chunk adds to the second value of the
+ * stack and then jumps to the chunk after it, so that every jump is known
+ * and the whole program can be traced.
+ *
+ * @param chunks
+ *     The number of chunks in the program
+ *
+ * @return
+ *     The source of the program
+ */
+std::string chainedProgram(size_t chunks = SYNTHETIC_CHUNKS) {
+    std::string source;
+
+    for (size_t i = 0; i < chunks; i++) {
+        source += i % 16 == 15 ? "45455\n" : "45455 ";
+    }
+
+    return source;
+}
+
+/**
+ * Generates a program where every chunk depends on whether it's been visited,
+ * and then jumps to a chunk that isn't known until runtime, so that every
+ * chunk is split at its Ignore command and goes through the shared jump.
+ *
+ * @param chunks
+ *     The number of chunks in the program
+ *
+ * @return
+ *     The source of the program
+ */
+std::string visitingProgram(size_t chunks) {
+    std::string source;
+
+    for (size_t i = 0; i < chunks; i++) {
+        source += i % 16 == 15 ? "8A5FF\n" : "8A5FF ";
+    }
+
+    return source;
+}
+
+/**
+ * Parses a program that's known to be valid.
+ *
+ * @param source
+ *     The source of the program
+ *
+ * @return
+ *     The chunks of the program
+ */
+std::vector<xrf::Chunk> parseValid(const std::string &source) {
+    auto result = xrf::parseXrf(std::string_view(source));
+
+    REQUIRE(std::holds_alternative<std::vector<xrf::Chunk>>(result));
+
+    return std::get<std::vector<xrf::Chunk>>(std::move(result));
+}
+
+/**
+ * Benchmarks each phase of compiling a program.
+ *
+ * @param name
+ *     The name of the program, which the benchmarks are named after
+ * @param source
+ *     The source of the program
+ */
+void benchmarkPhases(const std::string &name, const std::string &source) {
+    BENCHMARK("parseXrf " + name) {
+        return xrf::parseXrf(std::string_view(source));
+    };
+
+    auto specialized = xrf::specializeVisits(parseValid(source));
+
+    // Each run optimizes its own copy, so copying the chunks isn't timed
+    BENCHMARK_ADVANCED("optimizeChunks " + name)(Catch::Benchmark::Chronometer meter) {
+        std::vector<std::vector<xrf::Chunk>> inputs(meter.runs(), specialized);
+
+        meter.measure([&] (int i) {
+            return xrf::optimizeChunks(std::move(inputs[i]));
+        });
+    };
+
+    auto chunkOptimized = xrf::optimizeChunks(specialized);
+
+    BENCHMARK_ADVANCED("optimizeProgram " + name)(Catch::Benchmark::Chronometer meter) {
+        std::vector<std::vector<xrf::Chunk>> inputs(meter.runs(), chunkOptimized);
+
+        meter.measure([&] (int i) {
+            return xrf::optimizeProgram(std::move(inputs[i]));
+        });
+    };
+
+    auto optimized = xrf::optimizeProgram(chunkOptimized);
+
+    BENCHMARK("generateCode " + name) {
+        llvm::LLVMContext context;
+
+        // The module has to be destroyed before the context it was made in
+        return xrf::generateCode(context, optimized)->size();
+    };
+}
+
+} // anonymous namespace
+
+TEST_CASE("Compiling 2.xrf", "[benchmark]") {
+    benchmarkPhases("2.xrf", readExample("2.xrf"));
+}
+
+TEST_CASE("Compiling quine.xrf", "[benchmark]") {
+    benchmarkPhases("quine.xrf", readExample("quine.xrf"));
+}
+
+TEST_CASE("Compiling a random 100k chunk program", "[benchmark]") {
+    benchmarkPhases("random", randomProgram());
+}
+
+TEST_CASE("Compiling a chained 100k chunk program", "[benchmark]") {
+    benchmarkPhases("chained", chainedProgram());
+}
+
+TEST_CASE("Generating code for bigger and bigger programs", "[benchmark]") {
+    for (auto size: SCALING_CHUNKS) {
+        auto name = size >= 1000000 ? std::to_string(size / 1000000) + "M" : std::to_string(size / 1000) + "k";
+
+        // These are generated without being optimized, so that every chunk
+        // still has its Ignore command
+        auto visiting = parseValid(visitingProgram(size));
+
+        BENCHMARK("generateCode visiting " + name) {
+            llvm::LLVMContext context;
+            return xrf::generateCode(context, visiting)->size();
+        };
+
+        auto chained = xrf::optimizeProgram(xrf::optimizeChunks(xrf::specializeVisits(parseValid(chainedProgram(size)))));
+
+        BENCHMARK("generateCode chained " + name) {
+            llvm::LLVMContext context;
+            return xrf::generateCode(context, chained)->size();
+        };
+    }
+}
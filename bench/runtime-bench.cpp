@@ -0,0 +1,309 @@
+#include "codegen.hpp"
+#include "emit.hpp"
+#include "optimization.hpp"
+#include "parser.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <optional>
+#include <string>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+// The number of bytes of input given to programs that read input
+constexpr size_t INPUT_SIZE = 1 << 20;
+
+// The number of times each program is run, with the fastest run reported
+constexpr int RUNS = 3;
+
+// The LLVM optimization level the programs are compiled with. LLVM's own
+// optimizations take minutes on the bigger examples, so they're left out, and
+// the timings only show the effect of the XRF optimizations.
+constexpr int LLVM_OPT_LEVEL = 0;
+
+// How long a program can run for before it's taken to be stuck
+constexpr int TIMEOUT_MS = 60000;
+
+/**
+ * An example program to time, along with how it's run.
+ */
+struct RuntimeBenchmark {
+    /**
+     * The filename of the example in the examples directory
+     */
+    const char *example;
+
+    /**
+     * Whether the program is given INPUT_SIZE bytes of input, instead of no
+     * input at all
+     */
+    bool takesInput;
+
+    /**
+     * The number of bytes of output after which the program is stopped
+     */
+    size_t outputCap;
+};
+
+/**
+ * The programs that get timed. The programs that copy their input are
+ * stopped once they've written out as much as they've read, and the
+ * programs that never stop are stopped after a fixed amount of output.
+ */
+const RuntimeBenchmark BENCHMARKS[] = {
+    {"cat.xrf", true, INPUT_SIZE},
+    {"rot13.xrf", true, INPUT_SIZE},
+    {"2.xrf", false, 1 << 16},
+    {"aaaaa.xrf", false, 1 << 24},
+};
+
+/**
+ * The result of timing a run of a program.
+ */
+struct RunResult {
+    /**
+     * How long the program ran for, in seconds
+     */
+    double seconds;
+
+    /**
+     * The number of bytes the program wrote out before it exited or was
+     * stopped
+     */
+    size_t outputSize;
+};
+
+/**
+ * Writes out the input given to the programs that read input, which is
+ * lines of lowercase words, and is the same every time.
+ *
+ * @param filename
+ *     The file to write the input to
+ */
+void writeInput(const std::string &filename) {
+    std::ofstream file{filename, std::ios::binary};
+
+    uint32_t state = 1;
+
+    for (size_t i = 0; i < INPUT_SIZE; i++) {
+        state = state * 1103515245 + 12345;
+
+        auto letter = (state >> 16) % 32;
+
+        if (i % 64 == 63) {
+            file.put('\n');
+        }
+        else if (letter >= 26) {
+            file.put(' ');
+        }
+        else {
+            file.put(static_cast<char>('a' + letter));
+        }
+    }
+}
+
+/**
+ * Compiles one of the example programs into an executable.
+ *
+ * @param example
+ *     The filename of the example in the examples directory
+ * @param optLevel
+ *     The XRF optimization level, from 0 to 2
+ * @param filename
+ *     The file to write the executable to
+ *
+ * @return
+ *     An error if the program couldn't be compiled
+ */
+llvm::Error compileExample(const std::string &example, int optLevel, const std::string &filename) {
+    auto path = std::string(XRF_EXAMPLES_DIR) + "/" + example;
+    auto file = llvm::MemoryBuffer::getFile(path);
+
+    if (!file) {
+        return llvm::createFileError(path, file.getError());
+    }
+
+    auto result = xrf::parseXrf(std::string_view((*file)->getBufferStart(), (*file)->getBufferSize()));
+
+    if (!std::holds_alternative<std::vector<xrf::Chunk>>(result)) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(), "Unable to parse %s", path.c_str());
+    }
+
+    auto chunks = std::get<std::vector<xrf::Chunk>>(std::move(result));
+
+    if (optLevel > 0) {
+        chunks = xrf::optimizeChunks(xrf::specializeVisits(std::move(chunks)));
+    }
+
+    if (optLevel > 1) {
+        chunks = xrf::optimizeProgram(std::move(chunks));
+    }
+
+    llvm::LLVMContext context;
+    auto module = xrf::generateCode(context, chunks);
+
+    auto targetMachine = xrf::createTargetMachine(LLVM_OPT_LEVEL);
+
+    if (!targetMachine) {
+        return targetMachine.takeError();
+    }
+
+    xrf::optimizeModule(*module, **targetMachine, LLVM_OPT_LEVEL);
+
+    return xrf::writeModule(*module, **targetMachine, xrf::OutputType::Executable, filename);
+}
+
+/**
+ * Runs a compiled program, timing how long it takes to write out its output.
+ *
+ * @param program
+ *     The executable to run
+ * @param input
+ *     The file the program reads its input from
+ * @param outputCap
+ *     The number of bytes of output after which the program is stopped
+ *
+ * @return
+ *     How long the program ran for, or nothing if it couldn't be run or got
+ *     stuck
+ */
+std::optional<RunResult> runProgram(const std::string &program, const std::string &input, size_t outputCap) {
+    int output[2];
+
+    if (pipe(output) != 0) {
+        return std::nullopt;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto pid = fork();
+
+    if (pid < 0) {
+        close(output[0]);
+        close(output[1]);
+        return std::nullopt;
+    }
+
+    if (pid == 0) {
+        auto inputFd = open(input.c_str(), O_RDONLY);
+
+        dup2(inputFd, STDIN_FILENO);
+        dup2(output[1], STDOUT_FILENO);
+
+        close(inputFd);
+        close(output[0]);
+        close(output[1]);
+
+        execl(program.c_str(), program.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+
+    close(output[1]);
+
+    RunResult result = {0, 0};
+    bool stuck = false;
+    char buffer[65536];
+
+    while (result.outputSize < outputCap) {
+        pollfd pollOutput = {output[0], POLLIN, 0};
+
+        if (poll(&pollOutput, 1, TIMEOUT_MS) <= 0) {
+            stuck = true;
+            break;
+        }
+
+        auto bytesRead = read(output[0], buffer, sizeof(buffer));
+
+        if (bytesRead <= 0) {
+            break;
+        }
+
+        result.outputSize += bytesRead;
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    close(output[0]);
+
+    if (stuck) {
+        return std::nullopt;
+    }
+
+    return result;
+}
+
+} // anonymous namespace
+
+int main() {
+    llvm::SmallString<128> tempDir;
+
+    if (llvm::sys::fs::createUniqueDirectory("xrf-runtime-bench", tempDir)) {
+        std::fprintf(stderr, "Unable to create a temporary directory\n");
+        return 1;
+    }
+
+    auto inputFile = std::string(tempDir) + "/input.txt";
+    auto programFile = std::string(tempDir) + "/program";
+
+    writeInput(inputFile);
+
+    int status = 0;
+
+    for (const auto &benchmark: BENCHMARKS) {
+        for (int optLevel = 0; optLevel <= 2; optLevel++) {
+            if (auto err = compileExample(benchmark.example, optLevel, programFile)) {
+                std::fprintf(stderr, "%s -O%d: %s\n", benchmark.example, optLevel,
+                             llvm::toString(std::move(err)).c_str());
+                status = 1;
+                continue;
+            }
+
+            auto input = benchmark.takesInput ? inputFile : "/dev/null";
+
+            std::optional<RunResult> best;
+
+            for (int run = 0; run < RUNS; run++) {
+                auto result = runProgram(programFile, input, benchmark.outputCap);
+
+                if (!result) {
+                    best = std::nullopt;
+                    break;
+                }
+
+                if (!best || result->seconds < best->seconds) {
+                    best = result;
+                }
+            }
+
+            if (!best) {
+                std::fprintf(stderr, "%s -O%d: the program couldn't be run, or got stuck\n",
+                             benchmark.example, optLevel);
+                status = 1;
+                continue;
+            }
+
+            std::printf("%-10s -O%d %9.4fs %9zu bytes %9.2f MB/s\n", benchmark.example, optLevel,
+                        best->seconds, best->outputSize, best->outputSize / best->seconds / 1e6);
+            std::fflush(stdout);
+        }
+    }
+
+    llvm::sys::fs::remove_directories(tempDir);
+
+    return status;
+}
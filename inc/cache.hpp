@@ -0,0 +1,104 @@
+#pragma once
+
+#include "codegen.hpp"
+#include "xrf-chunk.hpp"
+
+#include "llvm/Support/Error.h"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace xrf {
+
+/**
+ * Works out the key that the compiled output of a program is stored under in
+ * the cache. The key is a hash of the hash of every chunk, which covers the
+ * chunk's commands and the chunks it's known to jump to, along with the
+ * options and settings that change the compiled output.
+ *
+ * @param chunks
+ *     The chunks of the program, after they've been optimized
+ * @param options
+ *     The options that code is generated with
+ * @param settings
+ *     Anything else that changes the compiled output, like the kind of file
+ *     being written
+ *
+ * @return
+ *     The cache key for the compiled output
+ */
+std::string getCacheKey(const std::vector<Chunk> &chunks, const CodegenOptions &options, const std::string &settings);
+
+/**
+ * Works out the key that one of the modules of partitioned code is stored
+ * under in the cache, once it's been compiled. A partition's key only covers
+ * its own chunks and the functions of the chunks they're known to jump to,
+ * so editing a chunk only changes the keys of its own partition, the main
+ * module, and any partition the layout moves it out of or into.
+ *
+ * @param chunks
+ *     The chunks of the program, after they've been optimized
+ * @param options
+ *     The options that code is generated with
+ * @param layout
+ *     The functions that the code is split into, from layoutPartitions()
+ * @param partition
+ *     The partition of the module, or std::nullopt for the main module
+ * @param settings
+ *     Anything else that changes the compiled output
+ *
+ * @return
+ *     The cache key for the compiled module
+ */
+std::string getSplitModuleKey(const std::vector<Chunk> &chunks, const CodegenOptions &options,
+                              const PartitionLayout &layout, std::optional<size_t> partition,
+                              const std::string &settings);
+
+/**
+ * Finds the file stored in the cache under the given key, which can be used
+ * straight from the cache without copying it.
+ *
+ * @param cacheDir
+ *     The directory the cache is kept in
+ * @param key
+ *     The key of the file
+ *
+ * @return
+ *     The path of the cached file, or std::nullopt if there isn't one
+ */
+std::optional<std::string> findCached(const std::string &cacheDir, const std::string &key);
+
+/**
+ * Copies a compiled file out of the cache, if there's a file stored in the
+ * cache under the given key.
+ *
+ * @param cacheDir
+ *     The directory the cache is kept in
+ * @param key
+ *     The key of the file to copy
+ * @param filename
+ *     The file to copy the cached file to
+ *
+ * @return
+ *     Whether the file was found in the cache and copied
+ */
+bool loadCached(const std::string &cacheDir, const std::string &key, const std::string &filename);
+
+/**
+ * Stores a copy of a compiled file in the cache under the given key, creating
+ * the cache directory if it doesn't exist yet.
+ *
+ * @param cacheDir
+ *     The directory the cache is kept in
+ * @param key
+ *     The key to store the file under
+ * @param filename
+ *     The compiled file to store
+ *
+ * @return
+ *     An error if the file couldn't be stored
+ */
+llvm::Error storeCached(const std::string &cacheDir, const std::string &key, const std::string &filename);
+
+} // namespace xrf
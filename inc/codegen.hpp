@@ -1,14 +1,174 @@
 #pragma once
 
+#include "jump-targets.hpp"
+#include "profile.hpp"
 #include "xrf-chunk.hpp"
 
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <string>
+#include <vector>
 
 namespace xrf {
 
+/**
+ * The different ways that generated code can perform input and output.
+ */
+enum class IoMode {
+    // Reads and writes a character at a time through getchar() and putchar()
+    Stdio,
+
+    // Reads and writes through buffers, in bulk with read() and write()
+    Buffered,
+};
+
+/**
+ * The different ways that generated code can jump to the next chunk, when
+ * the next chunk isn't known until runtime.
+ */
+enum class DispatchMode {
+    // Every chunk branches to one shared switch over the chunk indices
+    Switch,
+
+    // Every chunk ends with its own indirect branch through a table of block
+    // addresses, exiting the program if the chunk doesn't exist
+    Threaded,
+
+    // The same as Threaded, but without checking that the chunk exists
+    ThreadedUnchecked,
+};
+
+/**
+ * The different kinds of memory that the stack can be kept in.
+ */
+enum class StackStorage {
+    // A global array
+    Static,
+
+    // Memory that's reserved with mmap() when the program starts, and only
+    // paged in by the OS as it gets used
+    Mmap,
+};
+
+/**
+ * The default number of values the stack can hold, when it's a global array.
+ */
+constexpr uint64_t DEFAULT_STACK_SIZE = 65536;
+
+/**
+ * The default number of values the stack can hold, when it's mapped with
+ * mmap(). This reserves 1 GiB of address space.
+ */
+constexpr uint64_t DEFAULT_MMAP_STACK_SIZE = uint64_t(1) << 28;
+
+/**
+ * The file that instrumented programs write their profile to by default.
+ */
+constexpr const char *DEFAULT_PROFILE_FILE = "xrf.profile";
+
+
+/**
+ * Options that control what kind of LLVM code is generated for an XRF program.
+ */
+struct CodegenOptions {
+    /**
+     * Whether to keep the indices of the top and bottom of the stack, and the
+     * top value of the stack, in SSA registers that get passed from chunk to
+     * chunk, rather than in stack-allocated variables that every command has
+     * to load from and store to.
+     */
+    bool registerState = false;
+
+    /**
+     * How the generated code performs input and output
+     */
+    IoMode ioMode = IoMode::Stdio;
+
+    /**
+     * How the generated code jumps to chunks chosen at runtime
+     */
+    DispatchMode dispatchMode = DispatchMode::Switch;
+
+    /**
+     * The number of values the stack can hold before it wraps around, which
+     * must be a power of two
+     */
+    uint64_t stackSize = DEFAULT_STACK_SIZE;
+
+    /**
+     * The kind of memory the stack is kept in
+     */
+    StackStorage stackStorage = StackStorage::Static;
+
+    /**
+     * Whether the generated code stops with an error, giving the line and
+     * column of the chunk, when a chunk would pop a value off of an empty
+     * stack, push more values than the stack can hold, or jump to a chunk
+     * that doesn't exist. Each chunk checks the stack once when it starts.
+     * This can't be used with DispatchMode::ThreadedUnchecked.
+     */
+    bool checked = false;
+
+    /**
+     * The seed for the generator that D commands shuffle the stack with. If
+     * this isn't given, the program is seeded with the time when it starts.
+     */
+    std::optional<uint64_t> seed;
+
+    /**
+     * Whether to generate re-entrant library code instead of a program. The
+     * module defines xrf_run() and xrf_context_size() rather than main(), and
+     * keeps all of the program's state, including the stack, in the context
+     * that xrf_run() is passed, doing its I/O through the callbacks in the
+     * context. The stack is always kept in the context, so the stack storage
+     * and the I/O mode don't apply. Jumps to chunks that don't exist make
+     * xrf_run() return 1, and so do failed checks, which aren't reported.
+     * This can't be used with instrument or DispatchMode::ThreadedUnchecked.
+     */
+    bool library = false;
+
+    /**
+     * The most chunks to put in each function, or 0 to put every chunk in one
+     * function. Chunks that jump to each other are kept in the same function
+     * where they can be, and the functions jump to each other with tail
+     * calls, passing the stack state along as arguments. This keeps each
+     * function small, so LLVM's passes don't slow down on huge programs. This
+     * can only be used with DispatchMode::Switch, and can't be used with
+     * checked.
+     */
+    size_t partitionSize = 0;
+
+    /**
+     * Whether the generated code counts how often each chunk runs, jumps and
+     * checks whether it's been visited, writing the counts out to the profile
+     * file when the program exits
+     */
+    bool instrument = false;
+
+    /**
+     * The file that instrumented code writes its profile to
+     */
+    std::string profileFile = DEFAULT_PROFILE_FILE;
+
+    /**
+     * A profile from an instrumented run of the program, if there is one,
+     * which is used to weight branches and to lay out hot chunks first
+     */
+    const Profile *profile = nullptr;
+
+    /**
+     * Where the jumps between chunks can go, if that's been worked out with
+     * findJumpTargets(). Code is only generated for the chunks that can be
+     * run, and jumps chosen at runtime only go to the chunks they can reach.
+     */
+    const JumpTargets *jumpTargets = nullptr;
+};
+
 /**
  * Generates LLVM IR code from an XRF program.
  *
@@ -16,10 +176,86 @@ namespace xrf {
  *     The LLVMContext used to generate LLVM code
  * @param chunks
  *     The list of chunks that make up the XRF program
+ * @param options
+ *     The options controlling what kind of code is generated
  *
  * @return
  *     An module that contains the LLVM code generated from the chunks
  */
-std::unique_ptr<llvm::Module> generateCode(llvm::LLVMContext &context, const std::vector<Chunk> &chunks);
+std::unique_ptr<llvm::Module> generateCode(llvm::LLVMContext &context, const std::vector<Chunk> &chunks,
+                                           const CodegenOptions &options = {});
+
+/**
+ * How partitioned code is split into functions.
+ */
+struct PartitionLayout {
+    /**
+     * The chunks in each function, in the order they're laid out
+     */
+    std::vector<std::vector<size_t>> members;
+
+    /**
+     * The function that each chunk is in, or std::nullopt for the chunks that
+     * can never be run
+     */
+    std::vector<std::optional<size_t>> partitions;
+
+    /**
+     * Whether each chunk can be started at by a call from another function,
+     * because it's the first chunk, it can be jumped to at runtime, or a
+     * chunk in another function is known to jump to it
+     */
+    std::vector<bool> isEntry;
+
+    /**
+     * Whether any chunk shuffles the stack, so the main function has to seed
+     * the random number generator
+     */
+    bool random = false;
+};
+
+/**
+ * Works out how partitioned code is split into functions, in the same way as
+ * generateCode() splits it.
+ *
+ * @param chunks
+ *     The list of chunks that make up the XRF program
+ * @param options
+ *     The options controlling what kind of code is generated, which must have
+ *     a partition size
+ *
+ * @return
+ *     The functions that the code is split into
+ */
+PartitionLayout layoutPartitions(const std::vector<Chunk> &chunks, const CodegenOptions &options);
+
+/**
+ * Generates one of the modules that partitioned code can be split into, so
+ * that each of them can be compiled and cached on its own. Linking every
+ * partition's module together with the main module gives the same program
+ * as generateCode(). The variables shared by the functions are defined in
+ * the main module, and the modules refer to them and to each other's
+ * functions by hidden symbols, which are only visible inside the program.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param chunks
+ *     The list of chunks that make up the XRF program
+ * @param options
+ *     The options controlling what kind of code is generated, which must have
+ *     a partition size
+ * @param layout
+ *     The functions that the code is split into, from layoutPartitions()
+ * @param partition
+ *     The partition to generate the function for, or std::nullopt for the
+ *     main module, which has main() or xrf_run(), the shared variables, and
+ *     the function that jumps to chunks chosen at runtime
+ *
+ * @return
+ *     A module with the LLVM code of the partition or of the main module
+ */
+std::unique_ptr<llvm::Module> generateSplitModule(llvm::LLVMContext &context, const std::vector<Chunk> &chunks,
+                                                  const CodegenOptions &options, const PartitionLayout &layout,
+                                                  std::optional<size_t> partition);
 
 } // namespace xrf
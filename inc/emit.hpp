@@ -0,0 +1,97 @@
+#pragma once
+
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace xrf {
+
+/**
+ * The different kinds of files that a generated module can be written out as.
+ */
+enum class OutputType {
+    // Textual LLVM IR
+    IR,
+
+    // LLVM bitcode
+    Bitcode,
+
+    // Native assembly
+    Assembly,
+
+    // A native object file
+    Object,
+
+    // A native executable, linked with the system's C compiler
+    Executable,
+};
+
+/**
+ * Creates a TargetMachine for the host that's running the compiler.
+ *
+ * @param optLevel
+ *     The LLVM optimization level, from 0 to 3, that the TargetMachine will
+ *     generate native code with
+ *
+ * @return
+ *     The TargetMachine, or an error if the host isn't supported by LLVM
+ */
+llvm::Expected<std::unique_ptr<llvm::TargetMachine>> createTargetMachine(int optLevel);
+
+/**
+ * Runs LLVM's default optimization pipeline for the given optimization level
+ * on a module. This also sets the module's target triple and data layout to
+ * those of the target machine, so make sure it's the same target machine that
+ * the module is later compiled with.
+ *
+ * @param module
+ *     The module to optimize
+ * @param targetMachine
+ *     The machine that the module will be compiled for
+ * @param optLevel
+ *     The LLVM optimization level, from 0 to 3. At level 0, the module is
+ *     left unoptimized.
+ */
+void optimizeModule(llvm::Module &module, llvm::TargetMachine &targetMachine, int optLevel);
+
+/**
+ * Writes a module out to a file.
+ *
+ * @param module
+ *     The module to write out
+ * @param targetMachine
+ *     The machine to generate native code for, when writing out assembly,
+ *     object files, or executables
+ * @param type
+ *     The type of file to write
+ * @param filename
+ *     The file to write the module to
+ *
+ * @return
+ *     An error if writing the file failed
+ */
+llvm::Error writeModule(llvm::Module &module, llvm::TargetMachine &targetMachine, OutputType type,
+                        const std::string &filename);
+
+/**
+ * Links object files together with the system's C compiler, into either an
+ * executable or one object file.
+ *
+ * @param objects
+ *     The object files to link
+ * @param type
+ *     The type of file to write, which must be OutputType::Executable or
+ *     OutputType::Object
+ * @param filename
+ *     The file to write the linked objects to
+ *
+ * @return
+ *     An error if the objects couldn't be linked
+ */
+llvm::Error linkObjects(const std::vector<std::string> &objects, OutputType type, const std::string &filename);
+
+} // namespace xrf
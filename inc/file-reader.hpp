@@ -2,6 +2,7 @@
 
 #include <iosfwd>
 #include <optional>
+#include <string>
 
 namespace xrf {
 
@@ -28,6 +29,15 @@ public:
      */
     std::optional<char> read();
 
+    /**
+     * Reads the rest of the file all at once. The line and column are left
+     * at the last character of the file.
+     *
+     * @return
+     *     The rest of the file
+     */
+    std::string readAll();
+
     /**
      * Returns whether the file has ended.
      *
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "xrf-chunk.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <vector>
+
+namespace xrf {
+
+/**
+ * Runs a program directly, without generating any code for it. The chunks
+ * can be optimized or not, and are run with the same semantics as the code
+ * generated for them, using a stack that wraps around in the same way.
+ *
+ * @param chunks
+ *     The chunks of the program to run
+ * @param stackSize
+ *     The number of values the stack can hold before wrapping around, which
+ *     must be a power of two
+ * @param input
+ *     The file that the program reads input from
+ * @param output
+ *     The file that the program writes output to, which is flushed when the
+ *     program stops
+ * @param seed
+ *     The seed that the stack is shuffled with by D commands, which is the
+ *     time the program starts if it isn't given
+ *
+ * @return
+ *     The exit status of the program, which is 0 if the program exits, or 1
+ *     if it tries to jump to a chunk that doesn't exist
+ */
+int interpret(const std::vector<Chunk> &chunks, uint64_t stackSize, std::FILE *input = stdin,
+              std::FILE *output = stdout, std::optional<uint64_t> seed = std::nullopt);
+
+} // namespace xrf
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+
+#include <memory>
+
+namespace xrf {
+
+/**
+ * JIT-compiles a module produced by generateCode() with LLVM's ORC JIT, so
+ * that the functions it defines can be looked up and called in the current
+ * process. Any external functions the module calls are resolved to the ones
+ * in the host process.
+ *
+ * @param context
+ *     The LLVMContext the module was generated with. The JIT takes ownership
+ *     of it, as it has to outlive the compiled module.
+ * @param module
+ *     The module to compile
+ *
+ * @return
+ *     The JIT that the module was added to, which has to be kept alive for
+ *     as long as its functions are used, or an error if the JIT couldn't be
+ *     created
+ */
+llvm::Expected<std::unique_ptr<llvm::orc::LLJIT>> compileModule(std::unique_ptr<llvm::LLVMContext> context,
+                                                                 std::unique_ptr<llvm::Module> module);
+
+/**
+ * JIT-compiles a module produced by generateCode() with LLVM's ORC JIT and
+ * runs its main function in the current process. Any external functions the
+ * module calls, like getchar() and putchar(), are resolved to the ones in the
+ * host process.
+ *
+ * @param context
+ *     The LLVMContext the module was generated with. The JIT takes ownership
+ *     of it, as it has to outlive the compiled module.
+ * @param module
+ *     The module to compile and run
+ *
+ * @return
+ *     The value returned by the module's main function, or an error if the
+ *     module couldn't be compiled
+ */
+llvm::Expected<int> runModule(std::unique_ptr<llvm::LLVMContext> context, std::unique_ptr<llvm::Module> module);
+
+} // namespace xrf
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "xrf-chunk.hpp"
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+namespace xrf {
+
+/**
+ * A range of chunks, which includes both the first and the last chunk.
+ */
+struct ChunkRange {
+    /**
+     * The index of the first chunk in the range
+     */
+    size_t first;
+
+    /**
+     * The index of the last chunk in the range
+     */
+    size_t last;
+};
+
+/**
+ * Where the jumps between the chunks of a program can go, as worked out by
+ * findJumpTargets().
+ */
+struct JumpTargets {
+    /**
+     * Whether each chunk can ever be run, by following the jumps that can be
+     * taken from the first chunk
+     */
+    std::vector<bool> reachable;
+
+    /**
+     * Whether each chunk can be jumped to by a jump that's chosen at runtime,
+     * from a chunk that can be run
+     */
+    std::vector<bool> dynamicTargets;
+
+    /**
+     * For each chunk, the range of chunks that the jumps chosen at runtime at
+     * the end of the chunk can go to, if the chunk has any such jumps that can
+     * go to a chunk that exists
+     */
+    std::vector<std::optional<ChunkRange>> successors;
+};
+
+/**
+ * Works out which chunks of a program can ever be run, and which chunks a jump
+ * chosen at runtime can go to. The range of each of the values at the top of
+ * the stack is followed from chunk to chunk, starting from the stack of
+ * zeroes the program starts with. Known jumps go straight to their chunk, and
+ * every other jump can go to any chunk in the range of the top of the stack
+ * at the end of the chunk. So, for instance, a chunk that jumps to a byte of
+ * input can only go to the first 256 chunks. Chunks that skip commands
+ * depending on whether they've been visited are worked out both ways, so the
+ * chunks can be optimized or not.
+ *
+ * @param chunks
+ *     The chunks of the program
+ *
+ * @return
+ *     The chunks that can be run, and the chunks that can be jumped to at
+ *     runtime
+ */
+JumpTargets findJumpTargets(const std::vector<Chunk> &chunks);
+
+} // namespace xrf
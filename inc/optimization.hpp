@@ -4,6 +4,27 @@
 
 namespace xrf {
 
+/**
+ * Splits every chunk that has commands that are skipped depending on whether
+ * the chunk has been visited before into two versions: the commands that are
+ * run on the first visit, and the commands that are run on every visit after
+ * that. Neither version has any Ignore commands left, so each version can be
+ * optimized on its own, and the generated code only has to check whether the
+ * chunk has been visited once at the start of the chunk.
+ *
+ * @param chunks
+ *     The list of chunks to split. The chunks are split in place, so a list
+ *     that isn't needed afterwards can be moved in to avoid copying it.
+ * @param hotChunks
+ *     Whether each chunk is hot, from a profile of the program. If this
+ *     isn't empty, only hot chunks get split, and the rest keep their Ignore
+ *     commands.
+ *
+ * @return
+ *     The chunks, with any chunks that depend on being visited split.
+ */
+std::vector<Chunk> specializeVisits(std::vector<Chunk> chunks, const std::vector<bool> &hotChunks = {});
+
 /**
  * Performs chunk-level optimizations on the provided list of chunks. This
  * looks at each chunk individually and tries to optimize it as best as it can,
@@ -11,28 +32,54 @@ namespace xrf {
  * setting a known jump location for the chunk if it is known.
  *
  * @param chunks
- *     The list of chunks to optimize.
+ *     The list of chunks to optimize. The chunks are optimized in place, so
+ *     a list that isn't needed afterwards can be moved in to avoid copying
+ *     it.
+ * @param jobs
+ *     The number of threads to optimize the chunks with. The optimized
+ *     chunks are the same no matter how many threads there are.
  *
  * @return
  *     An optimized version of the chunks.
  */
-std::vector<Chunk> optimizeChunks(const std::vector<Chunk> &chunks);
+std::vector<Chunk> optimizeChunks(std::vector<Chunk> chunks, unsigned jobs = 1);
 
 /**
  * Performs program-level optimizations on the provided list of chunks. This
- * will do things to look at flows of chunks to condense chunks. So, for
+ * follows the jumps between chunks that are known ahead of time to build
+ * traces of chunks that run one after another, so they can run without
+ * jumping between chunks. It also condenses chunks along the way. So, for
  * instance, if there is a series of five chunks that each add 2 to the second
  * value of the stack, it will condense it to add 10 to the second value of the
- * stack and jump to the chunk following those chunks.
+ * stack and jump to the chunk following those chunks. Loops of chunks that
+ * jump to each other get each iteration combined into one series of
+ * optimized commands, and loops that never do any I/O are left spinning
+ * without touching the stack, since they can never be left. Chunks that read
+ * a byte of input and just write out a translation of it before reading the
+ * next byte get the translation worked out for every byte ahead of time.
  *
  * @param chunks
  *     The list of chunks to optimize. It is expected that these chunks have
  *     already gone through chunk-level optimizations, otherwise the program
- *     level optimizations will not work.
+ *     level optimizations will not work. As with optimizeChunks(), a list
+ *     that isn't needed afterwards can be moved in.
+ * @param jobs
+ *     The number of threads to build the traces with. The optimized chunks
+ *     are the same no matter how many threads there are.
+ * @param hotChunks
+ *     Whether each chunk is hot, from a profile of the program. If this
+ *     isn't empty, only hot chunks get traces built from them or get
+ *     condensed, and the rest are left as they are.
+ * @param checked
+ *     Whether the chunks are for checked code, in which case they're left
+ *     as they are. Checked code stops at the chunk that misuses the stack,
+ *     so chunks can't be merged into the chunks that jump to them, and a
+ *     loop that misuses the stack has to stop instead of spinning forever.
  *
  * @return
  *     An optimized version of the chunks.
  */
-std::vector<Chunk> optimizeProgram(const std::vector<Chunk> &chunks);
+std::vector<Chunk> optimizeProgram(std::vector<Chunk> chunks, unsigned jobs = 1,
+                                   const std::vector<bool> &hotChunks = {}, bool checked = false);
 
 } // namespace xrf
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace xrf {
+
+/**
+ * Runs a function for every index up to a count, splitting the indices into
+ * one contiguous range for each thread. The function must only write to the
+ * results for the index it's given, so the results don't depend on how many
+ * threads there are.
+ *
+ * @param count
+ *     The number of indices to run the function for
+ * @param jobs
+ *     The number of threads to split the work between
+ * @param func
+ *     The function to run, which is given the index to work on, along with
+ *     the number of the thread running it
+ */
+template <typename Func>
+void parallelFor(size_t count, unsigned jobs, Func func) {
+    jobs = std::max(1u, std::min<unsigned>(jobs, count));
+
+    if (jobs == 1) {
+        for (size_t i = 0; i < count; i++) {
+            func(i, 0);
+        }
+        return;
+    }
+
+    std::vector<std::thread> threads;
+
+    for (unsigned job = 0; job < jobs; job++) {
+        threads.emplace_back([=] {
+            auto end = count * (job + 1) / jobs;
+
+            for (size_t i = count * job / jobs; i < end; i++) {
+                func(i, job);
+            }
+        });
+    }
+
+    for (auto &thread: threads) {
+        thread.join();
+    }
+}
+
+} // namespace xrf
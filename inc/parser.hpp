@@ -4,6 +4,7 @@
 #include "xrf-chunk.hpp"
 
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
@@ -53,4 +54,17 @@ using ParserErrorList = std::vector<ErrorMsg>;
  */
 std::variant<ParserErrorList, std::vector<Chunk>> parseXrf(FileReader &reader);
 
+/**
+ * @brief Parses XRF source that is already in memory, such as a memory-mapped
+ * file. This is much faster than reading the source a character at a time,
+ * and the chunks are read straight out of the source.
+ *
+ * @param source
+ *     The XRF source to parse
+ *
+ * @return
+ *     Either a list of parsing errors, or a list of parsed chunks
+ */
+std::variant<ParserErrorList, std::vector<Chunk>> parseXrf(std::string_view source);
+
 } // namespace xrf
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "llvm/Support/Error.h"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace xrf {
+
+/**
+ * The counters that instrumented programs keep for each chunk. The profile
+ * has a line for each chunk that ran, with the index of the chunk followed by
+ * these counters, in this order.
+ */
+enum class ProfileCounter {
+    // The number of times the chunk started running
+    Runs,
+
+    // The number of times the chunk jumped to a chunk chosen at runtime
+    JumpsFrom,
+
+    // The number of times a chunk chosen at runtime was this chunk
+    JumpsTo,
+
+    // The number of times the chunk checked whether it had been visited
+    VisitChecks,
+
+    // The number of those checks that found the chunk had been visited
+    VisitedHits,
+};
+
+/**
+ * The number of counters kept for each chunk in instrumented programs.
+ */
+constexpr unsigned PROFILE_COUNTERS = 5;
+
+/**
+ * The share of all of the chunk runs in a profile that the hot chunks make
+ * up between them.
+ */
+constexpr double HOT_COVERAGE = 0.99;
+
+/**
+ * The counts from an instrumented run of a program.
+ */
+struct Profile {
+    /**
+     * The counters for each chunk in the program, in the order of
+     * ProfileCounter
+     */
+    std::vector<std::array<uint64_t, PROFILE_COUNTERS>> counts;
+
+    /**
+     * Returns one of the counters of a chunk.
+     *
+     * @param chunk
+     *     The index of the chunk
+     * @param counter
+     *     The counter to get
+     *
+     * @return
+     *     The value of the counter
+     */
+    uint64_t get(size_t chunk, ProfileCounter counter) const {
+        return counts[chunk][static_cast<unsigned>(counter)];
+    }
+};
+
+/**
+ * Parses a profile written out by an instrumented program.
+ *
+ * @param text
+ *     The contents of the profile
+ *
+ * @return
+ *     The profile, or an error if it isn't a valid profile
+ */
+llvm::Expected<Profile> parseProfile(std::string_view text);
+
+/**
+ * Reads in a profile written out by an instrumented program.
+ *
+ * @param filename
+ *     The file the profile was written to
+ *
+ * @return
+ *     The profile, or an error if it can't be read or isn't a valid profile
+ */
+llvm::Expected<Profile> loadProfile(const std::string &filename);
+
+/**
+ * Picks out the hot chunks of a profiled program: the fewest chunks that
+ * between them make up HOT_COVERAGE of the chunk runs in the profile. Chunks
+ * that never ran are never hot.
+ *
+ * @param profile
+ *     The profile of the program
+ *
+ * @return
+ *     Whether each chunk is hot
+ */
+std::vector<bool> findHotChunks(const Profile &profile);
+
+/**
+ * Orders the chunks of a profiled program from the most runs to the fewest,
+ * with chunks that ran the same number of times kept in program order.
+ *
+ * @param profile
+ *     The profile of the program
+ *
+ * @return
+ *     The indices of every chunk, hottest first
+ */
+std::vector<size_t> orderHotFirst(const Profile &profile);
+
+} // namespace xrf
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace xrf {
+
+/**
+ * The state of the xoshiro256** generator that D commands shuffle the stack
+ * with. The generated code uses the same generator, seeded in the same way,
+ * so a program shuffles its stack the same way whether it's compiled or
+ * interpreted.
+ */
+using RandomState = std::array<uint64_t, 4>;
+
+/**
+ * The amount that each step of splitmix64 adds to the seed, when the seed is
+ * turned into the state of the generator.
+ */
+constexpr uint64_t SPLITMIX_INCREMENT = 0x9e3779b97f4a7c15;
+
+/**
+ * The multipliers that splitmix64 mixes the seed with.
+ */
+constexpr uint64_t SPLITMIX_MULTIPLIERS[] = {0xbf58476d1ce4e5b9, 0x94d049bb133111eb};
+
+/**
+ * Creates the state of the generator from a seed, by filling it with the
+ * output of splitmix64, as recommended for xoshiro.
+ *
+ * @param seed
+ *     The seed
+ *
+ * @return
+ *     The state of the generator
+ */
+RandomState seedRandom(uint64_t seed);
+
+/**
+ * Gets the next random number from the generator.
+ *
+ * @param state
+ *     The state of the generator, which is advanced
+ *
+ * @return
+ *     The random number
+ */
+uint64_t nextRandom(RandomState &state);
+
+/**
+ * Gets a random number below a bound, from the top 32 bits of the next random
+ * number multiplied by the bound. This is very slightly biased for bounds that
+ * aren't powers of two, but doesn't need a division or a retry.
+ *
+ * @param state
+ *     The state of the generator, which is advanced
+ * @param bound
+ *     The bound, which is at most 2^32
+ *
+ * @return
+ *     A random number from 0 up to but not including the bound
+ */
+uint64_t randomBelow(RandomState &state, uint64_t bound);
+
+} // namespace xrf
@@ -27,6 +27,12 @@ class StackSimulator {
          */
         StackSimulator(unsigned index);
 
+        /**
+         * Construct a new StackSimulator for simulating commands from the
+         * middle of a chunk, where the top value of the stack isn't known.
+         */
+        StackSimulator();
+
         /**
          * Simulates adding the top two values of the stack.
          */
@@ -53,12 +59,16 @@ class StackSimulator {
         void inc();
 
         /**
-         * Simulates a pushing a byte of input onto the stack.
+         * Simulates a pushing a byte of input onto the stack. Since the byte
+         * isn't known, this always leaves the simulator in a state that
+         * can't be represented with optimized commands.
          */
         void input();
 
         /**
-         * Simulates outputting the top value of the stack.
+         * Simulates outputting the top value of the stack. If the value can
+         * be computed from the original stack, the output is included in the
+         * optimized commands.
          */
         void output();
 
@@ -77,6 +87,23 @@ class StackSimulator {
          */
         void swap();
 
+        /**
+         * Simulates one of the commands that are generated by optimizing a
+         * chunk, like SetTop or BeginShuffle. This lets the effect of chunks
+         * that have already been optimized be combined. A BeginShuffle
+         * command is simulated along with the ShuffleValue commands after it.
+         *
+         * @param commands
+         *     The list of commands the command to simulate is in
+         * @param index
+         *     The index of the command to simulate, which must be an optimized
+         *     command
+         *
+         * @return
+         *     The number of commands that were simulated
+         */
+        size_t simulateOptimized(const std::vector<Command> &commands, size_t index);
+
         /**
          * Returns the top value of the stack, if it is known value, otherwise
          * return std::nullopt.
@@ -84,7 +111,16 @@ class StackSimulator {
          * @return
          *     The stack top, if known, otherwise std::nullopt
          */
-        std::optional<unsigned> getStackTop();
+        std::optional<unsigned> getStackTop() const;
+
+        /**
+         * Returns whether the current state of the stack, along with any
+         * output, can be reproduced with a series of optimized commands.
+         *
+         * @return
+         *     Whether getCommands() will be able to optimize the commands
+         */
+        bool isRepresentable() const;
 
         /**
          * Tries to create an optimized series of commands that will reproduce
@@ -96,6 +132,24 @@ class StackSimulator {
          */
         std::optional<std::vector<Command>> getCommands() const;
 
+        /**
+         * Returns whether the stack is just the original stack with its top
+         * value popped off, with nothing sent to the bottom of the stack.
+         *
+         * @return
+         *     Whether only the top of the stack has been popped
+         */
+        bool onlyPoppedTop() const;
+
+        /**
+         * Returns the values that have been output, if they are all known
+         * values, otherwise returns std::nullopt.
+         *
+         * @return
+         *     The values that have been output, if they're known
+         */
+        std::optional<std::vector<unsigned>> getKnownOutput() const;
+
     private:
         /**
          * Returns whether all of the values in the given vector have a
@@ -110,13 +164,54 @@ class StackSimulator {
         static bool allKnownValues(const std::vector<StackValue> &values);
 
         /**
-         * Returns whether we are able to optimize the current state of the
-         * stack into a series of optimized commands.
+         * Returns whether all of the values in the given vector can be
+         * computed from the original stack.
+         *
+         * @param values
+         *     The list of values to check
+         *
+         * @return
+         *     Whether all of the values are representable
+         */
+        static bool allRepresentable(const std::vector<StackValue> &values);
+
+        /**
+         * Creates a command that uses a value computed from the original
+         * stack.
+         *
+         * @param type
+         *     The type of command to create
+         * @param value
+         *     The value the command uses, which must be representable
+         *
+         * @return
+         *     The command
+         */
+        static Command valueCommand(CommandType type, const StackValue &value);
+
+        /**
+         * Works out the value used by an optimized command that either uses a
+         * known value, or a value computed from one or two slots on the
+         * stack, in terms of the stack we're simulating.
+         *
+         * @param command
+         *     The command to work out the value of
+         *
+         * @return
+         *     The value the command uses
+         */
+        StackValue commandValue(const Command &command) const;
+
+        /**
+         * Returns whether the effect the simulated commands have on the stack
+         * only changes the top two values of the stack in simple ways, so
+         * that it can be reproduced with commands like SetTop and
+         * AddToSecond, rather than by shuffling the top of the stack.
          *
          * @return
-         *     Whether we're able to optimize the stack's state
+         *     Whether commands on the second value can reproduce the stack
          */
-        bool canOptimize() const;
+        bool canUseSecondValueCommands() const;
 
         /**
          * Simulates pushing a stack value to the stack.
@@ -135,9 +230,9 @@ class StackSimulator {
         StackValue doPop();
 
         /**
-         * The initial top value of the stack.
+         * The initial top value of the stack, if known.
          */
-        unsigned _origIndex;
+        std::optional<unsigned> _origIndex;
 
         /**
          * How deep into the stack we've popped. This does not mean how many
@@ -147,10 +242,16 @@ class StackSimulator {
         unsigned _maxPopped;
 
         /**
-         * Whether we've simulated an input or output command
+         * Whether we've simulated an input or output command that can't be
+         * represented with optimized commands
          */
         bool _hadIO;
 
+        /**
+         * The list of values we've output, in order
+         */
+        std::vector<StackValue> _output;
+
         /**
          * A list of values we've sent to the bottom
          */
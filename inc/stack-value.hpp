@@ -1,28 +1,44 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <optional>
 
 namespace xrf {
 
 /**
  * Represents a value on the stack, for use with the StackSimulator. This keeps
- * track of what information we know about the value, which may include its
- * value, its original index on the stack, and what has been added to it. The
- * operations on StackValue will preserve information if it's known, and produce
- * unknown values if either of the operands is unknown.
+ * track of what information we know about the value, as a known amount plus
+ * the original values at a few known indexes on the stack, each multiplied by
+ * a known amount. All of the arithmetic wraps around like the values on the
+ * stack do. The operations on StackValue will preserve information if it's
+ * known, and produce unknown values if either of the operands is unknown, or
+ * if the result would need more than MAX_TERMS values from the stack.
  */
 class StackValue {
     public:
         /**
-         * Construct a new StackValue object with a known value from a knonw
-         * index on the stack.
-         *
-         * @param index
-         *     The index the stack value originated from.
-         * @param val
-         *     The value of the StackValue
+         * One of the original values on the stack that a StackValue is made
+         * from, and the amount it's multiplied by.
          */
-        StackValue(unsigned index, unsigned val);
+        struct Term {
+            /**
+             * The index of the original value on the stack
+             */
+            unsigned index;
+
+            /**
+             * The amount the original value is multiplied by, which is never
+             * 0
+             */
+            unsigned multiple;
+        };
+
+        /**
+         * The most original values on the stack that a StackValue can be
+         * made from, which is as many as a Command can compute a value from.
+         */
+        static constexpr size_t MAX_TERMS = 2;
 
         /**
          * Creates a StackValue which originates from a known index on the
@@ -62,15 +78,25 @@ class StackValue {
 
         /**
          * Simulates decrementing this value. Note that this is different from
-         * calling sub() with a known value of 1, since that can never
-         * underflow.
+         * calling sub() with a known value of 1, since decrementing 0 wraps
+         * around to the largest value, while subtracting can never underflow.
          */
         void dec();
 
+        /**
+         * Simulates multiplying this value by a known amount, which wraps
+         * around like the values on the stack do.
+         *
+         * @param multiple
+         *     The amount to multiply this value by
+         */
+        void mul(unsigned multiple);
+
         /**
          * Simulates a subtraction operation on this value. This will subtract
          * the smaller value from the larger one, and sets this value to the
-         * difference.
+         * difference. The difference is only known if both values are known,
+         * or if they're the same value, in which case it's 0.
          *
          * @param value
          *     The value to subtract
@@ -95,8 +121,18 @@ class StackValue {
         unsigned getKnownValue() const;
 
         /**
-         * Returns whether the stack value originates from a known index on
-         * the stack.
+         * Returns whether the value is either known, or is from a known index
+         * on the stack, such that code can be generated to compute the value
+         * from the original values on the stack.
+         *
+         * @return
+         *     Whether the value can be computed from the original stack
+         */
+        bool isRepresentable() const;
+
+        /**
+         * Returns whether the stack value is made from the original value at
+         * just one known index on the stack.
          *
          * @return
          *     Whether this value is from a known index
@@ -112,6 +148,28 @@ class StackValue {
          */
         unsigned getIndex() const;
 
+        /**
+         * Returns how many original values on the stack this StackValue is
+         * made from. Only valid if isRepresentable().
+         *
+         * @return
+         *     The number of terms, which is at most MAX_TERMS
+         */
+        size_t getTermCount() const;
+
+        /**
+         * Returns one of the original values on the stack that this
+         * StackValue is made from, which are ordered by their index.
+         *
+         * @param i
+         *     Which of the terms to get, which must be less than
+         *     getTermCount()
+         *
+         * @return
+         *     The index of the original value and its multiple
+         */
+        const Term &getTerm(size_t i) const;
+
         /**
          * Returns the value of this StackValue if it's known, or std::nullopt
          * if it's not known.
@@ -123,12 +181,14 @@ class StackValue {
 
         /**
          * Returns the amount that this stack value has been changed from its
-         * original value. Only valid if hasKnownIndex() && !hasKnownValue().
+         * original values. Only valid if isRepresentable() &&
+         * !hasKnownValue().
          *
          * @return
-         *     The amount the stack value has been changed
+         *     The amount the stack value has been changed, which wraps around
+         *     like the values on the stack do
          */
-        int getChange() const;
+        unsigned getChange() const;
 
         /**
          * Returns the amount that this stack value has been multiplied by.
@@ -141,24 +201,39 @@ class StackValue {
 
     private:
         /**
-         * The index that the StackValue originated from, if known.
+         * Adds a multiple of the original value at an index to this value,
+         * keeping the terms in order of their index. Makes this value unknown
+         * if it would need too many terms.
+         *
+         * @param term
+         *     The index of the original value and its multiple
+         */
+        void addTerm(const Term &term);
+
+        /**
+         * Makes this value unknown.
+         */
+        void forget();
+
+        /**
+         * Whether anything is known about the StackValue
          */
-        std::optional<unsigned> _index;
+        bool _representable = false;
 
         /**
-         * The value of the StackValue, if known
+         * The known amount that's added to the terms
          */
-        std::optional<unsigned> _value;
+        unsigned _knownChange = 0;
 
         /**
-         * The amount that the StackValue is changed by
+         * The original values on the stack that the StackValue is made from
          */
-        int _knownChange = 0;
+        std::array<Term, MAX_TERMS> _terms{};
 
         /**
-         * The amount that the StackValue is multiplied by
+         * How many of the terms are used
          */
-        unsigned _knownMultiple = 1;
+        size_t _termCount = 0;
 };
 
 } // namespace xrf
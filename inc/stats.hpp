@@ -0,0 +1,155 @@
+#pragma once
+
+#include "xrf-chunk.hpp"
+
+#include "llvm/IR/Module.h"
+
+#include <chrono>
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace xrf {
+
+/**
+ * Statistics about compiling a program, for seeing where the compiler spends
+ * its time, and how much the optimizations did.
+ */
+struct CompileStats {
+    /**
+     * The wall time each phase of compiling took, in seconds, in the order
+     * that the phases ran
+     */
+    std::vector<std::pair<std::string, double>> phases;
+
+    /**
+     * The number of chunks in the program
+     */
+    size_t chunks = 0;
+
+    /**
+     * The number of commands in the program, before it was optimized
+     */
+    size_t sourceCommands = 0;
+
+    /**
+     * The number of commands left after optimizing the program, counting the
+     * commands for both visits of split chunks
+     */
+    size_t commands = 0;
+
+    /**
+     * The number of the commands left after optimizing that are optimized
+     * commands made by fusing other commands together
+     */
+    size_t fusedCommands = 0;
+
+    /**
+     * The number of chunks whose next chunk is known ahead of time, counting
+     * both visits of split chunks
+     */
+    size_t knownJumps = 0;
+
+    /**
+     * The number of places in the generated code that jump to a chunk chosen
+     * at runtime
+     */
+    size_t dynamicJumps = 0;
+
+    /**
+     * The number of edges from those jumps to the chunks they can jump to,
+     * counting every case of the switch used by switch dispatch, and every
+     * destination of the indirect branches used by threaded dispatch
+     */
+    size_t dispatchEdges = 0;
+};
+
+/**
+ * Times a phase of compiling, from when the timer is constructed until it is
+ * destroyed, adding the time to the list of phases in a CompileStats.
+ */
+class PhaseTimer {
+    public:
+        /**
+         * Construct a new PhaseTimer, which starts timing the phase.
+         *
+         * @param stats
+         *     The stats to add the phase's time to
+         * @param phase
+         *     The name of the phase
+         */
+        PhaseTimer(CompileStats &stats, std::string phase);
+
+        /**
+         * Adds the time since it was constructed to the stats.
+         */
+        ~PhaseTimer();
+
+        PhaseTimer(const PhaseTimer&) = delete;
+        PhaseTimer &operator=(const PhaseTimer&) = delete;
+
+    private:
+        /**
+         * The stats to add the phase's time to
+         */
+        CompileStats &_stats;
+
+        /**
+         * The name of the phase being timed
+         */
+        std::string _phase;
+
+        /**
+         * When the phase started
+         */
+        std::chrono::steady_clock::time_point _start;
+};
+
+/**
+ * Counts the chunks and commands in a program that has been optimized, and
+ * the jumps that are known ahead of time.
+ *
+ * @param stats
+ *     The stats to fill in the chunk and command counts of
+ * @param chunks
+ *     The optimized chunks of the program
+ */
+void countChunkStats(CompileStats &stats, const std::vector<Chunk> &chunks);
+
+/**
+ * Counts the jumps to chunks that are chosen at runtime in a module produced
+ * by generateCode(), before LLVM has optimized it.
+ *
+ * @param stats
+ *     The stats to fill in the jump counts of
+ * @param module
+ *     The generated module
+ */
+void countDispatchStats(CompileStats &stats, const llvm::Module &module);
+
+/**
+ * Writes the stats out in a human-readable form.
+ *
+ * @param out
+ *     The stream to write the stats to
+ * @param stats
+ *     The stats to write
+ * @param phases
+ *     Whether to write out the time each phase took
+ * @param counts
+ *     Whether to write out the counts of chunks, commands and jumps
+ */
+void printStats(std::ostream &out, const CompileStats &stats, bool phases, bool counts);
+
+/**
+ * Writes the stats out as a JSON object.
+ *
+ * @param out
+ *     The stream to write the stats to
+ * @param stats
+ *     The stats to write
+ */
+void printStatsJson(std::ostream &out, const CompileStats &stats);
+
+} // namespace xrf
@@ -2,6 +2,8 @@
 
 #include "xrf-command.hpp"
 
+#include <array>
+#include <memory>
 #include <optional>
 #include <vector>
 
@@ -10,6 +12,20 @@ namespace xrf {
 // The number of commands in each chunk
 constexpr int COMMANDS_PER_CHUNK = 5;
 
+// The translation of a byte of input that doesn't output anything
+constexpr unsigned TRANSLATE_NO_OUTPUT = 256;
+
+// The translation of a byte of input that stops translating input
+constexpr unsigned TRANSLATE_STOP = 257;
+
+/**
+ * The translation table for a TranslateInput command. Each byte of input is
+ * either translated to a byte of output, TRANSLATE_NO_OUTPUT for bytes that
+ * don't output anything, or TRANSLATE_STOP for bytes that the table doesn't
+ * handle.
+ */
+using InputTranslation = std::array<unsigned, 256>;
+
 /**
  * A simple struct representing a "chunk" of commands in XRF
  */
@@ -28,6 +44,26 @@ struct Chunk {
      * The next chunk to jump to, if known
      */
     std::optional<unsigned> nextChunk;
+
+    /**
+     * For chunks that do different things depending on whether they've been
+     * visited before, the commands that are run on every visit after the
+     * first. When this is set, the commands above are only run on the first
+     * visit, and neither list has any Ignore commands.
+     */
+    std::optional<std::vector<Command>> visitedCommands;
+
+    /**
+     * The next chunk to jump to after a visit to the chunk that isn't the
+     * first, if known and if the chunk has visited commands
+     */
+    std::optional<unsigned> visitedNextChunk;
+
+    /**
+     * For chunks with a TranslateInput command, the translation table it
+     * uses. Every chunk that reads input the same way shares the same table.
+     */
+    std::shared_ptr<const InputTranslation> translation;
 };
 
 } // namespace xrf
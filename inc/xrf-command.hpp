@@ -1,13 +1,15 @@
 #pragma once
 
+#include <cstdint>
+
 namespace xrf {
 
 /**
  * The different types of command we can have. This includes 16 commands that
  * map directly to the commands present in XRF, and also some optimized versions
- * of commands.
+ * of commands. Each type fits in a byte, to keep commands small.
  */
-enum class CommandType {
+enum class CommandType : uint8_t {
     // The commands built into XRF
     Input,         // 0
     Output,        // 1
@@ -41,8 +43,9 @@ enum class CommandType {
     // Inserts a value below the top of the stack
     PushSecondValue,
 
-    // Pushes a known value to the bottom of the stack, without having to push
-    // it to the top of the stack first
+    // Pushes a value to the bottom of the stack, without having to push it to
+    // the top of the stack first. The value is either known, or computed from
+    // a value on the stack, as with ShuffleValue
     PushValueToBottom,
 
     // Sets the second value of the stack
@@ -50,6 +53,30 @@ enum class CommandType {
 
     // Sets the top value of the stack to a known value
     SetTop,
+
+    // Outputs a value, which is either known, or computed from a value on the
+    // stack as with ShuffleValue, without changing the stack
+    OutputValue,
+
+    // Replaces values at the top of the stack with new values, all at once.
+    // The slot is how many values get replaced, counting the top value, and
+    // the value is how many new values replace them. This is followed by a
+    // ShuffleValue command for each new value, from the deepest to the new
+    // top of the stack
+    BeginShuffle,
+
+    // One of the new values for a BeginShuffle command. The new value is the
+    // original value in the given slot times the multiple, plus the original
+    // value in the added slot times the added multiple, plus the value. Slot 0
+    // is the top of the stack, slot 1 the value below it, and so on. If the
+    // multiple is 0, the new value is just the known value, and if the added
+    // multiple is 0, nothing is added from the added slot
+    ShuffleValue,
+
+    // Reads bytes of input, and outputs the translation of each byte from the
+    // chunk's translation table, until it reads a byte that the table doesn't
+    // handle, which is pushed to the stack as with Input
+    TranslateInput,
 };
 
 /**
@@ -74,6 +101,43 @@ struct Command {
      */
     Command(CommandType type, int val): type(type), val(val) {}
 
+    /**
+     * Construct a new Command object for a command that computes a value from
+     * a value on the stack.
+     *
+     * @param type
+     *     The type of command to construct
+     * @param val
+     *     The amount added to the computed value
+     * @param slot
+     *     The slot on the stack the computed value is from
+     * @param multiple
+     *     The amount the value from the stack is multiplied by
+     */
+    Command(CommandType type, int val, unsigned slot, unsigned multiple):
+        type(type), val(val), slot(slot), multiple(multiple) {}
+
+    /**
+     * Construct a new Command object for a command that computes a value from
+     * the sum of two values on the stack.
+     *
+     * @param type
+     *     The type of command to construct
+     * @param val
+     *     The amount added to the computed value
+     * @param slot
+     *     The slot on the stack the computed value is from
+     * @param multiple
+     *     The amount the value from the stack is multiplied by
+     * @param addedSlot
+     *     The slot on the stack of the value that's added to the computed
+     *     value
+     * @param addedMultiple
+     *     The amount the added value is multiplied by
+     */
+    Command(CommandType type, int val, unsigned slot, unsigned multiple, unsigned addedSlot, unsigned addedMultiple):
+        type(type), val(val), slot(slot), multiple(multiple), addedSlot(addedSlot), addedMultiple(addedMultiple) {}
+
     /**
      * The type of command this is.
      */
@@ -86,6 +150,33 @@ struct Command {
      * bottom of the stack.
      */
     int val = 0;
+
+    /**
+     * For commands that compute a value from a value on the stack, or replace
+     * values on the stack, which slot on the stack they use, where 0 is the
+     * top of the stack.
+     */
+    unsigned slot = 0;
+
+    /**
+     * For commands that compute a value from a value on the stack, the amount
+     * that the value from the stack is multiplied by. Commands with a
+     * multiple of 0 use a known value instead.
+     */
+    unsigned multiple = 0;
+
+    /**
+     * For commands that compute a value from a value on the stack, the slot
+     * of another value on the stack that's added to the computed value.
+     */
+    unsigned addedSlot = 0;
+
+    /**
+     * For commands that compute a value from a value on the stack, the amount
+     * that the value from the added slot is multiplied by before it's added.
+     * Commands with an added multiple of 0 only use the value from the slot.
+     */
+    unsigned addedMultiple = 0;
 };
 
 } // namespace xrf
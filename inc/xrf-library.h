@@ -0,0 +1,67 @@
+#ifndef XRF_LIBRARY_H
+#define XRF_LIBRARY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The start of the context that code compiled by xrfc with --emit-library
+ * runs in. The caller fills in these fields, and the rest of the context is
+ * private state of the program, such as its stack. Each context has to be
+ * xrf_context_size() bytes, with the alignment of max_align_t, as malloc()
+ * gives. Any number of contexts can be run at once, on any threads, as long
+ * as each context is only run on one thread at a time.
+ */
+typedef struct xrf_context {
+    /**
+     * Passed to the callbacks, for the caller to use however it likes
+     */
+    void *user;
+
+    /**
+     * Reads up to size bytes of input into buffer, returning the number of
+     * bytes read, or 0 or less once the end of input has been reached
+     */
+    ptrdiff_t (*read)(void *user, uint8_t *buffer, size_t size);
+
+    /**
+     * Writes size bytes of output from buffer, returning the number of bytes
+     * written, which can be less than size, or less than 0 on an error. The
+     * output is buffered, and is written out before reading more input and
+     * when the program stops.
+     */
+    ptrdiff_t (*write)(void *user, const uint8_t *buffer, size_t size);
+} xrf_context;
+
+/**
+ * Gets the number of bytes to allocate for each context.
+ *
+ * @return
+ *     The size of the context, including the program's private state
+ */
+size_t xrf_context_size(void);
+
+/**
+ * Runs the program from the start, in the given context.
+ *
+ * @param context
+ *     The context to run the program in, with the fields of xrf_context
+ *     filled in
+ *
+ * @return
+ *     0 if the program exits, or 1 if it stops with an error. Jumping to a
+ *     chunk that doesn't exist is always an error, and with --checked, so is
+ *     popping a value off of an empty stack or pushing more values than the
+ *     stack can hold. Nothing is written out for the error itself.
+ */
+int xrf_run(xrf_context *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
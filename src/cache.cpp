@@ -0,0 +1,351 @@
+#include "cache.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/xxhash.h"
+
+#include <cstdint>
+#include <cstdio>
+
+namespace xrf {
+
+namespace {
+
+/**
+ * Appends the bytes of a value to a buffer that is going to be hashed.
+ *
+ * @param buffer
+ *     The buffer to append to
+ * @param value
+ *     The value to append
+ */
+template <typename T>
+void appendValue(std::string &buffer, T value) {
+    buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+/**
+ * Appends a list of commands to a buffer that is going to be hashed.
+ *
+ * @param buffer
+ *     The buffer to append to
+ * @param commands
+ *     The commands to append
+ */
+void appendCommands(std::string &buffer, const std::vector<Command> &commands) {
+    appendValue(buffer, commands.size());
+
+    for (const auto &command: commands) {
+        appendValue(buffer, command.type);
+        appendValue(buffer, command.val);
+        appendValue(buffer, command.slot);
+        appendValue(buffer, command.multiple);
+        appendValue(buffer, command.addedSlot);
+        appendValue(buffer, command.addedMultiple);
+    }
+}
+
+/**
+ * Appends a jump to a known chunk to a buffer that is going to be hashed.
+ *
+ * @param buffer
+ *     The buffer to append to
+ * @param nextChunk
+ *     The known chunk that is jumped to, if there is one
+ */
+void appendJump(std::string &buffer, std::optional<unsigned> nextChunk) {
+    appendValue(buffer, nextChunk.has_value());
+    appendValue(buffer, nextChunk.value_or(0));
+}
+
+/**
+ * Hashes everything about a chunk that changes the code generated for it.
+ *
+ * @param chunk
+ *     The chunk to hash
+ *
+ * @return
+ *     The hash of the chunk
+ */
+uint64_t hashChunk(const Chunk &chunk) {
+    std::string buffer;
+
+    appendCommands(buffer, chunk.commands);
+    appendJump(buffer, chunk.nextChunk);
+
+    appendValue(buffer, chunk.visitedCommands.has_value());
+
+    if (chunk.visitedCommands) {
+        appendCommands(buffer, *chunk.visitedCommands);
+        appendJump(buffer, chunk.visitedNextChunk);
+    }
+
+    appendValue(buffer, chunk.translation != nullptr);
+
+    if (chunk.translation) {
+        for (auto entry: *chunk.translation) {
+            appendValue(buffer, entry);
+        }
+    }
+
+    return llvm::xxHash64(buffer);
+}
+
+/**
+ * Gets the path of the file stored in the cache under the given key.
+ *
+ * @param cacheDir
+ *     The directory the cache is kept in
+ * @param key
+ *     The key of the file
+ *
+ * @return
+ *     The path of the cached file
+ */
+std::string getCachePath(const std::string &cacheDir, const std::string &key) {
+    llvm::SmallString<128> path(cacheDir);
+    llvm::sys::path::append(path, key);
+    return std::string(path);
+}
+
+/**
+ * Copies a file, along with its permissions, so that cached executables can
+ * still be run.
+ *
+ * @param from
+ *     The file to copy
+ * @param to
+ *     Where to copy the file to
+ *
+ * @return
+ *     The error from copying the file, if any
+ */
+std::error_code copyFile(const std::string &from, const std::string &to) {
+    auto perms = llvm::sys::fs::getPermissions(from);
+
+    if (!perms) {
+        return perms.getError();
+    }
+
+    if (auto err = llvm::sys::fs::copy_file(from, to)) {
+        return err;
+    }
+
+    return llvm::sys::fs::setPermissions(to, *perms);
+}
+
+/**
+ * Appends the options and settings that change the compiled output to a
+ * buffer that is going to be hashed.
+ *
+ * @param buffer
+ *     The buffer to append to
+ * @param options
+ *     The options that code is generated with
+ * @param settings
+ *     Anything else that changes the compiled output
+ */
+void appendOptions(std::string &buffer, const CodegenOptions &options, const std::string &settings) {
+    buffer += settings;
+
+    appendValue(buffer, options.registerState);
+    appendValue(buffer, options.ioMode);
+    appendValue(buffer, options.dispatchMode);
+    appendValue(buffer, options.stackSize);
+    appendValue(buffer, options.stackStorage);
+    appendValue(buffer, options.instrument);
+
+    if (options.instrument) {
+        appendValue(buffer, options.profileFile.size());
+        buffer += options.profileFile;
+    }
+
+    appendValue(buffer, options.profile != nullptr);
+
+    if (options.profile) {
+        for (const auto &counts: options.profile->counts) {
+            for (auto count: counts) {
+                appendValue(buffer, count);
+            }
+        }
+    }
+
+    // The jump targets are worked out from the chunks, so they don't need
+    // to be hashed themselves
+    appendValue(buffer, options.jumpTargets != nullptr);
+
+    appendValue(buffer, options.checked);
+    appendValue(buffer, options.seed.has_value());
+    appendValue(buffer, options.seed.value_or(0));
+    appendValue(buffer, options.library);
+    appendValue(buffer, options.partitionSize);
+}
+
+/**
+ * Appends where a jump chosen at runtime at the end of a chunk can go to a
+ * buffer that is going to be hashed.
+ *
+ * @param buffer
+ *     The buffer to append to
+ * @param options
+ *     The options that code is generated with, which have the jump targets
+ *     if they've been worked out
+ * @param chunkIdx
+ *     The index of the chunk
+ */
+void appendSuccessors(std::string &buffer, const CodegenOptions &options, size_t chunkIdx) {
+    if (!options.jumpTargets) {
+        return;
+    }
+
+    const auto &successors = options.jumpTargets->successors[chunkIdx];
+
+    appendValue(buffer, successors.has_value());
+    appendValue(buffer, successors ? successors->first : 0);
+    appendValue(buffer, successors ? successors->last : 0);
+}
+
+/**
+ * Turns the contents of a buffer into a cache key, by hashing it.
+ *
+ * @param buffer
+ *     The buffer to hash
+ *
+ * @return
+ *     The cache key
+ */
+std::string makeKey(const std::string &buffer) {
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(llvm::xxHash64(buffer)));
+
+    return key;
+}
+
+} // anonymous namespace
+
+std::string getCacheKey(const std::vector<Chunk> &chunks, const CodegenOptions &options, const std::string &settings) {
+    std::string buffer;
+
+    appendOptions(buffer, options, settings);
+
+    appendValue(buffer, chunks.size());
+
+    for (const auto &chunk: chunks) {
+        appendValue(buffer, hashChunk(chunk));
+
+        // Checked code reports where each chunk is in the file
+        if (options.checked) {
+            appendValue(buffer, chunk.line);
+            appendValue(buffer, chunk.col);
+        }
+    }
+
+    return makeKey(buffer);
+}
+
+std::string getSplitModuleKey(const std::vector<Chunk> &chunks, const CodegenOptions &options,
+                              const PartitionLayout &layout, std::optional<size_t> partition,
+                              const std::string &settings)
+{
+    std::string buffer;
+
+    appendOptions(buffer, options, settings);
+
+    appendValue(buffer, chunks.size());
+    appendValue(buffer, layout.members.size());
+    appendValue(buffer, partition.has_value());
+    appendValue(buffer, partition.value_or(0));
+
+    auto isDynamicTarget = [&] (size_t chunkIdx) {
+        return !options.jumpTargets || options.jumpTargets->dynamicTargets[chunkIdx];
+    };
+
+    auto appendPartition = [&] (size_t chunkIdx) {
+        appendValue(buffer, layout.partitions[chunkIdx].has_value());
+        appendValue(buffer, layout.partitions[chunkIdx].value_or(0));
+    };
+
+    // The main module calls the first chunk's function, and jumps to the
+    // chunks chosen at runtime through the functions they're in
+    if (!partition) {
+        for (size_t i = 0; i < chunks.size(); i++) {
+            appendPartition(i);
+            appendValue(buffer, isDynamicTarget(i));
+        }
+
+        appendValue(buffer, layout.random);
+
+        return makeKey(buffer);
+    }
+
+    // A partition's function only depends on its own chunks, and on the
+    // functions of the chunks they're known to jump to
+    for (auto i: layout.members[*partition]) {
+        appendValue(buffer, i);
+        appendValue(buffer, hashChunk(chunks[i]));
+        appendValue(buffer, layout.isEntry[i]);
+        appendValue(buffer, isDynamicTarget(i));
+        appendSuccessors(buffer, options, i);
+
+        // Checked code reports where each chunk is in the file
+        if (options.checked) {
+            appendValue(buffer, chunks[i].line);
+            appendValue(buffer, chunks[i].col);
+        }
+
+        for (auto known: {chunks[i].nextChunk, chunks[i].visitedNextChunk}) {
+            if (known && *known < chunks.size() && layout.partitions[*known] != partition) {
+                appendValue(buffer, *known);
+                appendPartition(*known);
+                appendValue(buffer, isDynamicTarget(*known));
+            }
+        }
+    }
+
+    return makeKey(buffer);
+}
+
+std::optional<std::string> findCached(const std::string &cacheDir, const std::string &key) {
+    auto path = getCachePath(cacheDir, key);
+
+    if (!llvm::sys::fs::exists(path)) {
+        return std::nullopt;
+    }
+
+    return path;
+}
+
+bool loadCached(const std::string &cacheDir, const std::string &key, const std::string &filename) {
+    auto path = getCachePath(cacheDir, key);
+
+    return llvm::sys::fs::exists(path) && !copyFile(path, filename);
+}
+
+llvm::Error storeCached(const std::string &cacheDir, const std::string &key, const std::string &filename) {
+    if (auto err = llvm::sys::fs::create_directories(cacheDir)) {
+        return llvm::createFileError(cacheDir, err);
+    }
+
+    auto path = getCachePath(cacheDir, key);
+
+    // Copy to a temporary file first, so that another compile reading the
+    // cache at the same time never sees a partly written file. The temporary
+    // file gets a unique name, since files compiled together can store the
+    // same key at the same time
+    llvm::SmallString<128> tempPath;
+    llvm::sys::fs::createUniquePath(path + "-%%%%%%%%.tmp", tempPath, false);
+
+    if (auto err = copyFile(filename, std::string(tempPath))) {
+        return llvm::createFileError(tempPath, err);
+    }
+
+    if (auto err = llvm::sys::fs::rename(tempPath, path)) {
+        llvm::sys::fs::remove(tempPath);
+        return llvm::createFileError(path, err);
+    }
+
+    return llvm::Error::success();
+}
+
+} // namespace xrf
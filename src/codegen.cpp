@@ -1,17 +1,162 @@
 #include "codegen.hpp"
+#include "random.hpp"
 
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/GlobalValue.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
+
+#include <algorithm>
+#include <array>
+#include <cinttypes>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/mman.h>
 
 namespace xrf {
 
 namespace {
 
-constexpr int STACK_SIZE = 65536;
-constexpr int STACK_MASK = 65535;
+// The number of bytes of output that are buffered before being written out,
+// when using buffered I/O
+constexpr int OUTPUT_BUFFER_SIZE = 65536;
+
+// The number of bytes of input that are read at once when using buffered I/O
+constexpr int INPUT_BUFFER_SIZE = 65536;
+
+// The most chunks that a jump chosen at runtime can go to, for the chunk to
+// branch to them itself rather than through the jump shared by every chunk
+constexpr size_t MAX_LOCAL_TARGETS = 8;
+
+/**
+ * The fields of the context that library code keeps all of its state in, in
+ * the order they're laid out. The first fields are set by the caller, and
+ * match the xrf_context struct in xrf-library.h, while the rest are private
+ * to the generated code.
+ */
+enum class ContextField : unsigned {
+    User,
+    Read,
+    Write,
+    OutputLength,
+    InputPosition,
+    InputLength,
+    InputEof,
+    OutputBuffer,
+    InputBuffer,
+    Visited,
+    Random,
+    Stack,
+};
+
+/**
+ * A variable that keeps its value between chunks for the whole run of the
+ * program. In a program this is a global variable, and in library code it's
+ * a field of the context that every generated function is passed.
+ */
+struct StateVariable {
+    /**
+     * The type of the variable's value
+     */
+    llvm::Type *type = nullptr;
+
+    /**
+     * The global variable, if the code isn't library code
+     */
+    llvm::GlobalVariable *global = nullptr;
+
+    /**
+     * The field of the context, if the code is library code
+     */
+    ContextField field = ContextField::User;
+};
+
+/**
+ * The kinds of errors that checked code stops the program for.
+ */
+enum class CheckFailure {
+    // A chunk would pop a value off of an empty stack, or push more values
+    // than the stack can hold
+    StackDepth,
+
+    // A chunk jumps to a chunk that doesn't exist
+    BadJump,
+};
+
+/**
+ * How far a chunk can take the stack below and above the number of values it
+ * starts with, not counting the top value of the stack.
+ */
+struct StackBounds {
+    /**
+     * The most values that can be taken off of the stack, compared to the
+     * start of the chunk
+     */
+    int64_t below = 0;
+
+    /**
+     * The most values that can be added to the stack, compared to the start
+     * of the chunk
+     */
+    int64_t above = 0;
+};
+
+/**
+ * The commands that code is generated for in one version of a chunk, from a
+ * given command to the end. Code for the commands after an Ignore command is
+ * generated from the same commands as the rest of the chunk, so this refers to
+ * the commands in the chunk instead of copying them.
+ */
+struct ChunkCommands {
+    /**
+     * The commands of the version of the chunk
+     */
+    const std::vector<Command> &commands;
+
+    /**
+     * The index of the first command to generate code for
+     */
+    size_t first;
+
+    /**
+     * The chunk that this version of the chunk is known to jump to, if there
+     * is one
+     */
+    std::optional<unsigned> nextChunk;
+
+    /**
+     * The translation that TranslateInput commands in the chunk use
+     */
+    const InputTranslation *translation;
+};
+
+/**
+ * The values that make up the state of the stack at a given point in the
+ * program, when the state is kept in SSA registers instead of in memory.
+ */
+struct StackState {
+    /**
+     * The index of the top value of the stack
+     */
+    llvm::Value *top = nullptr;
+
+    /**
+     * The index of the bottom value of the stack
+     */
+    llvm::Value *bottom = nullptr;
+
+    /**
+     * The top value of the stack
+     */
+    llvm::Value *topValue = nullptr;
+};
 
 /**
  * A simple struct that contains various things that are needed to generate the
@@ -24,9 +169,15 @@ struct XrfContext {
     llvm::Module *module;
 
     /**
-     * The LLVM variable for the stack that the XRF code operates on
+     * A pointer to the first element of the stack that the XRF code operates
+     * on, either a global variable or memory mapped at the start of the program
+     */
+    llvm::Value *stack;
+
+    /**
+     * The mask that wraps stack indices around the ring buffer of the stack
      */
-    llvm::GlobalVariable *stack;
+    uint64_t stackMask;
 
     /**
      * The getchar() function
@@ -39,15 +190,122 @@ struct XrfContext {
     llvm::FunctionCallee putcharFunc;
 
     /**
-     * The main function where all of the XRF code is generated
+     * How the generated code performs input and output
+     */
+    IoMode ioMode;
+
+    /**
+     * With library code, the type of the context that holds all of the
+     * program's state, which a pointer to is passed to every generated
+     * function, or nullptr if the code isn't library code
+     */
+    llvm::StructType *libraryContext = nullptr;
+
+    /**
+     * With buffered I/O, the buffer that output is written to before being
+     * flushed
+     */
+    StateVariable outputBuffer;
+
+    /**
+     * With buffered I/O, the number of bytes currently in the output buffer
+     */
+    StateVariable outputLength;
+
+    /**
+     * With buffered I/O, a function that writes out everything in the output
+     * buffer and empties it
+     */
+    llvm::Function *flushOutputFunc;
+
+    /**
+     * With buffered I/O, the buffer that input is read into
+     */
+    StateVariable inputBuffer;
+
+    /**
+     * With buffered I/O, the position of the next unread byte in the input
+     * buffer
+     */
+    StateVariable inputPosition;
+
+    /**
+     * With buffered I/O, the number of bytes that were read into the input
+     * buffer
+     */
+    StateVariable inputLength;
+
+    /**
+     * With buffered I/O, a function that refills the input buffer once it's
+     * been used up, returning the first byte read, or -1 at the end of input
+     */
+    llvm::Function *refillInputFunc;
+
+    /**
+     * How the generated code jumps to chunks chosen at runtime
+     */
+    DispatchMode dispatchMode;
+
+    /**
+     * With threaded dispatch, the table with the address of each chunk's block
+     */
+    llvm::GlobalVariable *jumpTable;
+
+    /**
+     * With bounds-checked threaded dispatch, the block that is jumped to when
+     * trying to jump to a chunk that doesn't exist
+     */
+    llvm::BasicBlock *stackError;
+
+    /**
+     * With threaded dispatch, the block in the jump table for the chunks that
+     * jumps chosen at runtime can't go to, if there are any
+     */
+    llvm::BasicBlock *noTarget = nullptr;
+
+    /**
+     * The function that the XRF code is currently being generated in, which
+     * is the main function, unless the code is partitioned
      */
     llvm::Function *mainFunc;
 
     /**
-     * The first block in the main function
+     * The block at the start of the main function that everything is set up
+     * in, before jumping to the first chunk
      */
     llvm::BasicBlock *startBlock;
 
+    /**
+     * The most chunks to put in each function, or 0 if every chunk is in the
+     * main function
+     */
+    size_t partitionSize = 0;
+
+    /**
+     * With partitioned code, the function that each chunk is in, or nullptr
+     * for the chunks that can never be run
+     */
+    std::vector<llvm::Function*> chunkFunctions;
+
+    /**
+     * With partitioned code, the function that jumps to a chunk chosen at
+     * runtime, by calling the function that the chunk is in
+     */
+    llvm::Function *dispatchFunc = nullptr;
+
+    /**
+     * Whether the code is split into modules by generateSplitModule(), where
+     * the variables that keep their value for the whole run of the program
+     * are shared between the modules
+     */
+    bool split = false;
+
+    /**
+     * With split code, the partition that the module has the function of, or
+     * std::nullopt for the main module, which defines the shared variables
+     */
+    std::optional<size_t> splitPartition;
+
     /**
      * The index of the top value of the stack
      */
@@ -64,6 +322,117 @@ struct XrfContext {
      * stack when stack top changes
      */
     llvm::AllocaInst *topValue;
+
+    /**
+     * Whether the stack indices and the top value are kept in SSA registers
+     * rather than in the allocas above, which are left unused if so
+     */
+    bool registerState;
+
+    /**
+     * When the stack state is kept in registers, the values of the stack
+     * state at the point that code is currently being generated for
+     */
+    StackState state;
+
+    /**
+     * When the stack state is kept in registers, the phi nodes that receive
+     * the stack state at the start of each block that can be jumped to from
+     * multiple places
+     */
+    std::unordered_map<llvm::BasicBlock*, StackState> statePhis;
+
+    /**
+     * A bitset with a bit for each chunk, set once the chunk has been visited
+     */
+    StateVariable visitedFlags;
+
+    /**
+     * For chunks split by whether they've been visited, the block that runs
+     * the commands for visits after the first
+     */
+    std::unordered_map<size_t, llvm::BasicBlock*> visitedBlocks;
+
+    /**
+     * The global variables holding the translation tables used by
+     * TranslateInput commands, for each table
+     */
+    std::unordered_map<const InputTranslation*, llvm::GlobalVariable*> translationTables;
+
+    /**
+     * The seed for the generator that Randomize commands shuffle the stack
+     * with, if it's known at compile time
+     */
+    std::optional<uint64_t> seed;
+
+    /**
+     * The state of the generator that Randomize commands shuffle the stack
+     * with, which is only created for programs that shuffle the stack
+     */
+    StateVariable randomState;
+
+    /**
+     * Whether the generated code checks that the stack never underflows or
+     * overflows, and that jumps only go to chunks that exist
+     */
+    bool checked;
+
+    /**
+     * With checked code, the block that reports a failed check and exits,
+     * which takes the kind of failure, the chunk it happened in, and a value
+     * that depends on the kind of failure
+     */
+    llvm::BasicBlock *checkFailed = nullptr;
+
+    /**
+     * With checked code, the phi nodes at the start of the check failed block
+     * for the kind of failure, the chunk and the value
+     */
+    llvm::PHINode *failureKind, *failureChunk, *failureValue;
+
+    /**
+     * With checked code and switch dispatch, the phi node in the shared stack
+     * jump block that receives the chunk that jumped to it
+     */
+    llvm::PHINode *jumpFrom = nullptr;
+
+    /**
+     * The index of the chunk that code is currently being generated for
+     */
+    size_t currentChunk = 0;
+
+    /**
+     * Whether the generated code counts what each chunk does
+     */
+    bool instrument;
+
+    /**
+     * The file that instrumented code writes its profile to
+     */
+    std::string profileFile;
+
+    /**
+     * With instrumented code, the counters for every chunk, as an array of
+     * PROFILE_COUNTERS arrays that each have a counter for every chunk,
+     * followed by one for jumps to chunks that don't exist
+     */
+    llvm::GlobalVariable *profileCounts = nullptr;
+
+    /**
+     * With instrumented code, a function that writes the counters out to
+     * the profile file
+     */
+    llvm::Function *dumpProfileFunc = nullptr;
+
+    /**
+     * The profile that branches are weighted with, if there is one
+     */
+    const Profile *profile;
+
+    /**
+     * Where the jumps between chunks can go, if that's been worked out
+     */
+    const JumpTargets *jumpTargets;
 };
 
 /**
@@ -74,7 +443,7 @@ struct XrfContext {
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param chunk
- *     The XRF chunk to generate LLVM code for
+ *     The commands of the XRF chunk to generate LLVM code for
  * @param index
  *     The index of the chunk in the program
  * @param chunkBlock
@@ -88,115 +457,57 @@ struct XrfContext {
  *     Whether to set a variable for this chunk having been visited after the
  *     execution of the chunk is finished
  */
-void generateCodeForChunk(llvm::LLVMContext &context, XrfContext &xrfContext, const Chunk &chunk, size_t index,
-                          llvm::BasicBlock *chunkBlock, std::vector<llvm::BasicBlock*> chunks, llvm::BasicBlock *stackJump,
-                          bool setVisited = false);
+void generateCodeForChunk(llvm::LLVMContext &context, XrfContext &xrfContext, const ChunkCommands &chunk, size_t index,
+                          llvm::BasicBlock *chunkBlock, const std::vector<llvm::BasicBlock*> &chunks,
+                          llvm::BasicBlock *stackJump, bool setVisited = false);
 
 /**
- * Gets the context for generating LLVM code from XRF. This sets up a number of
- * useful things for the code generation, including all of the variables the
- * XRF program will use.
+ * Emits LLVM code to get a pointer to a value in the stack.
  *
- * @param module
- *     The LLVM module that all of the generated code will be in
  * @param context
  *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param index
+ *     The index of the value in the stack, which must already be wrapped
  *
  * @return
- *     An XRFContext with helpful fields for generating LLVM code from XRF
+ *     A pointer to the value in the stack
  */
-XrfContext getGenerationContext(llvm::Module &module, llvm::LLVMContext &context) {
-    XrfContext xrfContext;
-
-    xrfContext.module = &module;
-
-    auto stackType = llvm::ArrayType::get(llvm::IntegerType::getInt32Ty(context), STACK_SIZE);
-
-    module.getOrInsertGlobal("stack", stackType);
-    xrfContext.stack = module.getGlobalVariable("stack");
-    xrfContext.stack->setLinkage(llvm::GlobalValue::PrivateLinkage);
-    xrfContext.stack->setInitializer(llvm::UndefValue::get(stackType));
-
-    xrfContext.getcharFunc = module.getOrInsertFunction(
-        "getchar", llvm::IntegerType::getInt32Ty(context));
-
-    xrfContext.putcharFunc = module.getOrInsertFunction(
-        "putchar", llvm::IntegerType::getInt32Ty(context), llvm::IntegerType::getInt32Ty(context));
-
-    xrfContext.mainFunc = llvm::Function::Create(
-        llvm::FunctionType::get(llvm::IntegerType::getInt32Ty(context), false),
-        llvm::Function::ExternalLinkage, "main", &module
-    );
-
-    xrfContext.startBlock = llvm::BasicBlock::Create(context, "start", xrfContext.mainFunc);
-
-    auto indexType = llvm::IntegerType::getInt64Ty(context);
-
-    auto elementType = llvm::IntegerType::getInt32Ty(context);
-
-    llvm::IRBuilder builder(xrfContext.startBlock);
-
-    xrfContext.stackTop = builder.CreateAlloca(indexType, nullptr, "top");
-
-    xrfContext.stackBottom = builder.CreateAlloca(indexType, nullptr, "bottom");
-
-    xrfContext.topValue = builder.CreateAlloca(elementType, nullptr, "top_value");
-
-    builder.CreateStore(llvm::ConstantInt::get(indexType, 0), xrfContext.stackTop);
-
-    builder.CreateStore(llvm::ConstantInt::get(indexType, STACK_SIZE - 1), xrfContext.stackBottom);
-
-    builder.CreateStore(llvm::ConstantInt::get(elementType, 0), xrfContext.topValue);
-
-    return xrfContext;
+llvm::Value *emitStackPtr(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+                          llvm::Value *index)
+{
+    return builder.CreateInBoundsGEP(llvm::IntegerType::getInt32Ty(context), xrfContext.stack, index);
 }
 
 /**
- * Creates a block that jumps to the next chunk to execute, as determined by
- * the top value of the stack. This block is jumped to at the end of each
- * chunk, unless the jump to this block is optimized away by determining
- * statically which chunk will be jumped to next from a given chunk.
+ * Emits LLVM code to get the top value of the stack.
  *
  * @param context
  *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
- * @param chunks
- *     The list of all of the LLVM blocks for the chunks
+ * @param builder
+ *     The IR builder to use for generating LLVM code
  *
  * @return
- *     The block that contains the jump based on the stack top
+ *     The top value of the stack
  */
-llvm::BasicBlock *createStackJump(llvm::LLVMContext &context, XrfContext &xrfContext, const std::vector<llvm::BasicBlock*> chunks) {
-    auto stackJump = llvm::BasicBlock::Create(context, "stack-jump", xrfContext.mainFunc);
-
-    auto errorBlock = llvm::BasicBlock::Create(context, "stack-error", xrfContext.mainFunc);
-
-    llvm::IRBuilder errorBuilder(errorBlock);
-
-    errorBuilder.CreateUnreachable();
-
-    llvm::IRBuilder builder(stackJump);
+llvm::Value *emitLoadTopValue(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    if (xrfContext.registerState) {
+        return xrfContext.state.topValue;
+    }
 
-    auto topValue = builder.CreateLoad(
+    return builder.CreateLoad(
         llvm::IntegerType::getInt32Ty(context),
         xrfContext.topValue
     );
-
-    auto switchInst = builder.CreateSwitch(topValue, errorBlock, chunks.size());
-
-    for (size_t i = 0; i < chunks.size(); i++) {
-        switchInst->addCase(
-            llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), i),
-            chunks[i]
-        );
-    }
-
-    return stackJump;
 }
 
 /**
- * Emits LLVM code to add a constant value to the top value of the stack.
+ * Emits LLVM code to get the index of the top of the stack.
  *
  * @param context
  *     The LLVMContext used to generate LLVM code
@@ -204,25 +515,23 @@ llvm::BasicBlock *createStackJump(llvm::LLVMContext &context, XrfContext &xrfCon
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param builder
  *     The IR builder to use for generating LLVM code
- * @param toAdd
- *     The amount to add to the top of stack
+ *
+ * @return
+ *     The index of the top of the stack
  */
-void emitAddConstant(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, int toAdd) {
-    auto topValue = builder.CreateLoad(
-        llvm::IntegerType::getInt32Ty(context),
-        xrfContext.topValue
+llvm::Value *emitLoadStackTop(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    if (xrfContext.registerState) {
+        return xrfContext.state.top;
+    }
+
+    return builder.CreateLoad(
+        llvm::IntegerType::getInt64Ty(context),
+        xrfContext.stackTop
     );
-
-    auto newTopValue = builder.CreateAdd(
-        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), toAdd),
-        topValue
-    );
-
-    builder.CreateStore(newTopValue, xrfContext.topValue);
-}
+}
 
 /**
- * Emits LLVM code to push a value to the bottom of the stack.
+ * Emits LLVM code to get the index of the bottom of the stack.
  *
  * @param context
  *     The LLVMContext used to generate LLVM code
@@ -230,624 +539,960 @@ void emitAddConstant(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::I
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param builder
  *     The IR builder to use for generating LLVM code
- * @param value
- *     The LLVM value to push to the bottom of the stack
+ *
+ * @return
+ *     The index of the bottom of the stack
  */
-void emitBottom(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, llvm::Value *value) {
-    auto stackBottom = builder.CreateLoad(
+llvm::Value *emitLoadStackBottom(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    if (xrfContext.registerState) {
+        return xrfContext.state.bottom;
+    }
+
+    return builder.CreateLoad(
         llvm::IntegerType::getInt64Ty(context),
         xrfContext.stackBottom
     );
-
-    auto stackPtr = builder.CreateInBoundsGEP(
-        xrfContext.stack,
-        {
-            llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), 0),
-            stackBottom
-        }
-    );
-
-    builder.CreateStore(value, stackPtr);
-
-    auto bottomMinusOne = builder.CreateSub(
-        stackBottom,
-        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), 1)
-    );
-
-    auto bottomWrapped = builder.CreateAnd(bottomMinusOne, STACK_MASK);
-
-    builder.CreateStore(bottomWrapped, xrfContext.stackBottom);
 }
 
 /**
- * Emits LLVM code to load the second value of the stack.
+ * Emits LLVM code to set the top value of the stack.
  *
- * @param context
- *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param builder
  *     The IR builder to use for generating LLVM code
- *
- * @return
- *     A pointer to the second value of the stack
+ * @param value
+ *     The new top value of the stack
  */
-llvm::Value *emitGet2ndValue(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
-    auto topIndex = builder.CreateLoad(
-        llvm::IntegerType::getInt64Ty(context),
-        xrfContext.stackTop
-    );
-
-    auto topMinusOne = builder.CreateSub(
-        topIndex,
-        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), 1)
-    );
-
-    auto secondWrapped = builder.CreateAnd(topMinusOne, STACK_MASK);
-
-    return builder.CreateInBoundsGEP(
-        xrfContext.stack,
-        {
-            llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), 0),
-            secondWrapped
-        }
-    );
+void emitStoreTopValue(XrfContext &xrfContext, llvm::IRBuilder<> &builder, llvm::Value *value) {
+    if (xrfContext.registerState) {
+        xrfContext.state.topValue = value;
+    }
+    else {
+        builder.CreateStore(value, xrfContext.topValue);
+    }
 }
 
 /**
- * Emits LLVM code to pop the top value of the stack.
+ * Emits LLVM code to set the index of the top of the stack.
  *
- * @param context
- *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param builder
  *     The IR builder to use for generating LLVM code
+ * @param value
+ *     The new index of the top of the stack
  */
-void emitPop(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
-    auto stackTop = builder.CreateLoad(
-        llvm::IntegerType::getInt64Ty(context),
-        xrfContext.stackTop
-    );
-
-    auto topMinusOne = builder.CreateSub(
-        stackTop,
-        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), 1)
-    );
-
-    auto topWrapped = builder.CreateAnd(topMinusOne, STACK_MASK);
-
-    auto stackPtr = builder.CreateInBoundsGEP(
-        xrfContext.stack,
-        {
-            llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), 0),
-            topWrapped
-        }
-    );
-
-    auto newTopValue = builder.CreateLoad(
-        llvm::IntegerType::getInt32Ty(context),
-        stackPtr
-    );
-
-    builder.CreateStore(newTopValue, xrfContext.topValue);
-
-    builder.CreateStore(topWrapped, xrfContext.stackTop);
+void emitStoreStackTop(XrfContext &xrfContext, llvm::IRBuilder<> &builder, llvm::Value *value) {
+    if (xrfContext.registerState) {
+        xrfContext.state.top = value;
+    }
+    else {
+        builder.CreateStore(value, xrfContext.stackTop);
+    }
 }
 
 /**
- * Emits LLVM code to push a value to the stack.
+ * Emits LLVM code to set the index of the bottom of the stack.
  *
- * @param context
- *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param builder
  *     The IR builder to use for generating LLVM code
  * @param value
- *     The value to push to the stack
+ *     The new index of the bottom of the stack
  */
-void emitPush(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, llvm::Value *value) {
-    auto topValue = builder.CreateLoad(
-        llvm::IntegerType::getInt32Ty(context),
-        xrfContext.topValue
-    );
-
-    auto stackTop = builder.CreateLoad(
-        llvm::IntegerType::getInt64Ty(context),
-        xrfContext.stackTop
-    );
+void emitStoreStackBottom(XrfContext &xrfContext, llvm::IRBuilder<> &builder, llvm::Value *value) {
+    if (xrfContext.registerState) {
+        xrfContext.state.bottom = value;
+    }
+    else {
+        builder.CreateStore(value, xrfContext.stackBottom);
+    }
+}
 
-    auto stackPointer = builder.CreateInBoundsGEP(
-        xrfContext.stack,
-        {
-            llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), 0),
-            stackTop
-        }
-    );
+/**
+ * Gets the type of the callbacks that library code does its I/O through.
+ * Both callbacks take the user pointer, a buffer and its size, and return how
+ * many bytes they read or wrote, like read() and write().
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ *
+ * @return
+ *     The type of the callbacks
+ */
+llvm::FunctionType *getCallbackType(llvm::LLVMContext &context) {
+    auto sizeType = llvm::IntegerType::getInt64Ty(context);
+    auto bytePtrType = llvm::PointerType::getUnqual(llvm::IntegerType::getInt8Ty(context));
 
-    builder.CreateStore(topValue, stackPointer);
+    return llvm::FunctionType::get(sizeType, {bytePtrType, bytePtrType, sizeType}, false);
+}
 
-    builder.CreateStore(value, xrfContext.topValue);
+/**
+ * Creates the type of the context that library code keeps all of its state
+ * in, along with the exported function that gives its size, so that callers
+ * know how much memory to allocate for it.
+ *
+ * @param module
+ *     The LLVM module that all of the generated code will be in
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param options
+ *     The options controlling how the code is generated
+ * @param numChunks
+ *     The number of chunks in the program
+ */
+void createLibraryContext(llvm::Module &module, llvm::LLVMContext &context, XrfContext &xrfContext,
+                          const CodegenOptions &options, size_t numChunks)
+{
+    auto sizeType = llvm::IntegerType::getInt64Ty(context);
+    auto byteType = llvm::IntegerType::getInt8Ty(context);
+    auto bytePtrType = llvm::PointerType::getUnqual(byteType);
+    auto callbackType = llvm::PointerType::getUnqual(getCallbackType(context));
+
+    xrfContext.libraryContext = llvm::StructType::create(context, {
+        bytePtrType,
+        callbackType,
+        callbackType,
+        sizeType,
+        sizeType,
+        sizeType,
+        llvm::IntegerType::getInt1Ty(context),
+        llvm::ArrayType::get(byteType, OUTPUT_BUFFER_SIZE),
+        llvm::ArrayType::get(byteType, INPUT_BUFFER_SIZE),
+        llvm::ArrayType::get(sizeType, (numChunks + 63) / 64),
+        llvm::ArrayType::get(sizeType, std::tuple_size_v<RandomState>),
+        llvm::ArrayType::get(llvm::IntegerType::getInt32Ty(context), options.stackSize),
+    }, "xrf_context");
+
+    // With split code, only the main module has the exported functions
+    if (xrfContext.splitPartition) {
+        return;
+    }
 
-    auto topPlusOne = builder.CreateAdd(
-        stackTop,
-        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), 1)
+    auto sizeFunc = llvm::Function::Create(
+        llvm::FunctionType::get(sizeType, false),
+        llvm::Function::ExternalLinkage, "xrf_context_size", &module
     );
 
-    auto topWrapped = builder.CreateAnd(topPlusOne, STACK_MASK);
+    llvm::IRBuilder builder(llvm::BasicBlock::Create(context, "entry", sizeFunc));
 
-    builder.CreateStore(topWrapped, xrfContext.stackTop);
+    builder.CreateRet(llvm::ConstantExpr::getSizeOf(xrfContext.libraryContext));
 }
 
 /**
- * Emit a global variable that will keep track of whether a given XRF chunk has
- * been visited.
+ * Creates a private global variable in the module. If the name is taken,
+ * a number is added to the end of it.
  *
  * @param module
- *     The LLVM module containing all of the generated code
- * @param context
- *     The LLVMContext used to generate LLVM code
- * @param chunkIdx
- *     The index of the chunk to keep track of
+ *     The LLVM module to add the global to
+ * @param type
+ *     The type of the global
+ * @param isConstant
+ *     Whether the global is never written to
+ * @param initializer
+ *     The initial value of the global
+ * @param name
+ *     The name of the global
  *
  * @return
- *     The variable keeping track of whether the chunk has been visited
+ *     The newly-created global
  */
-llvm::GlobalVariable *emitVisited(llvm::Module &module, llvm::LLVMContext &context, int chunkIdx) {
-    auto visitedVarName = "visited-" + std::to_string(chunkIdx);
+llvm::GlobalVariable *createGlobal(llvm::Module &module, llvm::Type *type, bool isConstant,
+                                   llvm::Constant *initializer, const std::string &name)
+{
+    // getOrInsertGlobal() hands back any global that already has the name,
+    // so globals that are made more than once need names of their own
+    auto uniqueName = name;
 
-    module.getOrInsertGlobal(
-        visitedVarName,
-        llvm::Type::getInt1Ty(context)
-    );
+    for (unsigned i = 1; module.getNamedValue(uniqueName); i++) {
+        uniqueName = name + "." + std::to_string(i);
+    }
 
-    auto visited = module.getGlobalVariable(visitedVarName, true);
+    module.getOrInsertGlobal(uniqueName, type);
 
-    visited->setLinkage(llvm::GlobalValue::PrivateLinkage);
-    visited->setInitializer(llvm::ConstantInt::get(llvm::Type::getInt1Ty(context), 0));
+    auto global = module.getGlobalVariable(uniqueName, true);
 
-    return visited;
+    global->setLinkage(llvm::GlobalValue::PrivateLinkage);
+    global->setInitializer(initializer);
+    global->setConstant(isConstant);
+
+    return global;
 }
 
 /**
- * Generates LLVM code to add the top two values of the stack together.
- * Generated from the "5" XRF command.
+ * Creates a global variable that keeps its value for the whole run of the
+ * program. With split code, every module refers to the same variable, which
+ * only the main module defines.
  *
- * @param context
- *     The LLVMContext used to generate LLVM code
+ * @param module
+ *     The LLVM module to add the global to
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
- * @param builder
- *     The IR builder to use for generating LLVM code
+ * @param type
+ *     The type of the global
+ * @param initializer
+ *     The initial value of the global
+ * @param name
+ *     The name of the global
+ *
+ * @return
+ *     The newly-created global
  */
-void generateAdd(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
-    auto oldTop = builder.CreateLoad(
-        llvm::IntegerType::getInt32Ty(context),
-        xrfContext.topValue
-    );
+llvm::GlobalVariable *createSharedGlobal(llvm::Module &module, XrfContext &xrfContext, llvm::Type *type,
+                                         llvm::Constant *initializer, const std::string &name)
+{
+    if (!xrfContext.split) {
+        return createGlobal(module, type, false, initializer, name);
+    }
 
-    emitPop(context, xrfContext, builder);
+    // The modules find the variable by its name, so it gets a prefix to keep
+    // it apart from anything else the program is linked with
+    auto sharedName = "xrf_" + name;
 
-    auto newTop = builder.CreateLoad(
-        llvm::IntegerType::getInt32Ty(context),
-        xrfContext.topValue
-    );
+    module.getOrInsertGlobal(sharedName, type);
 
-    auto sum = builder.CreateAdd(oldTop, newTop);
+    auto global = module.getGlobalVariable(sharedName);
+
+    global->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    global->setVisibility(llvm::GlobalValue::HiddenVisibility);
+
+    if (!xrfContext.splitPartition) {
+        global->setInitializer(initializer);
+    }
 
-    builder.CreateStore(sum, xrfContext.topValue);
+    return global;
 }
 
 /**
- * Generates LLVM code which will add a constant to the second value in the
- * stack.
+ * Emits LLVM code to get a pointer to a variable that keeps its value for the
+ * whole run of the program. For library code, this is the field of the
+ * context passed to the function that the builder is in.
  *
- * @param context
- *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param builder
  *     The IR builder to use for generating LLVM code
- * @param diff
- *     The amount to add to the second value of the stack
+ * @param variable
+ *     The variable to get a pointer to
+ *
+ * @return
+ *     A pointer to the variable
  */
-void generateAdd2nd(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, int diff) {
-    auto secondPtr = emitGet2ndValue(context, xrfContext, builder);
-
-    auto secondValue = builder.CreateLoad(
-        llvm::IntegerType::getInt32Ty(context),
-        secondPtr
-    );
+llvm::Value *emitStatePtr(XrfContext &xrfContext, llvm::IRBuilder<> &builder, const StateVariable &variable) {
+    if (!xrfContext.libraryContext) {
+        return variable.global;
+    }
 
-    auto secondAdded = builder.CreateAdd(
-        secondValue,
-        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), diff)
-    );
+    // Every function generated for library code takes the context as its
+    // first argument
+    auto contextPtr = builder.GetInsertBlock()->getParent()->getArg(0);
 
-    builder.CreateStore(secondAdded, secondPtr);
+    return builder.CreateStructGEP(xrfContext.libraryContext, contextPtr, static_cast<unsigned>(variable.field));
 }
 
 /**
- * Generates LLVM code to send the top value of the stack to the bottom.
- * Generated from the "9" XRF command.
+ * Creates a variable that keeps its value for the whole run of the program.
+ * In a program this creates a global variable, and in library code the
+ * variable is the context's field, which gets set to the initial value at
+ * the start of every run.
  *
- * @param context
- *     The LLVMContext used to generate LLVM code
+ * @param module
+ *     The LLVM module that all of the generated code will be in
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param builder
- *     The IR builder to use for generating LLVM code
+ *     The IR builder for the start of the program, used to set library code's
+ *     variables to their initial values
+ * @param field
+ *     The field of the context that the variable is kept in for library code
+ * @param initializer
+ *     The initial value of the variable, which can be undef for variables
+ *     that are always written to before they're read
+ * @param name
+ *     The name of the global variable
+ *
+ * @return
+ *     The newly-created variable
  */
-void generateBottom(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
-    auto topValue = builder.CreateLoad(
-        llvm::IntegerType::getInt32Ty(context),
-        xrfContext.topValue
-    );
+StateVariable createStateVariable(llvm::Module &module, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+                                  ContextField field, llvm::Constant *initializer, const std::string &name)
+{
+    StateVariable variable;
+    variable.type = initializer->getType();
+    variable.field = field;
 
-    emitPop(context, xrfContext, builder);
+    if (!xrfContext.libraryContext) {
+        variable.global = createSharedGlobal(module, xrfContext, variable.type, initializer, name);
 
-    emitBottom(context, xrfContext, builder, topValue);
+        return variable;
+    }
+
+    if (llvm::isa<llvm::UndefValue>(initializer)) {
+        return variable;
+    }
+
+    auto ptr = emitStatePtr(xrfContext, builder, variable);
+
+    if (initializer->isNullValue() && variable.type->isAggregateType()) {
+        builder.CreateMemSet(ptr, builder.getInt8(0), llvm::ConstantExpr::getSizeOf(variable.type), llvm::MaybeAlign());
+    }
+    else {
+        builder.CreateStore(initializer, ptr);
+    }
+
+    return variable;
 }
 
 /**
- * Generates LLVM code to decrement the top value of the stack. Generated from
- * the "6" XRF command.
+ * Gets the type of a function generated to work on the program's state,
+ * which for library code takes a pointer to the context.
  *
- * @param context
- *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
- * @param builder
- *     The IR builder to use for generating LLVM code
+ * @param result
+ *     The type the function returns
+ *
+ * @return
+ *     The type of the function
  */
-void generateDec(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
-    emitAddConstant(context, xrfContext, builder, -1);
+llvm::FunctionType *getStateFunctionType(XrfContext &xrfContext, llvm::Type *result) {
+    if (!xrfContext.libraryContext) {
+        return llvm::FunctionType::get(result, false);
+    }
+
+    return llvm::FunctionType::get(result, {llvm::PointerType::getUnqual(xrfContext.libraryContext)}, false);
 }
 
 /**
- * Generates LLVM code to duplicate the top value of the stack. Generated from
- * the "3" XRF command.
+ * Emits LLVM code that calls a function created with getStateFunctionType(),
+ * passing on the context for library code.
  *
- * @param context
- *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param builder
  *     The IR builder to use for generating LLVM code
+ * @param func
+ *     The function to call
+ *
+ * @return
+ *     The value the function returns
  */
-void generateDup(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
-    auto topValue = builder.CreateLoad(
-        llvm::IntegerType::getInt32Ty(context),
-        xrfContext.topValue
-    );
+llvm::CallInst *emitStateCall(XrfContext &xrfContext, llvm::IRBuilder<> &builder, llvm::Function *func) {
+    if (!xrfContext.libraryContext) {
+        return builder.CreateCall(func);
+    }
 
-    emitPush(context, xrfContext, builder, topValue);
+    return builder.CreateCall(func, {builder.GetInsertBlock()->getParent()->getArg(0)});
 }
 
 /**
- * Generates LLVM code to increment the top value of the stack. Generated from
- * the "5" XRF command.
+ * Emits LLVM code that calls one of the callbacks that library code does its
+ * I/O through, with the user pointer from the context.
  *
- * @param context
- *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param builder
  *     The IR builder to use for generating LLVM code
+ * @param field
+ *     The field of the context with the callback to call
+ * @param buffer
+ *     The buffer to pass to the callback
+ * @param size
+ *     The size of the buffer
+ *
+ * @return
+ *     The number of bytes that the callback read or wrote
  */
-void generateInc(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
-    emitAddConstant(context, xrfContext, builder, 1);
+llvm::Value *emitCallback(XrfContext &xrfContext, llvm::IRBuilder<> &builder, ContextField field,
+                          llvm::Value *buffer, llvm::Value *size)
+{
+    auto contextPtr = builder.GetInsertBlock()->getParent()->getArg(0);
+
+    auto fieldPtr = [&] (ContextField field) {
+        return builder.CreateStructGEP(xrfContext.libraryContext, contextPtr, static_cast<unsigned>(field));
+    };
+
+    auto userType = xrfContext.libraryContext->getElementType(static_cast<unsigned>(ContextField::User));
+    auto callbackType = xrfContext.libraryContext->getElementType(static_cast<unsigned>(field));
+
+    auto user = builder.CreateLoad(userType, fieldPtr(ContextField::User));
+    auto callback = builder.CreateLoad(callbackType, fieldPtr(field));
+
+    return builder.CreateCall(getCallbackType(builder.getContext()), callback, {user, buffer, size});
 }
 
 /**
- * Generates LLVM code to push a byte of input onto the stack. Generated from
- * the "0" XRF command.
+ * Creates a block that can be jumped to from multiple places in the program.
+ * If the stack state is kept in registers, this also creates the phi nodes
+ * that receive the stack state at the start of the block.
  *
  * @param context
  *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
- * @param builder
- *     The IR builder to use for generating LLVM code
+ * @param name
+ *     The name of the block
+ *
+ * @return
+ *     The newly-created block
  */
-void generateInput(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
-    auto inputChar = builder.CreateCall(xrfContext.getcharFunc);
+llvm::BasicBlock *createJumpTarget(llvm::LLVMContext &context, XrfContext &xrfContext, const std::string &name) {
+    auto block = llvm::BasicBlock::Create(context, name, xrfContext.mainFunc);
 
-    auto isEof = builder.CreateICmpEQ(
-        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), -1),
-        inputChar
-    );
+    if (xrfContext.registerState) {
+        llvm::IRBuilder builder(block);
 
-    auto correctedChar = builder.CreateSelect(
-        isEof,
-        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), 0),
-        inputChar
-    );
+        xrfContext.statePhis[block] = {
+            builder.CreatePHI(llvm::IntegerType::getInt64Ty(context), 1, "top"),
+            builder.CreatePHI(llvm::IntegerType::getInt64Ty(context), 1, "bottom"),
+            builder.CreatePHI(llvm::IntegerType::getInt32Ty(context), 1, "top_value"),
+        };
+    }
 
-    emitPush(context, xrfContext, builder, correctedChar);
+    return block;
 }
 
 /**
- * Generates LLVM code to multiply the second value in the stack by a constant
- * value.
+ * Sets the current stack state to the state at the start of a block created
+ * with createJumpTarget(), before generating the code inside the block. Does
+ * nothing if the stack state isn't kept in registers.
  *
- * @param context
- *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
- * @param builder
- *     The IR builder to use for generating LLVM code
- * @param mul
- *     The amount to multiply the 2nd value by
+ * @param block
+ *     The block that code is about to be generated in
  */
-void generateMultiply2nd(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, int mul) {
-    auto secondPtr = emitGet2ndValue(context, xrfContext, builder);
+void enterJumpTarget(XrfContext &xrfContext, llvm::BasicBlock *block) {
+    if (xrfContext.registerState) {
+        xrfContext.state = xrfContext.statePhis[block];
+    }
+}
 
-    auto secondValue = builder.CreateLoad(
-        llvm::IntegerType::getInt32Ty(context),
-        secondPtr
-    );
+/**
+ * Passes the current stack state to a block created with createJumpTarget(),
+ * for when the current block jumps to it. Does nothing if the stack state
+ * isn't kept in registers.
+ *
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param from
+ *     The block that jumps to the target block
+ * @param target
+ *     The block being jumped to
+ */
+void addJumpSource(XrfContext &xrfContext, llvm::BasicBlock *from, llvm::BasicBlock *target) {
+    if (xrfContext.jumpFrom && target == xrfContext.jumpFrom->getParent()) {
+        xrfContext.jumpFrom->addIncoming(
+            llvm::ConstantInt::get(xrfContext.jumpFrom->getType(), xrfContext.currentChunk), from
+        );
+    }
 
-    auto secondMultiplied = builder.CreateNUWMul(
-        secondValue,
-        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), mul)
-    );
+    if (!xrfContext.registerState) {
+        return;
+    }
 
-    builder.CreateStore(secondMultiplied, secondPtr);
+    auto &phis = xrfContext.statePhis[target];
+
+    llvm::cast<llvm::PHINode>(phis.top)->addIncoming(xrfContext.state.top, from);
+    llvm::cast<llvm::PHINode>(phis.bottom)->addIncoming(xrfContext.state.bottom, from);
+    llvm::cast<llvm::PHINode>(phis.topValue)->addIncoming(xrfContext.state.topValue, from);
 }
 
 /**
- * Generates LLVM code to output the top value of the stack as a character,
- * popping the stack in the process. Generated from the "1" XRF command.
+ * Emits a branch to a block created with createJumpTarget(), passing it the
+ * current stack state.
  *
- * @param context
- *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param builder
  *     The IR builder to use for generating LLVM code
+ * @param target
+ *     The block to jump to
  */
-void generateOutput(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
-    auto topValue = builder.CreateLoad(
-        llvm::IntegerType::getInt32Ty(context),
-        xrfContext.topValue
-    );
-
-    builder.CreateCall(xrfContext.putcharFunc, topValue);
-
-    emitPop(context, xrfContext, builder);
+void emitJump(XrfContext &xrfContext, llvm::IRBuilder<> &builder, llvm::BasicBlock *target) {
+    addJumpSource(xrfContext, builder.GetInsertBlock(), target);
+    builder.CreateBr(target);
 }
 
 /**
- * Generates LLVM code to pop the stack. Generated from the "2" XRF command.
+ * Gets the type of the functions that partitioned code is split into. Each
+ * function is passed the stack, the chunk to start at and the stack state,
+ * after the context for library code, and returns the exit status of the
+ * program.
  *
  * @param context
  *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
- * @param builder
- *     The IR builder to use for generating LLVM code
+ *
+ * @return
+ *     The type of the functions
  */
-void generatePop(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
-    emitPop(context, xrfContext, builder);
+llvm::FunctionType *getPartitionType(llvm::LLVMContext &context, XrfContext &xrfContext) {
+    auto int32Type = llvm::IntegerType::getInt32Ty(context);
+    auto int64Type = llvm::IntegerType::getInt64Ty(context);
+
+    std::vector<llvm::Type*> params;
+
+    if (xrfContext.libraryContext) {
+        params.push_back(llvm::PointerType::getUnqual(xrfContext.libraryContext));
+    }
+
+    params.insert(params.end(), {llvm::PointerType::getUnqual(int32Type), int32Type, int64Type, int64Type, int32Type});
+
+    return llvm::FunctionType::get(int32Type, params, false);
 }
 
 /**
- * Generates LLVM code to remove the second value of the stack from the stack.
+ * Emits LLVM code that jumps to a chunk in one of the functions of
+ * partitioned code, by calling the function with the current stack state and
+ * returning what it returns. Calls from one of the functions to another are
+ * musttail calls, so they never grow the call stack.
  *
- * @param context
- *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param builder
  *     The IR builder to use for generating LLVM code
+ * @param func
+ *     The function to call
+ * @param chunkIdx
+ *     The index of the chunk to jump to, as a 32-bit integer
  */
-void generatePopSecond(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
-    auto topIndex = builder.CreateLoad(
-        llvm::IntegerType::getInt64Ty(context),
-        xrfContext.stackTop
-    );
+void emitPartitionJump(XrfContext &xrfContext, llvm::IRBuilder<> &builder, llvm::Function *func,
+                       llvm::Value *chunkIdx)
+{
+    auto &context = builder.getContext();
+    auto caller = builder.GetInsertBlock()->getParent();
 
-    auto topMinusOne = builder.CreateSub(
-        topIndex,
-        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), 1)
-    );
+    std::vector<llvm::Value*> args;
 
-    auto topWrapped = builder.CreateAnd(topMinusOne, STACK_MASK);
+    if (xrfContext.libraryContext) {
+        args.push_back(caller->getArg(0));
+    }
+
+    args.insert(args.end(), {
+        xrfContext.stack,
+        chunkIdx,
+        emitLoadStackTop(context, xrfContext, builder),
+        emitLoadStackBottom(context, xrfContext, builder),
+        emitLoadTopValue(context, xrfContext, builder),
+    });
+
+    auto call = builder.CreateCall(func, args);
+
+    // The main function doesn't have the same type as the functions it calls,
+    // so its call can't be a musttail call
+    if (caller->getFunctionType() == func->getFunctionType()) {
+        call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+    }
 
-    builder.CreateStore(topWrapped, xrfContext.stackTop);
+    builder.CreateRet(call);
 }
 
 /**
- * Generates LLVM code that will insert a value beneath the top value of the
- * stack.
+ * Creates the function that writes out the contents of the output buffer and
+ * empties it, for use with buffered I/O. Partial writes are retried until
+ * everything has been written, or until write() fails.
  *
+ * @param module
+ *     The LLVM module that all of the generated code will be in
  * @param context
  *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
- * @param builder
- *     The IR builder to use for generating LLVM code
- * @param val
- *     The value to insert
  */
-void generatePushSecondValue(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, unsigned val) {
-    auto topIndex = builder.CreateLoad(
-        llvm::IntegerType::getInt64Ty(context),
-        xrfContext.stackTop
+void createFlushOutput(llvm::Module &module, llvm::LLVMContext &context, XrfContext &xrfContext) {
+    auto sizeType = llvm::IntegerType::getInt64Ty(context);
+
+    auto bytePtrType = llvm::PointerType::getUnqual(llvm::IntegerType::getInt8Ty(context));
+
+    xrfContext.flushOutputFunc = llvm::Function::Create(
+        getStateFunctionType(xrfContext, llvm::Type::getVoidTy(context)),
+        llvm::Function::PrivateLinkage, "flush_output", &module
     );
 
-    auto stackPtr = builder.CreateInBoundsGEP(
-        xrfContext.stack,
+    auto entryBlock = llvm::BasicBlock::Create(context, "entry", xrfContext.flushOutputFunc);
+    auto writeBlock = llvm::BasicBlock::Create(context, "write", xrfContext.flushOutputFunc);
+    auto doneBlock = llvm::BasicBlock::Create(context, "done", xrfContext.flushOutputFunc);
+
+    llvm::IRBuilder builder(entryBlock);
+
+    auto lengthPtr = emitStatePtr(xrfContext, builder, xrfContext.outputLength);
+
+    auto length = builder.CreateLoad(sizeType, lengthPtr);
+
+    builder.CreateCondBr(
+        builder.CreateICmpEQ(length, llvm::ConstantInt::get(sizeType, 0)),
+        doneBlock,
+        writeBlock
+    );
+
+    builder.SetInsertPoint(writeBlock);
+
+    auto written = builder.CreatePHI(sizeType, 2, "written");
+    written->addIncoming(llvm::ConstantInt::get(sizeType, 0), entryBlock);
+
+    auto bufferPtr = builder.CreateInBoundsGEP(
+        xrfContext.outputBuffer.type,
+        emitStatePtr(xrfContext, builder, xrfContext.outputBuffer),
         {
             llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), 0),
-            topIndex
+            written
         }
     );
 
-    builder.CreateStore(
-        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), val),
-        stackPtr
-    );
+    llvm::Value *result;
 
-    auto topPlusOne = builder.CreateAdd(
-        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), 1),
-        topIndex
+    if (xrfContext.libraryContext) {
+        result = emitCallback(xrfContext, builder, ContextField::Write, bufferPtr, builder.CreateSub(length, written));
+    }
+    else {
+        auto writeFunc = module.getOrInsertFunction(
+            "write", sizeType, llvm::IntegerType::getInt32Ty(context), bytePtrType, sizeType);
+
+        result = builder.CreateCall(writeFunc, {
+            llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), 1),
+            bufferPtr,
+            builder.CreateSub(length, written)
+        });
+    }
+
+    auto newWritten = builder.CreateAdd(written, result);
+    written->addIncoming(newWritten, writeBlock);
+
+    // Keep writing until everything is written or write() returns an error
+    auto keepWriting = builder.CreateAnd(
+        builder.CreateICmpSGT(result, llvm::ConstantInt::get(sizeType, 0)),
+        builder.CreateICmpSLT(newWritten, length)
     );
 
-    auto secondWrapped = builder.CreateAnd(topPlusOne, STACK_MASK);
+    builder.CreateCondBr(keepWriting, writeBlock, doneBlock);
+
+    builder.SetInsertPoint(doneBlock);
+
+    builder.CreateStore(llvm::ConstantInt::get(sizeType, 0), lengthPtr);
 
-    builder.CreateStore(secondWrapped, xrfContext.stackTop);
+    builder.CreateRetVoid();
 }
 
 /**
- * Generates LLVM code that will push a value to the bottom of the stack.
+ * Creates the function that refills the input buffer for buffered I/O. It
+ * returns the first new byte of input, consuming it, or -1 once the end of
+ * input has been reached. Like getchar(), once the end of input has been
+ * reached every later read also returns -1. Any buffered output is written
+ * out before reading, so that prompts show up before the program blocks on
+ * input.
  *
+ * @param module
+ *     The LLVM module that all of the generated code will be in
  * @param context
  *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
- * @param builder
- *     The IR builder to use for generating LLVM code
- * @param val
- *     The value to push to the bottom.
+ * @param startBuilder
+ *     The IR builder for the start of the program, used to set library code's
+ *     end of input flag to its initial value
  */
-void generatePushToBottom(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, unsigned val) {
-    emitBottom(
-        context, xrfContext, builder,
-        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), val)
+void createRefillInput(llvm::Module &module, llvm::LLVMContext &context, XrfContext &xrfContext,
+                       llvm::IRBuilder<> &startBuilder)
+{
+    auto sizeType = llvm::IntegerType::getInt64Ty(context);
+
+    auto charType = llvm::IntegerType::getInt32Ty(context);
+
+    auto bytePtrType = llvm::PointerType::getUnqual(llvm::IntegerType::getInt8Ty(context));
+
+    auto inputEof = createStateVariable(
+        module, xrfContext, startBuilder, ContextField::InputEof, llvm::ConstantInt::getFalse(context), "input_eof"
+    );
+
+    xrfContext.refillInputFunc = llvm::Function::Create(
+        getStateFunctionType(xrfContext, charType),
+        llvm::Function::PrivateLinkage, "refill_input", &module
+    );
+
+    auto entryBlock = llvm::BasicBlock::Create(context, "entry", xrfContext.refillInputFunc);
+    auto readBlock = llvm::BasicBlock::Create(context, "read", xrfContext.refillInputFunc);
+    auto gotInputBlock = llvm::BasicBlock::Create(context, "got-input", xrfContext.refillInputFunc);
+    auto eofBlock = llvm::BasicBlock::Create(context, "eof", xrfContext.refillInputFunc);
+
+    llvm::IRBuilder builder(entryBlock);
+
+    emitStateCall(xrfContext, builder, xrfContext.flushOutputFunc);
+
+    builder.CreateCondBr(
+        builder.CreateLoad(llvm::IntegerType::getInt1Ty(context), emitStatePtr(xrfContext, builder, inputEof)),
+        eofBlock,
+        readBlock
+    );
+
+    builder.SetInsertPoint(readBlock);
+
+    auto bufferStart = builder.CreateInBoundsGEP(
+        xrfContext.inputBuffer.type,
+        emitStatePtr(xrfContext, builder, xrfContext.inputBuffer),
+        {
+            llvm::ConstantInt::get(charType, 0),
+            llvm::ConstantInt::get(charType, 0)
+        }
+    );
+
+    llvm::Value *bytesRead;
+
+    if (xrfContext.libraryContext) {
+        bytesRead = emitCallback(xrfContext, builder, ContextField::Read, bufferStart,
+                                 llvm::ConstantInt::get(sizeType, INPUT_BUFFER_SIZE));
+    }
+    else {
+        auto readFunc = module.getOrInsertFunction("read", sizeType, charType, bytePtrType, sizeType);
+
+        bytesRead = builder.CreateCall(readFunc, {
+            llvm::ConstantInt::get(charType, 0),
+            bufferStart,
+            llvm::ConstantInt::get(sizeType, INPUT_BUFFER_SIZE)
+        });
+    }
+
+    // read() errors are treated the same as reaching the end of input
+    builder.CreateCondBr(
+        builder.CreateICmpSGT(bytesRead, llvm::ConstantInt::get(sizeType, 0)),
+        gotInputBlock,
+        eofBlock
     );
+
+    builder.SetInsertPoint(gotInputBlock);
+
+    builder.CreateStore(bytesRead, emitStatePtr(xrfContext, builder, xrfContext.inputLength));
+    builder.CreateStore(llvm::ConstantInt::get(sizeType, 1), emitStatePtr(xrfContext, builder, xrfContext.inputPosition));
+
+    builder.CreateRet(builder.CreateZExt(
+        builder.CreateLoad(llvm::IntegerType::getInt8Ty(context), bufferStart),
+        charType
+    ));
+
+    builder.SetInsertPoint(eofBlock);
+
+    builder.CreateStore(llvm::ConstantInt::getTrue(context), emitStatePtr(xrfContext, builder, inputEof));
+    builder.CreateRet(llvm::ConstantInt::get(charType, -1));
 }
 
 /**
- * Generates LLVM code which will set the second value of the stack to a known
- * value.
+ * Creates the variables and functions used by the generated code for
+ * buffered I/O.
  *
+ * @param module
+ *     The LLVM module that all of the generated code will be in
  * @param context
  *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param builder
- *     The IR builder to use for generating LLVM code
- * @param val
+ *     The IR builder for the start of the program
  */
-void generateSetSecondValue(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, unsigned val) {
-    auto secondPtr = emitGet2ndValue(context, xrfContext, builder);
+void createBufferedIo(llvm::Module &module, llvm::LLVMContext &context, XrfContext &xrfContext,
+                      llvm::IRBuilder<> &builder)
+{
+    auto sizeType = llvm::IntegerType::getInt64Ty(context);
 
-    builder.CreateStore(
-        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), val),
-        secondPtr
+    // The buffers are always written to before they're read, so they don't
+    // need to be cleared for each run of library code
+    auto outputBufferType = llvm::ArrayType::get(llvm::IntegerType::getInt8Ty(context), OUTPUT_BUFFER_SIZE);
+
+    xrfContext.outputBuffer = createStateVariable(
+        module, xrfContext, builder, ContextField::OutputBuffer, llvm::UndefValue::get(outputBufferType), "output_buffer"
+    );
+
+    xrfContext.outputLength = createStateVariable(
+        module, xrfContext, builder, ContextField::OutputLength, llvm::ConstantInt::get(sizeType, 0), "output_length"
+    );
+
+    createFlushOutput(module, context, xrfContext);
+
+    auto inputBufferType = llvm::ArrayType::get(llvm::IntegerType::getInt8Ty(context), INPUT_BUFFER_SIZE);
+
+    xrfContext.inputBuffer = createStateVariable(
+        module, xrfContext, builder, ContextField::InputBuffer, llvm::UndefValue::get(inputBufferType), "input_buffer"
+    );
+
+    xrfContext.inputPosition = createStateVariable(
+        module, xrfContext, builder, ContextField::InputPosition, llvm::ConstantInt::get(sizeType, 0), "input_position"
+    );
+
+    xrfContext.inputLength = createStateVariable(
+        module, xrfContext, builder, ContextField::InputLength, llvm::ConstantInt::get(sizeType, 0), "input_length"
     );
+
+    createRefillInput(module, context, xrfContext, builder);
 }
 
 /**
- * Generates LLVM that will set the top value of the stack to a known value.
+ * Emits LLVM code to write out any buffered output. Does nothing unless
+ * buffered I/O is being used.
  *
- * @param context
- *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param builder
  *     The IR builder to use for generating LLVM code
- * @param val
- *     The value to set the top to
  */
-void generateSetTop(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, unsigned val) {
-    builder.CreateStore(
-        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), val),
-        xrfContext.topValue
-    );
+void emitFlushOutput(XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    if (xrfContext.ioMode == IoMode::Buffered) {
+        emitStateCall(xrfContext, builder, xrfContext.flushOutputFunc);
+    }
 }
 
 /**
- * Generates LLVM code which will replace the top two values of the stack with
- * their difference. Generated from the "E" XRF command.
+ * Creates the function that writes out the profile of an instrumented
+ * program. The profile starts with a line with the number of chunks, followed
+ * by a line for each chunk that ran, with the index of the chunk and each of
+ * its counters. Nothing is written out if the file can't be opened.
  *
+ * @param module
+ *     The LLVM module that all of the generated code will be in
  * @param context
  *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
- * @param builder
- *     The IR builder to use for generating LLVM code
+ * @param numChunks
+ *     The number of chunks in the program
  */
-void generateSub(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
-    auto value1 = builder.CreateLoad(
-        llvm::IntegerType::getInt32Ty(context),
-        xrfContext.topValue
+void createDumpProfile(llvm::Module &module, llvm::LLVMContext &context, XrfContext &xrfContext, size_t numChunks) {
+    auto counterType = llvm::IntegerType::getInt64Ty(context);
+
+    auto intType = llvm::IntegerType::getInt32Ty(context);
+
+    auto bytePtrType = llvm::PointerType::getUnqual(llvm::IntegerType::getInt8Ty(context));
+
+    auto fopenFunc = module.getOrInsertFunction("fopen", bytePtrType, bytePtrType, bytePtrType);
+
+    auto fprintfFunc = module.getOrInsertFunction(
+        "fprintf", llvm::FunctionType::get(intType, {bytePtrType, bytePtrType}, true));
+
+    auto fcloseFunc = module.getOrInsertFunction("fclose", intType, bytePtrType);
+
+    xrfContext.dumpProfileFunc = llvm::Function::Create(
+        llvm::FunctionType::get(llvm::Type::getVoidTy(context), false),
+        llvm::Function::PrivateLinkage, "dump_profile", &module
     );
 
-    emitPop(context, xrfContext, builder);
+    auto entryBlock = llvm::BasicBlock::Create(context, "entry", xrfContext.dumpProfileFunc);
+    auto headerBlock = llvm::BasicBlock::Create(context, "header", xrfContext.dumpProfileFunc);
+    auto loopBlock = llvm::BasicBlock::Create(context, "loop", xrfContext.dumpProfileFunc);
+    auto writeBlock = llvm::BasicBlock::Create(context, "write", xrfContext.dumpProfileFunc);
+    auto nextBlock = llvm::BasicBlock::Create(context, "next", xrfContext.dumpProfileFunc);
+    auto closeBlock = llvm::BasicBlock::Create(context, "close", xrfContext.dumpProfileFunc);
+    auto doneBlock = llvm::BasicBlock::Create(context, "done", xrfContext.dumpProfileFunc);
 
-    auto value2 = builder.CreateLoad(
-        llvm::IntegerType::getInt32Ty(context),
-        xrfContext.topValue
+    llvm::IRBuilder builder(entryBlock);
+
+    auto file = builder.CreateCall(fopenFunc, {
+        builder.CreateGlobalStringPtr(xrfContext.profileFile, "profile_file"),
+        builder.CreateGlobalStringPtr("w")
+    });
+
+    builder.CreateCondBr(builder.CreateIsNull(file), doneBlock, headerBlock);
+
+    builder.SetInsertPoint(headerBlock);
+
+    builder.CreateCall(fprintfFunc, {
+        file,
+        builder.CreateGlobalStringPtr("xrf-profile %" PRIu64 "\n"),
+        llvm::ConstantInt::get(counterType, numChunks)
+    });
+
+    builder.CreateBr(loopBlock);
+
+    builder.SetInsertPoint(loopBlock);
+
+    auto index = builder.CreatePHI(counterType, 2, "index");
+    index->addIncoming(llvm::ConstantInt::get(counterType, 0), headerBlock);
+
+    std::vector<llvm::Value*> counters;
+    std::string format = "%" PRIu64;
+
+    for (unsigned i = 0; i < PROFILE_COUNTERS; i++) {
+        auto counterPtr = builder.CreateInBoundsGEP(
+            xrfContext.profileCounts->getValueType(),
+            xrfContext.profileCounts,
+            {llvm::ConstantInt::get(counterType, 0), llvm::ConstantInt::get(counterType, i), index}
+        );
+
+        counters.push_back(builder.CreateLoad(counterType, counterPtr));
+        format += " %" PRIu64;
+    }
+
+    format += "\n";
+
+    auto runs = counters[static_cast<unsigned>(ProfileCounter::Runs)];
+
+    builder.CreateCondBr(
+        builder.CreateICmpEQ(runs, llvm::ConstantInt::get(counterType, 0)),
+        nextBlock,
+        writeBlock
     );
 
-    auto sub1 = builder.CreateSub(value1, value2);
+    builder.SetInsertPoint(writeBlock);
 
-    auto sub2 = builder.CreateSub(value2, value1);
+    std::vector<llvm::Value*> args = {file, builder.CreateGlobalStringPtr(format), index};
+    args.insert(args.end(), counters.begin(), counters.end());
 
-    auto value1IsGreater = builder.CreateICmpUGT(value1, value2);
+    builder.CreateCall(fprintfFunc, args);
+    builder.CreateBr(nextBlock);
 
-    auto selectedValue = builder.CreateSelect(value1IsGreater, sub1, sub2);
+    builder.SetInsertPoint(nextBlock);
 
-    builder.CreateStore(selectedValue, xrfContext.topValue);
+    auto nextIndex = builder.CreateAdd(index, llvm::ConstantInt::get(counterType, 1));
+    index->addIncoming(nextIndex, nextBlock);
+
+    builder.CreateCondBr(
+        builder.CreateICmpULT(nextIndex, llvm::ConstantInt::get(counterType, numChunks)),
+        loopBlock,
+        closeBlock
+    );
+
+    builder.SetInsertPoint(closeBlock);
+    builder.CreateCall(fcloseFunc, {file});
+    builder.CreateBr(doneBlock);
+
+    builder.SetInsertPoint(doneBlock);
+    builder.CreateRetVoid();
 }
 
 /**
- * Generates LLVM code which will swap the top two values of the stack.
- * Generated from the "4" XRF command.
+ * Creates the counters that instrumented code keeps for each chunk, along
+ * with the function that writes them out.
  *
+ * @param module
+ *     The LLVM module that all of the generated code will be in
  * @param context
  *     The LLVMContext used to generate LLVM code
  * @param xrfContext
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
- * @param builder
- *     The IR builder to use for generating LLVM code
+ * @param numChunks
+ *     The number of chunks in the program
  */
-void generateSwap(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
-    auto stackTop = builder.CreateLoad(
-        llvm::IntegerType::getInt64Ty(context),
-        xrfContext.stackTop
-    );
-
-    auto topMinusOne = builder.CreateSub(
-        stackTop,
-        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), 1)
-    );
-
-    auto stack2ndIndex = builder.CreateAnd(
-        topMinusOne,
-        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), STACK_MASK)
-    );
-
-    auto stackIndex = builder.CreateInBoundsGEP(
-        xrfContext.stack,
-        {
-            llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), 0),
-            stack2ndIndex
-        }
-    );
-
-    auto stack2ndValue = builder.CreateLoad(
-        llvm::IntegerType::getInt32Ty(context),
-        stackIndex
+void createProfileCounters(llvm::Module &module, llvm::LLVMContext &context, XrfContext &xrfContext, size_t numChunks) {
+    // Each array has an extra counter at the end for jumps to chunks that
+    // don't exist, so that counting a jump never has to be bounds checked
+    auto countersType = llvm::ArrayType::get(
+        llvm::ArrayType::get(llvm::IntegerType::getInt64Ty(context), numChunks + 1),
+        PROFILE_COUNTERS
     );
 
-    auto topValue = builder.CreateLoad(
-        llvm::IntegerType::getInt32Ty(context),
-        xrfContext.topValue
+    xrfContext.profileCounts = createSharedGlobal(
+        module, xrfContext, countersType, llvm::ConstantAggregateZero::get(countersType), "profile_counts"
     );
 
-    builder.CreateStore(topValue, stackIndex);
-
-    builder.CreateStore(stack2ndValue, xrfContext.topValue);
+    createDumpProfile(module, context, xrfContext, numChunks);
 }
 
 /**
- * Generates code for conditionally executing code based on whether chunk has
- * been visited before. Generated from the "8" and "C" XRF commands.
+ * Emits LLVM code to add to one of a chunk's counters. Does nothing unless
+ * the code is instrumented. The program only ever runs on one thread, so the
+ * counters are updated with plain loads and stores.
  *
  * @param context
  *     The LLVMContext used to generate LLVM code
@@ -855,179 +1500,3199 @@ void generateSwap(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBu
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param builder
  *     The IR builder to use for generating LLVM code
- * @param index
+ * @param counter
+ *     The counter to add to
+ * @param chunkIdx
+ *     An i64 value with the index of the chunk whose counter is added to
+ * @param amount
+ *     An i64 value with the amount to add to the counter
+ */
+void emitCount(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+               ProfileCounter counter, llvm::Value *chunkIdx, llvm::Value *amount)
+{
+    if (!xrfContext.profileCounts) {
+        return;
+    }
+
+    auto counterType = llvm::IntegerType::getInt64Ty(context);
+
+    auto counterPtr = builder.CreateInBoundsGEP(
+        xrfContext.profileCounts->getValueType(),
+        xrfContext.profileCounts,
+        {
+            llvm::ConstantInt::get(counterType, 0),
+            llvm::ConstantInt::get(counterType, static_cast<unsigned>(counter)),
+            chunkIdx
+        }
+    );
+
+    auto count = builder.CreateLoad(counterType, counterPtr);
+
+    builder.CreateStore(builder.CreateAdd(count, amount), counterPtr);
+}
+
+/**
+ * Emits LLVM code to add one to one of a chunk's counters. Does nothing unless
+ * the code is instrumented.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param counter
+ *     The counter to add to
+ * @param chunkIdx
+ *     The index of the chunk whose counter is added to
+ */
+void emitCount(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+               ProfileCounter counter, size_t chunkIdx)
+{
+    auto counterType = llvm::IntegerType::getInt64Ty(context);
+
+    emitCount(context, xrfContext, builder, counter,
+              llvm::ConstantInt::get(counterType, chunkIdx), llvm::ConstantInt::get(counterType, 1));
+}
+
+/**
+ * Emits LLVM code to count a jump to the chunk given by the top value of the
+ * stack. Jumps to chunks that don't exist are counted in the extra counter
+ * past the last chunk. Does nothing unless the code is instrumented.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param topValue
+ *     The top value of the stack, which is the chunk being jumped to
+ * @param numChunks
+ *     The number of chunks in the program
+ */
+void emitCountJumpTo(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+                     llvm::Value *topValue, size_t numChunks)
+{
+    if (!xrfContext.profileCounts) {
+        return;
+    }
+
+    auto counterType = llvm::IntegerType::getInt64Ty(context);
+
+    auto target = builder.CreateZExt(topValue, counterType);
+
+    auto numChunksValue = llvm::ConstantInt::get(counterType, numChunks);
+
+    auto chunkIdx = builder.CreateSelect(builder.CreateICmpULT(target, numChunksValue), target, numChunksValue);
+
+    emitCount(context, xrfContext, builder, ProfileCounter::JumpsTo, chunkIdx, llvm::ConstantInt::get(counterType, 1));
+}
+
+/**
+ * Emits LLVM code to write out the profile of an instrumented program, for
+ * when the program exits. Does nothing unless the code is instrumented.
+ *
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ */
+void emitDumpProfile(XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    if (xrfContext.dumpProfileFunc) {
+        builder.CreateCall(xrfContext.dumpProfileFunc);
+    }
+}
+
+/**
+ * Emits LLVM code that maps the memory for the stack with mmap(), exiting the
+ * program if the memory can't be mapped. The memory is only reserved, so the
+ * OS only backs the pages of the stack that actually get used.
+ *
+ * @param module
+ *     The LLVM module that all of the generated code will be in
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param stackSize
+ *     The number of values the stack can hold
+ *
+ * @return
+ *     A pointer to the start of the stack
+ */
+llvm::Value *emitMapStack(llvm::Module &module, llvm::LLVMContext &context, XrfContext &xrfContext,
+                          llvm::IRBuilder<> &builder, uint64_t stackSize)
+{
+    auto sizeType = llvm::IntegerType::getInt64Ty(context);
+
+    auto intType = llvm::IntegerType::getInt32Ty(context);
+
+    auto bytePtrType = llvm::PointerType::getUnqual(llvm::IntegerType::getInt8Ty(context));
+
+    auto mmapFunc = module.getOrInsertFunction(
+        "mmap", bytePtrType, bytePtrType, sizeType, intType, intType, intType, sizeType);
+
+    // The generated code targets the host, so the host's flags are used
+    auto flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+
+    auto memory = builder.CreateCall(mmapFunc, {
+        llvm::ConstantPointerNull::get(bytePtrType),
+        llvm::ConstantInt::get(sizeType, stackSize * sizeof(uint32_t)),
+        llvm::ConstantInt::get(intType, PROT_READ | PROT_WRITE),
+        llvm::ConstantInt::get(intType, flags),
+        llvm::ConstantInt::get(intType, -1),
+        llvm::ConstantInt::get(sizeType, 0)
+    });
+
+    auto failedBlock = llvm::BasicBlock::Create(context, "map-failed", xrfContext.mainFunc);
+    auto mappedBlock = llvm::BasicBlock::Create(context, "mapped", xrfContext.mainFunc);
+
+    builder.CreateCondBr(
+        builder.CreateICmpEQ(builder.CreatePtrToInt(memory, sizeType), llvm::ConstantInt::get(sizeType, -1)),
+        failedBlock,
+        mappedBlock
+    );
+
+    builder.SetInsertPoint(failedBlock);
+    builder.CreateRet(llvm::ConstantInt::get(intType, 1));
+
+    builder.SetInsertPoint(mappedBlock);
+
+    // Code after the start block is generated with this as the entry point
+    xrfContext.startBlock = mappedBlock;
+
+    return builder.CreateBitCast(memory, llvm::PointerType::getUnqual(intType));
+}
+
+/**
+ * Gets the context for generating LLVM code from XRF. This sets up a number of
+ * useful things for the code generation, including all of the variables the
+ * XRF program will use.
+ *
+ * @param module
+ *     The LLVM module that all of the generated code will be in
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param options
+ *     The options controlling how the code is generated
+ * @param numChunks
+ *     The number of chunks in the program
+ * @param split
+ *     Whether the code is split into modules by generateSplitModule()
+ * @param splitPartition
+ *     With split code, the partition that the module has the function of, or
+ *     std::nullopt for the main module
+ *
+ * @return
+ *     An XRFContext with helpful fields for generating LLVM code from XRF
+ */
+XrfContext getGenerationContext(llvm::Module &module, llvm::LLVMContext &context, const CodegenOptions &options,
+                                size_t numChunks, bool split = false, std::optional<size_t> splitPartition = std::nullopt)
+{
+    XrfContext xrfContext;
+
+    xrfContext.module = &module;
+
+    xrfContext.split = split;
+
+    xrfContext.splitPartition = splitPartition;
+
+    xrfContext.registerState = options.registerState;
+
+    xrfContext.dispatchMode = options.dispatchMode;
+
+    xrfContext.stackMask = options.stackSize - 1;
+
+    xrfContext.getcharFunc = module.getOrInsertFunction(
+        "getchar", llvm::IntegerType::getInt32Ty(context));
+
+    xrfContext.putcharFunc = module.getOrInsertFunction(
+        "putchar", llvm::IntegerType::getInt32Ty(context), llvm::IntegerType::getInt32Ty(context));
+
+    // Library code does all of its I/O through the callbacks in the context,
+    // which are called with the I/O buffers
+    xrfContext.ioMode = options.library ? IoMode::Buffered : options.ioMode;
+
+    xrfContext.instrument = options.instrument;
+
+    xrfContext.profileFile = options.profileFile;
+
+    xrfContext.profile = options.profile;
+
+    xrfContext.jumpTargets = options.jumpTargets;
+
+    xrfContext.checked = options.checked;
+
+    xrfContext.seed = options.seed;
+
+    xrfContext.partitionSize = options.partitionSize;
+
+    if (options.library) {
+        createLibraryContext(module, context, xrfContext, options, numChunks);
+    }
+
+    xrfContext.mainFunc = llvm::Function::Create(
+        getStateFunctionType(xrfContext, llvm::IntegerType::getInt32Ty(context)),
+        llvm::Function::ExternalLinkage, options.library ? "xrf_run" : "main", &module
+    );
+
+    xrfContext.startBlock = llvm::BasicBlock::Create(context, "start", xrfContext.mainFunc);
+
+    auto indexType = llvm::IntegerType::getInt64Ty(context);
+
+    auto elementType = llvm::IntegerType::getInt32Ty(context);
+
+    llvm::IRBuilder builder(xrfContext.startBlock);
+
+    if (!xrfContext.registerState) {
+        xrfContext.stackTop = builder.CreateAlloca(indexType, nullptr, "top");
+
+        xrfContext.stackBottom = builder.CreateAlloca(indexType, nullptr, "bottom");
+
+        xrfContext.topValue = builder.CreateAlloca(elementType, nullptr, "top_value");
+    }
+
+    if (xrfContext.ioMode == IoMode::Buffered) {
+        createBufferedIo(module, context, xrfContext, builder);
+    }
+
+    auto visitedFlagsType = llvm::ArrayType::get(llvm::IntegerType::getInt64Ty(context), (numChunks + 63) / 64);
+
+    xrfContext.visitedFlags = createStateVariable(
+        module, xrfContext, builder, ContextField::Visited, llvm::ConstantAggregateZero::get(visitedFlagsType), "visited"
+    );
+
+    // Library code always keeps the stack in the context
+    if (options.stackStorage == StackStorage::Mmap && !options.library) {
+        xrfContext.stack = emitMapStack(module, context, xrfContext, builder, options.stackSize);
+    }
+    else {
+        auto stackType = llvm::ArrayType::get(llvm::IntegerType::getInt32Ty(context), options.stackSize);
+
+        auto stack = createStateVariable(
+            module, xrfContext, builder, ContextField::Stack, llvm::UndefValue::get(stackType), "stack"
+        );
+
+        xrfContext.stack = builder.CreateConstInBoundsGEP2_64(stackType, emitStatePtr(xrfContext, builder, stack), 0, 0);
+    }
+
+    emitStoreStackTop(xrfContext, builder, llvm::ConstantInt::get(indexType, 0));
+
+    emitStoreStackBottom(xrfContext, builder, llvm::ConstantInt::get(indexType, xrfContext.stackMask));
+
+    emitStoreTopValue(xrfContext, builder, llvm::ConstantInt::get(elementType, 0));
+
+    return xrfContext;
+}
+
+/**
+ * Creates the branch weights metadata for a branch from how many times each
+ * of its destinations was taken in a profile. The counts are scaled down to
+ * fit in the 32-bit weights LLVM uses.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param counts
+ *     How many times each destination was taken, in the order of the branch's
+ *     destinations
+ *
+ * @return
+ *     The branch weights, or nullptr if none of the destinations were taken
+ */
+llvm::MDNode *createBranchWeights(llvm::LLVMContext &context, const std::vector<uint64_t> &counts) {
+    auto maxCount = counts.empty() ? 0 : *std::max_element(counts.begin(), counts.end());
+
+    if (maxCount == 0) {
+        return nullptr;
+    }
+
+    auto scale = maxCount / UINT32_MAX + 1;
+
+    std::vector<uint32_t> weights;
+
+    for (auto count: counts) {
+        weights.push_back(static_cast<uint32_t>(count / scale));
+    }
+
+    return llvm::MDBuilder(context).createBranchWeights(weights);
+}
+
+/**
+ * Creates the branch weights for a check of whether a chunk has been visited,
+ * from the profile.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param chunkIdx
+ *     The index of the chunk being checked
+ *
+ * @return
+ *     The weights of the visited and first visit destinations, or nullptr if
+ *     there is no profile
+ */
+llvm::MDNode *createVisitWeights(llvm::LLVMContext &context, XrfContext &xrfContext, size_t chunkIdx) {
+    if (!xrfContext.profile || chunkIdx >= xrfContext.profile->counts.size()) {
+        return nullptr;
+    }
+
+    auto checks = xrfContext.profile->get(chunkIdx, ProfileCounter::VisitChecks);
+    auto hits = std::min(checks, xrfContext.profile->get(chunkIdx, ProfileCounter::VisitedHits));
+
+    return createBranchWeights(context, {hits, checks - hits});
+}
+
+/**
+ * Returns whether code is generated for a chunk, which is every chunk unless
+ * the jump targets have been worked out, and then only the chunks that can be
+ * run.
+ *
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param chunkIdx
+ *     The index of the chunk
+ *
+ * @return
+ *     Whether the chunk can be run
+ */
+bool isReachable(const XrfContext &xrfContext, size_t chunkIdx) {
+    return !xrfContext.jumpTargets || xrfContext.jumpTargets->reachable[chunkIdx];
+}
+
+/**
+ * Returns whether a jump chosen at runtime can go to a chunk, which is true
+ * of every chunk unless the jump targets have been worked out.
+ *
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param chunkIdx
+ *     The index of the chunk
+ *
+ * @return
+ *     Whether the chunk can be jumped to at runtime
+ */
+bool isDynamicTarget(const XrfContext &xrfContext, size_t chunkIdx) {
+    return !xrfContext.jumpTargets || xrfContext.jumpTargets->dynamicTargets[chunkIdx];
+}
+
+/**
+ * Creates the block that checked code jumps to when a check fails, which
+ * writes out the output so far, reports the error along with the line and
+ * column of the chunk it happened in, and exits with a status of 1. Library
+ * code only returns the status, since all of its I/O goes through the
+ * callbacks in the context.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param chunks
+ *     The XRF chunks that the code is generated from
+ */
+void createCheckFailed(llvm::LLVMContext &context, XrfContext &xrfContext, const std::vector<Chunk> &chunks) {
+    auto int32Type = llvm::IntegerType::getInt32Ty(context);
+    auto int64Type = llvm::IntegerType::getInt64Ty(context);
+    auto charPtrType = llvm::PointerType::getUnqual(llvm::IntegerType::getInt8Ty(context));
+
+    xrfContext.checkFailed = llvm::BasicBlock::Create(context, "check-failed", xrfContext.mainFunc);
+
+    llvm::IRBuilder builder(xrfContext.checkFailed);
+
+    xrfContext.failureKind = builder.CreatePHI(int32Type, 1, "failure_kind");
+    xrfContext.failureChunk = builder.CreatePHI(int32Type, 1, "failure_chunk");
+    xrfContext.failureValue = builder.CreatePHI(int64Type, 1, "failure_value");
+
+    emitFlushOutput(xrfContext, builder);
+
+    if (!xrfContext.libraryContext) {
+        // The lines and columns are only needed once a check fails, so they're
+        // looked up from tables rather than passed along with every check
+        auto tableType = llvm::ArrayType::get(int32Type, chunks.size());
+
+        std::vector<llvm::Constant*> lines, cols;
+
+        for (const auto &chunk: chunks) {
+            lines.push_back(llvm::ConstantInt::get(int32Type, chunk.line));
+            cols.push_back(llvm::ConstantInt::get(int32Type, chunk.col));
+        }
+
+        auto lineTable = createGlobal(
+            *xrfContext.module, tableType, true, llvm::ConstantArray::get(tableType, lines), "chunk_lines"
+        );
+
+        auto colTable = createGlobal(
+            *xrfContext.module, tableType, true, llvm::ConstantArray::get(tableType, cols), "chunk_cols"
+        );
+
+        auto dprintfFunc = xrfContext.module->getOrInsertFunction(
+            "dprintf", llvm::FunctionType::get(int32Type, {int32Type, charPtrType}, true)
+        );
+
+        auto chunkIdx = builder.CreateZExt(xrfContext.failureChunk, int64Type);
+
+        auto line = builder.CreateLoad(int32Type, builder.CreateInBoundsGEP(
+            tableType, lineTable, {llvm::ConstantInt::get(int64Type, 0), chunkIdx}
+        ));
+
+        auto col = builder.CreateLoad(int32Type, builder.CreateInBoundsGEP(
+            tableType, colTable, {llvm::ConstantInt::get(int64Type, 0), chunkIdx}
+        ));
+
+        auto underflowMessage = builder.CreateGlobalStringPtr(
+            "Error on line %u, column %u: chunk %u pops a value off of an empty stack\n"
+        );
+
+        auto overflowMessage = builder.CreateGlobalStringPtr(
+            "Error on line %u, column %u: chunk %u pushes more values than the stack can hold\n"
+        );
+
+        auto jumpMessage = builder.CreateGlobalStringPtr(
+            "Error on line %u, column %u: chunk %u jumps to chunk %" PRIu64 ", which doesn't exist\n"
+        );
+
+        // For the stack depth check, the value is the number of values on the
+        // stack minus the number the chunk needs, which is only negative if the
+        // chunk would pop a value off of an empty stack
+        auto depthMessage = builder.CreateSelect(
+            builder.CreateICmpSLT(xrfContext.failureValue, llvm::ConstantInt::get(int64Type, 0)),
+            underflowMessage,
+            overflowMessage
+        );
+
+        auto message = builder.CreateSelect(
+            builder.CreateICmpEQ(xrfContext.failureKind, llvm::ConstantInt::get(int32Type, static_cast<int>(CheckFailure::BadJump))),
+            jumpMessage,
+            depthMessage
+        );
+
+        builder.CreateCall(dprintfFunc, {
+            llvm::ConstantInt::get(int32Type, 2), message, line, col, xrfContext.failureChunk, xrfContext.failureValue
+        });
+    }
+
+    emitDumpProfile(xrfContext, builder);
+
+    builder.CreateRet(llvm::ConstantInt::get(int32Type, 1));
+}
+
+/**
+ * Creates the block that jumps to chunks that don't exist go to, when they
+ * aren't checked. Library code writes out the output so far and returns a
+ * status of 1 from it, so that a program that's wrong can't take down the
+ * program it's running in. Otherwise, the block is never reached unless the
+ * program is wrong.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param func
+ *     The function to add the block to
+ *
+ * @return
+ *     The block for jumps to chunks that don't exist
+ */
+llvm::BasicBlock *createNoChunk(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::Function *func) {
+    auto block = llvm::BasicBlock::Create(context, "stack-error", func);
+
+    llvm::IRBuilder builder(block);
+
+    if (!xrfContext.libraryContext) {
+        builder.CreateUnreachable();
+        return block;
+    }
+
+    emitFlushOutput(xrfContext, builder);
+
+    builder.CreateRet(llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), 1));
+
+    return block;
+}
+
+/**
+ * Passes the details of a failed check to the check failed block, for when a
+ * block can branch to it.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param from
+ *     The block that branches to the check failed block
+ * @param kind
+ *     The kind of check that failed
+ * @param chunkIdx
+ *     The index of the chunk that the check failed in, as a 32-bit integer
+ * @param value
+ *     The value to report, as a 64-bit integer, which is the number of values
+ *     on the stack minus the number the chunk needs for a stack depth check,
+ *     and the chunk being jumped to for a bad jump
+ */
+void addCheckFailure(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::BasicBlock *from, CheckFailure kind,
+                     llvm::Value *chunkIdx, llvm::Value *value)
+{
+    xrfContext.failureKind->addIncoming(
+        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), static_cast<int>(kind)), from
+    );
+    xrfContext.failureChunk->addIncoming(chunkIdx, from);
+    xrfContext.failureValue->addIncoming(value, from);
+}
+
+/**
+ * Works out how many values on the stack a command that computes a value
+ * reads from, counting the top value of the stack.
+ *
+ * @param command
+ *     The command that computes a value
+ *
+ * @return
+ *     The number of values the command needs on the stack
+ */
+int64_t computedDepth(const Command &command) {
+    if (command.multiple == 0) {
+        return 0;
+    }
+
+    auto deepest = command.addedMultiple != 0 ? std::max(command.slot, command.addedSlot) : command.slot;
+
+    return static_cast<int64_t>(deepest) + 1;
+}
+
+/**
+ * Works out how far a list of commands can take the stack below and above
+ * the number of values it starts with. Commands that can be skipped by an
+ * Ignore command are counted both ways, and the fused commands from the
+ * optimizer count as the commands they replace.
+ *
+ * @param commands
+ *     The commands to work out the bounds of
+ * @param bounds
+ *     The bounds to widen to cover the commands
+ */
+void addStackBounds(const std::vector<Command> &commands, StackBounds &bounds) {
+    // The lowest and highest number of values the stack can have before
+    // each command, compared to the start of the commands
+    int64_t low = 0, high = 0;
+
+    // The range of depths from before a command that can be skipped
+    std::optional<std::pair<int64_t, int64_t>> skipped;
+
+    // How many values, counting the top value, have to be on the stack for a
+    // command, and how many values the command adds overall
+    auto addCommand = [&](int64_t needed, int64_t change) {
+        bounds.below = std::max(bounds.below, needed - 1 - low);
+
+        low += change;
+        high += change;
+
+        bounds.above = std::max(bounds.above, high);
+
+        if (skipped) {
+            low = std::min(low, skipped->first);
+            high = std::max(high, skipped->second);
+            skipped.reset();
+        }
+    };
+
+    for (size_t i = 0; i < commands.size(); i++) {
+        const auto &command = commands[i];
+
+        switch (command.type) {
+            case CommandType::Input:
+            case CommandType::TranslateInput:
+                addCommand(0, 1);
+                break;
+
+            case CommandType::Dup:
+            case CommandType::PushSecondValue:
+                addCommand(1, 1);
+                break;
+
+            case CommandType::Output:
+            case CommandType::Pop:
+                addCommand(1, -1);
+                break;
+
+            case CommandType::Add:
+            case CommandType::Sub:
+            case CommandType::PopSecondValue:
+                addCommand(2, -1);
+                break;
+
+            case CommandType::Bottom:
+            case CommandType::Inc:
+            case CommandType::Dec:
+            case CommandType::SetTop:
+                addCommand(1, 0);
+                break;
+
+            case CommandType::Swap:
+            case CommandType::AddToSecond:
+            case CommandType::MultiplySecond:
+            case CommandType::SetSecondValue:
+                addCommand(2, 0);
+                break;
+
+            case CommandType::PushValueToBottom:
+                addCommand(computedDepth(command), 1);
+                break;
+
+            case CommandType::OutputValue:
+                addCommand(computedDepth(command), 0);
+                break;
+
+            case CommandType::BeginShuffle: {
+                int64_t needed = command.slot;
+
+                for (int j = 1; j <= command.val; j++) {
+                    needed = std::max(needed, computedDepth(commands[i + j]));
+                }
+
+                addCommand(needed, command.val - static_cast<int64_t>(command.slot));
+
+                i += command.val;
+                break;
+            }
+
+            case CommandType::IgnoreFirst:
+            case CommandType::IgnoreVisited:
+                if (i + 1 < commands.size()) {
+                    skipped = {low, high};
+                }
+                break;
+
+            // A jump or exit that can be skipped only stops one way through
+            case CommandType::Jump:
+            case CommandType::Exit: {
+                auto ifSkipped = skipped;
+                skipped.reset();
+
+                if (command.type == CommandType::Jump) {
+                    addCommand(1, 0);
+                }
+
+                if (!ifSkipped) {
+                    return;
+                }
+
+                low = ifSkipped->first;
+                high = ifSkipped->second;
+                break;
+            }
+
+            default:
+                addCommand(0, 0);
+                break;
+        }
+    }
+
+    // The top value of the stack is the chunk that's jumped to next
+    addCommand(1, 0);
+}
+
+/**
+ * Emits LLVM code that checks, all at once, that a chunk won't pop a value
+ * off of an empty stack or push more values than the stack can hold, from
+ * how far the chunk can take the stack. The builder is left in the block
+ * where the chunk carries on once the check passes.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param bounds
+ *     How far the chunk can take the stack
+ */
+void emitDepthCheck(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+                    const StackBounds &bounds)
+{
+    if (bounds.below == 0 && bounds.above == 0) {
+        return;
+    }
+
+    auto int64Type = llvm::IntegerType::getInt64Ty(context);
+
+    // The number of values below the top value of the stack
+    auto depth = builder.CreateAnd(
+        builder.CreateSub(
+            builder.CreateSub(emitLoadStackTop(context, xrfContext, builder), emitLoadStackBottom(context, xrfContext, builder)),
+            llvm::ConstantInt::get(int64Type, 1)
+        ),
+        xrfContext.stackMask
+    );
+
+    auto spare = builder.CreateSub(depth, llvm::ConstantInt::get(int64Type, bounds.below));
+
+    // One unsigned comparison checks both that there are enough values and
+    // that there's enough room, since too few values wrap around to a large
+    // number
+    auto limit = static_cast<int64_t>(xrfContext.stackMask) - bounds.above - bounds.below;
+
+    llvm::Value *passed = llvm::ConstantInt::getFalse(context);
+
+    if (limit >= 0) {
+        passed = builder.CreateICmpULE(spare, llvm::ConstantInt::get(int64Type, limit));
+    }
+
+    auto continueBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+
+    addCheckFailure(context, xrfContext, builder.GetInsertBlock(), CheckFailure::StackDepth,
+                    llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), xrfContext.currentChunk), spare);
+
+    builder.CreateCondBr(passed, continueBlock, xrfContext.checkFailed,
+                         llvm::MDBuilder(context).createBranchWeights(UINT32_MAX, 1));
+
+    builder.SetInsertPoint(continueBlock);
+}
+
+/**
+ * Creates a block that jumps to the next chunk to execute, as determined by
+ * the top value of the stack. This block is jumped to at the end of each
+ * chunk, unless the jump to this block is optimized away by determining
+ * statically which chunk will be jumped to next from a given chunk. With
+ * partitioned code, chunks that don't have a block in the current function
+ * are jumped to through the dispatch function instead.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param chunks
+ *     The list of all of the LLVM blocks for the chunks
+ * @param targets
+ *     The chunks that the switch can branch to, in the order they're added
+ *     to it, which are skipped if they can't be jumped to at runtime
+ *
+ * @return
+ *     The block that contains the jump based on the stack top
+ */
+llvm::BasicBlock *createStackJump(llvm::LLVMContext &context, XrfContext &xrfContext,
+                                  const std::vector<llvm::BasicBlock*> &chunks, const std::vector<size_t> &targets)
+{
+    auto stackJump = createJumpTarget(context, xrfContext, "stack-jump");
+
+    llvm::IRBuilder builder(stackJump);
+
+    // Checked code reports jumps to chunks that don't exist from the switch's
+    // default destination, which needs to know which chunk jumped
+    if (xrfContext.checked) {
+        xrfContext.jumpFrom = builder.CreatePHI(llvm::IntegerType::getInt32Ty(context), chunks.size(), "jump_from");
+    }
+
+    enterJumpTarget(xrfContext, stackJump);
+
+    auto topValue = emitLoadTopValue(context, xrfContext, builder);
+
+    emitCountJumpTo(context, xrfContext, builder, topValue, chunks.size());
+
+    llvm::BasicBlock *errorBlock;
+
+    if (xrfContext.checked) {
+        errorBlock = xrfContext.checkFailed;
+
+        addCheckFailure(context, xrfContext, stackJump, CheckFailure::BadJump, xrfContext.jumpFrom,
+                        builder.CreateZExt(topValue, llvm::IntegerType::getInt64Ty(context)));
+    }
+    else if (xrfContext.dispatchFunc) {
+        errorBlock = llvm::BasicBlock::Create(context, "leave", xrfContext.mainFunc);
+
+        llvm::IRBuilder leaveBuilder(errorBlock);
+
+        emitPartitionJump(xrfContext, leaveBuilder, xrfContext.dispatchFunc, topValue);
+    }
+    else {
+        errorBlock = createNoChunk(context, xrfContext, xrfContext.mainFunc);
+    }
+
+    auto switchInst = builder.CreateSwitch(topValue, errorBlock, targets.size());
+
+    auto profile = xrfContext.profile;
+    bool weighted = profile && profile->counts.size() == chunks.size();
+
+    // Jumps to chunks that don't exist aren't in the profile, so the default
+    // destination never gets any weight
+    std::vector<uint64_t> counts = {0};
+
+    for (auto i: targets) {
+        if (!isDynamicTarget(xrfContext, i) || !chunks[i]) {
+            continue;
+        }
+
+        switchInst->addCase(
+            llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), i),
+            chunks[i]
+        );
+
+        addJumpSource(xrfContext, stackJump, chunks[i]);
+
+        if (weighted) {
+            counts.push_back(profile->get(i, ProfileCounter::JumpsTo));
+        }
+    }
+
+    if (weighted) {
+        if (auto weights = createBranchWeights(context, counts); weights) {
+            switchInst->setMetadata(llvm::LLVMContext::MD_prof, weights);
+        }
+    }
+
+    return stackJump;
+}
+
+/**
+ * Creates the table of chunk block addresses used for threaded dispatch,
+ * along with the block that exits the program when the bounds check on a jump
+ * through the table fails.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param chunks
+ *     The list of all of the LLVM blocks for the chunks
+ */
+void createJumpTable(llvm::LLVMContext &context, XrfContext &xrfContext, const std::vector<llvm::BasicBlock*> &chunks) {
+    auto addressType = llvm::PointerType::getUnqual(llvm::IntegerType::getInt8Ty(context));
+
+    auto tableType = llvm::ArrayType::get(addressType, chunks.size());
+
+    if (xrfContext.dispatchMode == DispatchMode::Threaded) {
+        xrfContext.stackError = llvm::BasicBlock::Create(context, "stack-error", xrfContext.mainFunc);
+
+        llvm::IRBuilder builder(xrfContext.stackError);
+
+        emitFlushOutput(xrfContext, builder);
+
+        emitDumpProfile(xrfContext, builder);
+
+        builder.CreateRet(llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), 1));
+    }
+
+    std::vector<llvm::Constant*> addresses;
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (isDynamicTarget(xrfContext, i)) {
+            addresses.push_back(llvm::BlockAddress::get(xrfContext.mainFunc, chunks[i]));
+            continue;
+        }
+
+        // The chunks that can't be jumped to at runtime still need an entry
+        // in the table, which exits if it's checked, and is never reached
+        // otherwise
+        if (!xrfContext.noTarget) {
+            if (xrfContext.dispatchMode == DispatchMode::Threaded) {
+                xrfContext.noTarget = xrfContext.stackError;
+            }
+            else {
+                xrfContext.noTarget = llvm::BasicBlock::Create(context, "no-target", xrfContext.mainFunc);
+
+                llvm::IRBuilder builder(xrfContext.noTarget);
+
+                builder.CreateUnreachable();
+            }
+        }
+
+        addresses.push_back(llvm::BlockAddress::get(xrfContext.mainFunc, xrfContext.noTarget));
+    }
+
+    xrfContext.jumpTable = createGlobal(
+        *xrfContext.module, tableType, true, llvm::ConstantArray::get(tableType, addresses), "jump_table"
+    );
+}
+
+/**
+ * Emits LLVM code to jump to the chunk given by the top value of the stack.
+ * With switch dispatch this branches to the shared stack jump block, and
+ * otherwise it emits an indirect branch through the jump table, so that each
+ * chunk gets its own indirect branch.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param chunks
+ *     The list of all of the LLVM blocks for the chunks
+ * @param stackJump
+ *     The block that jumps to the next chunk with switch dispatch
+ */
+void emitStackJump(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+                   const std::vector<llvm::BasicBlock*> &chunks, llvm::BasicBlock *stackJump)
+{
+    if (xrfContext.dispatchMode == DispatchMode::Switch) {
+        emitJump(xrfContext, builder, stackJump);
+        return;
+    }
+
+    auto topValue = emitLoadTopValue(context, xrfContext, builder);
+
+    emitCountJumpTo(context, xrfContext, builder, topValue, chunks.size());
+
+    if (xrfContext.dispatchMode == DispatchMode::Threaded) {
+        auto dispatchBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+
+        auto errorBlock = xrfContext.stackError;
+
+        if (xrfContext.checked) {
+            errorBlock = xrfContext.checkFailed;
+
+            addCheckFailure(context, xrfContext, builder.GetInsertBlock(), CheckFailure::BadJump,
+                            llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), xrfContext.currentChunk),
+                            builder.CreateZExt(topValue, llvm::IntegerType::getInt64Ty(context)));
+        }
+
+        builder.CreateCondBr(
+            builder.CreateICmpULT(topValue, llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), chunks.size())),
+            dispatchBlock,
+            errorBlock
+        );
+
+        builder.SetInsertPoint(dispatchBlock);
+    }
+
+    auto entryPtr = builder.CreateInBoundsGEP(
+        xrfContext.jumpTable->getValueType(),
+        xrfContext.jumpTable,
+        {
+            llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), 0),
+            builder.CreateZExt(topValue, llvm::IntegerType::getInt64Ty(context))
+        }
+    );
+
+    auto address = builder.CreateLoad(llvm::PointerType::getUnqual(llvm::IntegerType::getInt8Ty(context)), entryPtr);
+
+    auto branch = builder.CreateIndirectBr(address, chunks.size());
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (isDynamicTarget(xrfContext, i)) {
+            branch->addDestination(chunks[i]);
+
+            addJumpSource(xrfContext, builder.GetInsertBlock(), chunks[i]);
+        }
+    }
+
+    // The stack state isn't passed on to the block for chunks that can't be
+    // jumped to, since that block never carries on to another chunk
+    if (xrfContext.noTarget) {
+        branch->addDestination(xrfContext.noTarget);
+    }
+}
+
+/**
+ * Returns the chunks that the jumps chosen at runtime at the end of a chunk
+ * can go to, if there are few enough of them for the chunk to branch to them
+ * itself. Instrumented code always goes through the shared jump, which is
+ * where jumps are counted.
+ *
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param chunkIdx
+ *     The index of the chunk
+ *
+ * @return
+ *     The chunks the chunk can jump to, or std::nullopt if it should use the
+ *     shared jump
+ */
+std::optional<ChunkRange> getLocalTargets(const XrfContext &xrfContext, size_t chunkIdx) {
+    if (!xrfContext.jumpTargets || xrfContext.instrument) {
+        return std::nullopt;
+    }
+
+    const auto &successors = xrfContext.jumpTargets->successors[chunkIdx];
+
+    if (!successors || successors->last - successors->first >= MAX_LOCAL_TARGETS) {
+        return std::nullopt;
+    }
+
+    return successors;
+}
+
+/**
+ * Emits LLVM code to jump to the chunk given by the top value of the stack,
+ * when it can only be one of a few chunks. The chunk gets a small switch of
+ * its own over just those chunks, which predicts much better than the jump
+ * shared by every chunk, and any other value falls back to the shared jump.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param chunks
+ *     The list of all of the LLVM blocks for the chunks
+ * @param stackJump
+ *     The block that jumps to the next chunk with switch dispatch
+ * @param targets
+ *     The chunks that the top value of the stack can be
+ */
+void emitLocalJump(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+                   const std::vector<llvm::BasicBlock*> &chunks, llvm::BasicBlock *stackJump,
+                   const ChunkRange &targets)
+{
+    auto topValue = emitLoadTopValue(context, xrfContext, builder);
+
+    auto fromBlock = builder.GetInsertBlock();
+
+    llvm::BasicBlock *fallback = stackJump;
+
+    if (xrfContext.dispatchMode == DispatchMode::Switch) {
+        addJumpSource(xrfContext, fromBlock, stackJump);
+    }
+    else {
+        fallback = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+    }
+
+    auto switchInst = builder.CreateSwitch(topValue, fallback, targets.last - targets.first + 1);
+
+    for (auto i = targets.first; i <= targets.last; i++) {
+        if (!chunks[i]) {
+            continue;
+        }
+
+        switchInst->addCase(llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), i), chunks[i]);
+
+        addJumpSource(xrfContext, fromBlock, chunks[i]);
+    }
+
+    if (fallback != stackJump) {
+        builder.SetInsertPoint(fallback);
+
+        emitStackJump(context, xrfContext, builder, chunks, stackJump);
+    }
+}
+
+/**
+ * Emits LLVM code to add a constant value to the top value of the stack.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param toAdd
+ *     The amount to add to the top of stack
+ */
+void emitAddConstant(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, int toAdd) {
+    auto topValue = emitLoadTopValue(context, xrfContext, builder);
+
+    auto newTopValue = builder.CreateAdd(
+        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), toAdd),
+        topValue
+    );
+
+    emitStoreTopValue(xrfContext, builder, newTopValue);
+}
+
+/**
+ * Emits LLVM code to push a value to the bottom of the stack.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param value
+ *     The LLVM value to push to the bottom of the stack
+ */
+void emitBottom(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, llvm::Value *value) {
+    auto stackBottom = emitLoadStackBottom(context, xrfContext, builder);
+
+    auto stackPtr = emitStackPtr(context, xrfContext, builder, stackBottom);
+
+    builder.CreateStore(value, stackPtr);
+
+    auto bottomMinusOne = builder.CreateSub(
+        stackBottom,
+        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), 1)
+    );
+
+    auto bottomWrapped = builder.CreateAnd(bottomMinusOne, xrfContext.stackMask);
+
+    emitStoreStackBottom(xrfContext, builder, bottomWrapped);
+}
+
+/**
+ * Emits LLVM code to load the second value of the stack.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ *
+ * @return
+ *     A pointer to the second value of the stack
+ */
+llvm::Value *emitGet2ndValue(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    auto topIndex = emitLoadStackTop(context, xrfContext, builder);
+
+    auto topMinusOne = builder.CreateSub(
+        topIndex,
+        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), 1)
+    );
+
+    auto secondWrapped = builder.CreateAnd(topMinusOne, xrfContext.stackMask);
+
+    return emitStackPtr(context, xrfContext, builder, secondWrapped);
+}
+
+/**
+ * Emits LLVM code to pop the top value of the stack.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ */
+void emitPop(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    auto stackTop = emitLoadStackTop(context, xrfContext, builder);
+
+    auto topMinusOne = builder.CreateSub(
+        stackTop,
+        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), 1)
+    );
+
+    auto topWrapped = builder.CreateAnd(topMinusOne, xrfContext.stackMask);
+
+    auto stackPtr = emitStackPtr(context, xrfContext, builder, topWrapped);
+
+    auto newTopValue = builder.CreateLoad(
+        llvm::IntegerType::getInt32Ty(context),
+        stackPtr
+    );
+
+    emitStoreTopValue(xrfContext, builder, newTopValue);
+
+    emitStoreStackTop(xrfContext, builder, topWrapped);
+}
+
+/**
+ * Emits LLVM code to push a value to the stack.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param value
+ *     The value to push to the stack
+ */
+void emitPush(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, llvm::Value *value) {
+    auto topValue = emitLoadTopValue(context, xrfContext, builder);
+
+    auto stackTop = emitLoadStackTop(context, xrfContext, builder);
+
+    auto stackPointer = emitStackPtr(context, xrfContext, builder, stackTop);
+
+    builder.CreateStore(topValue, stackPointer);
+
+    emitStoreTopValue(xrfContext, builder, value);
+
+    auto topPlusOne = builder.CreateAdd(
+        stackTop,
+        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), 1)
+    );
+
+    auto topWrapped = builder.CreateAnd(topPlusOne, xrfContext.stackMask);
+
+    emitStoreStackTop(xrfContext, builder, topWrapped);
+}
+
+/**
+ * Emits LLVM code to load a value from a slot near the top of the stack.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param stackTop
+ *     The index of the top of the stack
+ * @param slot
+ *     The slot to load, where 0 is the top value of the stack, 1 is the value
+ *     below it, and so on
+ *
+ * @return
+ *     The value in the slot
+ */
+llvm::Value *emitLoadSlot(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+                          llvm::Value *stackTop, unsigned slot)
+{
+    if (slot == 0) {
+        return emitLoadTopValue(context, xrfContext, builder);
+    }
+
+    auto slotIndex = builder.CreateSub(
+        stackTop,
+        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), slot)
+    );
+
+    auto slotWrapped = builder.CreateAnd(slotIndex, xrfContext.stackMask);
+
+    return builder.CreateLoad(
+        llvm::IntegerType::getInt32Ty(context),
+        emitStackPtr(context, xrfContext, builder, slotWrapped)
+    );
+}
+
+/**
+ * Emits LLVM code to compute the value used by a command that either uses a
+ * known value, or a value computed from one or two slots on the stack.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param stackTop
+ *     The index of the top of the stack
+ * @param command
+ *     The command to compute the value for
+ *
+ * @return
+ *     The computed value
+ */
+llvm::Value *emitComputedValue(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+                               llvm::Value *stackTop, const Command &command)
+{
+    auto int32Type = llvm::IntegerType::getInt32Ty(context);
+
+    if (command.multiple == 0) {
+        return llvm::ConstantInt::get(int32Type, command.val);
+    }
+
+    auto value = emitLoadSlot(context, xrfContext, builder, stackTop, command.slot);
+
+    if (command.multiple != 1) {
+        value = builder.CreateMul(value, llvm::ConstantInt::get(int32Type, command.multiple));
+    }
+
+    if (command.addedMultiple != 0) {
+        auto added = emitLoadSlot(context, xrfContext, builder, stackTop, command.addedSlot);
+
+        if (command.addedMultiple != 1) {
+            added = builder.CreateMul(added, llvm::ConstantInt::get(int32Type, command.addedMultiple));
+        }
+
+        value = builder.CreateAdd(value, added);
+    }
+
+    if (command.val != 0) {
+        value = builder.CreateAdd(value, llvm::ConstantInt::get(int32Type, command.val));
+    }
+
+    return value;
+}
+
+/**
+ * Emits LLVM code to check whether a chunk has been visited before.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param chunkIdx
+ *     The index of the chunk to check
+ *
+ * @return
+ *     An i1 value that is true if the chunk has been visited before
+ */
+llvm::Value *emitLoadVisited(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+                             size_t chunkIdx)
+{
+    auto wordType = llvm::IntegerType::getInt64Ty(context);
+
+    auto word = builder.CreateLoad(
+        wordType,
+        builder.CreateConstInBoundsGEP2_64(
+            xrfContext.visitedFlags.type, emitStatePtr(xrfContext, builder, xrfContext.visitedFlags), 0, chunkIdx / 64
+        )
+    );
+
+    auto bit = builder.CreateAnd(word, uint64_t(1) << (chunkIdx % 64));
+
+    return builder.CreateICmpNE(bit, llvm::ConstantInt::get(wordType, 0));
+}
+
+/**
+ * Emits LLVM code to check whether a chunk has been visited before, counting
+ * the check if the code is instrumented.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param chunkIdx
+ *     The index of the chunk to check
+ *
+ * @return
+ *     An i1 value that is true if the chunk has been visited before
+ */
+llvm::Value *emitCountedLoadVisited(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+                                    size_t chunkIdx)
+{
+    auto hasVisited = emitLoadVisited(context, xrfContext, builder, chunkIdx);
+
+    if (xrfContext.profileCounts) {
+        auto counterType = llvm::IntegerType::getInt64Ty(context);
+
+        emitCount(context, xrfContext, builder, ProfileCounter::VisitChecks, chunkIdx);
+
+        emitCount(context, xrfContext, builder, ProfileCounter::VisitedHits,
+                  llvm::ConstantInt::get(counterType, chunkIdx), builder.CreateZExt(hasVisited, counterType));
+    }
+
+    return hasVisited;
+}
+
+/**
+ * Emits LLVM code to mark a chunk as having been visited.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param chunkIdx
+ *     The index of the chunk that has been visited
+ */
+void emitSetVisited(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, size_t chunkIdx) {
+    auto wordPtr = builder.CreateConstInBoundsGEP2_64(
+        xrfContext.visitedFlags.type, emitStatePtr(xrfContext, builder, xrfContext.visitedFlags), 0, chunkIdx / 64);
+
+    auto word = builder.CreateLoad(llvm::IntegerType::getInt64Ty(context), wordPtr);
+
+    builder.CreateStore(builder.CreateOr(word, uint64_t(1) << (chunkIdx % 64)), wordPtr);
+}
+
+/**
+ * Generates LLVM code to add the top two values of the stack together.
+ * Generated from the "5" XRF command.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ */
+void generateAdd(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    auto oldTop = emitLoadTopValue(context, xrfContext, builder);
+
+    emitPop(context, xrfContext, builder);
+
+    auto newTop = emitLoadTopValue(context, xrfContext, builder);
+
+    auto sum = builder.CreateAdd(oldTop, newTop);
+
+    emitStoreTopValue(xrfContext, builder, sum);
+}
+
+/**
+ * Generates LLVM code which will add a constant to the second value in the
+ * stack.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param diff
+ *     The amount to add to the second value of the stack
+ */
+void generateAdd2nd(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, int diff) {
+    auto secondPtr = emitGet2ndValue(context, xrfContext, builder);
+
+    auto secondValue = builder.CreateLoad(
+        llvm::IntegerType::getInt32Ty(context),
+        secondPtr
+    );
+
+    auto secondAdded = builder.CreateAdd(
+        secondValue,
+        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), diff)
+    );
+
+    builder.CreateStore(secondAdded, secondPtr);
+}
+
+/**
+ * Generates LLVM code to send the top value of the stack to the bottom.
+ * Generated from the "9" XRF command.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ */
+void generateBottom(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    auto topValue = emitLoadTopValue(context, xrfContext, builder);
+
+    emitPop(context, xrfContext, builder);
+
+    emitBottom(context, xrfContext, builder, topValue);
+}
+
+/**
+ * Generates LLVM code to decrement the top value of the stack. Generated from
+ * the "6" XRF command.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ */
+void generateDec(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    emitAddConstant(context, xrfContext, builder, -1);
+}
+
+/**
+ * Generates LLVM code to duplicate the top value of the stack. Generated from
+ * the "3" XRF command.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ */
+void generateDup(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    auto topValue = emitLoadTopValue(context, xrfContext, builder);
+
+    emitPush(context, xrfContext, builder, topValue);
+}
+
+/**
+ * Generates LLVM code to increment the top value of the stack. Generated from
+ * the "5" XRF command.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ */
+void generateInc(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    emitAddConstant(context, xrfContext, builder, 1);
+}
+
+/**
+ * Emits LLVM code to read a byte from the input buffer, refilling the buffer
+ * if it's been used up. This ends the current block, and leaves the builder at
+ * the end of a new block that code generation continues in.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ *
+ * @return
+ *     The byte that was read, or -1 at the end of input, as with getchar()
+ */
+llvm::Value *emitBufferedInput(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    auto sizeType = llvm::IntegerType::getInt64Ty(context);
+
+    auto charType = llvm::IntegerType::getInt32Ty(context);
+
+    auto positionPtr = emitStatePtr(xrfContext, builder, xrfContext.inputPosition);
+
+    auto position = builder.CreateLoad(sizeType, positionPtr);
+    auto length = builder.CreateLoad(sizeType, emitStatePtr(xrfContext, builder, xrfContext.inputLength));
+
+    auto bufferedBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+    auto refillBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+    auto continueBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+
+    builder.CreateCondBr(builder.CreateICmpULT(position, length), bufferedBlock, refillBlock);
+
+    builder.SetInsertPoint(bufferedBlock);
+
+    auto bufferPtr = builder.CreateInBoundsGEP(
+        xrfContext.inputBuffer.type,
+        emitStatePtr(xrfContext, builder, xrfContext.inputBuffer),
+        {
+            llvm::ConstantInt::get(charType, 0),
+            position
+        }
+    );
+
+    auto bufferedChar = builder.CreateZExt(
+        builder.CreateLoad(llvm::IntegerType::getInt8Ty(context), bufferPtr),
+        charType
+    );
+
+    builder.CreateStore(builder.CreateAdd(position, llvm::ConstantInt::get(sizeType, 1)), positionPtr);
+    builder.CreateBr(continueBlock);
+
+    builder.SetInsertPoint(refillBlock);
+
+    auto refilledChar = emitStateCall(xrfContext, builder, xrfContext.refillInputFunc);
+
+    builder.CreateBr(continueBlock);
+
+    builder.SetInsertPoint(continueBlock);
+
+    auto inputChar = builder.CreatePHI(charType, 2);
+    inputChar->addIncoming(bufferedChar, bufferedBlock);
+    inputChar->addIncoming(refilledChar, refillBlock);
+
+    return inputChar;
+}
+
+/**
+ * Emits LLVM code to read a byte of input, which is read as 0 at the end of
+ * the input.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ *
+ * @return
+ *     The byte that was read
+ */
+llvm::Value *emitInput(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    auto inputChar = xrfContext.ioMode == IoMode::Buffered
+                   ? emitBufferedInput(context, xrfContext, builder)
+                   : builder.CreateCall(xrfContext.getcharFunc);
+
+    auto isEof = builder.CreateICmpEQ(
+        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), -1),
+        inputChar
+    );
+
+    return builder.CreateSelect(
+        isEof,
+        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), 0),
+        inputChar
+    );
+}
+
+/**
+ * Generates LLVM code to push a byte of input onto the stack. Generated from
+ * the "0" XRF command.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ */
+void generateInput(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    emitPush(context, xrfContext, builder, emitInput(context, xrfContext, builder));
+}
+
+/**
+ * Generates LLVM code to multiply the second value in the stack by a constant
+ * value.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param mul
+ *     The amount to multiply the 2nd value by
+ */
+void generateMultiply2nd(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, int mul) {
+    auto secondPtr = emitGet2ndValue(context, xrfContext, builder);
+
+    auto secondValue = builder.CreateLoad(
+        llvm::IntegerType::getInt32Ty(context),
+        secondPtr
+    );
+
+    auto secondMultiplied = builder.CreateMul(
+        secondValue,
+        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), mul)
+    );
+
+    builder.CreateStore(secondMultiplied, secondPtr);
+}
+
+/**
+ * Emits LLVM code to append a character to the output buffer, writing out the
+ * buffer if it's full afterwards. This ends the current block, and leaves the
+ * builder at the end of a new block that code generation continues in.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param value
+ *     The value to output as a character
+ */
+void emitBufferedOutput(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+                        llvm::Value *value)
+{
+    auto sizeType = llvm::IntegerType::getInt64Ty(context);
+
+    auto lengthPtr = emitStatePtr(xrfContext, builder, xrfContext.outputLength);
+
+    auto length = builder.CreateLoad(sizeType, lengthPtr);
+
+    auto bufferPtr = builder.CreateInBoundsGEP(
+        xrfContext.outputBuffer.type,
+        emitStatePtr(xrfContext, builder, xrfContext.outputBuffer),
+        {
+            llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), 0),
+            length
+        }
+    );
+
+    builder.CreateStore(builder.CreateTrunc(value, llvm::IntegerType::getInt8Ty(context)), bufferPtr);
+
+    auto newLength = builder.CreateAdd(length, llvm::ConstantInt::get(sizeType, 1));
+
+    builder.CreateStore(newLength, lengthPtr);
+
+    auto flushBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+    auto continueBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+
+    builder.CreateCondBr(
+        builder.CreateICmpEQ(newLength, llvm::ConstantInt::get(sizeType, OUTPUT_BUFFER_SIZE)),
+        flushBlock,
+        continueBlock
+    );
+
+    builder.SetInsertPoint(flushBlock);
+    emitStateCall(xrfContext, builder, xrfContext.flushOutputFunc);
+    builder.CreateBr(continueBlock);
+
+    builder.SetInsertPoint(continueBlock);
+}
+
+/**
+ * Emits LLVM code to output a value as a character, either through the output
+ * buffer or by calling putchar().
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param value
+ *     The value to output as a character
+ */
+void emitOutput(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, llvm::Value *value) {
+    if (xrfContext.ioMode == IoMode::Buffered) {
+        emitBufferedOutput(context, xrfContext, builder, value);
+    }
+    else {
+        builder.CreateCall(xrfContext.putcharFunc, value);
+    }
+}
+
+/**
+ * Generates LLVM code to output the top value of the stack as a character,
+ * popping the stack in the process. Generated from the "1" XRF command.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ */
+void generateOutput(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    auto topValue = emitLoadTopValue(context, xrfContext, builder);
+
+    emitOutput(context, xrfContext, builder, topValue);
+
+    emitPop(context, xrfContext, builder);
+}
+
+/**
+ * Generates LLVM code to output a value as a character, without changing the
+ * stack.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param command
+ *     The OutputValue command, with the value to output
+ */
+void generateOutputValue(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+                         const Command &command)
+{
+    auto stackTop = emitLoadStackTop(context, xrfContext, builder);
+
+    emitOutput(context, xrfContext, builder, emitComputedValue(context, xrfContext, builder, stackTop, command));
+}
+
+/**
+ * Gets the global variable holding a translation table for TranslateInput
+ * commands, creating it the first time the table is used.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param translation
+ *     The translation table
+ *
+ * @return
+ *     The global variable with the translation table
+ */
+llvm::GlobalVariable *getTranslationTable(llvm::LLVMContext &context, XrfContext &xrfContext,
+                                          const InputTranslation &translation)
+{
+    if (auto table = xrfContext.translationTables.find(&translation); table != xrfContext.translationTables.end()) {
+        return table->second;
+    }
+
+    auto entryType = llvm::IntegerType::getInt32Ty(context);
+    auto tableType = llvm::ArrayType::get(entryType, translation.size());
+
+    std::vector<llvm::Constant*> entries;
+
+    for (auto entry: translation) {
+        entries.push_back(llvm::ConstantInt::get(entryType, entry));
+    }
+
+    auto table = createGlobal(
+        *xrfContext.module, tableType, true, llvm::ConstantArray::get(tableType, entries), "translation"
+    );
+
+    xrfContext.translationTables[&translation] = table;
+
+    return table;
+}
+
+/**
+ * Generates LLVM code that reads bytes of input and writes out their
+ * translations, until it reads a byte that isn't translated, which is pushed
+ * onto the stack.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param translation
+ *     The translation table to use
+ */
+void generateTranslateInput(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+                            const InputTranslation &translation)
+{
+    auto table = getTranslationTable(context, xrfContext, translation);
+    auto entryType = llvm::IntegerType::getInt32Ty(context);
+
+    auto readBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+    auto translateBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+    auto outputBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+    auto stopBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+
+    builder.CreateBr(readBlock);
+    builder.SetInsertPoint(readBlock);
+
+    auto inputChar = emitInput(context, xrfContext, builder);
+
+    auto entryPtr = builder.CreateInBoundsGEP(
+        table->getValueType(),
+        table,
+        {
+            llvm::ConstantInt::get(entryType, 0),
+            inputChar
+        }
+    );
+
+    auto entry = builder.CreateLoad(entryType, entryPtr);
+
+    builder.CreateCondBr(
+        builder.CreateICmpEQ(entry, llvm::ConstantInt::get(entryType, TRANSLATE_STOP)),
+        stopBlock,
+        translateBlock
+    );
+
+    builder.SetInsertPoint(translateBlock);
+    builder.CreateCondBr(
+        builder.CreateICmpEQ(entry, llvm::ConstantInt::get(entryType, TRANSLATE_NO_OUTPUT)),
+        readBlock,
+        outputBlock
+    );
+
+    builder.SetInsertPoint(outputBlock);
+    emitOutput(context, xrfContext, builder, entry);
+    builder.CreateBr(readBlock);
+
+    builder.SetInsertPoint(stopBlock);
+    emitPush(context, xrfContext, builder, inputChar);
+}
+
+/**
+ * Generates LLVM code to pop the stack. Generated from the "2" XRF command.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ */
+void generatePop(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    emitPop(context, xrfContext, builder);
+}
+
+/**
+ * Generates LLVM code to remove the second value of the stack from the stack.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ */
+void generatePopSecond(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    auto topIndex = emitLoadStackTop(context, xrfContext, builder);
+
+    auto topMinusOne = builder.CreateSub(
+        topIndex,
+        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), 1)
+    );
+
+    auto topWrapped = builder.CreateAnd(topMinusOne, xrfContext.stackMask);
+
+    emitStoreStackTop(xrfContext, builder, topWrapped);
+}
+
+/**
+ * Generates LLVM code that will insert a value beneath the top value of the
+ * stack.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param val
+ *     The value to insert
+ */
+void generatePushSecondValue(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, unsigned val) {
+    auto topIndex = emitLoadStackTop(context, xrfContext, builder);
+
+    auto stackPtr = emitStackPtr(context, xrfContext, builder, topIndex);
+
+    builder.CreateStore(
+        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), val),
+        stackPtr
+    );
+
+    auto topPlusOne = builder.CreateAdd(
+        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), 1),
+        topIndex
+    );
+
+    auto secondWrapped = builder.CreateAnd(topPlusOne, xrfContext.stackMask);
+
+    emitStoreStackTop(xrfContext, builder, secondWrapped);
+}
+
+/**
+ * Generates LLVM code that will push a value to the bottom of the stack.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param command
+ *     The PushValueToBottom command, with the value to push to the bottom
+ */
+void generatePushToBottom(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+                          const Command &command)
+{
+    auto stackTop = emitLoadStackTop(context, xrfContext, builder);
+
+    emitBottom(context, xrfContext, builder, emitComputedValue(context, xrfContext, builder, stackTop, command));
+}
+
+/**
+ * Generates LLVM code that replaces the values at the top of the stack with
+ * new values computed from them, for a BeginShuffle command and the
+ * ShuffleValue commands following it. All of the new values are computed
+ * before any of them are stored, and new values that are the same as the
+ * value already in their place on the stack aren't stored at all.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param commands
+ *     The commands of the chunk
+ * @param index
+ *     The index of the BeginShuffle command in the commands
+ */
+void generateShuffle(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder,
+                     const std::vector<Command> &commands, size_t index)
+{
+    auto replaced = commands[index].slot;
+    auto newCount = static_cast<unsigned>(commands[index].val);
+
+    auto int64Type = llvm::IntegerType::getInt64Ty(context);
+
+    auto stackTop = emitLoadStackTop(context, xrfContext, builder);
+
+    std::vector<llvm::Value*> newValues;
+
+    for (unsigned i = 1; i <= newCount; i++) {
+        newValues.push_back(emitComputedValue(context, xrfContext, builder, stackTop, commands[index + i]));
+    }
+
+    // If none of the values are replaced, the top value stays where it is and
+    // needs to be moved from the top of the stack into the stack itself
+    if (replaced == 0 && newCount > 0) {
+        auto topValue = emitLoadTopValue(context, xrfContext, builder);
+
+        builder.CreateStore(topValue, emitStackPtr(context, xrfContext, builder, stackTop));
+    }
+
+    // The deepest new value goes where the top of the stack would be after
+    // removing the replaced values, and each one after goes above it
+    auto base = builder.CreateSub(stackTop, llvm::ConstantInt::get(int64Type, replaced));
+
+    for (unsigned i = 1; i < newCount; i++) {
+        auto &command = commands[index + i];
+
+        // Values already in the stack don't need to be stored again, unlike
+        // the top value of the stack, which isn't stored in the stack itself
+        if (command.multiple == 1 && command.addedMultiple == 0 && command.val == 0 && command.slot != 0 &&
+            command.slot + i == replaced)
+        {
+            continue;
+        }
+
+        auto slotIndex = builder.CreateAnd(
+            builder.CreateAdd(base, llvm::ConstantInt::get(int64Type, i)),
+            xrfContext.stackMask
+        );
+
+        builder.CreateStore(newValues[i - 1], emitStackPtr(context, xrfContext, builder, slotIndex));
+    }
+
+    auto newTop = builder.CreateAnd(
+        builder.CreateAdd(base, llvm::ConstantInt::get(int64Type, newCount)),
+        xrfContext.stackMask
+    );
+
+    if (newCount > 0) {
+        emitStoreTopValue(xrfContext, builder, newValues.back());
+    }
+    else {
+        emitStoreTopValue(xrfContext, builder, builder.CreateLoad(
+            llvm::IntegerType::getInt32Ty(context),
+            emitStackPtr(context, xrfContext, builder, newTop)
+        ));
+    }
+
+    emitStoreStackTop(xrfContext, builder, newTop);
+}
+
+/**
+ * Gets the state of the generator that Randomize commands shuffle the stack
+ * with, creating it the first time it's used. The state is seeded at the
+ * start of the program with splitmix64, in the same way as seedRandom().
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ *
+ * @return
+ *     The state of the generator
+ */
+const StateVariable &getRandomState(llvm::LLVMContext &context, XrfContext &xrfContext) {
+    if (xrfContext.randomState.type) {
+        return xrfContext.randomState;
+    }
+
+    auto int64Type = llvm::IntegerType::getInt64Ty(context);
+    auto stateType = llvm::ArrayType::get(int64Type, std::tuple_size_v<RandomState>);
+
+    // The start block already jumps to the first chunk by now, so the state
+    // is seeded just before that jump
+    llvm::IRBuilder builder(xrfContext.startBlock->getTerminator());
+
+    xrfContext.randomState = createStateVariable(
+        *xrfContext.module, xrfContext, builder, ContextField::Random, llvm::UndefValue::get(stateType), "random"
+    );
+
+    llvm::Value *seed;
+
+    if (xrfContext.seed) {
+        seed = llvm::ConstantInt::get(int64Type, *xrfContext.seed);
+    }
+    else {
+        auto bytePtrType = llvm::PointerType::getUnqual(llvm::IntegerType::getInt8Ty(context));
+        auto timeFunc = xrfContext.module->getOrInsertFunction("time", int64Type, bytePtrType);
+
+        seed = builder.CreateCall(timeFunc, {llvm::ConstantPointerNull::get(bytePtrType)});
+    }
+
+    auto statePtr = emitStatePtr(xrfContext, builder, xrfContext.randomState);
+
+    for (unsigned i = 0; i < std::tuple_size_v<RandomState>; i++) {
+        seed = builder.CreateAdd(seed, llvm::ConstantInt::get(int64Type, SPLITMIX_INCREMENT));
+
+        auto z = builder.CreateMul(
+            builder.CreateXor(seed, builder.CreateLShr(seed, 30)),
+            llvm::ConstantInt::get(int64Type, SPLITMIX_MULTIPLIERS[0])
+        );
+        z = builder.CreateMul(
+            builder.CreateXor(z, builder.CreateLShr(z, 27)),
+            llvm::ConstantInt::get(int64Type, SPLITMIX_MULTIPLIERS[1])
+        );
+        z = builder.CreateXor(z, builder.CreateLShr(z, 31));
+
+        builder.CreateStore(z, builder.CreateConstInBoundsGEP2_64(stateType, statePtr, 0, i));
+    }
+
+    return xrfContext.randomState;
+}
+
+/**
+ * Generates LLVM code to shuffle every value on the stack, with a
+ * Fisher-Yates shuffle. Generated from the "D" XRF command. The top value is
+ * stored above the rest of the stack, so that the shuffle swaps values in
+ * place, and the state of the generator is kept in registers for the whole
+ * shuffle. The values are shuffled in the same order as the interpreter
+ * shuffles them.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ */
+void generateRandomize(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    auto int64Type = llvm::IntegerType::getInt64Ty(context);
+    auto int32Type = llvm::IntegerType::getInt32Ty(context);
+
+    const auto &random = getRandomState(context, xrfContext);
+    auto stateType = random.type;
+    constexpr auto stateSize = std::tuple_size_v<RandomState>;
+
+    auto stackTop = emitLoadStackTop(context, xrfContext, builder);
+    auto stackBottom = emitLoadStackBottom(context, xrfContext, builder);
+
+    builder.CreateStore(emitLoadTopValue(context, xrfContext, builder),
+                        emitStackPtr(context, xrfContext, builder, stackTop));
+
+    // The number of values below the top value
+    auto depth = builder.CreateAnd(
+        builder.CreateSub(builder.CreateSub(stackTop, stackBottom), llvm::ConstantInt::get(int64Type, 1)),
+        xrfContext.stackMask
+    );
+
+    auto statePtr = emitStatePtr(xrfContext, builder, random);
+
+    std::array<llvm::Value*, stateSize> state;
+
+    for (unsigned i = 0; i < stateSize; i++) {
+        state[i] = builder.CreateLoad(int64Type, builder.CreateConstInBoundsGEP2_64(stateType, statePtr, 0, i));
+    }
+
+    auto entryBlock = builder.GetInsertBlock();
+    auto loopBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+    auto doneBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+
+    builder.CreateCondBr(builder.CreateICmpEQ(depth, llvm::ConstantInt::get(int64Type, 0)), doneBlock, loopBlock);
+
+    builder.SetInsertPoint(loopBlock);
+
+    // Each time around the loop, the value i slots below the top swaps with a
+    // random value at or above it
+    auto i = builder.CreatePHI(int64Type, 2);
+    i->addIncoming(depth, entryBlock);
+
+    std::array<llvm::PHINode*, stateSize> statePhis;
+
+    for (unsigned j = 0; j < stateSize; j++) {
+        statePhis[j] = builder.CreatePHI(int64Type, 2);
+        statePhis[j]->addIncoming(state[j], entryBlock);
+    }
+
+    auto rotateLeft = [&] (llvm::Value *value, unsigned amount) {
+        return builder.CreateOr(builder.CreateShl(value, amount), builder.CreateLShr(value, 64 - amount));
+    };
+
+    // The next random number from xoshiro256**, as with nextRandom()
+    auto result = builder.CreateMul(rotateLeft(builder.CreateMul(statePhis[1], builder.getInt64(5)), 7),
+                                    builder.getInt64(9));
+    auto shifted = builder.CreateShl(statePhis[1], 17);
+
+    std::array<llvm::Value*, stateSize> next;
+    next[2] = builder.CreateXor(statePhis[2], statePhis[0]);
+    next[3] = builder.CreateXor(statePhis[3], statePhis[1]);
+    next[1] = builder.CreateXor(statePhis[1], next[2]);
+    next[0] = builder.CreateXor(statePhis[0], next[3]);
+    next[2] = builder.CreateXor(next[2], shifted);
+    next[3] = rotateLeft(next[3], 45);
+
+    // A random slot from 0 to i, as with randomBelow()
+    auto swapSlot = builder.CreateLShr(
+        builder.CreateMul(builder.CreateLShr(result, 32), builder.CreateAdd(i, builder.getInt64(1))),
+        32
+    );
+
+    auto slotPtr = [&] (llvm::Value *slot) {
+        return emitStackPtr(context, xrfContext, builder,
+                            builder.CreateAnd(builder.CreateSub(stackTop, slot), xrfContext.stackMask));
+    };
+
+    auto firstPtr = slotPtr(i);
+    auto secondPtr = slotPtr(swapSlot);
+    auto first = builder.CreateLoad(int32Type, firstPtr);
+    auto second = builder.CreateLoad(int32Type, secondPtr);
+    builder.CreateStore(second, firstPtr);
+    builder.CreateStore(first, secondPtr);
+
+    auto nextI = builder.CreateSub(i, builder.getInt64(1));
+    i->addIncoming(nextI, loopBlock);
+
+    for (unsigned j = 0; j < stateSize; j++) {
+        statePhis[j]->addIncoming(next[j], loopBlock);
+    }
+
+    builder.CreateCondBr(builder.CreateICmpEQ(nextI, builder.getInt64(0)), doneBlock, loopBlock);
+
+    builder.SetInsertPoint(doneBlock);
+
+    std::array<llvm::Value*, stateSize> finalState;
+
+    for (unsigned j = 0; j < stateSize; j++) {
+        auto phi = builder.CreatePHI(int64Type, 2);
+        phi->addIncoming(state[j], entryBlock);
+        phi->addIncoming(next[j], loopBlock);
+        finalState[j] = phi;
+    }
+
+    for (unsigned j = 0; j < stateSize; j++) {
+        builder.CreateStore(finalState[j], builder.CreateConstInBoundsGEP2_64(stateType, statePtr, 0, j));
+    }
+
+    emitStoreTopValue(xrfContext, builder, builder.CreateLoad(
+        int32Type,
+        emitStackPtr(context, xrfContext, builder, stackTop)
+    ));
+}
+
+/**
+ * Generates LLVM code which will set the second value of the stack to a known
+ * value.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param val
+ */
+void generateSetSecondValue(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, unsigned val) {
+    auto secondPtr = emitGet2ndValue(context, xrfContext, builder);
+
+    builder.CreateStore(
+        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), val),
+        secondPtr
+    );
+}
+
+/**
+ * Generates LLVM that will set the top value of the stack to a known value.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param val
+ *     The value to set the top to
+ */
+void generateSetTop(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, unsigned val) {
+    emitStoreTopValue(
+        xrfContext, builder,
+        llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), val)
+    );
+}
+
+/**
+ * Generates LLVM code which will replace the top two values of the stack with
+ * their difference. Generated from the "E" XRF command.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ */
+void generateSub(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    auto value1 = emitLoadTopValue(context, xrfContext, builder);
+
+    emitPop(context, xrfContext, builder);
+
+    auto value2 = emitLoadTopValue(context, xrfContext, builder);
+
+    auto sub1 = builder.CreateSub(value1, value2);
+
+    auto sub2 = builder.CreateSub(value2, value1);
+
+    auto value1IsGreater = builder.CreateICmpUGT(value1, value2);
+
+    auto selectedValue = builder.CreateSelect(value1IsGreater, sub1, sub2);
+
+    emitStoreTopValue(xrfContext, builder, selectedValue);
+}
+
+/**
+ * Generates LLVM code which will swap the top two values of the stack.
+ * Generated from the "4" XRF command.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ */
+void generateSwap(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder) {
+    auto stackTop = emitLoadStackTop(context, xrfContext, builder);
+
+    auto topMinusOne = builder.CreateSub(
+        stackTop,
+        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), 1)
+    );
+
+    auto stack2ndIndex = builder.CreateAnd(
+        topMinusOne,
+        llvm::ConstantInt::get(llvm::IntegerType::getInt64Ty(context), xrfContext.stackMask)
+    );
+
+    auto stackIndex = emitStackPtr(context, xrfContext, builder, stack2ndIndex);
+
+    auto stack2ndValue = builder.CreateLoad(
+        llvm::IntegerType::getInt32Ty(context),
+        stackIndex
+    );
+
+    auto topValue = emitLoadTopValue(context, xrfContext, builder);
+
+    builder.CreateStore(topValue, stackIndex);
+
+    emitStoreTopValue(xrfContext, builder, stack2ndValue);
+}
+
+/**
+ * Generates code for conditionally executing code based on whether chunk has
+ * been visited before. Generated from the "8" and "C" XRF commands.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param builder
+ *     The IR builder to use for generating LLVM code
+ * @param index
+ *     The index of the chunk in the program
+ * @param chunks
+ *     The list of all of the chunks in the program
+ * @param stackJump
+ *     The block that is generated for jumping to the next chunk based on the
+ *     top value of the stack
+ * @param visited
+ *     The commands to execute if the chunk has been visited already
+ * @param first
+ *     The commands to execute if the chunk has never been visited
+ */
+void generateVisitJump(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, size_t index,
+                       const std::vector<llvm::BasicBlock*> &chunks, llvm::BasicBlock *stackJump,
+                       const ChunkCommands &visited, const ChunkCommands &first)
+{
+    auto hasVisited = emitCountedLoadVisited(context, xrfContext, builder, index);
+
+    auto firstBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+    auto visitedBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+
+    // Both blocks carry on from the stack state at the end of this block
+    auto state = xrfContext.state;
+
+    generateCodeForChunk(context, xrfContext, visited, index, visitedBlock, chunks, stackJump, false);
+
+    xrfContext.state = state;
+
+    generateCodeForChunk(context, xrfContext, first, index, firstBlock, chunks, stackJump, true);
+
+    builder.CreateCondBr(hasVisited, visitedBlock, firstBlock, createVisitWeights(context, xrfContext, index));
+}
+
+/**
+ * Gets the commands of a chunk from a given command onwards, without copying
+ * them.
+ *
+ * @param chunk
+ *     The commands to take commands from
+ * @param firstIndex
+ *     The index of the first command to take from the chunk
+ *
+ * @return
+ *     The commands from the given command to the end of the chunk
+ */
+ChunkCommands chunkFromCommand(const ChunkCommands &chunk, size_t firstIndex) {
+    auto shorterChunk = chunk;
+    shorterChunk.first = firstIndex;
+    return shorterChunk;
+}
+
+/**
+ * Gets the commands of a chunk that are run the first time it's visited, or
+ * every time if it hasn't been split.
+ *
+ * @param chunk
+ *     The chunk
+ *
+ * @return
+ *     All of the commands of the chunk
+ */
+ChunkCommands firstCommands(const Chunk &chunk) {
+    return {chunk.commands, 0, chunk.nextChunk, chunk.translation.get()};
+}
+
+/**
+ * Gets the commands of a split chunk that are run after it's been visited.
+ *
+ * @param chunk
+ *     The split chunk
+ *
+ * @return
+ *     The commands the chunk runs once it's been visited
+ */
+ChunkCommands visitedCommands(const Chunk &chunk) {
+    return {*chunk.visitedCommands, 0, chunk.visitedNextChunk, chunk.translation.get()};
+}
+
+void generateCodeForChunk(llvm::LLVMContext &context, XrfContext &xrfContext, const ChunkCommands &chunk, size_t index,
+                          llvm::BasicBlock *chunkBlock, const std::vector<llvm::BasicBlock*> &chunks,
+                          llvm::BasicBlock *stackJump, bool setVisited)
+{
+    llvm::IRBuilder builder(chunkBlock);
+
+    for (size_t i = chunk.first; i < chunk.commands.size(); i++) {
+        const auto &command = chunk.commands[i];
+
+        switch (command.type) {
+            case CommandType::Add:
+                generateAdd(context, xrfContext, builder);
+                break;
+
+            case CommandType::AddToSecond:
+                generateAdd2nd(context, xrfContext, builder, command.val);
+                break;
+
+            case CommandType::Bottom:
+                generateBottom(context, xrfContext, builder);
+                break;
+
+            case CommandType::Dec:
+                generateDec(context, xrfContext, builder);
+                break;
+
+            case CommandType::Dup:
+                generateDup(context, xrfContext, builder);
+                break;
+
+            case CommandType::Exit:
+                emitFlushOutput(xrfContext, builder);
+
+                emitDumpProfile(xrfContext, builder);
+
+                builder.CreateRet(
+                    llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), 0)
+                );
+                return;
+
+            case CommandType::Inc:
+                generateInc(context, xrfContext, builder);
+                break;
+
+            case CommandType::Input:
+                generateInput(context, xrfContext, builder);
+                break;
+
+            case CommandType::Jump:
+                // Exit this loop
+                i = chunk.commands.size();
+                break;
+
+            case CommandType::MultiplySecond:
+                generateMultiply2nd(context, xrfContext, builder, command.val);
+                break;
+
+            case CommandType::Output:
+                generateOutput(context, xrfContext, builder);
+                break;
+
+            case CommandType::Pop:
+                generatePop(context, xrfContext, builder);
+                break;
+
+            case CommandType::PopSecondValue:
+                generatePopSecond(context, xrfContext, builder);
+                break;
+
+            case CommandType::PushSecondValue:
+                generatePushSecondValue(context, xrfContext, builder, command.val);
+                break;
+
+            case CommandType::PushValueToBottom:
+                generatePushToBottom(context, xrfContext, builder, command);
+                break;
+
+            case CommandType::OutputValue:
+                generateOutputValue(context, xrfContext, builder, command);
+                break;
+
+            case CommandType::BeginShuffle:
+                generateShuffle(context, xrfContext, builder, chunk.commands, i);
+
+                // Skip over the ShuffleValue commands we just generated
+                i += command.val;
+                break;
+
+            case CommandType::Randomize:
+                generateRandomize(context, xrfContext, builder);
+                break;
+
+            case CommandType::SetSecondValue:
+                generateSetSecondValue(context, xrfContext, builder, command.val);
+                break;
+
+            case CommandType::SetTop:
+                generateSetTop(context, xrfContext, builder, command.val);
+                break;
+
+            case CommandType::TranslateInput:
+                generateTranslateInput(context, xrfContext, builder, *chunk.translation);
+                break;
+
+            case CommandType::Sub:
+                generateSub(context, xrfContext, builder);
+                break;
+
+            case CommandType::Swap:
+                generateSwap(context, xrfContext, builder);
+                break;
+
+            case CommandType::IgnoreVisited:
+            case CommandType::IgnoreFirst: {
+                if (i == chunk.commands.size() - 1) {
+                    break;
+                }
+
+                auto nextChunk = chunkFromCommand(chunk, i + 1);
+                auto skipChunk = chunkFromCommand(chunk, i + 2);
+
+                if (chunk.commands[i].type == CommandType::IgnoreVisited) {
+                    generateVisitJump(context, xrfContext, builder, index, chunks, stackJump, skipChunk, nextChunk);
+                }
+                else {
+                    generateVisitJump(context, xrfContext, builder, index, chunks, stackJump, nextChunk, skipChunk);
+                }
+
+                return;
+            }
+
+            default:
+                break;
+        }
+    }
+
+    if (setVisited) {
+        emitSetVisited(context, xrfContext, builder, index);
+    }
+
+    if (auto knownJump = chunk.nextChunk; knownJump && *knownJump < chunks.size()) {
+        auto visitedBlock = xrfContext.visitedBlocks.find(*knownJump);
+
+        // A split chunk that jumps back to itself has been visited by then, so
+        // it can skip checking whether it's been visited
+        if (*knownJump == index && visitedBlock != xrfContext.visitedBlocks.end()) {
+            emitCount(context, xrfContext, builder, ProfileCounter::Runs, index);
+            emitJump(xrfContext, builder, visitedBlock->second);
+        }
+        else {
+            emitJump(xrfContext, builder, chunks[*knownJump]);
+        }
+    }
+    else {
+        emitCount(context, xrfContext, builder, ProfileCounter::JumpsFrom, index);
+
+        if (auto targets = getLocalTargets(xrfContext, index); targets) {
+            emitLocalJump(context, xrfContext, builder, chunks, stackJump, *targets);
+        }
+        else {
+            emitStackJump(context, xrfContext, builder, chunks, stackJump);
+        }
+    }
+}
+
+/**
+ * Generates LLVM code for a chunk that has been split into the commands run
+ * on the first visit to the chunk and the commands run on later visits. The
+ * chunk's block checks whether the chunk has been visited once, and then
+ * branches to the code for the right version of the chunk.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param chunk
+ *     The split XRF chunk to generate LLVM code for
+ * @param index
  *     The index of the chunk in the program
+ * @param chunkBlock
+ *     The LLVM block to generate the code in
  * @param chunks
- *     The list of all of the chunks in the program
+ *     The list of all of the blocks for the XRF chunks in the program
  * @param stackJump
  *     The block that is generated for jumping to the next chunk based on the
  *     top value of the stack
- * @param visited
- *     The chunk to execute if the chunk has been visited already
- * @param first
- *     The chunk to execute if the chunk has never been visited
  */
-void generateVisitJump(llvm::LLVMContext &context, XrfContext &xrfContext, llvm::IRBuilder<> &builder, size_t index,
-                       std::vector<llvm::BasicBlock*> chunks, llvm::BasicBlock *stackJump, const Chunk &visited, const Chunk &first)
+void generateSplitChunk(llvm::LLVMContext &context, XrfContext &xrfContext, const Chunk &chunk, size_t index,
+                        llvm::BasicBlock *chunkBlock, const std::vector<llvm::BasicBlock*> &chunks,
+                        llvm::BasicBlock *stackJump)
+{
+    auto firstBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+    auto visitedBlock = createJumpTarget(context, xrfContext, "chunk" + std::to_string(index) + "-visited");
+
+    xrfContext.visitedBlocks[index] = visitedBlock;
+
+    llvm::IRBuilder builder(chunkBlock);
+
+    auto hasVisited = emitCountedLoadVisited(context, xrfContext, builder, index);
+
+    addJumpSource(xrfContext, chunkBlock, visitedBlock);
+    builder.CreateCondBr(hasVisited, visitedBlock, firstBlock, createVisitWeights(context, xrfContext, index));
+
+    auto first = firstCommands(chunk);
+
+    // The visited block can be jumped to straight from the chunk itself, so
+    // each version of the chunk checks the stack on its own
+    builder.SetInsertPoint(firstBlock);
+
+    if (xrfContext.checked) {
+        StackBounds bounds;
+        addStackBounds(first.commands, bounds);
+        emitDepthCheck(context, xrfContext, builder, bounds);
+    }
+
+    generateCodeForChunk(context, xrfContext, first, index, builder.GetInsertBlock(), chunks, stackJump, true);
+
+    auto visited = visitedCommands(chunk);
+
+    enterJumpTarget(xrfContext, visitedBlock);
+
+    builder.SetInsertPoint(visitedBlock);
+
+    if (xrfContext.checked) {
+        StackBounds bounds;
+        addStackBounds(visited.commands, bounds);
+        emitDepthCheck(context, xrfContext, builder, bounds);
+    }
+
+    generateCodeForChunk(context, xrfContext, visited, index, builder.GetInsertBlock(), chunks, stackJump, false);
+}
+
+/**
+ * Generates LLVM code for a group of chunks in the function that code is
+ * currently being generated in, along with the block that jumps to chunks
+ * chosen at runtime from those chunks.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param chunks
+ *     The XRF chunks to turn into LLVM code
+ * @param chunkStarts
+ *     The blocks of the chunks in the current function, which are nullptr
+ *     for the chunks that don't have a block in it
+ * @param order
+ *     The chunks to generate code for, in the order they're laid out
+ * @param targets
+ *     The chunks with blocks in the current function that jumps chosen at
+ *     runtime can branch to straight away
+ * @param hotFirst
+ *     Whether the order puts the hot chunks first, in which case each chunk's
+ *     blocks are moved after the blocks of the chunks before it
+ */
+void generateChunkGroup(llvm::LLVMContext &context, XrfContext &xrfContext, const std::vector<Chunk> &chunks,
+                        const std::vector<llvm::BasicBlock*> &chunkStarts, const std::vector<size_t> &order,
+                        const std::vector<size_t> &targets, bool hotFirst)
 {
-    auto hasVisited = builder.CreateLoad(llvm::Type::getInt1Ty(context), emitVisited(*xrfContext.module, context, index));
+    llvm::BasicBlock *stackJump = nullptr;
+
+    if (xrfContext.checked) {
+        createCheckFailed(context, xrfContext, chunks);
+    }
+
+    if (xrfContext.dispatchMode == DispatchMode::Switch) {
+        stackJump = createStackJump(context, xrfContext, chunkStarts, targets);
+    }
+    else {
+        createJumpTable(context, xrfContext, chunkStarts);
+    }
+
+    for (auto i: order) {
+        if (!chunkStarts[i]) {
+            continue;
+        }
+
+        if (hotFirst) {
+            chunkStarts[i]->moveAfter(&xrfContext.mainFunc->back());
+        }
+
+        xrfContext.currentChunk = i;
+
+        enterJumpTarget(xrfContext, chunkStarts[i]);
+
+        llvm::IRBuilder chunkBuilder(chunkStarts[i]);
+
+        emitCount(context, xrfContext, chunkBuilder, ProfileCounter::Runs, i);
+
+        if (chunks[i].visitedCommands) {
+            generateSplitChunk(context, xrfContext, chunks[i], i, chunkStarts[i], chunkStarts, stackJump);
+            continue;
+        }
+
+        if (xrfContext.checked) {
+            StackBounds bounds;
+            addStackBounds(chunks[i].commands, bounds);
+            emitDepthCheck(context, xrfContext, chunkBuilder, bounds);
+        }
+
+        generateCodeForChunk(context, xrfContext, firstCommands(chunks[i]), i, chunkBuilder.GetInsertBlock(), chunkStarts,
+                             stackJump);
+    }
+}
+
+/**
+ * Returns the chunks that a chunk can jump to that are worth keeping in the
+ * same function as it, which are the chunks it's known to jump to and the
+ * chunks that it branches to itself when the jump is chosen at runtime.
+ *
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param chunks
+ *     The XRF chunks of the program
+ * @param chunkIdx
+ *     The index of the chunk
+ *
+ * @return
+ *     The chunks the chunk can jump to, which can be run
+ */
+std::vector<size_t> getNearbyChunks(const XrfContext &xrfContext, const std::vector<Chunk> &chunks, size_t chunkIdx) {
+    std::vector<size_t> nearby;
+
+    for (auto known: {chunks[chunkIdx].nextChunk, chunks[chunkIdx].visitedNextChunk}) {
+        if (known && *known < chunks.size() && isReachable(xrfContext, *known)) {
+            nearby.push_back(*known);
+        }
+    }
+
+    if (auto targets = getLocalTargets(xrfContext, chunkIdx); targets) {
+        for (auto i = targets->first; i <= targets->last && i < chunks.size(); i++) {
+            if (isReachable(xrfContext, i)) {
+                nearby.push_back(i);
+            }
+        }
+    }
+
+    return nearby;
+}
+
+/**
+ * Splits the chunks that can be run into the groups that each get a function
+ * of their own. The strongly connected groups of chunks, which can each reach
+ * one another through the jumps from getNearbyChunks(), are put together in
+ * the same function until it's full, and a strongly connected group that's
+ * bigger than a function can hold is split up in the order of its chunks.
+ *
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param chunks
+ *     The XRF chunks of the program
+ *
+ * @return
+ *     The chunks that go in each function, in order
+ */
+std::vector<std::vector<size_t>> partitionChunks(const XrfContext &xrfContext, const std::vector<Chunk> &chunks) {
+    constexpr auto UNVISITED = std::numeric_limits<size_t>::max();
+
+    std::vector<std::vector<size_t>> nearby(chunks.size());
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (isReachable(xrfContext, i)) {
+            nearby[i] = getNearbyChunks(xrfContext, chunks, i);
+        }
+    }
 
-    auto firstBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
-    auto visitedBlock = llvm::BasicBlock::Create(context, "", xrfContext.mainFunc);
+    // Tarjan's algorithm, with an explicit stack of the chunks being visited
+    // and the next of their nearby chunks to follow, since programs can have
+    // far too many chunks to recurse through
+    std::vector<size_t> visitIndex(chunks.size(), UNVISITED), lowLink(chunks.size());
+    std::vector<bool> onStack(chunks.size());
+    std::vector<size_t> componentStack;
+    std::vector<std::pair<size_t, size_t>> callStack;
+    std::vector<std::vector<size_t>> components;
+    size_t nextIndex = 0;
+
+    for (size_t root = 0; root < chunks.size(); root++) {
+        if (!isReachable(xrfContext, root) || visitIndex[root] != UNVISITED) {
+            continue;
+        }
 
-    generateCodeForChunk(context, xrfContext, visited, index, visitedBlock, chunks, stackJump, false);
-    generateCodeForChunk(context, xrfContext, first, index, firstBlock, chunks, stackJump, true);
+        callStack.emplace_back(root, 0);
+
+        while (!callStack.empty()) {
+            auto &[chunk, edge] = callStack.back();
+
+            if (edge == 0) {
+                visitIndex[chunk] = lowLink[chunk] = nextIndex++;
+                componentStack.push_back(chunk);
+                onStack[chunk] = true;
+            }
+
+            if (edge < nearby[chunk].size()) {
+                auto next = nearby[chunk][edge++];
+
+                if (visitIndex[next] == UNVISITED) {
+                    callStack.emplace_back(next, 0);
+                }
+                else if (onStack[next]) {
+                    lowLink[chunk] = std::min(lowLink[chunk], visitIndex[next]);
+                }
+
+                continue;
+            }
+
+            auto finished = chunk;
+            callStack.pop_back();
+
+            if (!callStack.empty()) {
+                auto parent = callStack.back().first;
+                lowLink[parent] = std::min(lowLink[parent], lowLink[finished]);
+            }
+
+            if (lowLink[finished] == visitIndex[finished]) {
+                auto &component = components.emplace_back();
+
+                size_t member;
+                do {
+                    member = componentStack.back();
+                    componentStack.pop_back();
+                    onStack[member] = false;
+                    component.push_back(member);
+                } while (member != finished);
+
+                std::sort(component.begin(), component.end());
+            }
+        }
+    }
+
+    // The components come out with the chunks that are jumped to before the
+    // chunks that jump to them, so they're packed the other way around to
+    // lay the program out from its first chunk
+    std::vector<std::vector<size_t>> partitions;
+    std::vector<size_t> current;
+
+    auto finishPartition = [&] {
+        if (!current.empty()) {
+            std::sort(current.begin(), current.end());
+            partitions.push_back(std::move(current));
+            current.clear();
+        }
+    };
+
+    for (auto component = components.rbegin(); component != components.rend(); ++component) {
+        if (current.size() + component->size() > xrfContext.partitionSize) {
+            finishPartition();
+        }
+
+        for (auto chunk: *component) {
+            current.push_back(chunk);
+
+            if (current.size() == xrfContext.partitionSize) {
+                finishPartition();
+            }
+        }
+    }
 
-    builder.CreateCondBr(hasVisited, visitedBlock, firstBlock);
+    finishPartition();
+
+    return partitions;
 }
 
 /**
- * Creates a new XRF chunk from a given chunk, including only the commands
- * after a specific index.
- *
- * @param chunk
- *     The chunk to take commands from.
- * @param firstIndex
- *     The index of the first command to copy from the chunk
+ * Creates the function that partitioned code jumps through when the chunk
+ * chosen at runtime isn't in the function that's jumping. It calls the
+ * function that the chunk is in, which carries on from the chunk.
  *
- * @return
- *     A shorter chunk made from the commands from the original chunk
- */
-Chunk chunkFromCommand(const Chunk &chunk, size_t firstIndex) {
-    Chunk shorterChunk;
-    shorterChunk.commands.insert(shorterChunk.commands.begin(),
-                                 chunk.commands.begin() + firstIndex,
-                                 chunk.commands.end());
-    shorterChunk.line = chunk.line;
-    shorterChunk.col = chunk.col + firstIndex;
-    return shorterChunk;
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param partitions
+ *     The functions that the code is split into
+ * @param numChunks
+ *     The number of chunks in the program
+ */
+void createDispatchFunction(llvm::LLVMContext &context, XrfContext &xrfContext,
+                            const std::vector<llvm::Function*> &partitions, size_t numChunks)
+{
+    auto func = xrfContext.dispatchFunc;
+    auto int32Type = llvm::IntegerType::getInt32Ty(context);
+
+    llvm::IRBuilder builder(llvm::BasicBlock::Create(context, "entry", func));
+
+    std::vector<llvm::Value*> args;
+
+    for (auto &arg: func->args()) {
+        args.push_back(&arg);
+    }
+
+    auto chunkIdx = args[xrfContext.libraryContext ? 2 : 1];
+
+    // As with the shared switch, jumps to chunks that don't exist are never
+    // reached unless the program is wrong, or stop library code
+    auto errorBlock = createNoChunk(context, xrfContext, func);
+
+    auto switchInst = builder.CreateSwitch(chunkIdx, errorBlock, numChunks);
+
+    std::unordered_map<llvm::Function*, llvm::BasicBlock*> callBlocks;
+
+    for (auto partition: partitions) {
+        auto block = llvm::BasicBlock::Create(context, "", func);
+
+        llvm::IRBuilder callBuilder(block);
+
+        auto call = callBuilder.CreateCall(partition, args);
+        call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+        callBuilder.CreateRet(call);
+
+        callBlocks[partition] = block;
+    }
+
+    for (size_t i = 0; i < numChunks; i++) {
+        if (xrfContext.chunkFunctions[i] && isDynamicTarget(xrfContext, i)) {
+            switchInst->addCase(llvm::ConstantInt::get(int32Type, i), callBlocks[xrfContext.chunkFunctions[i]]);
+        }
+    }
 }
 
-void generateCodeForChunk(llvm::LLVMContext &context, XrfContext &xrfContext, const Chunk &chunk, size_t index,
-                          llvm::BasicBlock *chunkBlock, std::vector<llvm::BasicBlock*> chunks, llvm::BasicBlock *stackJump,
-                          bool setVisited)
+/**
+ * Generates the function for one of the groups of chunks that partitioned
+ * code is split into. The function starts by branching to the chunk it's
+ * called with, and jumps to chunks in other functions by calling them, with
+ * a block for each chunk it's known to jump to in another function.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param chunks
+ *     The XRF chunks to turn into LLVM code
+ * @param func
+ *     The function to generate
+ * @param members
+ *     The chunks in the function, in the order they're laid out
+ * @param isEntry
+ *     Whether each chunk can be started at by a call from another function
+ * @param chunkStarts
+ *     The blocks of the chunks in the current function, which are all
+ *     nullptr, and are set back to nullptr afterwards
+ * @param hotFirst
+ *     Whether the members are ordered with the hot chunks first
+ */
+void generatePartition(llvm::LLVMContext &context, XrfContext &xrfContext, const std::vector<Chunk> &chunks,
+                       llvm::Function *func, const std::vector<size_t> &members, const std::vector<bool> &isEntry,
+                       std::vector<llvm::BasicBlock*> &chunkStarts, bool hotFirst)
 {
-    llvm::IRBuilder builder(chunkBlock);
+    auto int32Type = llvm::IntegerType::getInt32Ty(context);
 
-    for (size_t i = 0; i < chunk.commands.size(); i++) {
-        const auto &command = chunk.commands[i];
+    xrfContext.mainFunc = func;
 
-        switch (command.type) {
-            case CommandType::Add:
-                generateAdd(context, xrfContext, builder);
-                break;
+    auto entryBlock = llvm::BasicBlock::Create(context, "entry", func);
 
-            case CommandType::AddToSecond:
-                generateAdd2nd(context, xrfContext, builder, command.val);
-                break;
+    llvm::IRBuilder builder(entryBlock);
 
-            case CommandType::Bottom:
-                generateBottom(context, xrfContext, builder);
-                break;
+    auto arg = func->arg_begin() + (xrfContext.libraryContext ? 1 : 0);
 
-            case CommandType::Dec:
-                generateDec(context, xrfContext, builder);
-                break;
+    xrfContext.stack = &*arg++;
+    llvm::Value *chunkIdx = &*arg++;
+    llvm::Value *stackTop = &*arg++;
+    llvm::Value *stackBottom = &*arg++;
+    llvm::Value *topValue = &*arg++;
 
-            case CommandType::Dup:
-                generateDup(context, xrfContext, builder);
-                break;
+    if (!xrfContext.registerState) {
+        xrfContext.stackTop = builder.CreateAlloca(stackTop->getType(), nullptr, "top");
+        xrfContext.stackBottom = builder.CreateAlloca(stackBottom->getType(), nullptr, "bottom");
+        xrfContext.topValue = builder.CreateAlloca(topValue->getType(), nullptr, "top_value");
+    }
 
-            case CommandType::Exit:
-                builder.CreateRet(
-                    llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), 0)
-                );
-                return;
+    emitStoreStackTop(xrfContext, builder, stackTop);
+    emitStoreStackBottom(xrfContext, builder, stackBottom);
+    emitStoreTopValue(xrfContext, builder, topValue);
 
-            case CommandType::Inc:
-                generateInc(context, xrfContext, builder);
-                break;
+    std::vector<size_t> targets = members;
 
-            case CommandType::Input:
-                generateInput(context, xrfContext, builder);
-                break;
+    for (auto i: members) {
+        chunkStarts[i] = createJumpTarget(context, xrfContext, "chunk" + std::to_string(i));
+    }
 
-            case CommandType::Jump:
-                // Exit this loop
-                i = chunk.commands.size();
-                break;
+    // Each chunk in another function that's known to be jumped to gets a
+    // block that calls that function
+    std::vector<size_t> calls;
 
-            case CommandType::MultiplySecond:
-                generateMultiply2nd(context, xrfContext, builder, command.val);
-                break;
+    for (auto i: members) {
+        for (auto known: {chunks[i].nextChunk, chunks[i].visitedNextChunk}) {
+            if (known && *known < chunks.size() && !chunkStarts[*known]) {
+                chunkStarts[*known] = createJumpTarget(context, xrfContext, "call-chunk" + std::to_string(*known));
+                calls.push_back(*known);
+                targets.push_back(*known);
+            }
+        }
+    }
 
-            case CommandType::Output:
-                generateOutput(context, xrfContext, builder);
-                break;
+    auto noChunk = llvm::BasicBlock::Create(context, "no-chunk", func);
+    llvm::IRBuilder(noChunk).CreateUnreachable();
 
-            case CommandType::Pop:
-                generatePop(context, xrfContext, builder);
-                break;
+    auto switchInst = builder.CreateSwitch(chunkIdx, noChunk);
 
-            case CommandType::PopSecondValue:
-                generatePopSecond(context, xrfContext, builder);
-                break;
+    for (auto i: members) {
+        if (isEntry[i]) {
+            switchInst->addCase(llvm::ConstantInt::get(int32Type, i), chunkStarts[i]);
+            addJumpSource(xrfContext, entryBlock, chunkStarts[i]);
+        }
+    }
 
-            case CommandType::PushSecondValue:
-                generatePushSecondValue(context, xrfContext, builder, command.val);
-                break;
+    for (auto i: calls) {
+        enterJumpTarget(xrfContext, chunkStarts[i]);
 
-            case CommandType::PushValueToBottom:
-                generatePushToBottom(context, xrfContext, builder, command.val);
-                break;
+        llvm::IRBuilder callBuilder(chunkStarts[i]);
 
-            case CommandType::SetSecondValue:
-                generateSetSecondValue(context, xrfContext, builder, command.val);
-                break;
+        emitPartitionJump(xrfContext, callBuilder, xrfContext.chunkFunctions[i], llvm::ConstantInt::get(int32Type, i));
+    }
 
-            case CommandType::SetTop:
-                generateSetTop(context, xrfContext, builder, command.val);
-                break;
+    generateChunkGroup(context, xrfContext, chunks, chunkStarts, members, targets, hotFirst);
 
-            case CommandType::Sub:
-                generateSub(context, xrfContext, builder);
-                break;
+    for (auto i: targets) {
+        chunkStarts[i] = nullptr;
+    }
+}
 
-            case CommandType::Swap:
-                generateSwap(context, xrfContext, builder);
-                break;
+/**
+ * Gets the order to lay the chunks out in. With a profile, the hot chunks get
+ * laid out first, each followed by the rest of the blocks generated for it.
+ *
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param numChunks
+ *     The number of chunks in the program
+ *
+ * @return
+ *     The order to lay out the chunks in, and whether it puts the hot chunks
+ *     first
+ */
+std::pair<std::vector<size_t>, bool> getChunkOrder(const XrfContext &xrfContext, size_t numChunks) {
+    if (xrfContext.profile && xrfContext.profile->counts.size() == numChunks) {
+        return {orderHotFirst(*xrfContext.profile), true};
+    }
 
-            case CommandType::IgnoreVisited:
-            case CommandType::IgnoreFirst: {
-                if (i == chunk.commands.size() - 1) {
-                    break;
-                }
+    std::vector<size_t> order(numChunks);
+    std::iota(order.begin(), order.end(), 0);
 
-                auto nextChunk = chunkFromCommand(chunk, i + 1);
-                auto skipChunk = chunkFromCommand(chunk, i + 2);
+    return {order, false};
+}
 
-                if (chunk.commands[i].type == CommandType::IgnoreVisited) {
-                    generateVisitJump(context, xrfContext, builder, index, chunks, stackJump, skipChunk, nextChunk);
-                }
-                else {
-                    generateVisitJump(context, xrfContext, builder, index, chunks, stackJump, nextChunk, skipChunk);
-                }
+/**
+ * Works out how partitioned code is split into functions.
+ *
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param chunks
+ *     The XRF chunks of the program
+ *
+ * @return
+ *     The functions that the code is split into
+ */
+PartitionLayout getPartitionLayout(const XrfContext &xrfContext, const std::vector<Chunk> &chunks) {
+    auto groups = partitionChunks(xrfContext, chunks);
 
-                return;
-            }
+    PartitionLayout layout;
+    layout.members.resize(groups.size());
+    layout.partitions.resize(chunks.size());
 
-            default:
-                break;
+    for (size_t i = 0; i < groups.size(); i++) {
+        for (auto chunk: groups[i]) {
+            layout.partitions[chunk] = i;
         }
     }
 
-    if (setVisited) {
-        builder.CreateStore(
-            llvm::ConstantInt::get(llvm::Type::getInt1Ty(context), 1),
-            emitVisited(*xrfContext.module, context, index)
-        );
+    // Each function's chunks are laid out in the same order as they would be
+    // in one function
+    for (auto i: getChunkOrder(xrfContext, chunks.size()).first) {
+        if (layout.partitions[i]) {
+            layout.members[*layout.partitions[i]].push_back(i);
+        }
     }
 
-    if (auto knownJump = chunk.nextChunk; knownJump) {
-        builder.CreateBr(chunks[*knownJump]);
+    layout.isEntry.resize(chunks.size());
+    layout.isEntry[0] = true;
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (!layout.partitions[i]) {
+            continue;
+        }
+
+        layout.isEntry[i] = layout.isEntry[i] || isDynamicTarget(xrfContext, i);
+
+        for (auto known: {chunks[i].nextChunk, chunks[i].visitedNextChunk}) {
+            if (known && *known < chunks.size() && layout.partitions[*known] != layout.partitions[i]) {
+                layout.isEntry[*known] = true;
+            }
+        }
     }
-    else {
-        builder.CreateBr(stackJump);
+
+    return layout;
+}
+
+/**
+ * Generates the LLVM code for partitioned code, which is split into
+ * functions that each have up to the partition size of chunks. The main
+ * function calls the function with the first chunk. With split code, only
+ * the main module's functions or the function of the module's partition are
+ * generated, and the rest of the functions are only declared.
+ *
+ * @param context
+ *     The LLVMContext used to generate LLVM code
+ * @param xrfContext
+ *     The XRFContext that has helpful fields for generating LLVM code from XRF
+ * @param chunks
+ *     The XRF chunks to turn into LLVM code
+ * @param layout
+ *     The functions that the code is split into
+ * @param hotFirst
+ *     Whether the layout puts the hot chunks first
+ */
+void generatePartitions(llvm::LLVMContext &context, XrfContext &xrfContext, const std::vector<Chunk> &chunks,
+                        const PartitionLayout &layout, bool hotFirst)
+{
+    auto partitionType = getPartitionType(context, xrfContext);
+
+    // Split code calls the functions in the other modules, so they're
+    // visible to every module, but not outside of the program
+    auto linkage = xrfContext.split ? llvm::Function::ExternalLinkage : llvm::Function::InternalLinkage;
+    std::string prefix = xrfContext.split ? "xrf_" : "";
+
+    auto createFunction = [&] (const std::string &name) {
+        auto func = llvm::Function::Create(partitionType, linkage, prefix + name, xrfContext.module);
+
+        if (xrfContext.split) {
+            func->setVisibility(llvm::GlobalValue::HiddenVisibility);
+        }
+
+        return func;
+    };
+
+    std::vector<llvm::Function*> partitions;
+    xrfContext.chunkFunctions.assign(chunks.size(), nullptr);
+
+    for (size_t i = 0; i < layout.members.size(); i++) {
+        auto func = createFunction("partition" + std::to_string(i));
+
+        for (auto chunk: layout.members[i]) {
+            xrfContext.chunkFunctions[chunk] = func;
+        }
+
+        partitions.push_back(func);
+    }
+
+    xrfContext.dispatchFunc = createFunction("dispatch");
+
+    if (!xrfContext.splitPartition) {
+        createDispatchFunction(context, xrfContext, partitions, chunks.size());
+    }
+
+    // The main function calls the first chunk's function before the state
+    // of the main function gets replaced by each function's own state
+    auto runBlock = llvm::BasicBlock::Create(context, "run", xrfContext.mainFunc);
+
+    llvm::IRBuilder builder(xrfContext.startBlock);
+    builder.CreateBr(runBlock);
+
+    builder.SetInsertPoint(runBlock);
+    emitPartitionJump(xrfContext, builder, xrfContext.chunkFunctions[0],
+                      llvm::ConstantInt::get(llvm::IntegerType::getInt32Ty(context), 0));
+
+    std::vector<llvm::BasicBlock*> chunkStarts(chunks.size());
+
+    for (size_t i = 0; i < partitions.size(); i++) {
+        if (!xrfContext.split || xrfContext.splitPartition == i) {
+            generatePartition(context, xrfContext, chunks, partitions[i], layout.members[i], layout.isEntry,
+                              chunkStarts, hotFirst);
+        }
     }
 }
 
@@ -1042,37 +4707,118 @@ void generateCodeForChunk(llvm::LLVMContext &context, XrfContext &xrfContext, co
  *     The XRFContext that has helpful fields for generating LLVM code from XRF
  * @param chunks
  *     The XRF chunks to turn into LLVM code
+ * @param layout
+ *     With partitioned code, the functions that the code is split into, or
+ *     nullptr to work them out
  */
-void generateChunks(llvm::LLVMContext &context, XrfContext &xrfContext, const std::vector<Chunk> &chunks) {
-    std::vector<llvm::BasicBlock*> chunkStarts;
+void generateChunks(llvm::LLVMContext &context, XrfContext &xrfContext, const std::vector<Chunk> &chunks,
+                    const PartitionLayout *layout = nullptr)
+{
+    if (xrfContext.instrument) {
+        createProfileCounters(*xrfContext.module, context, xrfContext, chunks.size());
+    }
 
-    for (size_t i = 0; i < chunks.size(); i++) {
-        chunkStarts.push_back(
-            llvm::BasicBlock::Create(context, "chunk" + std::to_string(i), xrfContext.mainFunc)
-        );
+    auto [order, hotFirst] = getChunkOrder(xrfContext, chunks.size());
+
+    if (xrfContext.partitionSize > 0) {
+        generatePartitions(context, xrfContext, chunks, layout ? *layout : getPartitionLayout(xrfContext, chunks),
+                           hotFirst);
+        return;
     }
 
-    auto *stackJump = createStackJump(context, xrfContext, chunkStarts);
+    // Chunks that can never be run don't get a block
+    std::vector<llvm::BasicBlock*> chunkStarts(chunks.size());
 
     for (size_t i = 0; i < chunks.size(); i++) {
-        generateCodeForChunk(context, xrfContext, chunks[i], i, chunkStarts[i], chunkStarts, stackJump);
+        if (isReachable(xrfContext, i)) {
+            chunkStarts[i] = createJumpTarget(context, xrfContext, "chunk" + std::to_string(i));
+        }
     }
 
     llvm::IRBuilder builder(xrfContext.startBlock);
 
-    builder.CreateBr(chunkStarts[0]);
+    emitJump(xrfContext, builder, chunkStarts[0]);
+
+    std::vector<size_t> targets(chunks.size());
+    std::iota(targets.begin(), targets.end(), 0);
+
+    generateChunkGroup(context, xrfContext, chunks, chunkStarts, order, targets, hotFirst);
+}
+
+/**
+ * Returns whether any of the chunks shuffle the stack.
+ *
+ * @param chunks
+ *     The XRF chunks of the program
+ *
+ * @return
+ *     Whether there's a Randomize command in any of the chunks
+ */
+bool usesRandom(const std::vector<Chunk> &chunks) {
+    auto isRandomize = [] (const Command &command) {
+        return command.type == CommandType::Randomize;
+    };
+
+    return std::any_of(chunks.begin(), chunks.end(), [&] (const Chunk &chunk) {
+        return std::any_of(chunk.commands.begin(), chunk.commands.end(), isRandomize) ||
+               (chunk.visitedCommands &&
+                std::any_of(chunk.visitedCommands->begin(), chunk.visitedCommands->end(), isRandomize));
+    });
 }
 
 } // anonymous namespace
 
-std::unique_ptr<llvm::Module> generateCode(llvm::LLVMContext &context, const std::vector<Chunk> &chunks) {
+std::unique_ptr<llvm::Module> generateCode(llvm::LLVMContext &context, const std::vector<Chunk> &chunks,
+                                           const CodegenOptions &options)
+{
     auto module = std::make_unique<llvm::Module>("xrf", context);
 
-    auto xrfContext = getGenerationContext(*module, context);
+    auto xrfContext = getGenerationContext(*module, context, options, chunks.size());
 
     generateChunks(context, xrfContext, chunks);
 
     return module;
 }
 
+PartitionLayout layoutPartitions(const std::vector<Chunk> &chunks, const CodegenOptions &options) {
+    XrfContext xrfContext;
+
+    xrfContext.partitionSize = options.partitionSize;
+    xrfContext.instrument = options.instrument;
+    xrfContext.profile = options.profile;
+    xrfContext.jumpTargets = options.jumpTargets;
+
+    auto layout = getPartitionLayout(xrfContext, chunks);
+    layout.random = usesRandom(chunks);
+
+    return layout;
+}
+
+std::unique_ptr<llvm::Module> generateSplitModule(llvm::LLVMContext &context, const std::vector<Chunk> &chunks,
+                                                  const CodegenOptions &options, const PartitionLayout &layout,
+                                                  std::optional<size_t> partition)
+{
+    auto module = std::make_unique<llvm::Module>(
+        partition ? "xrf-partition" + std::to_string(*partition) : "xrf", context
+    );
+
+    auto xrfContext = getGenerationContext(*module, context, options, chunks.size(), true, partition);
+    auto mainFunc = xrfContext.mainFunc;
+
+    generateChunks(context, xrfContext, chunks, &layout);
+
+    if (partition) {
+        // The partition's copy of the main function only sets up the shared
+        // variables, which the main module does instead
+        mainFunc->eraseFromParent();
+    }
+    else if (layout.random) {
+        // The generator is seeded in the main function, even though only the
+        // partitions shuffle the stack
+        getRandomState(context, xrfContext);
+    }
+
+    return module;
+}
+
 } // namespace xrf
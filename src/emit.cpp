@@ -0,0 +1,352 @@
+#include "emit.hpp"
+
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+
+#if LLVM_VERSION_MAJOR >= 14
+#include "llvm/MC/TargetRegistry.h"
+#else
+#include "llvm/Support/TargetRegistry.h"
+#endif
+
+#include <cctype>
+#include <mutex>
+
+namespace xrf {
+
+namespace {
+
+#if LLVM_VERSION_MAJOR >= 14
+using OptimizationLevel = llvm::OptimizationLevel;
+#else
+using OptimizationLevel = llvm::PassBuilder::OptimizationLevel;
+#endif
+
+#if LLVM_VERSION_MAJOR >= 18
+using CodeGenLevel = llvm::CodeGenOptLevel;
+constexpr auto ASSEMBLY_FILE = llvm::CodeGenFileType::AssemblyFile;
+constexpr auto OBJECT_FILE = llvm::CodeGenFileType::ObjectFile;
+#else
+using CodeGenLevel = llvm::CodeGenOpt::Level;
+constexpr auto ASSEMBLY_FILE = llvm::CGFT_AssemblyFile;
+constexpr auto OBJECT_FILE = llvm::CGFT_ObjectFile;
+#endif
+
+/**
+ * Converts a numeric optimization level to the level the PassBuilder uses.
+ *
+ * @param optLevel
+ *     The optimization level, from 1 to 3
+ *
+ * @return
+ *     The corresponding PassBuilder optimization level
+ */
+OptimizationLevel getPassBuilderLevel(int optLevel) {
+    switch (optLevel) {
+        case 1:  return OptimizationLevel::O1;
+        case 2:  return OptimizationLevel::O2;
+        default: return OptimizationLevel::O3;
+    }
+}
+
+/**
+ * Converts a numeric optimization level to the level used for generating
+ * native code.
+ *
+ * @param optLevel
+ *     The optimization level, from 0 to 3
+ *
+ * @return
+ *     The corresponding code generation optimization level
+ */
+CodeGenLevel getCodeGenLevel(int optLevel) {
+    switch (optLevel) {
+        case 0:  return CodeGenLevel::None;
+        case 1:  return CodeGenLevel::Less;
+        case 2:  return CodeGenLevel::Default;
+        default: return CodeGenLevel::Aggressive;
+    }
+}
+
+/**
+ * Compiles a module to native code, writing out the result to a file.
+ *
+ * @param module
+ *     The module to compile
+ * @param targetMachine
+ *     The machine to compile the module for
+ * @param fileType
+ *     Whether to write out assembly or an object file
+ * @param filename
+ *     The file to write to
+ *
+ * @return
+ *     An error if the module couldn't be compiled or written
+ */
+template <typename FileType>
+llvm::Error writeNativeFile(llvm::Module &module, llvm::TargetMachine &targetMachine, FileType fileType,
+                            const std::string &filename)
+{
+    std::error_code err;
+    llvm::raw_fd_ostream outFile(filename, err, llvm::sys::fs::OF_None);
+
+    if (err) {
+        return llvm::createStringError(err, "Unable to write to %s", filename.c_str());
+    }
+
+    module.setTargetTriple(targetMachine.getTargetTriple().str());
+    module.setDataLayout(targetMachine.createDataLayout());
+
+    llvm::legacy::PassManager passManager;
+
+    if (targetMachine.addPassesToEmitFile(passManager, outFile, nullptr, fileType)) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "The target machine can't emit a file of this type");
+    }
+
+    passManager.run(module);
+    return llvm::Error::success();
+}
+
+/**
+ * Quotes an argument for a response file, in the form that cc reads them.
+ *
+ * @param arg
+ *     The argument to quote
+ *
+ * @return
+ *     The argument, with a backslash before every character that would
+ *     otherwise end it or be taken as quoting
+ */
+std::string quoteResponseArg(llvm::StringRef arg) {
+    std::string quoted;
+
+    for (auto c: arg) {
+        if (c == '\\' || c == '"' || c == '\'' || std::isspace(static_cast<unsigned char>(c))) {
+            quoted += '\\';
+        }
+
+        quoted += c;
+    }
+
+    return quoted;
+}
+
+/**
+ * Links object files with the system's C compiler. Object files that are too
+ * many to pass on the command line are passed in a response file instead.
+ *
+ * @param objects
+ *     The object files to link
+ * @param relocatable
+ *     Whether to link the objects into one object file, rather than into an
+ *     executable
+ * @param filename
+ *     The file to write the linked file to
+ *
+ * @return
+ *     An error if the objects couldn't be linked
+ */
+llvm::Error runLinker(const std::vector<std::string> &objects, bool relocatable, const std::string &filename) {
+    auto linker = llvm::sys::findProgramByName("cc");
+
+    if (!linker) {
+        return llvm::createStringError(linker.getError(), "Unable to find cc to link the executable with");
+    }
+
+    std::vector<llvm::StringRef> args = {*linker};
+
+    if (relocatable) {
+        args.push_back("-r");
+    }
+
+    args.insert(args.end(), objects.begin(), objects.end());
+    args.insert(args.end(), {"-o", filename});
+
+    llvm::SmallString<128> responseFile;
+    std::string responseArg;
+
+    if (!llvm::sys::commandLineFitsWithinSystemLimits(*linker, args)) {
+        if (auto err = llvm::sys::fs::createTemporaryFile("xrfc", "rsp", responseFile)) {
+            return llvm::createStringError(err, "Unable to create a temporary response file");
+        }
+
+        std::error_code err;
+        llvm::raw_fd_ostream out(responseFile, err, llvm::sys::fs::OF_Text);
+
+        if (err) {
+            llvm::sys::fs::remove(responseFile);
+            return llvm::createStringError(err, "Unable to write to %s", responseFile.c_str());
+        }
+
+        for (auto arg = args.begin() + 1; arg != args.end(); ++arg) {
+            out << quoteResponseArg(*arg) << '\n';
+        }
+
+        out.close();
+
+        responseArg = "@" + std::string(responseFile);
+        args = {*linker, responseArg};
+    }
+
+    std::string errorMsg;
+
+    auto result = llvm::sys::ExecuteAndWait(*linker, args, {}, {}, 0, 0, &errorMsg);
+
+    if (!responseFile.empty()) {
+        llvm::sys::fs::remove(responseFile);
+    }
+
+    if (result != 0) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(), "Linking %s failed: %s",
+                                       filename.c_str(), errorMsg.c_str());
+    }
+
+    return llvm::Error::success();
+}
+
+/**
+ * Compiles a module into an executable, by writing out an object file and
+ * linking it with the system's C compiler.
+ *
+ * @param module
+ *     The module to compile
+ * @param targetMachine
+ *     The machine to compile the module for
+ * @param filename
+ *     The file to write the executable to
+ *
+ * @return
+ *     An error if the module couldn't be compiled or linked
+ */
+llvm::Error writeExecutable(llvm::Module &module, llvm::TargetMachine &targetMachine, const std::string &filename) {
+    llvm::SmallString<128> objectFile;
+
+    if (auto err = llvm::sys::fs::createTemporaryFile("xrfc", "o", objectFile)) {
+        return llvm::createStringError(err, "Unable to create a temporary object file");
+    }
+
+    if (auto err = writeNativeFile(module, targetMachine, OBJECT_FILE, objectFile.str().str())) {
+        llvm::sys::fs::remove(objectFile);
+        return err;
+    }
+
+    auto err = runLinker({objectFile.str().str()}, false, filename);
+
+    llvm::sys::fs::remove(objectFile);
+
+    return err;
+}
+
+} // anonymous namespace
+
+llvm::Expected<std::unique_ptr<llvm::TargetMachine>> createTargetMachine(int optLevel) {
+    // Files compiled together each create their own target machine on their
+    // own thread, but the target only needs to be registered once
+    static std::once_flag initialized;
+
+    std::call_once(initialized, [] {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+    });
+
+    auto triple = llvm::sys::getDefaultTargetTriple();
+
+    std::string errorMsg;
+    auto target = llvm::TargetRegistry::lookupTarget(triple, errorMsg);
+
+    if (!target) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(), errorMsg);
+    }
+
+    std::unique_ptr<llvm::TargetMachine> targetMachine{target->createTargetMachine(
+        triple, "generic", "", llvm::TargetOptions(), llvm::Reloc::PIC_, {}, getCodeGenLevel(optLevel)
+    )};
+
+    if (!targetMachine) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "Unable to create a target machine for %s", triple.c_str());
+    }
+
+    return targetMachine;
+}
+
+void optimizeModule(llvm::Module &module, llvm::TargetMachine &targetMachine, int optLevel) {
+    module.setTargetTriple(targetMachine.getTargetTriple().str());
+    module.setDataLayout(targetMachine.createDataLayout());
+
+    if (optLevel <= 0) {
+        return;
+    }
+
+    llvm::LoopAnalysisManager loopAnalysis;
+    llvm::FunctionAnalysisManager functionAnalysis;
+    llvm::CGSCCAnalysisManager cgsccAnalysis;
+    llvm::ModuleAnalysisManager moduleAnalysis;
+
+    llvm::PassBuilder passBuilder(&targetMachine);
+
+    passBuilder.registerModuleAnalyses(moduleAnalysis);
+    passBuilder.registerCGSCCAnalyses(cgsccAnalysis);
+    passBuilder.registerFunctionAnalyses(functionAnalysis);
+    passBuilder.registerLoopAnalyses(loopAnalysis);
+    passBuilder.crossRegisterProxies(loopAnalysis, functionAnalysis, cgsccAnalysis, moduleAnalysis);
+
+    auto passManager = passBuilder.buildPerModuleDefaultPipeline(getPassBuilderLevel(optLevel));
+
+    passManager.run(module, moduleAnalysis);
+}
+
+llvm::Error writeModule(llvm::Module &module, llvm::TargetMachine &targetMachine, OutputType type,
+                        const std::string &filename)
+{
+    switch (type) {
+        case OutputType::Assembly:
+            return writeNativeFile(module, targetMachine, ASSEMBLY_FILE, filename);
+
+        case OutputType::Object:
+            return writeNativeFile(module, targetMachine, OBJECT_FILE, filename);
+
+        case OutputType::Executable:
+            return writeExecutable(module, targetMachine, filename);
+
+        case OutputType::Bitcode:
+        case OutputType::IR:
+            break;
+    }
+
+    std::error_code err;
+    llvm::raw_fd_ostream outFile(filename, err,
+                                 type == OutputType::IR ? llvm::sys::fs::OF_Text : llvm::sys::fs::OF_None);
+
+    if (err) {
+        return llvm::createStringError(err, "Unable to write to %s", filename.c_str());
+    }
+
+    if (type == OutputType::IR) {
+        module.print(outFile, nullptr);
+    }
+    else {
+        llvm::WriteBitcodeToFile(module, outFile);
+    }
+
+    return llvm::Error::success();
+}
+
+llvm::Error linkObjects(const std::vector<std::string> &objects, OutputType type, const std::string &filename) {
+    if (type != OutputType::Executable && type != OutputType::Object) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "Object files can only be linked into an executable or an object file");
+    }
+
+    return runLinker(objects, type == OutputType::Object, filename);
+}
+
+} // namespace xrf
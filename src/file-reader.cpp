@@ -1,6 +1,8 @@
 #include "file-reader.hpp"
 
+#include <algorithm>
 #include <istream>
+#include <iterator>
 
 namespace xrf {
 
@@ -28,6 +30,21 @@ std::optional<char> FileReader::read() {
     return c;
 }
 
+std::string FileReader::readAll() {
+    std::string contents{std::istreambuf_iterator<char>(_file), std::istreambuf_iterator<char>()};
+
+    _line += std::count(contents.begin(), contents.end(), '\n');
+
+    if (auto lastNewline = contents.rfind('\n'); lastNewline != std::string::npos) {
+        _col = contents.size() - lastNewline - 1;
+    }
+    else {
+        _col += contents.size();
+    }
+
+    return contents;
+}
+
 bool FileReader::ended() const {
     return _file.eof();
 }
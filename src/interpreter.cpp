@@ -0,0 +1,763 @@
+#include "interpreter.hpp"
+#include "random.hpp"
+
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <new>
+#include <optional>
+#include <utility>
+
+// With GCC and Clang, each instruction holds the address of the code that
+// runs it, and every handler jumps straight to the next instruction's handler
+// through a computed goto. Otherwise, the instructions are run with a switch
+// in a loop instead.
+#if defined(__GNUC__)
+#define XRF_DIRECT_THREADED
+#endif
+
+namespace xrf {
+
+namespace {
+
+/**
+ * The operations that the interpreter runs, which are the commands that do
+ * something, along with operations for the flow control between chunks.
+ */
+#define XRF_INTERPRETER_OPS(X) \
+    X(Input)                   \
+    X(TranslateInput)          \
+    X(Output)                  \
+    X(Pop)                     \
+    X(Dup)                     \
+    X(Swap)                    \
+    X(Inc)                     \
+    X(Dec)                     \
+    X(Add)                     \
+    X(Bottom)                  \
+    X(Sub)                     \
+    X(AddToSecond)             \
+    X(MultiplySecond)          \
+    X(PopSecondValue)          \
+    X(PushSecondValue)         \
+    X(PushValueToBottom)       \
+    X(SetSecondValue)          \
+    X(SetTop)                  \
+    X(OutputValue)             \
+    X(Shuffle)                 \
+    X(ShuffleValue)            \
+    X(Randomize)               \
+    X(SkipIfVisited)           \
+    X(SkipIfFirst)             \
+    X(SetVisited)              \
+    X(JumpTo)                  \
+    X(Dispatch)                \
+    X(Exit)
+
+enum class Op : uint8_t {
+#define XRF_OP_ENUM(name) name,
+    XRF_INTERPRETER_OPS(XRF_OP_ENUM)
+#undef XRF_OP_ENUM
+};
+
+/**
+ * A single instruction for the interpreter to run.
+ */
+struct Instruction {
+    /**
+     * The address of the code that runs the instruction, when the
+     * interpreter is direct threaded
+     */
+    const void *handler = nullptr;
+
+    /**
+     * The operation the instruction does
+     */
+    Op op;
+
+    /**
+     * The value used by the instruction, as with Command::val, or the index
+     * of the chunk whose visited flag the instruction uses
+     */
+    uint32_t val = 0;
+
+    /**
+     * The slot on the stack the instruction uses, as with Command::slot
+     */
+    uint32_t slot = 0;
+
+    /**
+     * The multiple of the value from the stack, as with Command::multiple
+     */
+    uint32_t multiple = 0;
+
+    /**
+     * The slot of the value that's added, as with Command::addedSlot
+     */
+    uint32_t addedSlot = 0;
+
+    /**
+     * The multiple of the value that's added, as with Command::addedMultiple
+     */
+    uint32_t addedMultiple = 0;
+
+    /**
+     * For instructions that jump, the index of the instruction they jump to
+     */
+    uint32_t target = 0;
+
+    /**
+     * For TranslateInput instructions, the table that input is translated by
+     */
+    const InputTranslation *translation = nullptr;
+};
+
+/**
+ * A program translated into instructions for the interpreter.
+ */
+struct Program {
+    /**
+     * The instructions of every chunk
+     */
+    std::vector<Instruction> code;
+
+    /**
+     * The index of the first instruction of each chunk
+     */
+    std::vector<uint32_t> chunkStarts;
+};
+
+/**
+ * Creates an instruction.
+ *
+ * @param op
+ *     The operation the instruction does
+ * @param val
+ *     The value the instruction uses
+ *
+ * @return
+ *     The new instruction
+ */
+Instruction makeInstruction(Op op, uint32_t val = 0) {
+    Instruction instruction;
+    instruction.op = op;
+    instruction.val = val;
+    return instruction;
+}
+
+/**
+ * Creates an instruction for a command that computes a value from a value on
+ * the stack, or for one of the new values of a shuffle.
+ *
+ * @param op
+ *     The operation the instruction does
+ * @param command
+ *     The command the instruction is made from
+ *
+ * @return
+ *     The new instruction
+ */
+Instruction makeComputedInstruction(Op op, const Command &command) {
+    auto instruction = makeInstruction(op, static_cast<uint32_t>(command.val));
+    instruction.slot = command.slot;
+    instruction.multiple = command.multiple;
+    instruction.addedSlot = command.addedSlot;
+    instruction.addedMultiple = command.addedMultiple;
+    return instruction;
+}
+
+/**
+ * Adds the instructions that end a chunk, which mark the chunk as visited if
+ * needed, and then jump to the next chunk.
+ *
+ * @param program
+ *     The program to add the instructions to
+ * @param index
+ *     The index of the chunk
+ * @param setVisited
+ *     Whether the chunk gets marked as visited
+ * @param nextChunk
+ *     The next chunk to jump to, if known
+ * @param numChunks
+ *     The number of chunks in the program
+ */
+void addChunkEnd(Program &program, size_t index, bool setVisited, std::optional<unsigned> nextChunk,
+                 size_t numChunks)
+{
+    if (setVisited) {
+        program.code.push_back(makeInstruction(Op::SetVisited, index));
+    }
+
+    // Known jumps are resolved to the chunk's first instruction once every
+    // chunk has been translated
+    if (nextChunk && *nextChunk < numChunks) {
+        program.code.push_back(makeInstruction(Op::JumpTo, *nextChunk));
+    }
+    else {
+        program.code.push_back(makeInstruction(Op::Dispatch));
+    }
+}
+
+/**
+ * Translates a list of commands from a chunk into instructions. This works
+ * for commands that have been optimized, and for commands with Ignore
+ * commands, which skip over the instructions for the command after them.
+ *
+ * @param program
+ *     The program to add the instructions to
+ * @param commands
+ *     The commands to translate
+ * @param chunk
+ *     The chunk the commands are from
+ * @param index
+ *     The index of the chunk
+ * @param setVisited
+ *     Whether the chunk gets marked as visited after running the commands
+ * @param nextChunk
+ *     The next chunk to jump to after running the commands, if known
+ * @param numChunks
+ *     The number of chunks in the program
+ */
+void translateCommands(Program &program, const std::vector<Command> &commands, const Chunk &chunk, size_t index,
+                       bool setVisited, std::optional<unsigned> nextChunk, size_t numChunks)
+{
+    auto &code = program.code;
+
+    // The Skip instruction for the Ignore command before the current one,
+    // which skips to the end of the current command's instructions
+    std::optional<size_t> pendingSkip;
+
+    for (size_t i = 0; i < commands.size(); i++) {
+        const auto &command = commands[i];
+        std::optional<size_t> skip;
+        bool endsChunk = false;
+
+        switch (command.type) {
+            case CommandType::Input:
+                code.push_back(makeInstruction(Op::Input));
+                break;
+
+            case CommandType::TranslateInput: {
+                auto instruction = makeInstruction(Op::TranslateInput);
+                instruction.translation = chunk.translation.get();
+                code.push_back(instruction);
+                break;
+            }
+
+            case CommandType::Output:
+                code.push_back(makeInstruction(Op::Output));
+                break;
+
+            case CommandType::Pop:
+                code.push_back(makeInstruction(Op::Pop));
+                break;
+
+            case CommandType::Dup:
+                code.push_back(makeInstruction(Op::Dup));
+                break;
+
+            case CommandType::Swap:
+                code.push_back(makeInstruction(Op::Swap));
+                break;
+
+            case CommandType::Inc:
+                code.push_back(makeInstruction(Op::Inc));
+                break;
+
+            case CommandType::Dec:
+                code.push_back(makeInstruction(Op::Dec));
+                break;
+
+            case CommandType::Add:
+                code.push_back(makeInstruction(Op::Add));
+                break;
+
+            case CommandType::Bottom:
+                code.push_back(makeInstruction(Op::Bottom));
+                break;
+
+            case CommandType::Sub:
+                code.push_back(makeInstruction(Op::Sub));
+                break;
+
+            case CommandType::AddToSecond:
+                code.push_back(makeInstruction(Op::AddToSecond, static_cast<uint32_t>(command.val)));
+                break;
+
+            case CommandType::MultiplySecond:
+                code.push_back(makeInstruction(Op::MultiplySecond, static_cast<uint32_t>(command.val)));
+                break;
+
+            case CommandType::PopSecondValue:
+                code.push_back(makeInstruction(Op::PopSecondValue));
+                break;
+
+            case CommandType::PushSecondValue:
+                code.push_back(makeInstruction(Op::PushSecondValue, static_cast<uint32_t>(command.val)));
+                break;
+
+            case CommandType::PushValueToBottom:
+                code.push_back(makeComputedInstruction(Op::PushValueToBottom, command));
+                break;
+
+            case CommandType::SetSecondValue:
+                code.push_back(makeInstruction(Op::SetSecondValue, static_cast<uint32_t>(command.val)));
+                break;
+
+            case CommandType::SetTop:
+                code.push_back(makeInstruction(Op::SetTop, static_cast<uint32_t>(command.val)));
+                break;
+
+            case CommandType::OutputValue:
+                code.push_back(makeComputedInstruction(Op::OutputValue, command));
+                break;
+
+            case CommandType::BeginShuffle:
+                code.push_back(makeComputedInstruction(Op::Shuffle, command));
+
+                for (int j = 1; j <= command.val; j++) {
+                    code.push_back(makeComputedInstruction(Op::ShuffleValue, commands[i + j]));
+                }
+
+                i += command.val;
+                break;
+
+            case CommandType::Randomize:
+                code.push_back(makeInstruction(Op::Randomize));
+                break;
+
+            case CommandType::IgnoreFirst:
+            case CommandType::IgnoreVisited:
+                // An Ignore command at the end of a chunk has nothing to skip
+                if (i + 1 < commands.size()) {
+                    skip = code.size();
+                    code.push_back(makeInstruction(
+                        command.type == CommandType::IgnoreFirst ? Op::SkipIfFirst : Op::SkipIfVisited, index));
+                }
+                break;
+
+            case CommandType::Jump:
+                addChunkEnd(program, index, setVisited, nextChunk, numChunks);
+                endsChunk = true;
+                break;
+
+            case CommandType::Exit:
+                code.push_back(makeInstruction(Op::Exit));
+                endsChunk = true;
+                break;
+
+            default:
+                break;
+        }
+
+        // The commands after one that ends the chunk only run if that
+        // command gets skipped
+        if (endsChunk && !pendingSkip) {
+            return;
+        }
+
+        if (pendingSkip) {
+            code[*pendingSkip].target = code.size();
+        }
+
+        pendingSkip = skip;
+    }
+
+    addChunkEnd(program, index, setVisited, nextChunk, numChunks);
+}
+
+/**
+ * Returns whether a chunk that hasn't been split by whether it's been visited
+ * does anything different depending on whether it's been visited.
+ *
+ * @param chunk
+ *     The chunk to check
+ *
+ * @return
+ *     Whether the chunk has an Ignore command that skips another command
+ */
+bool checksVisited(const Chunk &chunk) {
+    for (size_t i = 0; i + 1 < chunk.commands.size(); i++) {
+        auto type = chunk.commands[i].type;
+
+        if (type == CommandType::IgnoreFirst || type == CommandType::IgnoreVisited) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Translates every chunk of a program into instructions for the interpreter.
+ *
+ * @param chunks
+ *     The chunks of the program
+ *
+ * @return
+ *     The translated program
+ */
+Program translateProgram(const std::vector<Chunk> &chunks) {
+    Program program;
+    program.chunkStarts.reserve(chunks.size());
+    program.code.reserve(chunks.size() * (COMMANDS_PER_CHUNK + 2));
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        const auto &chunk = chunks[i];
+
+        program.chunkStarts.push_back(program.code.size());
+
+        if (chunk.visitedCommands) {
+            // The chunk skips to its visited commands once it's been visited
+            auto check = program.code.size();
+            program.code.push_back(makeInstruction(Op::SkipIfVisited, i));
+
+            translateCommands(program, chunk.commands, chunk, i, true, chunk.nextChunk, chunks.size());
+
+            program.code[check].target = program.code.size();
+
+            translateCommands(program, *chunk.visitedCommands, chunk, i, false, chunk.visitedNextChunk,
+                              chunks.size());
+        }
+        else {
+            translateCommands(program, chunk.commands, chunk, i, checksVisited(chunk), chunk.nextChunk,
+                              chunks.size());
+        }
+    }
+
+    for (auto &instruction: program.code) {
+        if (instruction.op == Op::JumpTo) {
+            instruction.target = program.chunkStarts[instruction.val];
+        }
+    }
+
+    return program;
+}
+
+#if defined(XRF_DIRECT_THREADED)
+// Taking the address of a label is a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+/**
+ * Runs a translated program.
+ *
+ * @param program
+ *     The program to run, whose instructions are given the addresses of their
+ *     handlers when the interpreter is direct threaded
+ * @param numChunks
+ *     The number of chunks in the program
+ * @param stackSize
+ *     The number of values the stack can hold, which is a power of two
+ * @param input
+ *     The file to read input from
+ * @param output
+ *     The file to write output to
+ * @param seed
+ *     The seed for the generator that Randomize instructions shuffle the
+ *     stack with
+ *
+ * @return
+ *     The exit status of the program
+ */
+int runProgram(Program &program, size_t numChunks, uint64_t stackSize, std::FILE *input, std::FILE *output,
+               uint64_t seed)
+{
+    // The stack is zeroed by calloc(), so large stacks only get paged in as
+    // they're used, as with a stack that's mapped with mmap()
+    std::unique_ptr<uint32_t[], decltype(&std::free)> stack(
+        static_cast<uint32_t*>(std::calloc(stackSize, sizeof(uint32_t))), &std::free);
+
+    if (!stack) {
+        throw std::bad_alloc();
+    }
+
+    // As with the generated code, the top value is kept apart from the rest
+    // of the stack, which starts with the number of the first chunk
+    uint64_t mask = stackSize - 1;
+    uint64_t topIndex = 0;
+    uint64_t bottomIndex = mask;
+    uint32_t top = 0;
+
+    std::vector<uint8_t> visited(numChunks);
+    std::vector<uint32_t> shuffled;
+    auto random = seedRandom(seed);
+
+    auto push = [&](uint32_t value) {
+        stack[topIndex] = top;
+        top = value;
+        topIndex = (topIndex + 1) & mask;
+    };
+
+    auto pop = [&] {
+        topIndex = (topIndex - 1) & mask;
+        top = stack[topIndex];
+    };
+
+    auto second = [&]() -> uint32_t& {
+        return stack[(topIndex - 1) & mask];
+    };
+
+    auto pushBottom = [&](uint32_t value) {
+        stack[bottomIndex] = value;
+        bottomIndex = (bottomIndex - 1) & mask;
+    };
+
+    auto slotValue = [&](uint32_t slot) -> uint32_t {
+        return slot == 0 ? top : stack[(topIndex - slot) & mask];
+    };
+
+    auto compute = [&](const Instruction &instruction) -> uint32_t {
+        if (instruction.multiple == 0) {
+            return instruction.val;
+        }
+
+        auto value = slotValue(instruction.slot) * instruction.multiple + instruction.val;
+
+        if (instruction.addedMultiple != 0) {
+            value += slotValue(instruction.addedSlot) * instruction.addedMultiple;
+        }
+
+        return value;
+    };
+
+    auto readByte = [&]() -> uint32_t {
+        auto c = std::getc(input);
+        return c == EOF ? 0 : c;
+    };
+
+    auto writeByte = [&](uint32_t value) {
+        std::putc(static_cast<unsigned char>(value), output);
+    };
+
+    if (numChunks == 0) {
+        return 1;
+    }
+
+    const auto *code = program.code.data();
+    const auto *ip = code + program.chunkStarts[0];
+
+#if defined(XRF_DIRECT_THREADED)
+    static const void *const HANDLERS[] = {
+#define XRF_OP_HANDLER(name) &&name##Handler,
+        XRF_INTERPRETER_OPS(XRF_OP_HANDLER)
+#undef XRF_OP_HANDLER
+    };
+
+    for (auto &instruction: program.code) {
+        instruction.handler = HANDLERS[static_cast<size_t>(instruction.op)];
+    }
+
+#define XRF_HANDLER(name) name##Handler:
+#define XRF_DISPATCH() goto *ip->handler
+#else
+#define XRF_HANDLER(name) case Op::name:
+#define XRF_DISPATCH() continue
+#endif
+
+#define XRF_NEXT() \
+    ip++;          \
+    XRF_DISPATCH()
+
+#if defined(XRF_DIRECT_THREADED)
+    XRF_DISPATCH();
+#else
+    for (;;) switch (ip->op) {
+#endif
+
+    XRF_HANDLER(Input)
+        push(readByte());
+        XRF_NEXT();
+
+    XRF_HANDLER(TranslateInput)
+        for (;;) {
+            auto c = readByte();
+            auto translated = (*ip->translation)[c];
+
+            if (translated == TRANSLATE_STOP) {
+                push(c);
+                break;
+            }
+
+            if (translated != TRANSLATE_NO_OUTPUT) {
+                writeByte(translated);
+            }
+        }
+        XRF_NEXT();
+
+    XRF_HANDLER(Output)
+        writeByte(top);
+        pop();
+        XRF_NEXT();
+
+    XRF_HANDLER(Pop)
+        pop();
+        XRF_NEXT();
+
+    XRF_HANDLER(Dup)
+        push(top);
+        XRF_NEXT();
+
+    XRF_HANDLER(Swap)
+        std::swap(top, second());
+        XRF_NEXT();
+
+    XRF_HANDLER(Inc)
+        top++;
+        XRF_NEXT();
+
+    XRF_HANDLER(Dec)
+        top--;
+        XRF_NEXT();
+
+    XRF_HANDLER(Add) {
+        auto value = top;
+        pop();
+        top += value;
+        XRF_NEXT();
+    }
+
+    XRF_HANDLER(Bottom) {
+        auto value = top;
+        pop();
+        pushBottom(value);
+        XRF_NEXT();
+    }
+
+    XRF_HANDLER(Sub) {
+        auto value = top;
+        pop();
+        top = value > top ? value - top : top - value;
+        XRF_NEXT();
+    }
+
+    XRF_HANDLER(AddToSecond)
+        second() += ip->val;
+        XRF_NEXT();
+
+    XRF_HANDLER(MultiplySecond)
+        second() *= ip->val;
+        XRF_NEXT();
+
+    XRF_HANDLER(PopSecondValue)
+        topIndex = (topIndex - 1) & mask;
+        XRF_NEXT();
+
+    XRF_HANDLER(PushSecondValue)
+        stack[topIndex] = ip->val;
+        topIndex = (topIndex + 1) & mask;
+        XRF_NEXT();
+
+    XRF_HANDLER(PushValueToBottom)
+        pushBottom(compute(*ip));
+        XRF_NEXT();
+
+    XRF_HANDLER(SetSecondValue)
+        second() = ip->val;
+        XRF_NEXT();
+
+    XRF_HANDLER(SetTop)
+        top = ip->val;
+        XRF_NEXT();
+
+    XRF_HANDLER(OutputValue)
+        writeByte(compute(*ip));
+        XRF_NEXT();
+
+    XRF_HANDLER(Shuffle) {
+        // Every new value is computed from the stack before any values are
+        // replaced
+        shuffled.clear();
+
+        for (uint32_t i = 1; i <= ip->val; i++) {
+            shuffled.push_back(compute(ip[i]));
+        }
+
+        if (ip->slot > 0) {
+            topIndex = (topIndex - ip->slot) & mask;
+            top = stack[topIndex];
+        }
+
+        for (auto value: shuffled) {
+            push(value);
+        }
+
+        ip += ip->val + 1;
+        XRF_DISPATCH();
+    }
+
+    // The new values of a shuffle are skipped over by the Shuffle
+    // instruction, so this is never reached
+    XRF_HANDLER(ShuffleValue)
+        XRF_NEXT();
+
+    XRF_HANDLER(Randomize) {
+        // The top value is stored above the rest of the stack, so that
+        // every value is shuffled in place, with the nth value of the stack
+        // at topIndex - n
+        stack[topIndex] = top;
+
+        for (uint64_t i = (topIndex - bottomIndex - 1) & mask; i > 0; i--) {
+            auto j = randomBelow(random, i + 1);
+            std::swap(stack[(topIndex - i) & mask], stack[(topIndex - j) & mask]);
+        }
+
+        top = stack[topIndex];
+        XRF_NEXT();
+    }
+
+    XRF_HANDLER(SkipIfVisited)
+        ip = visited[ip->val] ? code + ip->target : ip + 1;
+        XRF_DISPATCH();
+
+    XRF_HANDLER(SkipIfFirst)
+        ip = visited[ip->val] ? ip + 1 : code + ip->target;
+        XRF_DISPATCH();
+
+    XRF_HANDLER(SetVisited)
+        visited[ip->val] = true;
+        XRF_NEXT();
+
+    XRF_HANDLER(JumpTo)
+        ip = code + ip->target;
+        XRF_DISPATCH();
+
+    XRF_HANDLER(Dispatch)
+        if (top >= numChunks) {
+            std::fflush(output);
+            return 1;
+        }
+
+        ip = code + program.chunkStarts[top];
+        XRF_DISPATCH();
+
+    XRF_HANDLER(Exit)
+        std::fflush(output);
+        return 0;
+
+#if !defined(XRF_DIRECT_THREADED)
+    }
+#endif
+
+#undef XRF_NEXT
+#undef XRF_DISPATCH
+#undef XRF_HANDLER
+}
+
+#if defined(XRF_DIRECT_THREADED)
+#pragma GCC diagnostic pop
+#endif
+
+} // anonymous namespace
+
+int interpret(const std::vector<Chunk> &chunks, uint64_t stackSize, std::FILE *input, std::FILE *output,
+              std::optional<uint64_t> seed)
+{
+    auto program = translateProgram(chunks);
+
+    return runProgram(program, chunks.size(), stackSize, input, output,
+                      seed.value_or(static_cast<uint64_t>(std::time(nullptr))));
+}
+
+} // namespace xrf
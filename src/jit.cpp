@@ -0,0 +1,63 @@
+#include "jit.hpp"
+
+#include "llvm/Config/llvm-config.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/Support/TargetSelect.h"
+
+namespace xrf {
+
+llvm::Expected<std::unique_ptr<llvm::orc::LLJIT>> compileModule(std::unique_ptr<llvm::LLVMContext> context,
+                                                                 std::unique_ptr<llvm::Module> module)
+{
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    auto jit = llvm::orc::LLJITBuilder().create();
+
+    if (!jit) {
+        return jit.takeError();
+    }
+
+    // Let the JIT'd code find getchar(), putchar() and friends in our process
+    auto processSymbols = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        (*jit)->getDataLayout().getGlobalPrefix()
+    );
+
+    if (!processSymbols) {
+        return processSymbols.takeError();
+    }
+
+    (*jit)->getMainJITDylib().addGenerator(std::move(*processSymbols));
+
+    if (auto err = (*jit)->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context)))) {
+        return err;
+    }
+
+    return std::move(*jit);
+}
+
+llvm::Expected<int> runModule(std::unique_ptr<llvm::LLVMContext> context, std::unique_ptr<llvm::Module> module) {
+    auto jit = compileModule(std::move(context), std::move(module));
+
+    if (!jit) {
+        return jit.takeError();
+    }
+
+    auto mainSymbol = (*jit)->lookup("main");
+
+    if (!mainSymbol) {
+        return mainSymbol.takeError();
+    }
+
+#if LLVM_VERSION_MAJOR >= 15
+    auto mainFunc = mainSymbol->toPtr<int (*)()>();
+#else
+    auto mainFunc = reinterpret_cast<int (*)()>(mainSymbol->getAddress());
+#endif
+
+    return mainFunc();
+}
+
+} // namespace xrf
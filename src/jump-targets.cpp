@@ -0,0 +1,798 @@
+#include "jump-targets.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <optional>
+
+namespace xrf {
+
+namespace {
+
+// The largest value that can be on the stack
+constexpr uint64_t MAX_VALUE = std::numeric_limits<uint32_t>::max();
+
+/**
+ * The range of values that a value on the stack can have. Values wrap around,
+ * so a range that would wrap around partway through is widened to every value.
+ */
+struct ValueRange {
+    /**
+     * The smallest value
+     */
+    uint64_t min = 0;
+
+    /**
+     * The largest value
+     */
+    uint64_t max = MAX_VALUE;
+
+    /**
+     * Creates a range with just one value in it.
+     *
+     * @param value
+     *     The value
+     *
+     * @return
+     *     The range
+     */
+    static ValueRange of(uint32_t value) {
+        return {value, value};
+    }
+
+    bool operator==(const ValueRange &other) const {
+        return min == other.min && max == other.max;
+    }
+
+    bool operator!=(const ValueRange &other) const {
+        return !(*this == other);
+    }
+};
+
+/**
+ * Works out the smallest range that has every value of two ranges in it.
+ *
+ * @param a
+ *     The first range
+ * @param b
+ *     The second range
+ *
+ * @return
+ *     The range that covers both ranges
+ */
+ValueRange joinRanges(const ValueRange &a, const ValueRange &b) {
+    return {std::min(a.min, b.min), std::max(a.max, b.max)};
+}
+
+/**
+ * Works out the range of the sum of two values, which wraps around.
+ *
+ * @param a
+ *     The range of the first value
+ * @param b
+ *     The range of the second value
+ *
+ * @return
+ *     The range of the sum
+ */
+ValueRange addRanges(const ValueRange &a, const ValueRange &b) {
+    auto min = a.min + b.min;
+    auto max = a.max + b.max;
+
+    // The range is only kept if either none or all of the sums wrap around
+    if (max <= MAX_VALUE) {
+        return {min, max};
+    }
+    else if (min > MAX_VALUE) {
+        return {min - MAX_VALUE - 1, max - MAX_VALUE - 1};
+    }
+
+    return {};
+}
+
+/**
+ * Works out the range of a value multiplied by a known amount, which wraps
+ * around.
+ *
+ * @param range
+ *     The range of the value
+ * @param multiple
+ *     The amount it's multiplied by
+ *
+ * @return
+ *     The range of the product
+ */
+ValueRange multiplyRange(const ValueRange &range, uint32_t multiple) {
+    if (range.min == range.max) {
+        return ValueRange::of(static_cast<uint32_t>(range.min * multiple));
+    }
+
+    if (range.max * multiple <= MAX_VALUE) {
+        return {range.min * multiple, range.max * multiple};
+    }
+
+    return {};
+}
+
+/**
+ * Works out the range of the difference between two values, which is always
+ * the larger value minus the smaller one.
+ *
+ * @param a
+ *     The range of the first value
+ * @param b
+ *     The range of the second value
+ *
+ * @return
+ *     The range of the difference
+ */
+ValueRange subtractRanges(const ValueRange &a, const ValueRange &b) {
+    if (a.max < b.min) {
+        return {b.min - a.max, b.max - a.min};
+    }
+    else if (b.max < a.min) {
+        return {a.min - b.max, a.max - b.min};
+    }
+
+    return {0, std::max(a.max - b.min, b.max - a.min)};
+}
+
+// How many values at the top of the stack are kept track of on their own,
+// between chunks
+constexpr size_t MAX_TRACKED_VALUES = 8;
+
+// How many times the stack at the start of a chunk can change before it's
+// widened to a stack where nothing is known
+constexpr unsigned MAX_STATE_UPDATES = 4;
+
+// The most chunks a jump chosen at runtime can go to, for it to pass the stack
+// on to each of those chunks on its own, rather than sharing a stack with
+// every other jump that can go to more chunks
+constexpr uint64_t MAX_NARROW_JUMP = 16;
+
+/**
+ * The ranges of the values on the stack. The values at the top of the stack
+ * are kept track of on their own, and every value below them is in one range
+ * that covers all of them. That range also covers every value that's been
+ * left in the stack's memory, since a stack that wraps around can read those
+ * values back.
+ */
+class RangeStack {
+    public:
+        /**
+         * Construct a new RangeStack for a stack that nothing is known about.
+         */
+        RangeStack() = default;
+
+        /**
+         * Construct a new RangeStack where every value is in a given range.
+         *
+         * @param range
+         *     The range of every value on the stack
+         */
+        explicit RangeStack(const ValueRange &range): _rest(range) {}
+
+        /**
+         * Returns the range of a value on the stack.
+         *
+         * @param slot
+         *     The slot of the value, where 0 is the top of the stack
+         *
+         * @return
+         *     The range of the value
+         */
+        ValueRange get(size_t slot) const {
+            return slot < _values.size() ? _values[_values.size() - 1 - slot] : _rest;
+        }
+
+        /**
+         * Returns the range of a value on the stack that's about to change,
+         * keeping track of the values down to it.
+         *
+         * @param slot
+         *     The slot of the value, where 0 is the top of the stack
+         *
+         * @return
+         *     The range of the value, which can be changed
+         */
+        ValueRange &at(size_t slot) {
+            if (slot >= _values.size()) {
+                _values.insert(_values.begin(), slot + 1 - _values.size(), _rest);
+            }
+
+            return _values[_values.size() - 1 - slot];
+        }
+
+        /**
+         * Pushes a value to the top of the stack.
+         *
+         * @param range
+         *     The range of the value
+         */
+        void push(const ValueRange &range) {
+            _values.push_back(range);
+        }
+
+        /**
+         * Pops the top value off the stack. The value below it becomes the
+         * top value, and is left in the stack's memory.
+         *
+         * @return
+         *     The range of the popped value
+         */
+        ValueRange pop() {
+            auto range = get(0);
+
+            if (!_values.empty()) {
+                _values.pop_back();
+            }
+
+            _rest = joinRanges(_rest, get(0));
+
+            return range;
+        }
+
+        /**
+         * Pushes a value below the top of the stack.
+         *
+         * @param range
+         *     The range of the value
+         */
+        void pushSecond(const ValueRange &range) {
+            auto top = get(0);
+            at(0) = range;
+            push(top);
+        }
+
+        /**
+         * Removes the value below the top of the stack, which is left in the
+         * stack's memory.
+         */
+        void popSecond() {
+            auto top = get(0);
+            _rest = joinRanges(_rest, get(1));
+            at(1) = top;
+            _values.pop_back();
+        }
+
+        /**
+         * Swaps the top two values of the stack.
+         */
+        void swapTop() {
+            // Taking the second value first keeps track of both values before
+            // either reference is taken, since at() can grow the stack
+            auto &second = at(1);
+            auto &top = at(0);
+            std::swap(top, second);
+        }
+
+        /**
+         * Pushes a value to the bottom of the stack, which is below every
+         * value that's kept track of on its own.
+         *
+         * @param range
+         *     The range of the value
+         */
+        void pushBottom(const ValueRange &range) {
+            _rest = joinRanges(_rest, range);
+        }
+
+        /**
+         * Shuffles the stack, after which any value can be in any slot, so
+         * every value is covered by one range.
+         */
+        void shuffle() {
+            for (auto &range: _values) {
+                _rest = joinRanges(_rest, range);
+            }
+
+            _values.clear();
+        }
+
+        /**
+         * Works out the range of a value computed from values on the stack,
+         * as with Command::multiple and Command::addedMultiple.
+         *
+         * @param command
+         *     The command that computes the value
+         *
+         * @return
+         *     The range of the value
+         */
+        ValueRange computed(const Command &command) const {
+            auto val = ValueRange::of(static_cast<uint32_t>(command.val));
+
+            if (command.multiple == 0) {
+                return val;
+            }
+
+            auto range = addRanges(multiplyRange(get(command.slot), command.multiple), val);
+
+            if (command.addedMultiple != 0) {
+                range = addRanges(range, multiplyRange(get(command.addedSlot), command.addedMultiple));
+            }
+
+            return range;
+        }
+
+        /**
+         * Widens the ranges of this stack to cover the values of another
+         * stack as well. Only the top MAX_TRACKED_VALUES values are kept
+         * track of on their own afterwards.
+         *
+         * @param other
+         *     The stack to cover the values of
+         *
+         * @return
+         *     Whether any of the ranges changed
+         */
+        bool join(const RangeStack &other) {
+            auto size = std::min(std::max(_values.size(), other._values.size()), MAX_TRACKED_VALUES);
+
+            std::vector<ValueRange> values(size);
+            auto rest = joinRanges(_rest, other._rest);
+
+            for (size_t slot = 0; slot < std::max(_values.size(), other._values.size()); slot++) {
+                auto range = joinRanges(get(slot), other.get(slot));
+
+                if (slot < size) {
+                    values[size - 1 - slot] = range;
+                }
+                else {
+                    rest = joinRanges(rest, range);
+                }
+            }
+
+            // Values that are the same as the rest of the stack don't need to
+            // be kept track of on their own
+            auto firstTracked = std::find_if(values.begin(), values.end(), [&](const ValueRange &range) {
+                return range != rest;
+            });
+
+            values.erase(values.begin(), firstTracked);
+
+            bool changed = values != _values || rest != _rest;
+
+            _values = std::move(values);
+            _rest = rest;
+
+            return changed;
+        }
+
+    private:
+        /**
+         * The ranges of the values kept track of on their own, with the top
+         * of the stack at the back
+         */
+        std::vector<ValueRange> _values;
+
+        /**
+         * The range that covers every other value
+         */
+        ValueRange _rest;
+};
+
+/**
+ * Works out the range of the byte that a TranslateInput command pushes to the
+ * stack, which is one of the bytes that stops the translation.
+ *
+ * @param translation
+ *     The translation table of the command
+ *
+ * @return
+ *     The range of the pushed byte
+ */
+ValueRange stopRange(const InputTranslation &translation) {
+    std::optional<unsigned> first, last;
+
+    for (unsigned byte = 0; byte < translation.size(); byte++) {
+        if (translation[byte] == TRANSLATE_STOP) {
+            first = first.value_or(byte);
+            last = byte;
+        }
+    }
+
+    if (!first) {
+        return {0, 255};
+    }
+
+    return {*first, *last};
+}
+
+/**
+ * Simulates the commands of a chunk from a given command to the end of the
+ * chunk, working out the ranges of the values on the stack when the chunk
+ * jumps to the next chunk. When an Ignore command is reached, the rest of the
+ * commands are simulated both with and without the command after it.
+ *
+ * @param commands
+ *     The commands to simulate
+ * @param first
+ *     The index of the first command to simulate
+ * @param stack
+ *     The ranges of the values on the stack before the first command
+ * @param chunk
+ *     The chunk the commands are from
+ * @param onJump
+ *     Called with the stack whenever the commands jump to the next chunk,
+ *     which isn't called if they exit instead
+ */
+void simulateCommands(const std::vector<Command> &commands, size_t first, RangeStack stack, const Chunk &chunk,
+                      const std::function<void(const RangeStack&)> &onJump)
+{
+    for (size_t i = first; i < commands.size(); i++) {
+        const auto &command = commands[i];
+
+        switch (command.type) {
+            case CommandType::Input:
+                stack.push({0, 255});
+                break;
+
+            case CommandType::TranslateInput:
+                stack.push(stopRange(*chunk.translation));
+                break;
+
+            case CommandType::Output:
+            case CommandType::Pop:
+                stack.pop();
+                break;
+
+            case CommandType::Bottom:
+                stack.pushBottom(stack.pop());
+                break;
+
+            case CommandType::PushValueToBottom:
+                stack.pushBottom(stack.computed(command));
+                break;
+
+            case CommandType::Dup:
+                stack.push(stack.get(0));
+                break;
+
+            case CommandType::Swap:
+                stack.swapTop();
+                break;
+
+            case CommandType::Inc:
+                stack.at(0) = addRanges(stack.get(0), ValueRange::of(1));
+                break;
+
+            case CommandType::Dec:
+                stack.at(0) = addRanges(stack.get(0), ValueRange::of(MAX_VALUE));
+                break;
+
+            case CommandType::Add: {
+                auto top = stack.pop();
+                stack.at(0) = addRanges(stack.get(0), top);
+                break;
+            }
+
+            case CommandType::Sub: {
+                auto top = stack.pop();
+                stack.at(0) = subtractRanges(stack.get(0), top);
+                break;
+            }
+
+            case CommandType::AddToSecond:
+                stack.at(1) = addRanges(stack.get(1), ValueRange::of(static_cast<uint32_t>(command.val)));
+                break;
+
+            case CommandType::MultiplySecond:
+                stack.at(1) = multiplyRange(stack.get(1), static_cast<uint32_t>(command.val));
+                break;
+
+            case CommandType::PopSecondValue:
+                stack.popSecond();
+                break;
+
+            case CommandType::PushSecondValue:
+                stack.pushSecond(ValueRange::of(static_cast<uint32_t>(command.val)));
+                break;
+
+            case CommandType::SetSecondValue:
+                stack.at(1) = ValueRange::of(static_cast<uint32_t>(command.val));
+                break;
+
+            case CommandType::SetTop:
+                stack.at(0) = ValueRange::of(static_cast<uint32_t>(command.val));
+                break;
+
+            case CommandType::BeginShuffle: {
+                std::vector<ValueRange> shuffled;
+
+                for (int j = 1; j <= command.val; j++) {
+                    shuffled.push_back(stack.computed(commands[i + j]));
+                }
+
+                for (unsigned j = 0; j < command.slot; j++) {
+                    stack.pop();
+                }
+
+                for (auto &range: shuffled) {
+                    stack.push(range);
+                }
+
+                i += command.val;
+                break;
+            }
+
+            case CommandType::Randomize:
+                stack.shuffle();
+                break;
+
+            case CommandType::IgnoreFirst:
+            case CommandType::IgnoreVisited:
+                if (i + 1 < commands.size()) {
+                    simulateCommands(commands, i + 1, stack, chunk, onJump);
+                    simulateCommands(commands, i + 2, stack, chunk, onJump);
+                    return;
+                }
+                break;
+
+            case CommandType::Jump:
+                onJump(stack);
+                return;
+
+            case CommandType::Exit:
+                return;
+
+            default:
+                break;
+        }
+    }
+
+    onJump(stack);
+}
+
+/**
+ * Returns whether a chunk that hasn't been split by whether it's been visited
+ * has an Ignore command that skips another command. The code generated for
+ * such a chunk always jumps to a chunk chosen at runtime.
+ *
+ * @param chunk
+ *     The chunk to check
+ *
+ * @return
+ *     Whether the chunk checks whether it's been visited
+ */
+bool checksVisited(const Chunk &chunk) {
+    for (size_t i = 0; i + 1 < chunk.commands.size(); i++) {
+        auto type = chunk.commands[i].type;
+
+        if (type == CommandType::IgnoreFirst || type == CommandType::IgnoreVisited) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Keeps track of the chunks that haven't been reached yet, so that jumps to a
+ * range of chunks only have to look at each chunk once, no matter how many
+ * ranges it's in.
+ */
+class UnreachedChunks {
+    public:
+        /**
+         * Construct a new UnreachedChunks, where no chunks have been reached.
+         *
+         * @param numChunks
+         *     The number of chunks
+         */
+        UnreachedChunks(size_t numChunks): _next(numChunks + 1) {
+            std::iota(_next.begin(), _next.end(), 0);
+        }
+
+        /**
+         * Finds the first chunk that hasn't been reached, from a given chunk.
+         *
+         * @param index
+         *     The index of the chunk to start looking from
+         *
+         * @return
+         *     The index of the first unreached chunk, or the number of chunks
+         *     if every chunk from the given chunk has been reached
+         */
+        size_t find(size_t index) {
+            while (_next[index] != index) {
+                _next[index] = _next[_next[index]];
+                index = _next[index];
+            }
+
+            return index;
+        }
+
+        /**
+         * Marks a chunk as reached.
+         *
+         * @param index
+         *     The index of the chunk
+         */
+        void reach(size_t index) {
+            _next[index] = index + 1;
+        }
+
+    private:
+        /**
+         * For each chunk, a chunk to look from for the next unreached chunk
+         */
+        std::vector<size_t> _next;
+};
+
+} // anonymous namespace
+
+JumpTargets findJumpTargets(const std::vector<Chunk> &chunks) {
+    auto numChunks = chunks.size();
+
+    JumpTargets targets;
+    targets.reachable.resize(numChunks);
+    targets.dynamicTargets.resize(numChunks);
+    targets.successors.resize(numChunks);
+
+    if (numChunks == 0) {
+        return targets;
+    }
+
+    // The stack at the start of each chunk, covering every way the chunk can
+    // be reached. Chunks that are only reached by wide jumps use the stack
+    // of the wide jumps instead.
+    std::vector<std::optional<RangeStack>> states(numChunks);
+    std::vector<unsigned> updates(numChunks);
+
+    // Wide jumps all share one stack, so that a jump that can go to any
+    // chunk doesn't have to pass its stack on to every chunk
+    std::optional<RangeStack> wideState;
+    unsigned wideUpdates = 0;
+    std::vector<bool> wideTarget(numChunks);
+    std::vector<size_t> wideTargets;
+    UnreachedChunks notWideTargets(numChunks);
+
+    // The start and end of each range of chunks that can be jumped to at
+    // runtime are counted, so the ranges can be combined all at once
+    std::vector<int64_t> rangeEdges(numChunks + 1);
+
+    std::vector<bool> queued(numChunks);
+    std::vector<size_t> toVisit;
+
+    auto enqueue = [&](size_t index) {
+        targets.reachable[index] = true;
+
+        if (!queued[index]) {
+            queued[index] = true;
+            toVisit.push_back(index);
+        }
+    };
+
+    // Stacks that keep changing are widened to a stack that nothing is
+    // known about, so that loops that keep growing a value finish
+    auto merge = [&](std::optional<RangeStack> &state, unsigned &numUpdates, const RangeStack &stack) {
+        if (!state) {
+            state = stack;
+            return true;
+        }
+
+        if (!state->join(stack)) {
+            return false;
+        }
+
+        if (++numUpdates > MAX_STATE_UPDATES) {
+            state = RangeStack();
+        }
+
+        return true;
+    };
+
+    auto onKnownJump = [&](size_t index, const RangeStack &stack) {
+        if (merge(states[index], updates[index], stack)) {
+            enqueue(index);
+        }
+    };
+
+    auto onDynamicJump = [&](size_t from, const RangeStack &stack) {
+        auto range = stack.get(0);
+
+        if (range.min >= numChunks) {
+            return;
+        }
+
+        auto last = std::min<uint64_t>(range.max, numChunks - 1);
+
+        auto &successors = targets.successors[from];
+
+        if (successors) {
+            successors->first = std::min<size_t>(successors->first, range.min);
+            successors->last = std::max<size_t>(successors->last, last);
+        }
+        else {
+            successors = ChunkRange{range.min, last};
+        }
+
+        rangeEdges[range.min]++;
+        rangeEdges[last + 1]--;
+
+        if (last - range.min < MAX_NARROW_JUMP) {
+            for (auto i = range.min; i <= last; i++) {
+                onKnownJump(i, stack);
+            }
+
+            return;
+        }
+
+        if (merge(wideState, wideUpdates, stack)) {
+            for (auto i: wideTargets) {
+                enqueue(i);
+            }
+        }
+
+        for (auto i = notWideTargets.find(range.min); i <= last; i = notWideTargets.find(i + 1)) {
+            notWideTargets.reach(i);
+            wideTarget[i] = true;
+            wideTargets.push_back(i);
+            enqueue(i);
+        }
+    };
+
+    // Known jumps pass the stack on to just one chunk
+    auto simulate = [&](size_t index, const std::vector<Command> &commands, std::optional<unsigned> nextChunk,
+                        const RangeStack &stack)
+    {
+        if (nextChunk && *nextChunk < numChunks) {
+            simulateCommands(commands, 0, stack, chunks[index], [&](const RangeStack &end) {
+                onKnownJump(*nextChunk, end);
+            });
+        }
+        else {
+            simulateCommands(commands, 0, stack, chunks[index], [&](const RangeStack &end) {
+                onDynamicJump(index, end);
+            });
+        }
+    };
+
+    // The stack starts out filled with zeroes, other than the top value
+    // being the index of the first chunk, which is also 0
+    states[0] = RangeStack(ValueRange::of(0));
+    enqueue(0);
+
+    while (!toVisit.empty()) {
+        auto index = toVisit.back();
+        toVisit.pop_back();
+        queued[index] = false;
+
+        auto stack = states[index] ? *states[index] : *wideState;
+
+        if (wideTarget[index] && states[index]) {
+            stack.join(*wideState);
+        }
+
+        stack.at(0) = ValueRange::of(index);
+
+        const auto &chunk = chunks[index];
+
+        if (chunk.visitedCommands) {
+            simulate(index, chunk.commands, chunk.nextChunk, stack);
+            simulate(index, *chunk.visitedCommands, chunk.visitedNextChunk, stack);
+        }
+        else if (checksVisited(chunk)) {
+            simulateCommands(chunk.commands, 0, stack, chunk, [&](const RangeStack &end) {
+                onDynamicJump(index, end);
+            });
+        }
+        else {
+            simulate(index, chunk.commands, chunk.nextChunk, stack);
+        }
+    }
+
+    int64_t ranges = 0;
+
+    for (size_t i = 0; i < numChunks; i++) {
+        ranges += rangeEdges[i];
+        targets.dynamicTargets[i] = ranges > 0;
+    }
+
+    return targets;
+}
+
+} // namespace xrf
@@ -1,47 +1,744 @@
+#include "cache.hpp"
 #include "codegen.hpp"
+#include "emit.hpp"
+#include "interpreter.hpp"
+#include "jit.hpp"
+#include "jump-targets.hpp"
 #include "optimization.hpp"
+#include "parallel.hpp"
 #include "parser.hpp"
+#include "profile.hpp"
+#include "stats.hpp"
 
 #include "CLI/CLI.hpp"
-#include "llvm/Support/raw_ostream.h"
 
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <thread>
+
+/**
+ * The file types that can be given to --emit, along with the file extension
+ * of the default output file for each type.
+ */
+const std::map<std::string, std::pair<xrf::OutputType, std::string>> OUTPUT_TYPES = {
+    {"asm", {xrf::OutputType::Assembly, ".s"}},
+    {"bc", {xrf::OutputType::Bitcode, ".bc"}},
+    {"exe", {xrf::OutputType::Executable, ""}},
+    {"ll", {xrf::OutputType::IR, ".ll"}},
+    {"obj", {xrf::OutputType::Object, ".o"}},
+};
+
+/**
+ * The I/O modes that can be given to --io.
+ */
+const std::map<std::string, xrf::IoMode> IO_MODES = {
+    {"buffered", xrf::IoMode::Buffered},
+    {"stdio", xrf::IoMode::Stdio},
+};
+
+/**
+ * The dispatch modes that can be given to --dispatch.
+ */
+const std::map<std::string, xrf::DispatchMode> DISPATCH_MODES = {
+    {"switch", xrf::DispatchMode::Switch},
+    {"threaded", xrf::DispatchMode::Threaded},
+    {"threaded-unchecked", xrf::DispatchMode::ThreadedUnchecked},
+};
+
+/**
+ * The kinds of stack storage that can be given to --stack-storage.
+ */
+const std::map<std::string, xrf::StackStorage> STACK_STORAGES = {
+    {"mmap", xrf::StackStorage::Mmap},
+    {"static", xrf::StackStorage::Static},
+};
+
+/**
+ * The largest stack size that can be given to --stack-size.
+ */
+constexpr uint64_t MAX_STACK_SIZE = uint64_t(1) << 32;
+
+/**
+ * The settings given on the command line that every file is compiled with.
+ */
+struct CompileSettings {
+    /**
+     * The options for generating code, which each file adds its own profile
+     * and jump targets to
+     */
+    xrf::CodegenOptions codegenOptions;
+
+    /**
+     * The type of file to write, as given to --emit
+     */
+    std::string emitType;
+
+    /**
+     * The directory to cache compiled files in, or empty to not cache them
+     */
+    std::string cacheDir;
+
+    /**
+     * The profile to optimize with, or empty to not use a profile
+     */
+    std::string profileFile;
+
+    /**
+     * The file to write stats to as JSON, or empty to not write them
+     */
+    std::string statsJsonFile;
+
+    /**
+     * The level of optimization for XRF code
+     */
+    int optimizationLevel = 0;
+
+    /**
+     * The level of optimization LLVM uses on the generated code
+     */
+    int llvmOptimizationLevel = 0;
+
+    /**
+     * The number of threads to run XRF optimizations with
+     */
+    unsigned jobs = 1;
+
+    /**
+     * Whether to compile each function of partitioned code to its own object
+     * file, on its own thread, and link the objects together
+     */
+    bool splitObjects = false;
+
+    /**
+     * Whether to JIT-compile the program and run it
+     */
+    bool runProgram = false;
+
+    /**
+     * Whether to run the program with the interpreter
+     */
+    bool interpretProgram = false;
+
+    /**
+     * Whether to print how much is left after optimizing
+     */
+    bool printCounts = false;
+
+    /**
+     * Whether to print how long each phase took
+     */
+    bool printPhases = false;
+};
 
 /**
- * @brief Outputs a list of parser errors to stderr.
+ * @brief Outputs a list of parser errors.
  *
  * @param errors
  *     The list of errors to print out
+ * @param out
+ *     The stream to print the errors to
  */
-void printParserErrors(const xrf::ParserErrorList &errors) {
+void printParserErrors(const xrf::ParserErrorList &errors, std::ostream &out = std::cerr) {
     int numErrors = 0;
 
     for (auto &error: errors) {
         // If we've gotten more than 100 errors, we were most likely given some
         // random non-XRF file, so further errors will likely not help anybody
         if (numErrors++ == 100) {
-            std::cerr << "Too many errors, quitting." << "\n";
+            out << "Too many errors, quitting." << "\n";
             return;
         }
 
-        std::cerr << "Error on line " << error.line << ", column " << error.col
-                  << ": " << error.msg << '\n';
+        out << "Error on line " << error.line << ", column " << error.col
+            << ": " << error.msg << '\n';
+    }
+}
+
+/**
+ * Compiles partitioned code with each partition in its own module, so that
+ * the modules can be optimized and compiled on separate threads, and then
+ * links the object files together. With a cache, each object is cached on its
+ * own, and only the objects that aren't in the cache are compiled.
+ *
+ * @param chunks
+ *     The chunks of the program, after they've been optimized
+ * @param codegenOptions
+ *     The options to generate code with, which have a partition size
+ * @param settings
+ *     The settings to compile the file with
+ * @param keySettings
+ *     The settings that change the compiled objects, for their cache keys,
+ *     which are only used with a cache
+ * @param outFilename
+ *     The file to write the linked program to
+ * @param stats
+ *     The stats to add the time each phase took to
+ * @param err
+ *     The stream to write errors to
+ *
+ * @return
+ *     The exit status of xrfc for the file
+ */
+int compileSplitModules(const std::vector<xrf::Chunk> &chunks, const xrf::CodegenOptions &codegenOptions,
+                        const CompileSettings &settings, const std::string &keySettings,
+                        const std::string &outFilename, xrf::CompileStats &stats, std::ostream &err)
+{
+    auto layout = xrf::layoutPartitions(chunks, codegenOptions);
+
+    // The main module comes last, after every partition
+    auto numModules = layout.members.size() + 1;
+
+    auto getPartition = [&] (size_t i) -> std::optional<size_t> {
+        if (i == layout.members.size()) {
+            return std::nullopt;
+        }
+
+        return i;
+    };
+
+    bool cached = !settings.cacheDir.empty();
+
+    std::vector<std::string> keys(numModules);
+    std::vector<std::string> objects(numModules);
+    std::vector<size_t> missing;
+
+    for (size_t i = 0; i < numModules; i++) {
+        if (cached) {
+            keys[i] = xrf::getSplitModuleKey(chunks, codegenOptions, layout, getPartition(i), keySettings);
+
+            if (auto path = xrf::findCached(settings.cacheDir, keys[i])) {
+                objects[i] = std::move(*path);
+                continue;
+            }
+        }
+
+        missing.push_back(i);
+    }
+
+    // Each module gets its own context, so that the modules can be worked on
+    // by different threads, and each thread gets its own target machine
+    auto jobs = std::max(1u, std::min<unsigned>(settings.jobs, missing.size()));
+
+    std::vector<std::unique_ptr<llvm::LLVMContext>> contexts(missing.size());
+    std::vector<std::unique_ptr<llvm::Module>> modules(missing.size());
+    std::vector<std::unique_ptr<llvm::TargetMachine>> targetMachines;
+
+    for (unsigned job = 0; job < jobs; job++) {
+        auto targetMachine = xrf::createTargetMachine(settings.llvmOptimizationLevel);
+
+        if (!targetMachine) {
+            err << llvm::toString(targetMachine.takeError()) << '\n';
+            return 3;
+        }
+
+        targetMachines.push_back(std::move(*targetMachine));
+    }
+
+    {
+        xrf::PhaseTimer timer(stats, "codegen");
+
+        xrf::parallelFor(missing.size(), jobs, [&] (size_t j, unsigned) {
+            contexts[j] = std::make_unique<llvm::LLVMContext>();
+            modules[j] = xrf::generateSplitModule(*contexts[j], chunks, codegenOptions, layout,
+                                                  getPartition(missing[j]));
+        });
+    }
+
+    // Only the modules that were compiled are counted, just like a program
+    // that's copied out of the cache doesn't count any of its jumps
+    for (const auto &module: modules) {
+        xrf::CompileStats moduleStats;
+        xrf::countDispatchStats(moduleStats, *module);
+
+        stats.dynamicJumps += moduleStats.dynamicJumps;
+        stats.dispatchEdges += moduleStats.dispatchEdges;
+    }
+
+    {
+        xrf::PhaseTimer timer(stats, "llvm-opt");
+
+        xrf::parallelFor(missing.size(), jobs, [&] (size_t j, unsigned job) {
+            xrf::optimizeModule(*modules[j], *targetMachines[job], settings.llvmOptimizationLevel);
+        });
+    }
+
+    std::vector<std::string> tempFiles;
+
+    auto removeTempFiles = [&] {
+        for (const auto &tempFile: tempFiles) {
+            llvm::sys::fs::remove(tempFile);
+        }
+    };
+
+    for (auto i: missing) {
+        llvm::SmallString<128> tempPath;
+
+        if (auto error = llvm::sys::fs::createTemporaryFile("xrf-partition", "o", tempPath)) {
+            err << "Unable to create a temporary object file: " << error.message() << '\n';
+            removeTempFiles();
+            return 3;
+        }
+
+        tempFiles.emplace_back(tempPath);
+        objects[i] = tempFiles.back();
     }
+
+    {
+        xrf::PhaseTimer timer(stats, "emit");
+
+        std::vector<std::string> errors(missing.size());
+
+        xrf::parallelFor(missing.size(), jobs, [&] (size_t j, unsigned job) {
+            if (auto error = xrf::writeModule(*modules[j], *targetMachines[job], xrf::OutputType::Object,
+                                              tempFiles[j])) {
+                errors[j] = llvm::toString(std::move(error));
+            }
+
+            // The module is done with once it's been written out
+            modules[j].reset();
+            contexts[j].reset();
+        });
+
+        for (const auto &error: errors) {
+            if (!error.empty()) {
+                err << error << '\n';
+                removeTempFiles();
+                return 3;
+            }
+        }
+    }
+
+    // Failing to cache an object doesn't stop the program from being
+    // compiled, so this is only a warning
+    if (cached) {
+        for (size_t j = 0; j < missing.size(); j++) {
+            if (auto error = xrf::storeCached(settings.cacheDir, keys[missing[j]], tempFiles[j])) {
+                err << "Unable to cache an object for " << outFilename << ": "
+                    << llvm::toString(std::move(error)) << '\n';
+            }
+        }
+    }
+
+    {
+        xrf::PhaseTimer timer(stats, "link");
+
+        auto outputType = OUTPUT_TYPES.at(settings.emitType).first;
+
+        if (auto error = xrf::linkObjects(objects, outputType, outFilename)) {
+            err << llvm::toString(std::move(error)) << '\n';
+            removeTempFiles();
+            return 3;
+        }
+    }
+
+    removeTempFiles();
+
+    return 0;
+}
+
+/**
+ * Compiles a single XRF file, or runs it with --run or --interpret.
+ *
+ * @param filename
+ *     The XRF file to compile
+ * @param outFilename
+ *     The file to write the compiled program to
+ * @param settings
+ *     The settings to compile the file with
+ * @param err
+ *     The stream to write errors and stats to
+ *
+ * @return
+ *     The exit status of xrfc for the file, or the exit status of the
+ *     program with --run or --interpret
+ */
+int compileFile(const std::string &filename, const std::string &outFilename, const CompileSettings &settings,
+                std::ostream &err)
+{
+    auto codegenOptions = settings.codegenOptions;
+
+    xrf::CompileStats stats;
+
+    // Large files get memory mapped, so the parser reads them straight out
+    // of the page cache
+    auto file = llvm::MemoryBuffer::getFile(filename);
+
+    if (!file) {
+        err << "Unable to open " << filename << '\n';
+        return 1;
+    }
+
+    std::variant<xrf::ParserErrorList, std::vector<xrf::Chunk>> result;
+
+    {
+        xrf::PhaseTimer timer(stats, "parse");
+        result = xrf::parseXrf(std::string_view((*file)->getBufferStart(), (*file)->getBufferSize()));
+    }
+
+    if (auto *errors = std::get_if<xrf::ParserErrorList>(&result); errors) {
+        printParserErrors(*errors, err);
+        return 2;
+    }
+
+    auto chunks = std::get<std::vector<xrf::Chunk>>(std::move(result));
+
+    stats.sourceCommands = chunks.size() * xrf::COMMANDS_PER_CHUNK;
+
+    std::optional<xrf::Profile> profile;
+    std::vector<bool> hotChunks;
+
+    if (!settings.profileFile.empty()) {
+        auto loaded = xrf::loadProfile(settings.profileFile);
+
+        if (!loaded) {
+            err << llvm::toString(loaded.takeError()) << '\n';
+            return 1;
+        }
+
+        if (loaded->counts.size() != chunks.size()) {
+            err << settings.profileFile << " is a profile of a program with " << loaded->counts.size()
+                << " chunks, but " << filename << " has " << chunks.size() << " chunks.\n";
+            return 1;
+        }
+
+        profile = std::move(*loaded);
+        hotChunks = xrf::findHotChunks(*profile);
+        codegenOptions.profile = &*profile;
+    }
+
+    if (settings.optimizationLevel > 0) {
+        xrf::PhaseTimer timer(stats, "optimize-chunks");
+
+        chunks = xrf::optimizeChunks(xrf::specializeVisits(std::move(chunks), hotChunks), settings.jobs);
+    }
+
+    if (settings.optimizationLevel > 1) {
+        xrf::PhaseTimer timer(stats, "optimize-program");
+
+        chunks = xrf::optimizeProgram(std::move(chunks), settings.jobs, hotChunks, codegenOptions.checked);
+    }
+
+    // Program-level optimization also only generates code for the chunks
+    // that can be run, with jumps chosen at runtime only going to the chunks
+    // they can reach
+    xrf::JumpTargets jumpTargets;
+
+    if (settings.optimizationLevel > 1) {
+        xrf::PhaseTimer timer(stats, "jump-targets");
+
+        jumpTargets = xrf::findJumpTargets(chunks);
+        codegenOptions.jumpTargets = &jumpTargets;
+    }
+
+    xrf::countChunkStats(stats, chunks);
+
+    // With --run or --interpret, the stats are written out before running
+    // the program, so they don't get mixed up with the program's output
+    auto reportStats = [&] {
+        xrf::printStats(err, stats, settings.printPhases, settings.printCounts);
+
+        if (!settings.statsJsonFile.empty()) {
+            std::ofstream statsFile{settings.statsJsonFile};
+
+            if (!statsFile) {
+                err << "Unable to write stats to " << settings.statsJsonFile << '\n';
+                return;
+            }
+
+            xrf::printStatsJson(statsFile, stats);
+        }
+    };
+
+    if (settings.interpretProgram) {
+        reportStats();
+
+        return xrf::interpret(chunks, codegenOptions.stackSize, stdin, stdout, codegenOptions.seed);
+    }
+
+    auto outputType = OUTPUT_TYPES.at(settings.emitType).first;
+
+    auto compilerSettings = std::string("xrfc ") + XRFC_VERSION + " llvm " + LLVM_VERSION_STRING + ' ' +
+                            llvm::sys::getProcessTriple();
+    auto optSettings = " llvm-opt " + std::to_string(settings.llvmOptimizationLevel);
+
+    if (settings.splitObjects) {
+        auto status = compileSplitModules(chunks, codegenOptions, settings,
+                                          compilerSettings + " emit split-object" + optSettings,
+                                          outFilename, stats, err);
+
+        if (status == 0) {
+            reportStats();
+        }
+
+        return status;
+    }
+
+    std::string cacheKey;
+
+    if (!settings.cacheDir.empty() && !settings.runProgram) {
+        cacheKey = xrf::getCacheKey(chunks, codegenOptions, compilerSettings + " emit " + settings.emitType + optSettings);
+
+        if (xrf::loadCached(settings.cacheDir, cacheKey, outFilename)) {
+            reportStats();
+            return 0;
+        }
+    }
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    std::unique_ptr<llvm::Module> module;
+
+    {
+        xrf::PhaseTimer timer(stats, "codegen");
+        module = generateCode(*context, chunks, codegenOptions);
+    }
+
+    xrf::countDispatchStats(stats, *module);
+
+    auto targetMachine = xrf::createTargetMachine(settings.llvmOptimizationLevel);
+
+    if (!targetMachine) {
+        err << llvm::toString(targetMachine.takeError()) << '\n';
+        return 3;
+    }
+
+    {
+        xrf::PhaseTimer timer(stats, "llvm-opt");
+        xrf::optimizeModule(*module, **targetMachine, settings.llvmOptimizationLevel);
+    }
+
+    if (settings.runProgram) {
+        reportStats();
+
+        auto exitCode = xrf::runModule(std::move(context), std::move(module));
+
+        if (!exitCode) {
+            err << "Unable to run " << filename << ": " << llvm::toString(exitCode.takeError()) << '\n';
+            return 4;
+        }
+
+        return *exitCode;
+    }
+
+    {
+        xrf::PhaseTimer timer(stats, "emit");
+
+        if (auto error = xrf::writeModule(*module, **targetMachine, outputType, outFilename)) {
+            err << llvm::toString(std::move(error)) << '\n';
+            return 3;
+        }
+    }
+
+    reportStats();
+
+    // Failing to cache the file doesn't stop the file from being compiled,
+    // so this is only a warning
+    if (!cacheKey.empty()) {
+        if (auto error = xrf::storeCached(settings.cacheDir, cacheKey, outFilename)) {
+            err << "Unable to cache " << outFilename << ": " << llvm::toString(std::move(error)) << '\n';
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Reads the list of files in a manifest, which has a file on each line. Blank
+ * lines and lines starting with # are skipped.
+ *
+ * @param manifest
+ *     The manifest file to read
+ * @param filenames
+ *     The list to add the files to
+ *
+ * @return
+ *     Whether the manifest could be read
+ */
+bool readManifest(const std::string &manifest, std::vector<std::string> &filenames) {
+    std::ifstream file{manifest};
+
+    if (!file) {
+        return false;
+    }
+
+    for (std::string line; std::getline(file, line);) {
+        auto end = line.find_last_not_of(" \t\r");
+
+        if (end == std::string::npos || line[0] == '#') {
+            continue;
+        }
+
+        filenames.push_back(line.substr(0, end + 1));
+    }
+
+    return true;
+}
+
+/**
+ * Compiles a batch of XRF files, with several files being compiled at once.
+ * Each file is written next to itself, with its extension replaced by the
+ * extension for the type of file being written. A file that fails to compile
+ * doesn't stop the rest of the files from being compiled, and the errors for
+ * each file are printed out together once the file is done.
+ *
+ * @param filenames
+ *     The XRF files to compile
+ * @param settings
+ *     The settings to compile the files with, where the number of jobs is the
+ *     number of files compiled at once
+ *
+ * @return
+ *     0 if every file compiled, or else the exit status for the first file
+ *     in the list that failed to compile
+ */
+int compileBatch(const std::vector<std::string> &filenames, const CompileSettings &settings) {
+    auto fileSettings = settings;
+
+    // The files are compiled in parallel, so each one is optimized on the
+    // thread that compiles it
+    fileSettings.jobs = 1;
+
+    auto extension = OUTPUT_TYPES.at(settings.emitType).second;
+
+    std::vector<int> statuses(filenames.size());
+    std::atomic<size_t> nextFile = 0;
+    std::mutex errMutex;
+
+    auto compileFiles = [&] {
+        for (size_t i; (i = nextFile++) < filenames.size();) {
+            const auto &filename = filenames[i];
+            std::ostringstream err;
+
+            llvm::SmallString<128> outFilename{filename};
+            llvm::sys::path::replace_extension(outFilename, extension);
+
+            if (outFilename == filename) {
+                err << "Unable to pick an output file for " << filename << ", since it has no file extension.\n";
+                statuses[i] = 1;
+            }
+            else {
+                statuses[i] = compileFile(filename, std::string(outFilename), fileSettings, err);
+            }
+
+            auto messages = err.str();
+
+            if (!messages.empty()) {
+                std::lock_guard lock{errMutex};
+                std::cerr << "In " << filename << ":\n" << messages;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (size_t i = 1; i < std::min<size_t>(settings.jobs, filenames.size()); i++) {
+        threads.emplace_back(compileFiles);
+    }
+
+    compileFiles();
+
+    for (auto &thread: threads) {
+        thread.join();
+    }
+
+    auto numFailed = std::count_if(statuses.begin(), statuses.end(), [] (int status) {
+        return status != 0;
+    });
+
+    if (numFailed == 0) {
+        return 0;
+    }
+
+    std::cerr << numFailed << " of " << filenames.size() << " files failed to compile.\n";
+
+    return *std::find_if(statuses.begin(), statuses.end(), [] (int status) {
+        return status != 0;
+    });
 }
 
 int main(int argc, char **argv) {
     CLI::App app("Compiles XRF files.");
 
-    std::string filename;
+    std::vector<std::string> filenames;
+    std::string manifest;
     std::string outFilename;
-    int optimizationLevel = 0;
+    std::string ioMode = "stdio";
+    std::string dispatchMode = "switch";
+    std::string stackStorage = "static";
+    uint64_t stackSize = 0;
+    uint64_t seed = 0;
     bool printVersion = false;
+    CompileSettings settings;
+    settings.emitType = "ll";
+    auto &codegenOptions = settings.codegenOptions;
 
-    app.add_option("file", filename, "The XRF file to compile.");
-    app.add_option("-o,--output", outFilename, "The file to write the compiled source to.");
-    app.add_option("-O", optimizationLevel,
+    app.add_option("files", filenames, "The XRF files to compile.");
+    app.add_option("--manifest", manifest,
+        "A file listing XRF files to compile, one on each line, along with any files given on the command line.");
+    app.add_option("-o,--output", outFilename,
+        "The file to write the compiled source to. When compiling more than one file, each file is instead written next to itself, with its extension replaced.");
+    app.add_option("-O", settings.optimizationLevel,
         "The level of optimization for XRF code.\n0 = none\n1 = chunk-level optimizations\n2 = program-level optimizations");
+    app.add_option("-j,--jobs", settings.jobs,
+        "The number of threads to run XRF optimizations with, and to compile object files on with --split-objects, or the number of files to compile at once when compiling more than one file.")
+        ->check(CLI::Range(1u, 1024u));
+    app.add_option("--llvm-opt", settings.llvmOptimizationLevel,
+        "The level of optimization LLVM uses on the generated code, from 0 to 3.")
+        ->check(CLI::Range(0, 3));
+    app.add_option("--emit", settings.emitType,
+        "The type of file to write.\nll = LLVM IR\nbc = LLVM bitcode\nasm = assembly\nobj = object file\nexe = executable")
+        ->check(CLI::IsMember({"asm", "bc", "exe", "ll", "obj"}));
+    app.add_option("--io", ioMode,
+        "How the program does I/O.\nstdio = a getchar()/putchar() call per character\nbuffered = buffered, with bulk read() and write() calls")
+        ->check(CLI::IsMember({"buffered", "stdio"}));
+    app.add_option("--dispatch", dispatchMode,
+        "How the program jumps to chunks chosen at runtime.\nswitch = one shared switch\nthreaded = an indirect branch at the end of each chunk\nthreaded-unchecked = threaded, without checking that the chunk exists")
+        ->check(CLI::IsMember({"switch", "threaded", "threaded-unchecked"}));
+    app.add_option("--stack-size", stackSize,
+        "The number of values the stack can hold before wrapping around, which must be a power of two.\nDefaults to 65536 for a static stack, and 268435456 for an mmap stack.");
+    app.add_option("--stack-storage", stackStorage,
+        "Where the stack is kept.\nstatic = a global array\nmmap = memory reserved with mmap(), paged in as it's used")
+        ->check(CLI::IsMember({"mmap", "static"}));
+    app.add_flag("--register-state", codegenOptions.registerState,
+        "Keeps the stack indices and top value in registers that are passed between chunks, instead of in memory.");
+    app.add_flag("--checked", codegenOptions.checked,
+        "Makes the program stop with an error when a chunk would pop a value off of an empty stack, overflow the stack or jump to a chunk that doesn't exist.");
+    auto seedOption = app.add_option("--seed", seed,
+        "The seed for the random shuffles of the stack done by D commands, so that they're the same on every run.\nDefaults to the time when the program starts.");
+    app.add_option("--partition", codegenOptions.partitionSize,
+        "Splits the program into functions of at most this many chunks each, keeping chunks that jump to each other together, so that LLVM can optimize and compile very large programs quickly. Can only be used with --dispatch=switch.");
+    app.add_flag("--split-objects", settings.splitObjects,
+        "Compiles each function of a program split up with --partition to its own object file, optimizing and compiling them on separate threads, and links the objects together with the system's C compiler. Can only be used with --emit=obj or --emit=exe.");
+    app.add_flag("--emit-library", codegenOptions.library,
+        "Compiles the program into re-entrant library code, with xrf_run() and xrf_context_size() functions instead of main(), as declared in xrf-library.h. All of the program's state is kept in the context passed to xrf_run(), and I/O goes through the callbacks in the context.");
+    app.add_flag("--instrument", codegenOptions.instrument,
+        "Makes the program count how often each chunk runs, jumps and checks whether it's been visited, and write the counts to the profile file when it exits.");
+    app.add_option("--profile-output", codegenOptions.profileFile,
+        "The file that a program compiled with --instrument writes its profile to.\nDefaults to xrf.profile.");
+    app.add_option("--profile-use", settings.profileFile,
+        "A profile written out by a program compiled with --instrument. Branches are weighted by it, hot chunks are laid out first, and only hot chunks are split by whether they've been visited or built into traces.");
+    app.add_option("--cache-dir", settings.cacheDir,
+        "A directory to cache compiled files in. When a program optimizes to the same chunks as a program that was compiled before with the same options, the cached file is copied instead of compiling it again. With --split-objects, each object file is cached on its own, so only the functions with chunks that changed are compiled again.");
+    app.add_flag("--run", settings.runProgram, "JIT-compiles the program and runs it, instead of writing out LLVM IR.");
+    app.add_flag("--interpret", settings.interpretProgram,
+        "Runs the optimized program with a built-in interpreter, without generating any code for it.");
+    app.add_flag("--stats", settings.printCounts,
+        "Prints out how many chunks, commands and jumps are left after optimizing, to stderr.");
+    app.add_flag("--time-phases", settings.printPhases, "Prints out how long each phase of compiling took, to stderr.");
+    app.add_option("--stats-json", settings.statsJsonFile,
+        "Writes the phase times and the stats from --stats to a file, as JSON.");
     app.add_flag("--version", printVersion, "Prints the version information and exit.");
 
     CLI11_PARSE(app, argc, argv);
@@ -51,50 +748,122 @@ int main(int argc, char **argv) {
         return 0;
     }
 
-    if (filename.empty()) {
+    if (!manifest.empty() && !readManifest(manifest, filenames)) {
+        std::cerr << "Unable to open " << manifest << '\n';
+        return 1;
+    }
+
+    if (filenames.empty()) {
         std::cerr << "Please provide an XRF file to compile.\n";
         return 1;
     }
 
-    std::ifstream file{filename};
+    // A manifest is always compiled as a batch, even if it only has one file,
+    // so that its files are always written to the same place
+    bool batch = filenames.size() > 1 || !manifest.empty();
+
+    if (batch) {
+        std::pair<bool, const char *> singleFileOptions[] = {
+            {!outFilename.empty(), "-o"},
+            {settings.runProgram, "--run"},
+            {settings.interpretProgram, "--interpret"},
+            {!settings.profileFile.empty(), "--profile-use"},
+            {!settings.statsJsonFile.empty(), "--stats-json"},
+        };
+
+        for (auto [used, option]: singleFileOptions) {
+            if (used) {
+                std::cerr << option << " can't be used when compiling more than one file.\n";
+                return 1;
+            }
+        }
+    }
 
-    if (!file.is_open()) {
-        std::cerr << "Unable to open " << filename << '\n';
+    if (codegenOptions.checked && dispatchMode == "threaded-unchecked") {
+        std::cerr << "--checked can't be used with --dispatch=threaded-unchecked.\n";
         return 1;
     }
 
-    xrf::FileReader fileReader(file);
-    auto result = xrf::parseXrf(fileReader);
+    if (codegenOptions.partitionSize > 0) {
+        std::pair<bool, std::string> unpartitionedOptions[] = {
+            {dispatchMode != "switch", "--dispatch=" + dispatchMode},
+            {codegenOptions.checked, "--checked"},
+        };
 
-    if (auto *errors = std::get_if<xrf::ParserErrorList>(&result); errors) {
-        printParserErrors(*errors);
-        return 2;
+        for (auto [used, option]: unpartitionedOptions) {
+            if (used) {
+                std::cerr << "--partition can't be used with " << option << ".\n";
+                return 1;
+            }
+        }
     }
 
-    auto chunks = std::get<std::vector<xrf::Chunk>>(result);
-    if (optimizationLevel > 0) {
-        chunks = xrf::optimizeChunks(chunks);
+    if (settings.splitObjects && codegenOptions.partitionSize == 0) {
+        std::cerr << "--split-objects can only be used with --partition.\n";
+        return 1;
+    }
+
+    if (settings.splitObjects) {
+        std::pair<bool, std::string> unsplitOptions[] = {
+            {settings.runProgram, "--run"},
+            {settings.interpretProgram, "--interpret"},
+            {settings.emitType != "obj" && settings.emitType != "exe", "--emit=" + settings.emitType},
+        };
 
-        if (optimizationLevel > 1) {
-            chunks = xrf::optimizeProgram(chunks);
+        for (auto [used, option]: unsplitOptions) {
+            if (used) {
+                std::cerr << "--split-objects can't be used with " << option << ".\n";
+                return 1;
+            }
         }
     }
 
-    llvm::LLVMContext context;
-    auto module = generateCode(context, chunks);
+    if (codegenOptions.library) {
+        std::pair<bool, const char *> programOptions[] = {
+            {settings.emitType == "exe", "--emit=exe"},
+            {settings.runProgram, "--run"},
+            {codegenOptions.instrument, "--instrument"},
+            {stackStorage == "mmap", "--stack-storage=mmap"},
+            {dispatchMode == "threaded-unchecked", "--dispatch=threaded-unchecked"},
+        };
 
-    if (outFilename.empty()) {
-        outFilename = "out.ll";
+        for (auto [used, option]: programOptions) {
+            if (used) {
+                std::cerr << "--emit-library can't be used with " << option << ".\n";
+                return 1;
+            }
+        }
     }
 
-    std::error_code err;
-    llvm::raw_fd_ostream outFile(outFilename, err);
+    codegenOptions.stackStorage = STACK_STORAGES.at(stackStorage);
 
-    if (err) {
-        std::cerr << "Unable to write to " << outFilename << '\n';
-        return 3;
+    if (stackSize == 0) {
+        stackSize = codegenOptions.stackStorage == xrf::StackStorage::Mmap
+                  ? xrf::DEFAULT_MMAP_STACK_SIZE
+                  : xrf::DEFAULT_STACK_SIZE;
     }
 
-    module->print(outFile, nullptr);
-    return 0;
+    if (stackSize < 2 || stackSize > MAX_STACK_SIZE || (stackSize & (stackSize - 1)) != 0) {
+        std::cerr << "The stack size must be a power of two, from 2 to " << MAX_STACK_SIZE << ".\n";
+        return 1;
+    }
+
+    codegenOptions.stackSize = stackSize;
+
+    if (seedOption->count() > 0) {
+        codegenOptions.seed = seed;
+    }
+
+    codegenOptions.ioMode = IO_MODES.at(ioMode);
+    codegenOptions.dispatchMode = DISPATCH_MODES.at(dispatchMode);
+
+    if (batch) {
+        return compileBatch(filenames, settings);
+    }
+
+    if (outFilename.empty()) {
+        outFilename = "out" + OUTPUT_TYPES.at(settings.emitType).second;
+    }
+
+    return compileFile(filenames[0], outFilename, settings, std::cerr);
 }
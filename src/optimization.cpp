@@ -1,144 +1,260 @@
 #include "optimization.hpp"
+#include "parallel.hpp"
 
 #include "stack-simulator.hpp"
 
 #include <algorithm>
 #include <array>
 #include <cassert>
-#include <unordered_set>
+#include <memory>
 
 namespace xrf {
 
 namespace {
 
 /**
- * Attempts to optimize a chunk. This simulates the effect that a given chunk
- * will have on the stack, and based on the end state, it will attempt to
- * generate an optimized sequence of instructions.
+ * Simulates the effect a single command has on the stack.
+ *
+ * @param stack
+ *     The simulated stack to run the command on
+ * @param cmd
+ *     The command to simulate, which must be one of the commands from the
+ *     original program that the StackSimulator can simulate
+ */
+void simulateCommand(StackSimulator &stack, const Command &cmd) {
+    switch (cmd.type) {
+        case CommandType::Add:    stack.add(); break;
+        case CommandType::Bottom: stack.bottom(); break;
+        case CommandType::Dec:    stack.dec(); break;
+        case CommandType::Dup:    stack.dup(); break;
+        case CommandType::Inc:    stack.inc(); break;
+        case CommandType::Input:  stack.input(); break;
+        case CommandType::Output: stack.output(); break;
+        case CommandType::Pop:    stack.pop(); break;
+        case CommandType::Sub:    stack.sub(); break;
+        case CommandType::Swap:   stack.swap(); break;
+        default:                  break;
+    }
+}
+
+/**
+ * Adds the optimized commands for the effect a simulated run of commands had
+ * on the stack to a list of commands.
+ *
+ * @param commands
+ *     The list of commands to add to
+ * @param stack
+ *     The simulated stack, which must be representable
+ */
+void appendSimulatedCommands(std::vector<Command> &commands, const StackSimulator &stack) {
+    auto simulated = stack.getCommands();
+
+    assert(simulated);
+
+    commands.insert(commands.end(), simulated->begin(), simulated->end());
+}
+
+/**
+ * Simulates the effect a list of commands has on the stack, where the
+ * commands can be a mix of commands from the original program and commands
+ * generated by optimizing chunks.
+ *
+ * @param stack
+ *     The simulated stack to run the commands on
+ * @param commands
+ *     The commands to simulate
+ *
+ * @return
+ *     Whether the commands could all be simulated, and left the stack in a
+ *     state that can be represented with optimized commands
+ */
+bool simulateCommands(StackSimulator &stack, const std::vector<Command> &commands) {
+    for (size_t i = 0; i < commands.size(); ) {
+        auto type = commands[i].type;
+
+        if (type == CommandType::Exit || type == CommandType::Jump || type == CommandType::Randomize ||
+            type == CommandType::IgnoreFirst || type == CommandType::IgnoreVisited)
+        {
+            return false;
+        }
+        else if (type > CommandType::Nop) {
+            i += stack.simulateOptimized(commands, i);
+        }
+        else {
+            simulateCommand(stack, commands[i]);
+            i++;
+        }
+    }
+
+    return stack.isRepresentable();
+}
+
+/**
+ * Attempts to optimize a chunk in place. This simulates the effect that a
+ * given chunk will have on the stack, and based on the end state, it will
+ * attempt to generate an optimized sequence of instructions. Commands that
+ * can't be simulated, like reading input, split the chunk into runs of
+ * commands that are each optimized separately, with the commands that
+ * couldn't be simulated kept as they are between them.
  *
  * @param chunk
  *     The XRF chunk to optimize
  * @param index
  *     The index of the chunk in the program
- *
- * @return
- *     The optimized XRF chunk
  */
-Chunk optimizeChunk(const Chunk &chunk, unsigned index) {
+void optimizeChunk(Chunk &chunk, unsigned index) {
     StackSimulator stack(index);
-    Chunk optimized = chunk;
 
-    bool canOptimize = true;
+    std::vector<Command> commands;
+    bool exited = false;
 
     for (const auto &cmd: chunk.commands) {
-        bool breakOut = false;
-
-        switch (cmd.type) {
-            case CommandType::Add:
-                stack.add();
-                break;
-
-            case CommandType::Bottom:
-                stack.bottom();
-                break;
+        if (cmd.type == CommandType::Jump) {
+            break;
+        }
+        else if (cmd.type == CommandType::Nop) {
+            continue;
+        }
+        else if (cmd.type == CommandType::Exit) {
+            appendSimulatedCommands(commands, stack);
+            commands.push_back(cmd);
+            exited = true;
+            break;
+        }
+        else if (cmd.type == CommandType::Randomize) {
+            appendSimulatedCommands(commands, stack);
+            commands.push_back(cmd);
+            stack = StackSimulator();
+            continue;
+        }
+        else if (cmd.type == CommandType::IgnoreFirst || cmd.type == CommandType::IgnoreVisited ||
+                 cmd.type > CommandType::Nop)
+        {
+            // We don't bother trying to optimize a chunk that depends on
+            // whether it's been visited, or that has already been optimized
+            return;
+        }
 
-            case CommandType::Output:
-                stack.output();
-                break;
+        auto before = stack;
 
-            case CommandType::Pop:
-                stack.pop();
-                break;
+        simulateCommand(stack, cmd);
 
-            case CommandType::Dec:
-                stack.dec();
-                break;
+        // If the command leaves the stack in a state we can't represent, we
+        // use the command as it is, and start simulating from scratch after it
+        if (!stack.isRepresentable()) {
+            appendSimulatedCommands(commands, before);
+            commands.push_back(cmd);
+            stack = StackSimulator();
+        }
+    }
 
-            case CommandType::Dup:
-                stack.dup();
-                break;
+    if (!exited) {
+        appendSimulatedCommands(commands, stack);
 
-            case CommandType::Inc:
-                stack.inc();
-                break;
+        if (auto stackTop = stack.getStackTop(); stackTop) {
+            chunk.nextChunk = *stackTop;
+        }
+    }
 
-            case CommandType::Input:
-                stack.input();
-                break;
+    chunk.commands = std::move(commands);
+}
 
-            case CommandType::Jump:
-                breakOut = true;
-                break;
+/**
+ * Optimizes both versions of a chunk that has been split by whether it has
+ * been visited before, in place.
+ *
+ * @param chunk
+ *     The split XRF chunk to optimize
+ * @param index
+ *     The index of the chunk in the program
+ */
+void optimizeSplitChunk(Chunk &chunk, unsigned index) {
+    Chunk visited;
+    visited.commands = std::move(*chunk.visitedCommands);
+    visited.nextChunk = chunk.visitedNextChunk;
 
-            case CommandType::Nop:
-                break;
+    optimizeChunk(chunk, index);
+    optimizeChunk(visited, index);
 
-            case CommandType::Sub:
-                stack.sub();
-                break;
+    chunk.visitedCommands = std::move(visited.commands);
+    chunk.visitedNextChunk = visited.nextChunk;
+}
 
-            case CommandType::Swap:
-                stack.swap();
-                break;
+/**
+ * Resolves the Ignore commands in a list of commands, given whether the chunk
+ * the commands are from has been visited. Nothing after a Jump or Exit
+ * command is kept, as it would never be run.
+ *
+ * @param commands
+ *     The commands to resolve the Ignore commands in
+ * @param visited
+ *     Whether the chunk has been visited before
+ *
+ * @return
+ *     The commands that actually get run, with no Ignore commands
+ */
+std::vector<Command> resolveVisits(const std::vector<Command> &commands, bool visited) {
+    std::vector<Command> resolved;
 
-            case CommandType::Exit:
-            case CommandType::Randomize:
-            case CommandType::IgnoreFirst:
-            case CommandType::IgnoreVisited:
-                // We don't bother trying to optimize a chunk if any of these
-                // commands are in the chunk.
-                canOptimize = false;
-                break;
+    for (size_t i = 0; i < commands.size(); i++) {
+        auto type = commands[i].type;
 
-            case CommandType::AddToSecond:
-            case CommandType::MultiplySecond:
-            case CommandType::PopSecondValue:
-            case CommandType::PushSecondValue:
-            case CommandType::PushValueToBottom:
-            case CommandType::SetSecondValue:
-            case CommandType::SetTop:
-                // These commands are only generated by optimizing a chunk.
-                // We will not be able to optimize further than what we've
-                // already optimized, so we stop the procedure here.
-                canOptimize = false;
-                break;
+        if (type == CommandType::IgnoreFirst || type == CommandType::IgnoreVisited) {
+            if ((type == CommandType::IgnoreFirst) != visited) {
+                i++;
+            }
+            continue;
         }
 
-        if (breakOut || !canOptimize) {
+        resolved.push_back(commands[i]);
+
+        if (type == CommandType::Jump || type == CommandType::Exit) {
             break;
         }
     }
 
-    if (canOptimize) {
-        if (auto stackTop = stack.getStackTop(); stackTop) {
-            optimized.nextChunk = *stackTop;
-        }
+    return resolved;
+}
 
-        if (auto optimizedCommands = stack.getCommands(); optimizedCommands) {
-            optimized.commands = *optimizedCommands;
+/**
+ * Returns whether two lists of commands are the same.
+ *
+ * @param commands1
+ *     The first list of commands
+ * @param commands2
+ *     The second list of commands
+ *
+ * @return
+ *     Whether the commands have the same types, values, slots and multiples,
+ *     including the added slots and multiples
+ */
+bool sameCommands(const std::vector<Command> &commands1, const std::vector<Command> &commands2) {
+    return std::equal(commands1.begin(), commands1.end(), commands2.begin(), commands2.end(),
+        [] (const Command &cmd1, const Command &cmd2) {
+            return cmd1.type == cmd2.type && cmd1.val == cmd2.val &&
+                   cmd1.slot == cmd2.slot && cmd1.multiple == cmd2.multiple &&
+                   cmd1.addedSlot == cmd2.addedSlot && cmd1.addedMultiple == cmd2.addedMultiple;
         }
-    }
-
-    return optimized;
+    );
 }
 
 /**
- * Returns whether a chunk only has the commands in the given array.
+ * Returns whether a list of commands only has the commands in the given array.
  *
  * @tparam N
  *     The size of the array of commands
- * @param chunk
- *     The chunk to check for the commands
  * @param commands
+ *     The commands to check
+ * @param allowed
  *     The array containing the list of acceptable command types
  *
  * @return
- *     Returns true if the type of every command in the chunk is in the array
+ *     Returns true if the type of every command in the list is in the array
  */
 template <size_t N>
-bool chunkOnlyHas(const Chunk &chunk, const std::array<CommandType, N> &commands) {
-    return std::all_of(chunk.commands.begin(), chunk.commands.end(), [&] (Command cmd) {
-        return std::find(commands.begin(), commands.end(), cmd.type) != commands.end();
+bool onlyHasCommands(const std::vector<Command> &commands, const std::array<CommandType, N> &allowed) {
+    return std::all_of(commands.begin(), commands.end(), [&] (Command cmd) {
+        return std::find(allowed.begin(), allowed.end(), cmd.type) != allowed.end();
     });
 }
 
@@ -248,49 +364,450 @@ constexpr auto CONTINUE_CHUNK_OPT_COMMANDS = std::array{
     CommandType::SetTop,
 };
 
+// The most chunks that get followed when building a trace from a chunk.
+// Longer chains of chunks get split into multiple traces.
+constexpr size_t MAX_TRACE_CHUNKS = 32;
+
+/**
+ * Returns whether a chunk can be part of a trace, which is true unless what
+ * the chunk does depends on whether it has been visited.
+ *
+ * @param chunk
+ *     The chunk to check
+ *
+ * @return
+ *     Whether the chunk can be part of a trace
+ */
+bool canTraceThrough(const Chunk &chunk) {
+    return !chunk.visitedCommands && std::none_of(chunk.commands.begin(), chunk.commands.end(), [] (Command cmd) {
+        return cmd.type == CommandType::IgnoreFirst || cmd.type == CommandType::IgnoreVisited;
+    });
+}
+
+/**
+ * Gets the commands from a chunk that actually get run, for adding the chunk
+ * to a trace. Everything from a Jump command onwards is left out, as the jump
+ * is replaced by the trace carrying on into the next chunk, and nothing after
+ * an Exit command is included.
+ *
+ * @param commands
+ *     The commands of the chunk
+ *
+ * @return
+ *     The commands to add to the trace
+ */
+std::vector<Command> traceCommands(const std::vector<Command> &commands) {
+    std::vector<Command> traced;
+
+    for (const auto &cmd: commands) {
+        if (cmd.type == CommandType::Jump) {
+            break;
+        }
+
+        traced.push_back(cmd);
+
+        if (cmd.type == CommandType::Exit) {
+            break;
+        }
+    }
+
+    return traced;
+}
+
+/**
+ * Combines the commands for each chunk in a trace into one list of commands.
+ * Runs of chunks that only set the top value and operate on the second value
+ * of the stack get condensed, in the order they'd be run.
+ *
+ * @param traced
+ *     The commands for each chunk in the trace, in the order they're run
+ *
+ * @return
+ *     The combined commands of the trace
+ */
+std::vector<Command> condenseTrace(const std::vector<std::vector<Command>> &traced) {
+    std::vector<Command> commands;
+
+    for (size_t i = 0; i < traced.size(); ) {
+        if (!onlyHasCommands(traced[i], BEGIN_CHUNK_OPT_COMMANDS)) {
+            commands.insert(commands.end(), traced[i].begin(), traced[i].end());
+            i++;
+            continue;
+        }
+
+        std::vector<Command> run = traced[i];
+
+        for (i++; i < traced.size() && onlyHasCommands(traced[i], CONTINUE_CHUNK_OPT_COMMANDS); i++) {
+            run.insert(run.end(), traced[i].begin(), traced[i].end());
+        }
+
+        condenseStackTops(run);
+        handleSecondVal(run);
+
+        commands.insert(commands.end(), run.begin(), run.end());
+    }
+
+    return commands;
+}
+
+/**
+ * Returns whether a chunk exits the program, as opposed to jumping to another
+ * chunk.
+ *
+ * @param chunk
+ *     The chunk to check
+ *
+ * @return
+ *     Whether the chunk has an Exit command before any Jump command
+ */
+bool exitsProgram(const Chunk &chunk) {
+    for (const auto &cmd: chunk.commands) {
+        if (cmd.type == CommandType::Jump) {
+            return false;
+        }
+        if (cmd.type == CommandType::Exit) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Finds the chunks that make up the trace starting at a given chunk. The trace
+ * follows the jumps between chunks that are known ahead of time, until it
+ * reaches a chunk that starts its own trace, a jump that isn't known until
+ * runtime, or a chunk that exits the program.
+ *
+ * @param chunks
+ *     The list of chunks in the program
+ * @param index
+ *     The index of the chunk that starts the trace
+ * @param traceHeads
+ *     Whether each chunk starts its own trace
+ *
+ * @return
+ *     The indices of the chunks in the trace, in the order they're run
+ */
+std::vector<size_t> followTrace(const std::vector<Chunk> &chunks, size_t index, const std::vector<bool> &traceHeads) {
+    std::vector<size_t> trace;
+
+    while (true) {
+        trace.push_back(index);
+
+        auto &chunk = chunks[index];
+
+        if (exitsProgram(chunk)) {
+            break;
+        }
+
+        // Leave jumps to chunks that don't exist for the generated code
+        // to deal with
+        auto next = chunk.nextChunk;
+
+        if (!next || *next >= chunks.size() || traceHeads[*next] || !canTraceThrough(chunks[*next])) {
+            break;
+        }
+
+        if (trace.size() == MAX_TRACE_CHUNKS || std::find(trace.begin(), trace.end(), *next) != trace.end()) {
+            break;
+        }
+
+        index = *next;
+    }
+
+    return trace;
+}
+
+/**
+ * Picks the chunks that traces get built from. Chunks that can be jumped to
+ * from anywhere other than the end of one other chunk start a trace, and the
+ * rest of the chunks are added to the trace of the chunk that jumps to them,
+ * so that no chunk ends up copied into more than one trace. Chunks left out
+ * of every trace, like chunks in loops that can only be entered with jumps
+ * that aren't known until runtime, start traces of their own.
+ *
+ * @param chunks
+ *     The list of chunks in the program
+ *
+ * @return
+ *     Whether each chunk starts a trace
+ */
+std::vector<bool> findTraceHeads(const std::vector<Chunk> &chunks) {
+    std::vector<unsigned> predecessors(chunks.size(), 0);
+    std::vector<bool> untracedPredecessor(chunks.size(), false);
+
+    auto addJump = [&] (std::optional<unsigned> target, bool traced) {
+        if (target && *target < chunks.size()) {
+            predecessors[*target]++;
+
+            if (!traced) {
+                untracedPredecessor[*target] = true;
+            }
+        }
+    };
+
+    for (const auto &chunk: chunks) {
+        addJump(chunk.nextChunk, canTraceThrough(chunk));
+        addJump(chunk.visitedNextChunk, false);
+    }
+
+    std::vector<bool> traceHeads(chunks.size());
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        traceHeads[i] = i == 0 || predecessors[i] != 1 || untracedPredecessor[i];
+    }
+
+    std::vector<bool> inTrace(chunks.size(), false);
+
+    auto addTrace = [&] (size_t index) {
+        if (!canTraceThrough(chunks[index])) {
+            inTrace[index] = true;
+            return;
+        }
+
+        for (auto traced: followTrace(chunks, index, traceHeads)) {
+            inTrace[traced] = true;
+        }
+    };
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (traceHeads[i]) {
+            addTrace(i);
+        }
+    }
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (!inTrace[i]) {
+            traceHeads[i] = true;
+            addTrace(i);
+        }
+    }
+
+    return traceHeads;
+}
+
+/**
+ * Returns whether running a list of commands can never be seen from outside
+ * the program, because they don't do any I/O and don't exit the program.
+ *
+ * @param commands
+ *     The commands to check
+ *
+ * @return
+ *     Whether the commands are silent
+ */
+bool isSilent(const std::vector<Command> &commands) {
+    return std::none_of(commands.begin(), commands.end(), [] (Command cmd) {
+        return cmd.type == CommandType::Input || cmd.type == CommandType::Output ||
+               cmd.type == CommandType::OutputValue || cmd.type == CommandType::TranslateInput ||
+               cmd.type == CommandType::Exit;
+    });
+}
+
+/**
+ * Finds the chunks that are part of silent loops. A silent loop is a cycle of
+ * chunks that jump to each other with jumps that are known ahead of time, and
+ * that never do any I/O or exit the program. Once a silent loop is entered,
+ * the program runs it forever without anything it does being seen, so the
+ * loop only has to spin, without changing the stack at all.
+ *
+ * @param chunks
+ *     The list of chunks in the program
+ *
+ * @return
+ *     Whether each chunk is part of a silent loop
+ */
+std::vector<bool> findSilentLoops(const std::vector<Chunk> &chunks) {
+    enum class State { Unvisited, OnPath, Done };
+
+    std::vector<State> states(chunks.size(), State::Unvisited);
+    std::vector<bool> silentLoops(chunks.size(), false);
+
+    for (size_t start = 0; start < chunks.size(); start++) {
+        std::vector<size_t> path;
+        std::optional<size_t> index = start;
+
+        // Every chunk has at most one known jump, so following them from a
+        // chunk either leaves the known jumps, or ends up in a cycle
+        while (index && states[*index] == State::Unvisited) {
+            states[*index] = State::OnPath;
+            path.push_back(*index);
+
+            auto next = chunks[*index].nextChunk;
+
+            if (canTraceThrough(chunks[*index]) && next && *next < chunks.size()) {
+                index = *next;
+            }
+            else {
+                index = std::nullopt;
+            }
+        }
+
+        if (index && states[*index] == State::OnPath) {
+            auto loopStart = std::find(path.begin(), path.end(), *index);
+
+            bool silent = std::all_of(loopStart, path.end(), [&] (size_t loopIndex) {
+                return isSilent(chunks[loopIndex].commands);
+            });
+
+            if (silent) {
+                for (auto it = loopStart; it != path.end(); ++it) {
+                    silentLoops[*it] = true;
+                }
+            }
+        }
+
+        for (auto pathIndex: path) {
+            states[pathIndex] = State::Done;
+        }
+    }
+
+    return silentLoops;
+}
+
+/**
+ * Tries to combine the body of a loop, made of a trace of chunks that ends up
+ * jumping back to the start of the trace, into one series of optimized
+ * commands that has the effect of a whole iteration of the loop. Each
+ * iteration of the loop then loads the values it needs from the stack, works
+ * out the new values and stores them all at once, rather than going through
+ * each command of each chunk in turn.
+ *
+ * @param commands
+ *     The combined commands of the trace
+ * @param index
+ *     The index of the chunk that starts the trace
+ *
+ * @return
+ *     The optimized commands of one iteration of the loop, or std::nullopt if
+ *     the loop body couldn't be combined
+ */
+std::optional<std::vector<Command>> fuseLoopBody(const std::vector<Command> &commands, size_t index) {
+    StackSimulator stack(index);
+
+    if (!simulateCommands(stack, commands) || stack.getStackTop() != index) {
+        return std::nullopt;
+    }
+
+    return stack.getCommands();
+}
+
+/**
+ * Builds the trace that starts at a chunk, which has the effect of visiting
+ * all of the chunks in the trace in turn, without having to jump between
+ * them.
+ *
+ * @param chunks
+ *     The list of chunks in the program
+ * @param index
+ *     The index of the chunk that starts the trace
+ * @param traceHeads
+ *     Whether each chunk starts its own trace
+ *
+ * @return
+ *     The chunk for the whole trace
+ */
+Chunk buildTrace(const std::vector<Chunk> &chunks, size_t index, const std::vector<bool> &traceHeads) {
+    auto &originalChunk = chunks[index];
+
+    if (!canTraceThrough(originalChunk)) {
+        return originalChunk;
+    }
+
+    auto trace = followTrace(chunks, index, traceHeads);
+
+    std::vector<std::vector<Command>> traced;
+
+    for (auto traceIndex: trace) {
+        traced.push_back(traceCommands(chunks[traceIndex].commands));
+    }
+
+    Chunk optimizedChunk;
+    optimizedChunk.line = originalChunk.line;
+    optimizedChunk.col = originalChunk.col;
+    optimizedChunk.commands = condenseTrace(traced);
+    optimizedChunk.nextChunk = chunks[trace.back()].nextChunk;
+
+    if (optimizedChunk.nextChunk == index) {
+        if (auto loopBody = fuseLoopBody(optimizedChunk.commands, index); loopBody) {
+            optimizedChunk.commands = *loopBody;
+        }
+    }
+
+    return optimizedChunk;
+}
+
 /**
  * Follows the path through the program we will take after a chunk to create a
- * condensed chunk that has the effect that visiting this chunk will have. For
- * instance, if a chunk adds 2 to the second value of the stack, and it takes
- * us to a chunk that adds 2 to the second value of the stack, then this
- * function will produce an optimized chunk that adds 4 to the second value of
- * the stack, and will skip over the second chunk.
+ * condensed chunk that has the effect that visiting this chunk will have,
+ * while the chunks only modify the stack in simple ways. For instance, if a
+ * chunk adds 2 to the second value of the stack, and it takes us to a chunk
+ * that adds 2 to the second value of the stack, then this function will
+ * produce an optimized chunk that adds 4 to the second value of the stack,
+ * and will skip over the second chunk. This is used for chunks that are part
+ * of another chunk's trace, since they can still be jumped to at runtime.
  *
  * @param chunks
  *     The list of chunks in the program
  * @param index
  *     The index of the chunk we want to optimize
+ * @param chainVisits
+ *     A scratch list with an entry for each chunk, which is reused between
+ *     calls on the same thread. Each chunk the chain passes through gets
+ *     marked with the index of the chunk the chain starts from, plus one, so
+ *     the list never has to be cleared.
  *
  * @return
  *     The optimized version of the chunk
  */
-Chunk optimizeChunkInProgram(const std::vector<Chunk> &chunks, size_t index) {
+Chunk condenseChain(const std::vector<Chunk> &chunks, size_t index, std::vector<size_t> &chainVisits) {
     auto &originalChunk = chunks[index];
+
+    if (!canTraceThrough(originalChunk) || !onlyHasCommands(originalChunk.commands, BEGIN_CHUNK_OPT_COMMANDS)) {
+        return originalChunk;
+    }
+
     Chunk optimizedChunk;
+    optimizedChunk.line = originalChunk.line;
+    optimizedChunk.col = originalChunk.col;
 
-    auto toOptimize = chunks[index];
+    auto chainMark = index + 1;
 
-    std::unordered_set<size_t> visited;
+    auto toOptimize = &originalChunk;
 
-    if (chunkOnlyHas(toOptimize, BEGIN_CHUNK_OPT_COMMANDS)) {
-        do
-        {
-            if (visited.count(index)) {
-                // We're in a infinite loop, don't bother optimizing it
-                return originalChunk;
-            }
-            visited.insert(index);
+    size_t chainLength = 0;
+
+    do
+    {
+        if (chainVisits[index] == chainMark) {
+            // We're in a infinite loop, don't bother optimizing it
+            return originalChunk;
+        }
+        chainVisits[index] = chainMark;
+
+        optimizedChunk.commands.insert(optimizedChunk.commands.end(),
+                                       toOptimize->commands.begin(),
+                                       toOptimize->commands.end());
 
-            optimizedChunk.commands.insert(optimizedChunk.commands.end(),
-                                           toOptimize.commands.begin(),
-                                           toOptimize.commands.end());
+        optimizedChunk.nextChunk = toOptimize->nextChunk;
 
-            optimizedChunk.nextChunk = toOptimize.nextChunk;
-            index = *optimizedChunk.nextChunk;
-            toOptimize = chunks[index];
+        // Leave jumps to chunks that don't exist for the generated code
+        // to deal with
+        if (!optimizedChunk.nextChunk || *optimizedChunk.nextChunk >= chunks.size()) {
+            break;
         }
-        while (chunkOnlyHas(toOptimize, CONTINUE_CHUNK_OPT_COMMANDS));
+
+        // Long chains are cut off, like traces, so that condensing every
+        // chunk in a chain doesn't take time quadratic in its length
+        if (++chainLength == MAX_TRACE_CHUNKS) {
+            break;
+        }
+
+        index = *optimizedChunk.nextChunk;
+        toOptimize = &chunks[index];
     }
+    while (canTraceThrough(*toOptimize) && onlyHasCommands(toOptimize->commands, CONTINUE_CHUNK_OPT_COMMANDS));
 
     if (optimizedChunk.commands.empty()) {
         return originalChunk;
@@ -302,27 +819,280 @@ Chunk optimizeChunkInProgram(const std::vector<Chunk> &chunks, size_t index) {
     return optimizedChunk;
 }
 
-} // anonymous namespace
+/**
+ * The most chunks that are followed when working out the translation of a
+ * byte of input, before we give up on the byte.
+ */
+constexpr size_t MAX_TRANSLATION_CHUNKS = 64;
 
-std::vector<Chunk> optimizeChunks(const std::vector<Chunk> &chunks) {
-    std::vector<Chunk> optimizedChunks;
+/**
+ * Finds the Input command that reads the last byte of input in a chunk, if the
+ * chunk reads input and can be traced through.
+ *
+ * @param chunk
+ *     The chunk to check
+ *
+ * @return
+ *     The index of the last Input command run by the chunk, if there is one
+ */
+std::optional<size_t> findInputRead(const Chunk &chunk) {
+    if (!canTraceThrough(chunk)) {
+        return std::nullopt;
+    }
 
-    for (size_t i = 0; i < chunks.size(); i++) {
-        optimizedChunks.emplace_back(optimizeChunk(chunks[i], i));
+    auto commands = traceCommands(chunk.commands);
+
+    for (size_t i = commands.size(); i > 0; i--) {
+        if (commands[i - 1].type == CommandType::Input) {
+            return i - 1;
+        }
+    }
+
+    return std::nullopt;
+}
+
+/**
+ * Returns whether two chunks do the same thing after reading their last byte
+ * of input, by running the same commands and jumping to the same chunk.
+ *
+ * @param chunk1
+ *     The first chunk to check
+ * @param input1
+ *     The index of the last Input command in the first chunk
+ * @param chunk2
+ *     The second chunk to check
+ * @param input2
+ *     The index of the last Input command in the second chunk
+ *
+ * @return
+ *     Whether the two chunks continue the same way after reading input
+ */
+bool sameInputRead(const Chunk &chunk1, size_t input1, const Chunk &chunk2, size_t input2) {
+    auto commands1 = traceCommands(chunk1.commands);
+    auto commands2 = traceCommands(chunk2.commands);
+
+    return chunk1.nextChunk == chunk2.nextChunk &&
+           sameCommands({commands1.begin() + input1 + 1, commands1.end()},
+                        {commands2.begin() + input2 + 1, commands2.end()});
+}
+
+/**
+ * Works out what the program does when a chunk reads a given byte of input.
+ * The byte has a translation if the program only outputs known values until
+ * it reads input again the same way, with the stack left just as it was
+ * before the byte was read. Reading that byte can then be skipped over by
+ * writing out its translation and reading the next byte right away.
+ *
+ * @param chunks
+ *     The list of chunks in the program
+ * @param readIndex
+ *     The index of the chunk that reads the byte
+ * @param inputIndex
+ *     The index of the last Input command in the chunk
+ * @param byte
+ *     The byte of input that was read
+ *
+ * @return
+ *     The translation of the byte, which is TRANSLATE_STOP if the byte can't
+ *     be translated
+ */
+unsigned translateByte(const std::vector<Chunk> &chunks, size_t readIndex, size_t inputIndex, unsigned byte) {
+    auto &readChunk = chunks[readIndex];
+    auto readCommands = traceCommands(readChunk.commands);
+
+    StackSimulator stack(byte);
+
+    std::vector<Command> commands(readCommands.begin() + inputIndex + 1, readCommands.end());
+    auto nextChunk = readChunk.nextChunk;
+
+    for (size_t i = 0; i < MAX_TRANSLATION_CHUNKS; i++) {
+        if (!simulateCommands(stack, commands)) {
+            return TRANSLATE_STOP;
+        }
+
+        auto next = nextChunk ? nextChunk : stack.getStackTop();
+
+        if (!next || *next >= chunks.size() || !canTraceThrough(chunks[*next])) {
+            return TRANSLATE_STOP;
+        }
+
+        auto &chunk = chunks[*next];
+        commands = traceCommands(chunk.commands);
+        nextChunk = chunk.nextChunk;
+
+        auto input = findInputRead(chunk);
+
+        if (!input) {
+            continue;
+        }
+
+        if (!sameInputRead(readChunk, inputIndex, chunk, *input) ||
+            !simulateCommands(stack, {commands.begin(), commands.begin() + *input}) ||
+            !stack.onlyPoppedTop())
+        {
+            return TRANSLATE_STOP;
+        }
+
+        auto output = stack.getKnownOutput();
+
+        if (!output || output->size() > 1) {
+            return TRANSLATE_STOP;
+        }
+
+        return output->empty() ? TRANSLATE_NO_OUTPUT : output->front() & 0xFF;
     }
 
-    return optimizedChunks;
+    return TRANSLATE_STOP;
 }
 
-std::vector<Chunk> optimizeProgram(const std::vector<Chunk> &chunks) {
-    std::vector<Chunk> optimizedProgram;
+/**
+ * Finds the chunks that read input and then run through chunks that output a
+ * translation of the byte, before reading the next byte the same way, like a
+ * program that copies its input or encodes it with a cipher. These chunks get
+ * their last Input command replaced with a TranslateInput command, with a
+ * table of the translation of each byte worked out ahead of time, so the
+ * generated code can translate input in a tight loop.
+ *
+ * @param chunks
+ *     The list of chunks in the program
+ */
+void translateInputs(std::vector<Chunk> &chunks) {
+    struct InputRead {
+        size_t chunk;
+        size_t input;
+        std::shared_ptr<const InputTranslation> translation;
+    };
+
+    // Chunks that read input the same way share the same translation, so it
+    // only has to be worked out once
+    std::vector<InputRead> reads;
+    std::vector<std::pair<size_t, size_t>> translated;
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        auto input = findInputRead(chunks[i]);
+
+        if (!input) {
+            continue;
+        }
+
+        auto read = std::find_if(reads.begin(), reads.end(), [&] (const InputRead &other) {
+            return sameInputRead(chunks[other.chunk], other.input, chunks[i], *input);
+        });
 
-    optimizedProgram.reserve(chunks.size());
+        if (read == reads.end()) {
+            InputTranslation translation;
+            bool translatesAny = false;
 
+            for (unsigned byte = 0; byte < translation.size(); byte++) {
+                translation[byte] = translateByte(chunks, i, *input, byte);
+                translatesAny |= translation[byte] != TRANSLATE_STOP;
+            }
+
+            reads.push_back({i, *input, nullptr});
+            read = reads.end() - 1;
+
+            if (translatesAny) {
+                read->translation = std::make_shared<const InputTranslation>(translation);
+            }
+        }
+
+        if (read->translation) {
+            chunks[i].translation = read->translation;
+            translated.emplace_back(i, *input);
+        }
+    }
+
+    // The chunks are only changed after all of the translations have been
+    // worked out, since they're worked out from the original Input commands
+    for (auto [chunk, input]: translated) {
+        chunks[chunk].commands[input] = Command(CommandType::TranslateInput);
+    }
+}
+
+} // anonymous namespace
+
+std::vector<Chunk> specializeVisits(std::vector<Chunk> chunks, const std::vector<bool> &hotChunks) {
     for (size_t i = 0; i < chunks.size(); i++) {
-        optimizedProgram.emplace_back(optimizeChunkInProgram(chunks, i));
+        auto &chunk = chunks[i];
+
+        if (chunk.visitedCommands || (!hotChunks.empty() && !hotChunks[i])) {
+            continue;
+        }
+
+        auto firstCommands = resolveVisits(chunk.commands, false);
+        auto visitedCommands = resolveVisits(chunk.commands, true);
+
+        // Chunks without Ignore commands, or with one only at the end where
+        // it doesn't skip anything, don't need to be split
+        if (!sameCommands(firstCommands, visitedCommands)) {
+            chunk.visitedCommands = std::move(visitedCommands);
+            chunk.visitedNextChunk = chunk.nextChunk;
+        }
+
+        chunk.commands = std::move(firstCommands);
+    }
+
+    return chunks;
+}
+
+std::vector<Chunk> optimizeChunks(std::vector<Chunk> chunks, unsigned jobs) {
+    parallelFor(chunks.size(), jobs, [&] (size_t i, unsigned) {
+        if (chunks[i].visitedCommands) {
+            optimizeSplitChunk(chunks[i], i);
+        }
+        else {
+            optimizeChunk(chunks[i], i);
+        }
+    });
+
+    return chunks;
+}
+
+std::vector<Chunk> optimizeProgram(std::vector<Chunk> program, unsigned jobs, const std::vector<bool> &hotChunks,
+                                   bool checked)
+{
+    // Checked code reports the line and column of the chunk that misused the
+    // stack, after the output of the chunks before it, so none of the chunks
+    // can be merged together
+    if (checked) {
+        return program;
+    }
+
+    auto silentLoops = findSilentLoops(program);
+
+    for (size_t i = 0; i < program.size(); i++) {
+        if (silentLoops[i]) {
+            program[i].commands.clear();
+            program[i].nextChunk = i;
+        }
     }
 
+    std::vector<Chunk> optimizedProgram(program.size());
+
+    auto traceHeads = findTraceHeads(program);
+
+    std::vector<std::vector<size_t>> chainVisits(std::max(1u, jobs));
+
+    parallelFor(program.size(), jobs, [&] (size_t i, unsigned job) {
+        if (!hotChunks.empty() && !hotChunks[i]) {
+            optimizedProgram[i] = program[i];
+            return;
+        }
+
+        if (traceHeads[i]) {
+            optimizedProgram[i] = buildTrace(program, i, traceHeads);
+            return;
+        }
+
+        if (chainVisits[job].empty()) {
+            chainVisits[job].resize(program.size());
+        }
+
+        optimizedProgram[i] = condenseChain(program, i, chainVisits[job]);
+    });
+
+    translateInputs(optimizedProgram);
+
     return optimizedProgram;
 }
 
@@ -1,54 +1,307 @@
 #include "parser.hpp"
 
+#include <array>
+#include <cstdint>
+#include <string>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 using namespace std::string_literals;
 
 namespace xrf {
 
 namespace {
 
+// The entry in COMMAND_TABLE for characters that aren't XRF commands
+constexpr uint8_t NOT_A_COMMAND = 0xFF;
+
+/**
+ * A table with the command that each character stands for, or NOT_A_COMMAND
+ * for characters that aren't XRF commands.
+ */
+constexpr std::array<uint8_t, 256> COMMAND_TABLE = [] {
+    std::array<uint8_t, 256> table{};
+
+    for (auto &entry: table) {
+        entry = NOT_A_COMMAND;
+    }
+
+    for (uint8_t i = 0; i < 10; i++) {
+        table['0' + i] = i;
+    }
+
+    for (uint8_t i = 0; i < 6; i++) {
+        table['A' + i] = 10 + i;
+    }
+
+    return table;
+}();
+
+// How many characters of the source are classified at a time
+constexpr size_t BLOCK_SIZE = 16;
+
+/**
+ * Returns whether a character is whitespace, which separates chunks. This is
+ * the same as std::isspace() in the "C" locale.
+ *
+ * @param c
+ *     The character to check
+ *
+ * @return
+ *     Whether the character is whitespace
+ */
+bool isWhitespace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/**
+ * Finds which of the characters in a block of the source are whitespace, and
+ * which of them are newlines.
+ *
+ * @param block
+ *     A pointer to the BLOCK_SIZE characters to classify
+ * @param newlines
+ *     Where to write out the mask of newlines
+ *
+ * @return
+ *     A mask with a bit set for each character that is whitespace, where the
+ *     lowest bit is the first character
+ */
+uint32_t classifyBlock(const char *block, uint32_t &newlines) {
+#if defined(__SSE2__)
+    auto chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+
+    // Tabs up to carriage returns are next to each other, so they're found by
+    // checking that the distance from a tab is at most 4
+    auto fromTab = _mm_sub_epi8(chars, _mm_set1_epi8('\t'));
+    auto isControl = _mm_cmpeq_epi8(_mm_min_epu8(fromTab, _mm_set1_epi8(4)), fromTab);
+    auto isSpace = _mm_cmpeq_epi8(chars, _mm_set1_epi8(' '));
+
+    newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8('\n')));
+
+    return _mm_movemask_epi8(_mm_or_si128(isControl, isSpace));
+#else
+    uint32_t whitespace = 0;
+    newlines = 0;
+
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        whitespace |= uint32_t(isWhitespace(block[i])) << i;
+        newlines |= uint32_t(block[i] == '\n') << i;
+    }
+
+    return whitespace;
+#endif
+}
+
+/**
+ * Returns the number of trailing zero bits in a non-zero mask.
+ *
+ * @param mask
+ *     The mask, which must have at least one bit set
+ *
+ * @return
+ *     The index of the lowest set bit
+ */
+unsigned lowestBit(uint32_t mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    unsigned bit = 0;
+
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        bit++;
+    }
+
+    return bit;
+#endif
+}
+
+/**
+ * Returns the index of the highest set bit in a non-zero mask.
+ *
+ * @param mask
+ *     The mask, which must have at least one bit set
+ *
+ * @return
+ *     The index of the highest set bit
+ */
+unsigned highestBit(uint32_t mask) {
+#if defined(__GNUC__)
+    return 31 - __builtin_clz(mask);
+#else
+    unsigned bit = 0;
+
+    while (mask >>= 1) {
+        bit++;
+    }
+
+    return bit;
+#endif
+}
+
+/**
+ * Returns the number of set bits in a mask.
+ *
+ * @param mask
+ *     The mask to count the bits of
+ *
+ * @return
+ *     The number of set bits
+ */
+unsigned countBits(uint32_t mask) {
+#if defined(__GNUC__)
+    return __builtin_popcount(mask);
+#else
+    unsigned count = 0;
+
+    for (; mask; mask &= mask - 1) {
+        count++;
+    }
+
+    return count;
+#endif
+}
+
+/**
+ * Scans through XRF source that is all in memory. The line and column of a
+ * position are worked out from where the current line starts, so nothing has
+ * to be kept track of for each character, other than newlines in whitespace.
+ */
+struct Scanner {
+    /**
+     * The source being scanned
+     */
+    std::string_view source;
+
+    /**
+     * The position of the next character to scan
+     */
+    size_t pos = 0;
+
+    /**
+     * The line that the next character is on
+     */
+    int line = 1;
+
+    /**
+     * The position of the first character of the current line
+     */
+    size_t lineStart = 0;
+
+    /**
+     * Returns the column of a position in the current line.
+     *
+     * @param position
+     *     The position in the source
+     *
+     * @return
+     *     The column of the position, where the first column is 1
+     */
+    int column(size_t position) const {
+        return static_cast<int>(position - lineStart) + 1;
+    }
+
+    /**
+     * Skips over any whitespace at the current position, keeping track of
+     * the newlines that are skipped over.
+     */
+    void skipWhitespace() {
+        while (pos + BLOCK_SIZE <= source.size()) {
+            uint32_t newlines;
+            uint32_t nonWhitespace = ~classifyBlock(source.data() + pos, newlines) & ((1u << BLOCK_SIZE) - 1);
+
+            // Only the newlines before the next chunk have been skipped
+            auto skipped = nonWhitespace ? lowestBit(nonWhitespace) : BLOCK_SIZE;
+            newlines &= (uint32_t(1) << skipped) - 1;
+
+            if (newlines) {
+                line += countBits(newlines);
+                lineStart = pos + highestBit(newlines) + 1;
+            }
+
+            pos += skipped;
+
+            if (nonWhitespace) {
+                return;
+            }
+        }
+
+        for (; pos < source.size() && isWhitespace(source[pos]); pos++) {
+            if (source[pos] == '\n') {
+                line++;
+                lineStart = pos + 1;
+            }
+        }
+    }
+
+    /**
+     * Finds the end of the chunk starting at the current position, which is
+     * either the next whitespace character or the end of the source.
+     *
+     * @return
+     *     The position just past the end of the chunk
+     */
+    size_t findChunkEnd() const {
+        auto end = pos;
+
+        while (end + BLOCK_SIZE <= source.size()) {
+            uint32_t newlines;
+            auto whitespace = classifyBlock(source.data() + end, newlines);
+
+            if (whitespace) {
+                return end + lowestBit(whitespace);
+            }
+
+            end += BLOCK_SIZE;
+        }
+
+        while (end < source.size() && !isWhitespace(source[end])) {
+            end++;
+        }
+
+        return end;
+    }
+};
+
 /**
  * @brief Attempts to parse a XRF chunk, which will result in either a new,
  * valid, chunk being added to the passed-in list of chunks, or new error
  * messages being added to the list of errors
  *
- * @param file
- *     The file reader to read the next characters of the chunk from
- * @param chunkChar
- *     The first character in the chunk that was read already
+ * @param scanner
+ *     The scanner, at the first character of the chunk, which is left just
+ *     past the end of the chunk
  * @param chunks
  *     The existing list of chunks, which may be added to
  * @param errors
  *     The existing list of parser errors, which may be added to
  */
-void parseChunk(FileReader &file, char chunkChar, std::vector<Chunk> &chunks, ParserErrorList &errors) {
+void parseChunk(Scanner &scanner, std::vector<Chunk> &chunks, ParserErrorList &errors) {
+    auto start = scanner.pos;
+    auto end = scanner.findChunkEnd();
+
     Chunk chunk;
-    chunk.line = file.curLine();
-    chunk.col = file.curColumn();
-
-    for (std::optional<char> c = chunkChar; c && !std::isspace(*c); c = file.read()) {
-        switch (*c) {
-            case '0': chunk.commands.push_back(CommandType::Input); break;
-            case '1': chunk.commands.push_back(CommandType::Output); break;
-            case '2': chunk.commands.push_back(CommandType::Pop); break;
-            case '3': chunk.commands.push_back(CommandType::Dup); break;
-            case '4': chunk.commands.push_back(CommandType::Swap); break;
-            case '5': chunk.commands.push_back(CommandType::Inc); break;
-            case '6': chunk.commands.push_back(CommandType::Dec); break;
-            case '7': chunk.commands.push_back(CommandType::Add); break;
-            case '8': chunk.commands.push_back(CommandType::IgnoreFirst); break;
-            case '9': chunk.commands.push_back(CommandType::Bottom); break;
-            case 'A': chunk.commands.push_back(CommandType::Jump); break;
-            case 'B': chunk.commands.push_back(CommandType::Exit); break;
-            case 'C': chunk.commands.push_back(CommandType::IgnoreVisited); break;
-            case 'D': chunk.commands.push_back(CommandType::Randomize); break;
-            case 'E': chunk.commands.push_back(CommandType::Sub); break;
-            case 'F': chunk.commands.push_back(CommandType::Nop); break;
-            default:
-                errors.emplace_back("Found invalid command character: "s + *c, file.curLine(), file.curColumn());
-                break;
+    chunk.line = scanner.line;
+    chunk.col = scanner.column(start);
+    chunk.commands.reserve(COMMANDS_PER_CHUNK);
+
+    for (auto i = start; i < end; i++) {
+        auto command = COMMAND_TABLE[static_cast<unsigned char>(scanner.source[i])];
+
+        if (command == NOT_A_COMMAND) {
+            errors.emplace_back("Found invalid command character: "s + scanner.source[i],
+                                scanner.line, scanner.column(i));
+        }
+        else {
+            chunk.commands.push_back(static_cast<CommandType>(command));
         }
     }
 
+    scanner.pos = end;
+
     if (chunk.commands.size() < COMMANDS_PER_CHUNK) {
         errors.emplace_back("Chunk doesn't have enough commands.", chunk.line, chunk.col);
     }
@@ -62,14 +315,18 @@ void parseChunk(FileReader &file, char chunkChar, std::vector<Chunk> &chunks, Pa
 
 } // anonymous namespace
 
-std::variant<ParserErrorList, std::vector<Chunk>> parseXrf(FileReader &file) {
+std::variant<ParserErrorList, std::vector<Chunk>> parseXrf(std::string_view source) {
     std::vector<Chunk> chunks;
     ParserErrorList errors;
 
-    for (auto c = file.read(); c; c = file.read()) {
-        if (!std::isspace(*c)) {
-            parseChunk(file, *c, chunks, errors);
-        }
+    // Most chunks are five commands and a space or a newline
+    chunks.reserve(source.size() / (COMMANDS_PER_CHUNK + 1));
+
+    Scanner scanner;
+    scanner.source = source;
+
+    for (scanner.skipWhitespace(); scanner.pos < source.size(); scanner.skipWhitespace()) {
+        parseChunk(scanner, chunks, errors);
     }
 
     if (errors.empty()) {
@@ -80,4 +337,8 @@ std::variant<ParserErrorList, std::vector<Chunk>> parseXrf(FileReader &file) {
     }
 }
 
+std::variant<ParserErrorList, std::vector<Chunk>> parseXrf(FileReader &file) {
+    return parseXrf(file.readAll());
+}
+
 } // namespace xrf
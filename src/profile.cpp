@@ -0,0 +1,126 @@
+#include "profile.hpp"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace xrf {
+
+namespace {
+
+/**
+ * Creates the error for a profile that isn't valid.
+ *
+ * @param lineNumber
+ *     The line of the profile the problem is on
+ * @param message
+ *     What's wrong with the line
+ *
+ * @return
+ *     The error
+ */
+llvm::Error profileError(size_t lineNumber, const std::string &message) {
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   "Line " + std::to_string(lineNumber) + " of the profile: " + message);
+}
+
+} // anonymous namespace
+
+llvm::Expected<Profile> parseProfile(std::string_view text) {
+    llvm::SmallVector<llvm::StringRef, 0> lines;
+    llvm::StringRef(text.data(), text.size()).split(lines, '\n', -1, false);
+
+    llvm::StringRef header = lines.empty() ? "" : lines[0].trim();
+    size_t numChunks;
+
+    if (!header.consume_front("xrf-profile ") || header.trim().getAsInteger(10, numChunks)) {
+        return profileError(1, "expected \"xrf-profile\" and the number of chunks");
+    }
+
+    Profile profile;
+    profile.counts.resize(numChunks);
+
+    for (size_t i = 1; i < lines.size(); i++) {
+        llvm::SmallVector<llvm::StringRef, PROFILE_COUNTERS + 1> fields;
+        lines[i].split(fields, ' ', -1, false);
+
+        if (fields.empty()) {
+            continue;
+        }
+
+        size_t index;
+
+        if (fields.size() != PROFILE_COUNTERS + 1 || fields[0].trim().getAsInteger(10, index)) {
+            return profileError(i + 1, "expected a chunk index and " + std::to_string(PROFILE_COUNTERS) + " counters");
+        }
+
+        if (index >= numChunks) {
+            return profileError(i + 1, "chunk " + std::to_string(index) + " doesn't exist");
+        }
+
+        for (unsigned counter = 0; counter < PROFILE_COUNTERS; counter++) {
+            if (fields[counter + 1].trim().getAsInteger(10, profile.counts[index][counter])) {
+                return profileError(i + 1, "invalid counter \"" + fields[counter + 1].trim().str() + "\"");
+            }
+        }
+    }
+
+    return profile;
+}
+
+llvm::Expected<Profile> loadProfile(const std::string &filename) {
+    auto file = llvm::MemoryBuffer::getFile(filename);
+
+    if (!file) {
+        return llvm::createFileError(filename, file.getError());
+    }
+
+    auto profile = parseProfile(std::string_view((*file)->getBufferStart(), (*file)->getBufferSize()));
+
+    if (!profile) {
+        return llvm::createFileError(filename, profile.takeError());
+    }
+
+    return profile;
+}
+
+std::vector<bool> findHotChunks(const Profile &profile) {
+    std::vector<bool> hot(profile.counts.size(), false);
+
+    uint64_t totalRuns = 0;
+
+    for (size_t i = 0; i < profile.counts.size(); i++) {
+        totalRuns += profile.get(i, ProfileCounter::Runs);
+    }
+
+    uint64_t coveredRuns = 0;
+
+    for (auto chunk: orderHotFirst(profile)) {
+        auto runs = profile.get(chunk, ProfileCounter::Runs);
+
+        if (runs == 0 || coveredRuns >= totalRuns * HOT_COVERAGE) {
+            break;
+        }
+
+        hot[chunk] = true;
+        coveredRuns += runs;
+    }
+
+    return hot;
+}
+
+std::vector<size_t> orderHotFirst(const Profile &profile) {
+    std::vector<size_t> order(profile.counts.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    std::stable_sort(order.begin(), order.end(), [&] (size_t chunk1, size_t chunk2) {
+        return profile.get(chunk1, ProfileCounter::Runs) > profile.get(chunk2, ProfileCounter::Runs);
+    });
+
+    return order;
+}
+
+} // namespace xrf
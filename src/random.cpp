@@ -0,0 +1,57 @@
+#include "random.hpp"
+
+namespace xrf {
+
+namespace {
+
+/**
+ * Rotates the bits of a value to the left.
+ *
+ * @param value
+ *     The value to rotate
+ * @param amount
+ *     The number of bits to rotate by, from 1 to 63
+ *
+ * @return
+ *     The rotated value
+ */
+uint64_t rotateLeft(uint64_t value, unsigned amount) {
+    return (value << amount) | (value >> (64 - amount));
+}
+
+} // anonymous namespace
+
+RandomState seedRandom(uint64_t seed) {
+    RandomState state;
+
+    for (auto &word: state) {
+        seed += SPLITMIX_INCREMENT;
+
+        auto z = seed;
+        z = (z ^ (z >> 30)) * SPLITMIX_MULTIPLIERS[0];
+        z = (z ^ (z >> 27)) * SPLITMIX_MULTIPLIERS[1];
+        word = z ^ (z >> 31);
+    }
+
+    return state;
+}
+
+uint64_t nextRandom(RandomState &state) {
+    auto result = rotateLeft(state[1] * 5, 7) * 9;
+    auto shifted = state[1] << 17;
+
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= shifted;
+    state[3] = rotateLeft(state[3], 45);
+
+    return result;
+}
+
+uint64_t randomBelow(RandomState &state, uint64_t bound) {
+    return ((nextRandom(state) >> 32) * bound) >> 32;
+}
+
+} // namespace xrf
@@ -8,7 +8,13 @@ StackSimulator::StackSimulator(unsigned index):
     _origIndex(index),
     _maxPopped(0),
     _hadIO(false),
-    _values({{0, index}})
+    _values({StackValue::fromValue(index)})
+{}
+
+StackSimulator::StackSimulator():
+    _maxPopped(0),
+    _hadIO(false),
+    _values({StackValue::fromIndex(0)})
 {}
 
 void StackSimulator::add() {
@@ -47,8 +53,14 @@ void StackSimulator::input() {
 }
 
 void StackSimulator::output() {
-    doPop();
-    _hadIO = true;
+    auto val = doPop();
+
+    if (val.isRepresentable()) {
+        _output.push_back(val);
+    }
+    else {
+        _hadIO = true;
+    }
 }
 
 void StackSimulator::pop() {
@@ -69,66 +81,292 @@ void StackSimulator::swap() {
     doPush(val2);
 }
 
-std::optional<unsigned> StackSimulator::getStackTop() {
-    auto val = doPop();
-    doPush(val);
-    return val.getValue();
+size_t StackSimulator::simulateOptimized(const std::vector<Command> &commands, size_t index) {
+    auto &command = commands[index];
+
+    switch (command.type) {
+        case CommandType::AddToSecond: {
+            auto top = doPop();
+            auto second = doPop();
+            second.add(StackValue::fromValue(command.val));
+            doPush(second);
+            doPush(top);
+            break;
+        }
+
+        case CommandType::MultiplySecond: {
+            auto top = doPop();
+            auto second = doPop();
+            second.mul(command.val);
+            doPush(second);
+            doPush(top);
+            break;
+        }
+
+        case CommandType::PopSecondValue: {
+            auto top = doPop();
+            doPop();
+            doPush(top);
+            break;
+        }
+
+        case CommandType::PushSecondValue: {
+            auto top = doPop();
+            doPush(StackValue::fromValue(command.val));
+            doPush(top);
+            break;
+        }
+
+        case CommandType::SetSecondValue: {
+            auto top = doPop();
+            doPop();
+            doPush(StackValue::fromValue(command.val));
+            doPush(top);
+            break;
+        }
+
+        case CommandType::SetTop:
+            doPop();
+            doPush(StackValue::fromValue(command.val));
+            break;
+
+        case CommandType::PushValueToBottom:
+            _bottom.push_back(commandValue(command));
+            break;
+
+        case CommandType::OutputValue: {
+            auto value = commandValue(command);
+
+            if (value.isRepresentable()) {
+                _output.push_back(value);
+            }
+            else {
+                _hadIO = true;
+            }
+            break;
+        }
+
+        case CommandType::TranslateInput:
+            input();
+            break;
+
+        case CommandType::BeginShuffle: {
+            std::vector<StackValue> newValues;
+
+            for (int i = 1; i <= command.val; i++) {
+                newValues.push_back(commandValue(commands[index + i]));
+            }
+
+            for (unsigned i = 0; i < command.slot; i++) {
+                doPop();
+            }
+
+            for (auto &value: newValues) {
+                doPush(value);
+            }
+
+            return command.val + 1;
+        }
+
+        default:
+            break;
+    }
+
+    return 1;
+}
+
+std::optional<unsigned> StackSimulator::getStackTop() const {
+    if (_values.empty()) {
+        return std::nullopt;
+    }
+    return _values.back().getValue();
+}
+
+bool StackSimulator::isRepresentable() const {
+    return !_hadIO && allRepresentable(_bottom) && allRepresentable(_values);
 }
 
 std::optional<std::vector<Command>> StackSimulator::getCommands() const {
-    if (!canOptimize()) {
+    if (!isRepresentable()) {
         return std::nullopt;
     }
 
     std::vector<Command> commands;
-    for (const auto &bottomVal: _bottom) {
-        commands.emplace_back(CommandType::PushValueToBottom, bottomVal.getKnownValue());
+    for (const auto &outputVal: _output) {
+        commands.push_back(valueCommand(CommandType::OutputValue, outputVal));
     }
 
-    if (_origIndex != _values.back().getKnownValue()) {
-        commands.emplace_back(CommandType::SetTop);
-        commands.back().val = _values.back().getKnownValue();
+    for (const auto &bottomVal: _bottom) {
+        commands.push_back(valueCommand(CommandType::PushValueToBottom, bottomVal));
     }
 
-    if (_values.size() > 1) {
-        auto secondValue = _values[0];
-        if (secondValue.hasKnownValue()) {
-            if (_maxPopped == 0) {
-                commands.emplace_back(CommandType::PushSecondValue, secondValue.getKnownValue());
+    if (canUseSecondValueCommands()) {
+        if (!_origIndex || *_origIndex != _values.back().getKnownValue()) {
+            commands.emplace_back(CommandType::SetTop);
+            commands.back().val = _values.back().getKnownValue();
+        }
+
+        if (_values.size() > 1) {
+            auto secondValue = _values[0];
+            if (secondValue.hasKnownValue()) {
+                if (_maxPopped == 0) {
+                    commands.emplace_back(CommandType::PushSecondValue, secondValue.getKnownValue());
+                }
+                else {
+                    commands.emplace_back(CommandType::SetSecondValue, secondValue.getKnownValue());
+                }
             }
-            else {
-                commands.emplace_back(CommandType::SetSecondValue, secondValue.getKnownValue());
+            else if (secondValue.getMultiple() > 1) {
+                commands.emplace_back(CommandType::MultiplySecond, secondValue.getMultiple());
+            }
+            else if (secondValue.getChange() != 0) {
+                commands.emplace_back(CommandType::AddToSecond, secondValue.getChange());
             }
         }
-        else if (secondValue.getMultiple() > 1) {
-            commands.emplace_back(CommandType::MultiplySecond, secondValue.getMultiple());
+        else if (_maxPopped == 1) {
+            commands.emplace_back(CommandType::PopSecondValue);
         }
-        else if (secondValue.getChange() != 0) {
-            commands.emplace_back(CommandType::AddToSecond, secondValue.getChange());
+
+        return commands;
+    }
+
+    // Leave out the values that are still in the same slot they started in
+    // and haven't changed, since those don't need to be replaced
+    size_t unchanged = 0;
+
+    while (unchanged < _values.size()) {
+        auto &value = _values[unchanged];
+        auto slot = _maxPopped - unchanged;
+
+        if (value.hasKnownValue() || !value.hasKnownIndex() || value.getIndex() != slot ||
+            value.getMultiple() != 1 || value.getChange() != 0)
+        {
+            break;
         }
+        unchanged++;
+    }
+
+    if (unchanged == _values.size() && unchanged == _maxPopped + 1) {
+        return commands;
     }
-    else if (_maxPopped == 1) {
-        commands.emplace_back(CommandType::PopSecondValue);
+
+    commands.emplace_back(CommandType::BeginShuffle, _values.size() - unchanged, _maxPopped + 1 - unchanged, 0);
+
+    for (size_t i = unchanged; i < _values.size(); i++) {
+        commands.push_back(valueCommand(CommandType::ShuffleValue, _values[i]));
     }
 
     return commands;
 }
 
+bool StackSimulator::onlyPoppedTop() const {
+    if (!_bottom.empty() || _maxPopped != _values.size()) {
+        return false;
+    }
+
+    // Each value we're keeping track of has to be the original value from
+    // one slot deeper than the slot it's in now
+    for (size_t slot = 0; slot < _values.size(); slot++) {
+        auto &value = _values[_values.size() - 1 - slot];
+
+        if (value.hasKnownValue() || !value.hasKnownIndex() || value.getIndex() != slot + 1 ||
+            value.getMultiple() != 1 || value.getChange() != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::optional<std::vector<unsigned>> StackSimulator::getKnownOutput() const {
+    if (_hadIO || !allKnownValues(_output)) {
+        return std::nullopt;
+    }
+
+    std::vector<unsigned> output;
+
+    for (const auto &outputVal: _output) {
+        output.push_back(outputVal.getKnownValue());
+    }
+
+    return output;
+}
+
 bool StackSimulator::allKnownValues(const std::vector<StackValue> &values) {
     return std::all_of(values.begin(), values.end(), [] (StackValue val) {
         return val.hasKnownValue();
     });
 }
 
-bool StackSimulator::canOptimize() const {
-    return !_hadIO &&
-            _maxPopped < 2 &&
-            allKnownValues(_bottom) &&
-            _values.size() <= 2 &&
-            _values.size() >= 1 &&
-            _values.back().hasKnownValue() &&
-            (_values.size() == 1 || _values[0].hasKnownValue()
-            || (_values[0].hasKnownIndex() && _values[0].getIndex() == 1));
+bool StackSimulator::allRepresentable(const std::vector<StackValue> &values) {
+    return std::all_of(values.begin(), values.end(), [] (StackValue val) {
+        return val.isRepresentable();
+    });
+}
+
+Command StackSimulator::valueCommand(CommandType type, const StackValue &value) {
+    static_assert(StackValue::MAX_TERMS == 2, "Commands compute values from at most two slots");
+
+    if (value.hasKnownValue()) {
+        return {type, static_cast<int>(value.getKnownValue()), 0, 0};
+    }
+
+    auto &first = value.getTerm(0);
+
+    if (value.getTermCount() == 1) {
+        return {type, static_cast<int>(value.getChange()), first.index, first.multiple};
+    }
+
+    auto &added = value.getTerm(1);
+
+    return {type, static_cast<int>(value.getChange()), first.index, first.multiple, added.index, added.multiple};
+}
+
+StackValue StackSimulator::commandValue(const Command &command) const {
+    // Slots past the values we're keeping track of haven't been touched yet,
+    // so they still have the original values from deeper in the stack
+    auto slotValue = [&] (unsigned slot) {
+        return slot < _values.size()
+             ? _values[_values.size() - 1 - slot]
+             : StackValue::fromIndex(_maxPopped + 1 + slot - _values.size());
+    };
+
+    if (command.multiple == 0) {
+        return StackValue::fromValue(command.val);
+    }
+
+    auto value = slotValue(command.slot);
+    value.mul(command.multiple);
+
+    if (command.addedMultiple != 0) {
+        auto added = slotValue(command.addedSlot);
+        added.mul(command.addedMultiple);
+        value.add(added);
+    }
+
+    value.add(StackValue::fromValue(command.val));
+
+    return value;
+}
+
+bool StackSimulator::canUseSecondValueCommands() const {
+    if (_maxPopped >= 2 || !allKnownValues(_bottom) || _values.size() > 2 || _values.empty() ||
+        !_values.back().hasKnownValue())
+    {
+        return false;
+    }
+
+    if (_values.size() == 1 || _values[0].hasKnownValue()) {
+        return true;
+    }
+
+    // The second value has to still be the original second value, either
+    // multiplied or added to, but not both
+    auto &second = _values[0];
+
+    return second.hasKnownIndex() && second.getIndex() == 1 &&
+           (second.getMultiple() == 1 || (second.getMultiple() > 1 && second.getChange() == 0));
 }
 
 void StackSimulator::doPush(StackValue value) {
@@ -2,96 +2,168 @@
 
 namespace xrf {
 
-StackValue::StackValue(unsigned index, unsigned val):
-    _index(index),
-    _value(val)
-{}
-
 StackValue StackValue::fromIndex(unsigned index) {
     StackValue value;
-    value._index = index;
+    value._representable = true;
+    value.addTerm({index, 1});
     return value;
 }
 
 StackValue StackValue::fromValue(unsigned value) {
     StackValue stackValue;
-    stackValue._value = value;
+    stackValue._representable = true;
+    stackValue._knownChange = value;
     return stackValue;
 }
 
 void StackValue::add(const StackValue &value) {
-    if (hasKnownValue()) {
-        if (value.hasKnownValue()) {
-            *_value += value.getKnownValue();
-            return;
-        }
+    if (!isRepresentable() || !value.isRepresentable()) {
+        forget();
+        return;
     }
-    else if (hasKnownIndex()) {
-        if (value.hasKnownIndex() && value.getIndex() == getIndex()) {
-            _knownMultiple += value._knownMultiple;
-            return;
-        }
-        else if (value.hasKnownValue()) {
-            _knownChange += value.getKnownValue();
-            return;
-        }
+
+    _knownChange += value._knownChange;
+
+    for (size_t i = 0; i < value._termCount && isRepresentable(); i++) {
+        addTerm(value._terms[i]);
     }
-    _index = std::nullopt;
-    _value = std::nullopt;
 }
 
 void StackValue::dec() {
-    if (hasKnownValue() && getKnownValue() > 0) {
-        _value = *_value - 1;
-        return;
-    }
-    _value = std::nullopt;
     _knownChange--;
 }
 
+void StackValue::mul(unsigned multiple) {
+    _knownChange *= multiple;
+
+    size_t kept = 0;
+
+    // Multiplying by an even number can wrap a multiple around to 0, which
+    // leaves that term out of the value altogether
+    for (size_t i = 0; i < _termCount; i++) {
+        _terms[i].multiple *= multiple;
+
+        if (_terms[i].multiple != 0) {
+            _terms[kept++] = _terms[i];
+        }
+    }
+
+    _termCount = kept;
+}
+
 void StackValue::sub(const StackValue &value) {
     if (hasKnownValue() && value.hasKnownValue()) {
         auto val1 = getKnownValue();
-        auto val2 = getKnownValue();
+        auto val2 = value.getKnownValue();
 
         if (val1 > val2) {
-            _value = val1 - val2;
+            _knownChange = val1 - val2;
         }
         else {
-            _value = val2 - val1;
+            _knownChange = val2 - val1;
         }
         return;
     }
-    _index = std::nullopt;
-    _value = std::nullopt;
+
+    // The same value subtracted from itself is 0, whatever the value is, but
+    // anything else depends on which of the values is bigger
+    if (isRepresentable() && value.isRepresentable() && _knownChange == value._knownChange &&
+        _termCount == value._termCount)
+    {
+        bool same = true;
+
+        for (size_t i = 0; i < _termCount; i++) {
+            same = same && _terms[i].index == value._terms[i].index && _terms[i].multiple == value._terms[i].multiple;
+        }
+
+        if (same) {
+            *this = fromValue(0);
+            return;
+        }
+    }
+
+    forget();
+}
+
+bool StackValue::isRepresentable() const {
+    return _representable;
 }
 
 bool StackValue::hasKnownValue() const {
-    return _value.has_value();
+    return _representable && _termCount == 0;
 }
 
 unsigned StackValue::getKnownValue() const {
-    return *_value;
+    return _knownChange;
 }
 
 bool StackValue::hasKnownIndex() const {
-    return _index.has_value();
+    return _representable && _termCount == 1;
 }
 
 unsigned StackValue::getIndex() const {
-    return *_index;
+    return _terms[0].index;
+}
+
+size_t StackValue::getTermCount() const {
+    return _termCount;
+}
+
+const StackValue::Term &StackValue::getTerm(size_t i) const {
+    return _terms[i];
 }
 
 std::optional<unsigned> StackValue::getValue() const {
-    return _value;
+    if (!hasKnownValue()) {
+        return std::nullopt;
+    }
+    return _knownChange;
 }
 
-int StackValue::getChange() const {
+unsigned StackValue::getChange() const {
     return _knownChange;
 }
 
 unsigned StackValue::getMultiple() const {
-    return _knownMultiple;
+    return _terms[0].multiple;
+}
+
+void StackValue::addTerm(const Term &term) {
+    size_t i = 0;
+
+    while (i < _termCount && _terms[i].index < term.index) {
+        i++;
+    }
+
+    if (i < _termCount && _terms[i].index == term.index) {
+        _terms[i].multiple += term.multiple;
+
+        // The multiples can add up to a multiple of 2^32, which cancels the
+        // term out
+        if (_terms[i].multiple == 0) {
+            for (; i + 1 < _termCount; i++) {
+                _terms[i] = _terms[i + 1];
+            }
+            _termCount--;
+        }
+        return;
+    }
+
+    if (_termCount == MAX_TERMS) {
+        forget();
+        return;
+    }
+
+    for (size_t j = _termCount; j > i; j--) {
+        _terms[j] = _terms[j - 1];
+    }
+
+    _terms[i] = term;
+    _termCount++;
+}
+
+void StackValue::forget() {
+    *this = StackValue();
 }
 
 } // namespace xrf
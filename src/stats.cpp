@@ -0,0 +1,128 @@
+#include "stats.hpp"
+
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Instructions.h"
+
+#include <iomanip>
+#include <ostream>
+
+namespace xrf {
+
+namespace {
+
+/**
+ * Counts the commands in a list, and how many of them are optimized commands.
+ *
+ * @param stats
+ *     The stats to add the counts to
+ * @param commands
+ *     The commands to count
+ */
+void countCommands(CompileStats &stats, const std::vector<Command> &commands) {
+    stats.commands += commands.size();
+
+    for (const auto &command: commands) {
+        if (command.type > CommandType::Nop) {
+            stats.fusedCommands++;
+        }
+    }
+}
+
+} // anonymous namespace
+
+PhaseTimer::PhaseTimer(CompileStats &stats, std::string phase):
+    _stats(stats),
+    _phase(std::move(phase)),
+    _start(std::chrono::steady_clock::now())
+{}
+
+PhaseTimer::~PhaseTimer() {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - _start;
+
+    _stats.phases.emplace_back(_phase, elapsed.count());
+}
+
+void countChunkStats(CompileStats &stats, const std::vector<Chunk> &chunks) {
+    stats.chunks = chunks.size();
+    stats.commands = 0;
+    stats.fusedCommands = 0;
+    stats.knownJumps = 0;
+
+    for (const auto &chunk: chunks) {
+        countCommands(stats, chunk.commands);
+        stats.knownJumps += chunk.nextChunk.has_value();
+
+        if (chunk.visitedCommands) {
+            countCommands(stats, *chunk.visitedCommands);
+            stats.knownJumps += chunk.visitedNextChunk.has_value();
+        }
+    }
+}
+
+void countDispatchStats(CompileStats &stats, const llvm::Module &module) {
+    stats.dynamicJumps = 0;
+    stats.dispatchEdges = 0;
+
+    for (const auto &func: module) {
+        for (const auto &block: func) {
+            auto terminator = block.getTerminator();
+
+            if (auto switchInst = llvm::dyn_cast_or_null<llvm::SwitchInst>(terminator)) {
+                // The switch is shared, so each branch to it is one jump
+                stats.dynamicJumps += std::distance(llvm::pred_begin(&block), llvm::pred_end(&block));
+                stats.dispatchEdges += switchInst->getNumCases();
+            }
+            else if (auto branch = llvm::dyn_cast_or_null<llvm::IndirectBrInst>(terminator)) {
+                stats.dynamicJumps++;
+                stats.dispatchEdges += branch->getNumDestinations();
+            }
+        }
+    }
+}
+
+void printStats(std::ostream &out, const CompileStats &stats, bool phases, bool counts) {
+    if (phases) {
+        double total = 0;
+
+        for (const auto &[phase, seconds]: stats.phases) {
+            out << std::left << std::setw(16) << phase << std::fixed << std::setprecision(3)
+                << seconds * 1000 << " ms\n";
+            total += seconds;
+        }
+
+        out << std::left << std::setw(16) << "total" << total * 1000 << " ms\n";
+    }
+
+    if (counts) {
+        out << "chunks:          " << stats.chunks << '\n'
+            << "known jumps:     " << stats.knownJumps << '\n'
+            << "source commands: " << stats.sourceCommands << '\n'
+            << "commands:        " << stats.commands << '\n'
+            << "fused commands:  " << stats.fusedCommands << '\n'
+            << "dynamic jumps:   " << stats.dynamicJumps << '\n'
+            << "dispatch edges:  " << stats.dispatchEdges << '\n';
+    }
+}
+
+void printStatsJson(std::ostream &out, const CompileStats &stats) {
+    out << "{\n  \"phases\": {";
+
+    for (size_t i = 0; i < stats.phases.size(); i++) {
+        // Phase names are only ever simple identifiers, so they don't need
+        // escaping
+        out << (i == 0 ? "\n" : ",\n") << "    \"" << stats.phases[i].first << "\": "
+            << std::setprecision(6) << stats.phases[i].second;
+    }
+
+    out << (stats.phases.empty() ? "},\n" : "\n  },\n")
+        << "  \"chunks\": " << stats.chunks << ",\n"
+        << "  \"known_jumps\": " << stats.knownJumps << ",\n"
+        << "  \"source_commands\": " << stats.sourceCommands << ",\n"
+        << "  \"commands\": " << stats.commands << ",\n"
+        << "  \"fused_commands\": " << stats.fusedCommands << ",\n"
+        << "  \"dynamic_jumps\": " << stats.dynamicJumps << ",\n"
+        << "  \"dispatch_edges\": " << stats.dispatchEdges << "\n"
+        << "}\n";
+}
+
+} // namespace xrf
@@ -0,0 +1,134 @@
+#include "cache.hpp"
+#include "parser.hpp"
+
+#include "catch2/catch.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+std::vector<xrf::Chunk> parseChunks(const std::string &code) {
+    std::stringstream stream{code};
+    xrf::FileReader reader{stream};
+
+    auto parseResult = xrf::parseXrf(reader);
+
+    REQUIRE(std::holds_alternative<std::vector<xrf::Chunk>>(parseResult));
+
+    return std::get<std::vector<xrf::Chunk>>(parseResult);
+}
+
+std::string readFile(const std::string &filename) {
+    std::ifstream file{filename};
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+} // anonymous namespace
+
+TEST_CASE("Cache keys depend on the chunks and the options", "[cache]") {
+    xrf::CodegenOptions options;
+
+    auto key = xrf::getCacheKey(parseChunks("5AFFF 315FF"), options, "ll");
+
+    CHECK(key == xrf::getCacheKey(parseChunks("5AFFF 315FF"), options, "ll"));
+    CHECK(key != xrf::getCacheKey(parseChunks("5AFFF 316FF"), options, "ll"));
+    CHECK(key != xrf::getCacheKey(parseChunks("5AFFF 315FF"), options, "obj"));
+
+    options.ioMode = xrf::IoMode::Buffered;
+
+    CHECK(key != xrf::getCacheKey(parseChunks("5AFFF 315FF"), options, "ll"));
+
+    auto bufferedKey = xrf::getCacheKey(parseChunks("5AFFF 315FF"), options, "ll");
+    options.seed = 0;
+
+    CHECK(bufferedKey != xrf::getCacheKey(parseChunks("5AFFF 315FF"), options, "ll"));
+}
+
+TEST_CASE("Cached files are copied out of the cache", "[cache]") {
+    llvm::SmallString<128> cacheDir;
+    REQUIRE_FALSE(llvm::sys::fs::createUniqueDirectory("xrf-cache-test", cacheDir));
+
+    auto compiled = std::string(cacheDir) + "/compiled.ll";
+    auto copied = std::string(cacheDir) + "/copied.ll";
+
+    std::ofstream{compiled} << "compiled output";
+
+    auto cacheSubdir = std::string(cacheDir) + "/cache";
+    auto key = xrf::getCacheKey(parseChunks("5AFFF"), {}, "ll");
+
+    CHECK_FALSE(xrf::loadCached(cacheSubdir, key, copied));
+    REQUIRE_FALSE(llvm::errorToBool(xrf::storeCached(cacheSubdir, key, compiled)));
+    REQUIRE(xrf::loadCached(cacheSubdir, key, copied));
+    CHECK(readFile(copied) == "compiled output");
+
+    llvm::sys::fs::remove_directories(cacheDir);
+}
+
+TEST_CASE("Partitioned code is cached a partition at a time", "[cache]") {
+    xrf::CodegenOptions options;
+    options.partitionSize = 1;
+
+    auto getKeys = [&] (const std::vector<xrf::Chunk> &chunks) {
+        auto layout = xrf::layoutPartitions(chunks, options);
+
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < layout.members.size(); i++) {
+            keys.push_back(xrf::getSplitModuleKey(chunks, options, layout, i, "obj"));
+        }
+
+        keys.push_back(xrf::getSplitModuleKey(chunks, options, layout, std::nullopt, "obj"));
+
+        return keys;
+    };
+
+    auto keys = getKeys(parseChunks("10AFF 20AFF 30AFF"));
+
+    REQUIRE(keys.size() == 4);
+    CHECK(keys == getKeys(parseChunks("10AFF 20AFF 30AFF")));
+
+    // Only the partition with the chunk that changed needs to be compiled
+    // again
+    auto editedKeys = getKeys(parseChunks("10AFF 21AFF 30AFF"));
+
+    REQUIRE(editedKeys.size() == 4);
+    CHECK(editedKeys[0] == keys[0]);
+    CHECK(editedKeys[1] != keys[1]);
+    CHECK(editedKeys[2] == keys[2]);
+    CHECK(editedKeys[3] == keys[3]);
+
+    // Checked code also depends on where each chunk is in the file
+    auto movedKeys = getKeys(parseChunks("10AFF 20AFF\n30AFF"));
+
+    CHECK(movedKeys == keys);
+
+    options.checked = true;
+
+    auto checkedKeys = getKeys(parseChunks("10AFF 20AFF 30AFF"));
+    auto checkedMovedKeys = getKeys(parseChunks("10AFF 20AFF\n30AFF"));
+
+    auto moved = xrf::layoutPartitions(parseChunks("10AFF 20AFF\n30AFF"), options).partitions[2];
+
+    REQUIRE(moved);
+    REQUIRE(checkedMovedKeys.size() == 4);
+    for (size_t i = 0; i < checkedKeys.size(); i++) {
+        CHECK((checkedMovedKeys[i] != checkedKeys[i]) == (i == moved));
+    }
+
+    options.checked = false;
+
+    // Every module is compiled differently with different options
+    options.ioMode = xrf::IoMode::Buffered;
+
+    auto bufferedKeys = getKeys(parseChunks("10AFF 20AFF 30AFF"));
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        CHECK(bufferedKeys[i] != keys[i]);
+    }
+}
@@ -0,0 +1,817 @@
+#include "codegen.hpp"
+#include "interpreter.hpp"
+#include "jit.hpp"
+#include "optimization.hpp"
+#include "parser.hpp"
+#include "xrf-library.h"
+
+#include "catch2/catch.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+std::vector<xrf::Chunk> parseChunks(const std::string &code) {
+    std::stringstream stream{code};
+    xrf::FileReader reader{stream};
+
+    auto parseResult = xrf::parseXrf(reader);
+
+    REQUIRE(std::holds_alternative<std::vector<xrf::Chunk>>(parseResult));
+
+    return std::get<std::vector<xrf::Chunk>>(parseResult);
+}
+
+void checkGeneratesValidCode(const std::vector<xrf::Chunk> &chunks, const xrf::CodegenOptions &options) {
+    llvm::LLVMContext context;
+
+    auto module = xrf::generateCode(context, chunks, options);
+
+    REQUIRE(module);
+    CHECK_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+}
+
+/**
+ * The input and output of a run of library code, which the callbacks in its
+ * context read from and write to.
+ */
+struct LibraryIo {
+    std::string input;
+    size_t position = 0;
+    std::string output;
+};
+
+ptrdiff_t readLibraryInput(void *user, uint8_t *buffer, size_t size) {
+    auto io = static_cast<LibraryIo*>(user);
+    auto count = std::min(size, io->input.size() - io->position);
+
+    std::memcpy(buffer, io->input.data() + io->position, count);
+    io->position += count;
+
+    return count;
+}
+
+ptrdiff_t writeLibraryOutput(void *user, const uint8_t *buffer, size_t size) {
+    auto io = static_cast<LibraryIo*>(user);
+
+    io->output.append(reinterpret_cast<const char*>(buffer), size);
+
+    return size;
+}
+
+/**
+ * JIT-compiles a module of library code and runs it once.
+ *
+ * @param context
+ *     The LLVMContext that the module was generated in
+ * @param module
+ *     The module to run, which has xrf_run() and xrf_context_size()
+ * @param io
+ *     The input to run the program with, which the output is written to
+ *
+ * @return
+ *     The status that xrf_run() returned
+ */
+int runLibraryModule(std::unique_ptr<llvm::LLVMContext> context, std::unique_ptr<llvm::Module> module,
+                     LibraryIo &io)
+{
+    auto jit = xrf::compileModule(std::move(context), std::move(module));
+    if (!jit) {
+        FAIL(llvm::toString(jit.takeError()));
+    }
+
+    auto runSymbol = (*jit)->lookup("xrf_run");
+    auto sizeSymbol = (*jit)->lookup("xrf_context_size");
+    if (!runSymbol || !sizeSymbol) {
+        FAIL(llvm::toString(runSymbol ? sizeSymbol.takeError() : runSymbol.takeError()));
+    }
+
+#if LLVM_VERSION_MAJOR >= 15
+    auto run = runSymbol->toPtr<decltype(&xrf_run)>();
+    auto contextSize = sizeSymbol->toPtr<decltype(&xrf_context_size)>();
+#else
+    auto run = reinterpret_cast<decltype(&xrf_run)>(runSymbol->getAddress());
+    auto contextSize = reinterpret_cast<decltype(&xrf_context_size)>(sizeSymbol->getAddress());
+#endif
+
+    auto xrfContext = static_cast<xrf_context*>(std::malloc(contextSize()));
+    xrfContext->user = &io;
+    xrfContext->read = readLibraryInput;
+    xrfContext->write = writeLibraryOutput;
+
+    auto status = run(xrfContext);
+
+    std::free(xrfContext);
+
+    return status;
+}
+
+} // anonymous namespace
+
+TEST_CASE("Codegen generates valid modules in every mode", "[codegen]") {
+    // Reads input, echoes it back and jumps to a chunk based on the input
+    auto chunks = parseChunks("8B0AF 10AFF 10AFF 5AFFF 6AFFF C3A12");
+
+    auto ioMode = GENERATE(xrf::IoMode::Stdio, xrf::IoMode::Buffered);
+    auto dispatchMode = GENERATE(xrf::DispatchMode::Switch,
+                                 xrf::DispatchMode::Threaded,
+                                 xrf::DispatchMode::ThreadedUnchecked);
+    auto registerState = GENERATE(false, true);
+    auto stackStorage = GENERATE(xrf::StackStorage::Static, xrf::StackStorage::Mmap);
+
+    xrf::CodegenOptions options;
+    options.ioMode = ioMode;
+    options.dispatchMode = dispatchMode;
+    options.registerState = registerState;
+    options.stackStorage = stackStorage;
+
+    checkGeneratesValidCode(chunks, options);
+    checkGeneratesValidCode(xrf::optimizeProgram(xrf::optimizeChunks(xrf::specializeVisits(chunks))), options);
+}
+
+TEST_CASE("Codegen handles known jumps to chunks that don't exist", "[codegen]") {
+    auto chunks = xrf::optimizeProgram(xrf::optimizeChunks(xrf::specializeVisits(parseChunks("5AFFF"))));
+
+    REQUIRE(chunks.size() == 1);
+
+    auto dispatchMode = GENERATE(xrf::DispatchMode::Switch, xrf::DispatchMode::Threaded);
+
+    xrf::CodegenOptions options;
+    options.dispatchMode = dispatchMode;
+
+    checkGeneratesValidCode(chunks, options);
+}
+
+TEST_CASE("Codegen only generates the chunks that can be run", "[codegen]") {
+    // Chunk 0 jumps to chunk 1, which exits, so chunk 2 is never run
+    auto chunks = parseChunks("5AFFF 2BFFF 10AFF");
+    auto targets = xrf::findJumpTargets(chunks);
+
+    auto dispatchMode = GENERATE(xrf::DispatchMode::Switch,
+                                 xrf::DispatchMode::Threaded,
+                                 xrf::DispatchMode::ThreadedUnchecked);
+    auto registerState = GENERATE(false, true);
+
+    xrf::CodegenOptions options;
+    options.dispatchMode = dispatchMode;
+    options.registerState = registerState;
+    options.jumpTargets = &targets;
+
+    llvm::LLVMContext context;
+
+    auto module = xrf::generateCode(context, chunks, options);
+
+    REQUIRE(module);
+    CHECK_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+
+    std::vector<std::string> blocks;
+
+    for (auto &block: *module->getFunction("main")) {
+        blocks.push_back(block.getName().str());
+    }
+
+    CHECK(std::count(blocks.begin(), blocks.end(), "chunk1") == 1);
+    CHECK(std::count(blocks.begin(), blocks.end(), "chunk2") == 0);
+}
+
+TEST_CASE("Chunks with only a few jump targets branch to them themselves", "[codegen]") {
+    // Chunk 0 can only jump to chunk 1
+    auto chunks = parseChunks("5AFFF 2BFFF 10AFF");
+    auto targets = xrf::findJumpTargets(chunks);
+
+    auto dispatchMode = GENERATE(xrf::DispatchMode::Switch,
+                                 xrf::DispatchMode::Threaded,
+                                 xrf::DispatchMode::ThreadedUnchecked);
+    auto registerState = GENERATE(false, true);
+
+    xrf::CodegenOptions options;
+    options.dispatchMode = dispatchMode;
+    options.registerState = registerState;
+    options.jumpTargets = &targets;
+
+    llvm::LLVMContext context;
+
+    auto module = xrf::generateCode(context, chunks, options);
+
+    REQUIRE(module);
+    CHECK_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+
+    for (auto &block: *module->getFunction("main")) {
+        if (block.getName() != "chunk0") {
+            continue;
+        }
+
+        auto switchInst = llvm::dyn_cast<llvm::SwitchInst>(block.getTerminator());
+
+        REQUIRE(switchInst);
+        REQUIRE(switchInst->getNumCases() == 1);
+        CHECK(switchInst->case_begin()->getCaseSuccessor()->getName() == "chunk1");
+    }
+}
+
+TEST_CASE("Checked code stops programs that misuse the stack", "[codegen]") {
+    auto dispatchMode = GENERATE(xrf::DispatchMode::Switch, xrf::DispatchMode::Threaded);
+    auto registerState = GENERATE(false, true);
+    auto level = GENERATE(0, 1, 2);
+
+    xrf::CodegenOptions options;
+    options.dispatchMode = dispatchMode;
+    options.registerState = registerState;
+    options.checked = true;
+    options.stackSize = 4;
+
+    auto run = [&](const std::string &code) {
+        auto chunks = parseChunks(code);
+
+        if (level > 0) {
+            chunks = xrf::optimizeChunks(xrf::specializeVisits(std::move(chunks)));
+        }
+
+        if (level > 1) {
+            chunks = xrf::optimizeProgram(std::move(chunks), 1, {}, true);
+        }
+
+        auto context = std::make_unique<llvm::LLVMContext>();
+        auto module = xrf::generateCode(*context, chunks, options);
+
+        REQUIRE(module);
+        REQUIRE_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+
+        auto result = xrf::runModule(std::move(context), std::move(module));
+        if (!result) {
+            FAIL(llvm::toString(result.takeError()));
+        }
+
+        return *result;
+    };
+
+    // Chunk 0 jumps to chunk 1, which jumps back to chunk 0 the first time
+    // it's visited, and exits the second time
+    CHECK(run("5AFFF 8B6AF") == 0);
+
+    // Pops the only value off of the stack
+    CHECK(run("22AFF") == 1);
+
+    // Pushes two values in each chunk, which is more than the stack can hold
+    // by the second chunk
+    CHECK(run("335AF 335AF 335AF 2BFFF") == 1);
+
+    // Jumps to a chunk that doesn't exist
+    CHECK(run("5AFFF") == 1);
+
+    // Keeps jumping back to itself without doing any I/O, pushing two more
+    // values each time, which would be left spinning if it weren't checked
+    CHECK(run("33AFF") == 1);
+}
+
+TEST_CASE("Checked code stops at the chunk of a trace that misuses the stack", "[codegen]") {
+    // Chunk 0 writes out a value and jumps to chunk 1, which pops more values
+    // than there are, so the output of chunk 0 has to be written out before
+    // the program stops
+    auto chunks = parseChunks("3515A 222BF");
+
+    auto registerState = GENERATE(false, true);
+
+    xrf::CodegenOptions options;
+    options.registerState = registerState;
+    options.checked = true;
+    options.library = true;
+
+    auto run = [&](const std::vector<xrf::Chunk> &program, LibraryIo &io) {
+        auto context = std::make_unique<llvm::LLVMContext>();
+        auto module = xrf::generateCode(*context, program, options);
+
+        REQUIRE(module);
+        REQUIRE_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+
+        return runLibraryModule(std::move(context), std::move(module), io);
+    };
+
+    LibraryIo unoptimizedIo;
+    CHECK(run(chunks, unoptimizedIo) == 1);
+    CHECK(unoptimizedIo.output == "\x01");
+
+    auto optimized = xrf::optimizeProgram(xrf::optimizeChunks(xrf::specializeVisits(chunks)), 1, {}, true);
+
+    // Chunk 1 is still checked on its own, with its own line and column
+    REQUIRE(optimized.size() == 2);
+    CHECK(optimized[0].nextChunk == 1u);
+    CHECK(optimized[1].line == chunks[1].line);
+
+    LibraryIo optimizedIo;
+    CHECK(run(optimized, optimizedIo) == 1);
+    CHECK(optimizedIo.output == unoptimizedIo.output);
+}
+
+TEST_CASE("Library code keeps all of its state in the context", "[codegen]") {
+    auto chunks = parseChunks("8B0AF 10AFF 10AFF 5AFFF 6AFFF C3A12");
+
+    auto dispatchMode = GENERATE(xrf::DispatchMode::Switch, xrf::DispatchMode::Threaded);
+    auto registerState = GENERATE(false, true);
+    auto checked = GENERATE(false, true);
+
+    xrf::CodegenOptions options;
+    options.dispatchMode = dispatchMode;
+    options.registerState = registerState;
+    options.checked = checked;
+    options.library = true;
+
+    for (const auto &program: {chunks, xrf::optimizeProgram(xrf::optimizeChunks(xrf::specializeVisits(chunks)))}) {
+        llvm::LLVMContext context;
+
+        auto module = xrf::generateCode(context, program, options);
+
+        REQUIRE(module);
+        CHECK_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+
+        CHECK_FALSE(module->getFunction("main"));
+        CHECK(module->getFunction("xrf_run"));
+        CHECK(module->getFunction("xrf_context_size"));
+
+        for (const auto &global: module->globals()) {
+            CHECK(global.isConstant());
+        }
+    }
+}
+
+TEST_CASE("Library code returns an error for jumps to chunks that don't exist", "[codegen]") {
+    auto dispatchMode = GENERATE(xrf::DispatchMode::Switch, xrf::DispatchMode::Threaded);
+    auto partitionSize = GENERATE(0, 1);
+    auto checked = GENERATE(false, true);
+    auto level = GENERATE(0, 1, 2);
+
+    if (partitionSize > 0 && (dispatchMode != xrf::DispatchMode::Switch || checked)) {
+        return;
+    }
+
+    xrf::CodegenOptions options;
+    options.dispatchMode = dispatchMode;
+    options.partitionSize = partitionSize;
+    options.checked = checked;
+    options.library = true;
+
+    // Chunk 0 writes out a value and jumps to chunk 1, which jumps to chunk 3,
+    // which doesn't exist
+    auto chunks = parseChunks("3515A 55AFF");
+    xrf::JumpTargets jumpTargets;
+
+    if (level > 0) {
+        chunks = xrf::optimizeChunks(xrf::specializeVisits(std::move(chunks)));
+    }
+
+    if (level > 1) {
+        chunks = xrf::optimizeProgram(std::move(chunks), 1, {}, checked);
+        jumpTargets = xrf::findJumpTargets(chunks);
+        options.jumpTargets = &jumpTargets;
+    }
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = xrf::generateCode(*context, chunks, options);
+
+    REQUIRE(module);
+    REQUIRE_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+
+    LibraryIo io;
+    CHECK(runLibraryModule(std::move(context), std::move(module), io) == 1);
+    CHECK(io.output == "\x01");
+}
+
+TEST_CASE("Library code runs many programs at once", "[codegen]") {
+    // Chunk 0 reads a byte and jumps to the chunk for that byte, which writes
+    // it out and reads the next byte, until the end of input jumps back to
+    // chunk 0 and exits
+    std::string cat = "8B0AF";
+    for (int i = 1; i < 256; i++) {
+        cat += " 10AFF";
+    }
+
+    auto registerState = GENERATE(false, true);
+
+    xrf::CodegenOptions options;
+    options.registerState = registerState;
+    options.library = true;
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = xrf::generateCode(*context, parseChunks(cat), options);
+
+    auto jit = xrf::compileModule(std::move(context), std::move(module));
+    if (!jit) {
+        FAIL(llvm::toString(jit.takeError()));
+    }
+
+    auto runSymbol = (*jit)->lookup("xrf_run");
+    auto sizeSymbol = (*jit)->lookup("xrf_context_size");
+    if (!runSymbol || !sizeSymbol) {
+        FAIL(llvm::toString(runSymbol ? sizeSymbol.takeError() : runSymbol.takeError()));
+    }
+
+#if LLVM_VERSION_MAJOR >= 15
+    auto run = runSymbol->toPtr<decltype(&xrf_run)>();
+    auto contextSize = sizeSymbol->toPtr<decltype(&xrf_context_size)>();
+#else
+    auto run = reinterpret_cast<decltype(&xrf_run)>(runSymbol->getAddress());
+    auto contextSize = reinterpret_cast<decltype(&xrf_context_size)>(sizeSymbol->getAddress());
+#endif
+
+    constexpr size_t NUM_RUNS = 8;
+
+    std::vector<LibraryIo> io(NUM_RUNS);
+    std::vector<int> results(NUM_RUNS);
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < NUM_RUNS; i++) {
+        io[i].input = std::string(100000 + i, static_cast<char>('a' + i));
+
+        threads.emplace_back([&, i] {
+            auto xrfContext = static_cast<xrf_context*>(std::malloc(contextSize()));
+            xrfContext->user = &io[i];
+            xrfContext->read = readLibraryInput;
+            xrfContext->write = writeLibraryOutput;
+
+            results[i] = run(xrfContext);
+
+            // Running the program again in the same context starts it over
+            io[i].position = 0;
+            results[i] |= run(xrfContext);
+
+            std::free(xrfContext);
+        });
+    }
+
+    for (auto &thread: threads) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < NUM_RUNS; i++) {
+        CHECK(results[i] == 0);
+        CHECK(io[i].output == io[i].input + io[i].input);
+    }
+}
+
+TEST_CASE("Codegen shuffles the stack in every mode", "[codegen]") {
+    // Pushes a value, shuffles the stack and jumps to the top value
+    auto chunks = parseChunks("35D2F 35DFF 2BFFF");
+
+    auto ioMode = GENERATE(xrf::IoMode::Stdio, xrf::IoMode::Buffered);
+    auto registerState = GENERATE(false, true);
+    auto stackStorage = GENERATE(xrf::StackStorage::Static, xrf::StackStorage::Mmap);
+    auto library = GENERATE(false, true);
+    auto seeded = GENERATE(false, true);
+
+    if (library && stackStorage == xrf::StackStorage::Mmap) {
+        return;
+    }
+
+    xrf::CodegenOptions options;
+    options.ioMode = ioMode;
+    options.registerState = registerState;
+    options.stackStorage = stackStorage;
+    options.library = library;
+
+    if (seeded) {
+        options.seed = 42;
+    }
+
+    checkGeneratesValidCode(chunks, options);
+    checkGeneratesValidCode(xrf::optimizeProgram(xrf::optimizeChunks(xrf::specializeVisits(chunks))), options);
+}
+
+TEST_CASE("Generated code shuffles the stack the same way as the interpreter", "[codegen]") {
+    // Each of the first 200 chunks pushes the next number and jumps to the
+    // chunk for it, and then the last chunk shuffles the stack and writes out
+    // the top three values
+    std::string shuffle;
+    for (int i = 0; i < 200; i++) {
+        shuffle += "35FFF ";
+    }
+    shuffle += "D111B";
+
+    auto registerState = GENERATE(false, true);
+    auto seed = GENERATE(0, 1, 42);
+
+    auto chunks = parseChunks(shuffle);
+
+    // The library code's output is collected through its callbacks, so that
+    // it can be compared with what the interpreter writes out
+    xrf::CodegenOptions options;
+    options.registerState = registerState;
+    options.library = true;
+    options.seed = seed;
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = xrf::generateCode(*context, chunks, options);
+
+    auto jit = xrf::compileModule(std::move(context), std::move(module));
+    if (!jit) {
+        FAIL(llvm::toString(jit.takeError()));
+    }
+
+    auto runSymbol = (*jit)->lookup("xrf_run");
+    auto sizeSymbol = (*jit)->lookup("xrf_context_size");
+    if (!runSymbol || !sizeSymbol) {
+        FAIL(llvm::toString(runSymbol ? sizeSymbol.takeError() : runSymbol.takeError()));
+    }
+
+#if LLVM_VERSION_MAJOR >= 15
+    auto run = runSymbol->toPtr<decltype(&xrf_run)>();
+    auto contextSize = sizeSymbol->toPtr<decltype(&xrf_context_size)>();
+#else
+    auto run = reinterpret_cast<decltype(&xrf_run)>(runSymbol->getAddress());
+    auto contextSize = reinterpret_cast<decltype(&xrf_context_size)>(sizeSymbol->getAddress());
+#endif
+
+    LibraryIo io;
+
+    auto xrfContext = static_cast<xrf_context*>(std::malloc(contextSize()));
+    xrfContext->user = &io;
+    xrfContext->read = readLibraryInput;
+    xrfContext->write = writeLibraryOutput;
+
+    CHECK(run(xrfContext) == 0);
+
+    std::free(xrfContext);
+
+    auto outputFile = std::tmpfile();
+    REQUIRE(outputFile);
+
+    CHECK(xrf::interpret(chunks, options.stackSize, stdin, outputFile, options.seed) == 0);
+
+    std::rewind(outputFile);
+
+    std::string interpreted;
+    for (int c; (c = std::fgetc(outputFile)) != EOF;) {
+        interpreted.push_back(static_cast<char>(c));
+    }
+
+    std::fclose(outputFile);
+
+    CHECK(io.output.size() == 3);
+    CHECK(io.output == interpreted);
+}
+
+TEST_CASE("Generated code computes values from two slots at once", "[codegen]") {
+    // Reads two bytes, and writes out their sum before exiting
+    auto chunks = xrf::optimizeChunks(xrf::specializeVisits(parseChunks("0071B")));
+
+    REQUIRE(std::any_of(chunks[0].commands.begin(), chunks[0].commands.end(), [] (const xrf::Command &command) {
+        return command.type == xrf::CommandType::OutputValue && command.addedMultiple != 0;
+    }));
+
+    auto registerState = GENERATE(false, true);
+
+    xrf::CodegenOptions options;
+    options.registerState = registerState;
+    options.library = true;
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = xrf::generateCode(*context, chunks, options);
+
+    auto jit = xrf::compileModule(std::move(context), std::move(module));
+    if (!jit) {
+        FAIL(llvm::toString(jit.takeError()));
+    }
+
+    auto runSymbol = (*jit)->lookup("xrf_run");
+    auto sizeSymbol = (*jit)->lookup("xrf_context_size");
+    if (!runSymbol || !sizeSymbol) {
+        FAIL(llvm::toString(runSymbol ? sizeSymbol.takeError() : runSymbol.takeError()));
+    }
+
+#if LLVM_VERSION_MAJOR >= 15
+    auto run = runSymbol->toPtr<decltype(&xrf_run)>();
+    auto contextSize = sizeSymbol->toPtr<decltype(&xrf_context_size)>();
+#else
+    auto run = reinterpret_cast<decltype(&xrf_run)>(runSymbol->getAddress());
+    auto contextSize = reinterpret_cast<decltype(&xrf_context_size)>(sizeSymbol->getAddress());
+#endif
+
+    LibraryIo io;
+    io.input = "AB";
+
+    auto xrfContext = static_cast<xrf_context*>(std::malloc(contextSize()));
+    xrfContext->user = &io;
+    xrfContext->read = readLibraryInput;
+    xrfContext->write = writeLibraryOutput;
+
+    CHECK(run(xrfContext) == 0);
+    CHECK(io.output == "\x83");
+
+    std::free(xrfContext);
+}
+
+TEST_CASE("Partitioned code splits the program into functions", "[codegen]") {
+    auto chunks = parseChunks("8B0AF 10AFF 10AFF 5AFFF 6AFFF C3A12 35D2F");
+
+    auto ioMode = GENERATE(xrf::IoMode::Stdio, xrf::IoMode::Buffered);
+    auto registerState = GENERATE(false, true);
+    auto stackStorage = GENERATE(xrf::StackStorage::Static, xrf::StackStorage::Mmap);
+    auto library = GENERATE(false, true);
+    auto partitionSize = GENERATE(1, 3);
+
+    if (library && stackStorage == xrf::StackStorage::Mmap) {
+        return;
+    }
+
+    xrf::CodegenOptions options;
+    options.ioMode = ioMode;
+    options.registerState = registerState;
+    options.stackStorage = stackStorage;
+    options.library = library;
+    options.partitionSize = partitionSize;
+
+    for (const auto &program: {chunks, xrf::optimizeProgram(xrf::optimizeChunks(xrf::specializeVisits(chunks)))}) {
+        const auto targets = xrf::findJumpTargets(program);
+
+        for (auto jumpTargets: {static_cast<const xrf::JumpTargets*>(nullptr), &targets}) {
+            options.jumpTargets = jumpTargets;
+
+            llvm::LLVMContext context;
+
+            auto module = xrf::generateCode(context, program, options);
+
+            REQUIRE(module);
+            CHECK_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+
+            size_t partitions = 0;
+
+            for (const auto &func: module->functions()) {
+                if (func.getName().startswith("partition")) {
+                    partitions++;
+                }
+            }
+
+            CHECK(partitions > 1);
+        }
+    }
+}
+
+TEST_CASE("Partitioned code runs programs across its functions", "[codegen]") {
+    // Chunk 0 reads a byte and jumps to the chunk for that byte, which writes
+    // it out and reads the next byte, until the end of input jumps back to
+    // chunk 0 and exits
+    std::string cat = "8B0AF";
+    for (int i = 1; i < 256; i++) {
+        cat += " 10AFF";
+    }
+
+    auto registerState = GENERATE(false, true);
+    auto partitionSize = GENERATE(1, 16, 1000);
+
+    xrf::CodegenOptions options;
+    options.registerState = registerState;
+    options.library = true;
+    options.partitionSize = partitionSize;
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = xrf::generateCode(*context, parseChunks(cat), options);
+
+    auto jit = xrf::compileModule(std::move(context), std::move(module));
+    if (!jit) {
+        FAIL(llvm::toString(jit.takeError()));
+    }
+
+    auto runSymbol = (*jit)->lookup("xrf_run");
+    auto sizeSymbol = (*jit)->lookup("xrf_context_size");
+    if (!runSymbol || !sizeSymbol) {
+        FAIL(llvm::toString(runSymbol ? sizeSymbol.takeError() : runSymbol.takeError()));
+    }
+
+#if LLVM_VERSION_MAJOR >= 15
+    auto run = runSymbol->toPtr<decltype(&xrf_run)>();
+    auto contextSize = sizeSymbol->toPtr<decltype(&xrf_context_size)>();
+#else
+    auto run = reinterpret_cast<decltype(&xrf_run)>(runSymbol->getAddress());
+    auto contextSize = reinterpret_cast<decltype(&xrf_context_size)>(sizeSymbol->getAddress());
+#endif
+
+    // Every byte is written out by a different chunk, so this jumps between
+    // functions after almost every byte
+    LibraryIo io;
+    for (int i = 0; i < 100000; i++) {
+        io.input.push_back(static_cast<char>(1 + i % 255));
+    }
+
+    auto xrfContext = static_cast<xrf_context*>(std::malloc(contextSize()));
+    xrfContext->user = &io;
+    xrfContext->read = readLibraryInput;
+    xrfContext->write = writeLibraryOutput;
+
+    CHECK(run(xrfContext) == 0);
+    CHECK(io.output == io.input);
+
+    std::free(xrfContext);
+}
+
+TEST_CASE("Partitioned code split into modules links back into the same program", "[codegen]") {
+    std::string cat = "8B0AF";
+    for (int i = 1; i < 256; i++) {
+        cat += " 10AFF";
+    }
+
+    auto chunks = parseChunks(cat);
+    auto targets = xrf::findJumpTargets(chunks);
+
+    auto registerState = GENERATE(false, true);
+    auto useTargets = GENERATE(false, true);
+
+    xrf::CodegenOptions options;
+    options.registerState = registerState;
+    options.library = true;
+    options.partitionSize = 16;
+    options.jumpTargets = useTargets ? &targets : nullptr;
+
+    auto layout = xrf::layoutPartitions(chunks, options);
+
+    REQUIRE(layout.members.size() > 1);
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = xrf::generateSplitModule(*context, chunks, options, layout, std::nullopt);
+
+    REQUIRE(module);
+    CHECK_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+
+    for (size_t i = 0; i < layout.members.size(); i++) {
+        auto partition = xrf::generateSplitModule(*context, chunks, options, layout, i);
+
+        REQUIRE(partition);
+        CHECK_FALSE(llvm::verifyModule(*partition, &llvm::errs()));
+        CHECK_FALSE(partition->getFunction("xrf_run"));
+
+        REQUIRE_FALSE(llvm::Linker::linkModules(*module, std::move(partition)));
+    }
+
+    CHECK_FALSE(llvm::verifyModule(*module, &llvm::errs()));
+
+    LibraryIo io;
+    for (int i = 0; i < 10000; i++) {
+        io.input.push_back(static_cast<char>(1 + i % 255));
+    }
+
+    CHECK(runLibraryModule(std::move(context), std::move(module), io) == 0);
+    CHECK(io.output == io.input);
+}
+
+TEST_CASE("Instrumented code generates valid modules", "[codegen]") {
+    auto chunks = parseChunks("8B0AF 10AFF 10AFF 5AFFF 6AFFF C3A12");
+
+    auto dispatchMode = GENERATE(xrf::DispatchMode::Switch,
+                                 xrf::DispatchMode::Threaded,
+                                 xrf::DispatchMode::ThreadedUnchecked);
+    auto registerState = GENERATE(false, true);
+
+    xrf::CodegenOptions options;
+    options.dispatchMode = dispatchMode;
+    options.registerState = registerState;
+    options.instrument = true;
+
+    checkGeneratesValidCode(chunks, options);
+    checkGeneratesValidCode(xrf::specializeVisits(chunks), options);
+}
+
+TEST_CASE("Instrumented code writes out a profile when it exits", "[codegen]") {
+    // Chunk 0 jumps to chunk 1, which jumps back to chunk 0 the first time
+    // it's visited, and exits the second time
+    auto chunks = parseChunks("5AFFF 8B6AF");
+
+    llvm::SmallString<128> profileFile;
+    REQUIRE_FALSE(llvm::sys::fs::createTemporaryFile("xrf-profile", "txt", profileFile));
+
+    xrf::CodegenOptions options;
+    options.instrument = true;
+    options.profileFile = std::string(profileFile);
+
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = xrf::generateCode(*context, chunks, options);
+
+    auto result = xrf::runModule(std::move(context), std::move(module));
+    if (!result) {
+        FAIL(llvm::toString(result.takeError()));
+    }
+
+    CHECK(*result == 0);
+
+    std::ifstream file{std::string(profileFile)};
+    std::stringstream profile;
+    profile << file.rdbuf();
+
+    CHECK(profile.str() ==
+        "xrf-profile 2\n"
+        "0 2 2 1 0 0\n"
+        "1 2 1 2 2 1\n");
+
+    llvm::sys::fs::remove(profileFile);
+}
@@ -0,0 +1,141 @@
+#include "codegen.hpp"
+#include "interpreter.hpp"
+#include "optimization.hpp"
+#include "parser.hpp"
+
+#include "catch2/catch.hpp"
+
+#include <cstdio>
+#include <optional>
+#include <sstream>
+
+namespace {
+
+std::vector<xrf::Chunk> parseChunks(const std::string &code) {
+    std::stringstream stream{code};
+    xrf::FileReader reader{stream};
+
+    auto parseResult = xrf::parseXrf(reader);
+
+    REQUIRE(std::holds_alternative<std::vector<xrf::Chunk>>(parseResult));
+
+    return std::get<std::vector<xrf::Chunk>>(parseResult);
+}
+
+std::vector<xrf::Chunk> optimizeChunks(std::vector<xrf::Chunk> chunks, int optimizationLevel) {
+    if (optimizationLevel > 0) {
+        chunks = xrf::optimizeChunks(xrf::specializeVisits(std::move(chunks)));
+    }
+
+    if (optimizationLevel > 1) {
+        chunks = xrf::optimizeProgram(std::move(chunks));
+    }
+
+    return chunks;
+}
+
+/**
+ * Interprets a program with the given input, and returns its exit status and
+ * everything it wrote out.
+ */
+std::pair<int, std::string> interpret(const std::vector<xrf::Chunk> &chunks, const std::string &input,
+                                      std::optional<uint64_t> seed = std::nullopt)
+{
+    auto inputFile = std::tmpfile();
+    auto outputFile = std::tmpfile();
+
+    REQUIRE(inputFile);
+    REQUIRE(outputFile);
+
+    std::fwrite(input.data(), 1, input.size(), inputFile);
+    std::rewind(inputFile);
+
+    auto status = xrf::interpret(chunks, xrf::DEFAULT_STACK_SIZE, inputFile, outputFile, seed);
+
+    std::rewind(outputFile);
+
+    std::string output;
+    for (int c; (c = std::fgetc(outputFile)) != EOF;) {
+        output.push_back(static_cast<char>(c));
+    }
+
+    std::fclose(inputFile);
+    std::fclose(outputFile);
+
+    return {status, output};
+}
+
+} // anonymous namespace
+
+TEST_CASE("The interpreter runs programs at every optimization level", "[interpreter]") {
+    // Chunk 0 reads a byte and jumps to the chunk for that byte, which writes
+    // it out and reads the next byte, until the end of input jumps back to
+    // chunk 0 and exits
+    std::string cat = "8B0AF";
+    for (int i = 1; i < 256; i++) {
+        cat += " 10AFF";
+    }
+
+    auto level = GENERATE(0, 1, 2);
+    auto chunks = optimizeChunks(parseChunks(cat), level);
+
+    CHECK(interpret(chunks, "Hello, World!\n") == std::make_pair(0, std::string("Hello, World!\n")));
+    CHECK(interpret(chunks, "") == std::make_pair(0, std::string()));
+}
+
+TEST_CASE("The interpreter skips commands depending on whether chunks have been visited", "[interpreter]") {
+    // Chunk 1 jumps back to chunk 0 the first time it's visited, and exits
+    // the second time
+    auto chunks = parseChunks("5AFFF 8B6AF");
+
+    CHECK(interpret(chunks, "").first == 0);
+    CHECK(interpret(xrf::specializeVisits(chunks), "").first == 0);
+}
+
+TEST_CASE("The interpreter stops on jumps to chunks that don't exist", "[interpreter]") {
+    auto level = GENERATE(0, 1, 2);
+
+    CHECK(interpret(optimizeChunks(parseChunks("5AFFF"), level), "").first == 1);
+    CHECK(interpret(optimizeChunks(parseChunks("5AFFF 555AF"), level), "").first == 1);
+}
+
+TEST_CASE("The interpreter computes values from two slots at once", "[interpreter]") {
+    // Reads two bytes, and writes out their sum before exiting, which is
+    // optimized into one output of the sum of the top two values
+    auto level = GENERATE(0, 1, 2);
+
+    CHECK(interpret(optimizeChunks(parseChunks("0071B"), level), "AB") == std::make_pair(0, std::string("\x83")));
+}
+
+TEST_CASE("The interpreter shuffles the stack with the seed it's given", "[interpreter]") {
+    // Each of the first 200 chunks pushes the next number and jumps to the
+    // chunk for it, and then the last chunk shuffles the stack and writes out
+    // the top three values
+    std::string shuffle;
+    for (int i = 0; i < 200; i++) {
+        shuffle += "35FFF ";
+    }
+    shuffle += "D111B";
+
+    auto level = GENERATE(0, 1, 2);
+    auto chunks = optimizeChunks(parseChunks(shuffle), level);
+
+    auto [status, output] = interpret(chunks, "", 42);
+
+    CHECK(status == 0);
+    REQUIRE(output.size() == 3);
+
+    // The values are three different numbers from 0 to 200, which almost
+    // certainly aren't the three that were pushed last
+    for (auto c: output) {
+        CHECK(static_cast<unsigned char>(c) <= 200);
+    }
+
+    CHECK(output[0] != output[1]);
+    CHECK(output[0] != output[2]);
+    CHECK(output[1] != output[2]);
+    CHECK(output != "\xc8\xc7\xc6");
+
+    CHECK(interpret(chunks, "", 42).second == output);
+    CHECK(interpret(chunks, "", 43).second != output);
+}
@@ -0,0 +1,154 @@
+#include "jump-targets.hpp"
+#include "optimization.hpp"
+#include "parser.hpp"
+
+#include "catch2/catch.hpp"
+
+#include <sstream>
+
+namespace {
+
+std::vector<xrf::Chunk> parseChunks(const std::string &code) {
+    std::stringstream stream{code};
+    xrf::FileReader reader{stream};
+
+    auto parseResult = xrf::parseXrf(reader);
+
+    REQUIRE(std::holds_alternative<std::vector<xrf::Chunk>>(parseResult));
+
+    return std::get<std::vector<xrf::Chunk>>(parseResult);
+}
+
+} // anonymous namespace
+
+TEST_CASE("Jump targets are worked out from the commands in each chunk", "[jump-targets]") {
+    // Chunk 0 jumps to chunk 1, which jumps to chunk 2, which keeps jumping
+    // to itself, so chunk 3 is never run
+    auto targets = xrf::findJumpTargets(parseChunks("5AFFF 5AFFF FFFFF FFFFF"));
+
+    CHECK(targets.reachable == std::vector<bool>{true, true, true, false});
+    CHECK(targets.dynamicTargets == std::vector<bool>{false, true, true, false});
+}
+
+TEST_CASE("Known jumps aren't dynamic jump targets", "[jump-targets]") {
+    auto chunks = xrf::optimizeChunks(parseChunks("5AFFF 5AFFF 2BFFF FFFFF"));
+    auto targets = xrf::findJumpTargets(chunks);
+
+    CHECK(targets.reachable == std::vector<bool>{true, true, true, false});
+    CHECK(targets.dynamicTargets == std::vector<bool>{false, false, false, false});
+}
+
+TEST_CASE("Jumps to a byte of input can only reach the first 256 chunks", "[jump-targets]") {
+    std::string cat = "8B0AF";
+    for (int i = 1; i < 300; i++) {
+        cat += " 10AFF";
+    }
+
+    auto chunks = parseChunks(cat);
+    auto level = GENERATE(0, 1, 2);
+
+    if (level > 0) {
+        chunks = xrf::optimizeChunks(xrf::specializeVisits(std::move(chunks)));
+    }
+
+    if (level > 1) {
+        chunks = xrf::optimizeProgram(std::move(chunks));
+    }
+
+    auto targets = xrf::findJumpTargets(chunks);
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        CHECK(targets.reachable[i] == (i < 256));
+        CHECK(targets.dynamicTargets[i] == (i < 256));
+    }
+}
+
+TEST_CASE("Jumps to unknown values can reach every chunk", "[jump-targets]") {
+    // Chunk 0 reads a byte and decrements it, which wraps around for 0, so
+    // it could be any value
+    auto targets = xrf::findJumpTargets(parseChunks("06AFF 2BFFF FFFFF"));
+
+    CHECK(targets.reachable == std::vector<bool>{true, true, true});
+    CHECK(targets.dynamicTargets == std::vector<bool>{true, true, true});
+}
+
+TEST_CASE("Shuffling the stack mixes the ranges of every value", "[jump-targets]") {
+    // Chunk 0 pushes a 1 above a 0 and shuffles them, so after incrementing
+    // the top value it could jump to chunk 1 or chunk 2
+    auto targets = xrf::findJumpTargets(parseChunks("35D5F 2BFFF 2BFFF FFFFF"));
+
+    CHECK(targets.reachable == std::vector<bool>{true, true, true, false});
+    CHECK(targets.dynamicTargets == std::vector<bool>{false, true, true, false});
+}
+
+TEST_CASE("Swapping the top values follows both of their ranges", "[jump-targets]") {
+    // Chunk 0 leaves 1 below the top of the stack and jumps to chunk 2, which
+    // increments its own index and swaps it below the 1, so it jumps to
+    // chunk 1 and exits
+    auto targets = xrf::findJumpTargets(parseChunks("3535A BFFFF 54AFF FFFFF"));
+
+    CHECK(targets.reachable == std::vector<bool>{true, true, true, false});
+
+    REQUIRE(targets.successors[2]);
+    CHECK(targets.successors[2]->first == 1);
+    CHECK(targets.successors[2]->last == 1);
+}
+
+TEST_CASE("Jump targets follow values from one chunk to the next", "[jump-targets]") {
+    // The stack starts out filled with zeroes, so chunk 0 always jumps back
+    // to itself
+    auto targets = xrf::findJumpTargets(parseChunks("2AFFF 2BFFF FFFFF"));
+
+    CHECK(targets.reachable == std::vector<bool>{true, false, false});
+
+    // Chunk 0 leaves 2 below the top of the stack and jumps to chunk 1, which
+    // pops its index off and jumps to the 2
+    targets = xrf::findJumpTargets(parseChunks("5536F 2AFFF FFFFF FFFFF"));
+
+    CHECK(targets.reachable == std::vector<bool>{true, true, true, false});
+}
+
+TEST_CASE("Ranges of jump targets follow arithmetic on the stack", "[jump-targets]") {
+    // Chunk 0 reads a byte, adds 2 to it and then adds its own index of 0,
+    // so it can only jump to chunks 2 to 257
+    std::string program = "0557A";
+    for (int i = 1; i < 300; i++) {
+        program += " 2BFFF";
+    }
+
+    auto targets = xrf::findJumpTargets(parseChunks(program));
+
+    for (size_t i = 0; i < 300; i++) {
+        CHECK(targets.dynamicTargets[i] == (i >= 2 && i <= 257));
+    }
+}
+
+TEST_CASE("Each chunk has the range of chunks it can jump to at runtime", "[jump-targets]") {
+    auto targets = xrf::findJumpTargets(parseChunks("5AFFF 5AFFF FFFFF 2BFFF"));
+
+    REQUIRE(targets.successors.size() == 4);
+
+    REQUIRE(targets.successors[0]);
+    CHECK(targets.successors[0]->first == 1);
+    CHECK(targets.successors[0]->last == 1);
+
+    REQUIRE(targets.successors[2]);
+    CHECK(targets.successors[2]->first == 2);
+    CHECK(targets.successors[2]->last == 2);
+
+    // Chunk 3 is never run, and would exit if it were
+    CHECK_FALSE(targets.successors[3]);
+
+    // Chunk 0 of cat jumps to a byte of input, and every other chunk jumps
+    // back to chunk 0 at the end of input
+    std::string cat = "8B0AF";
+    for (int i = 1; i < 300; i++) {
+        cat += " 10AFF";
+    }
+
+    targets = xrf::findJumpTargets(parseChunks(cat));
+
+    REQUIRE(targets.successors[0]);
+    CHECK(targets.successors[0]->first == 0);
+    CHECK(targets.successors[0]->last == 255);
+}
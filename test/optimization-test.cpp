@@ -0,0 +1,179 @@
+#include "optimization.hpp"
+#include "parser.hpp"
+
+#include "catch2/catch.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+namespace {
+
+std::vector<xrf::Chunk> parseChunks(const std::string &code) {
+    std::stringstream stream{code};
+    xrf::FileReader reader{stream};
+
+    auto parseResult = xrf::parseXrf(reader);
+
+    REQUIRE(std::holds_alternative<std::vector<xrf::Chunk>>(parseResult));
+
+    return std::get<std::vector<xrf::Chunk>>(parseResult);
+}
+
+std::vector<xrf::CommandType> commandTypes(const std::vector<xrf::Command> &commands) {
+    std::vector<xrf::CommandType> types;
+
+    for (auto &command: commands) {
+        types.push_back(command.type);
+    }
+
+    return types;
+}
+
+} // anonymous namespace
+
+TEST_CASE("Chunks are split by whether they've been visited", "[optimization]") {
+    using xrf::CommandType;
+
+    auto chunks = xrf::specializeVisits(parseChunks("85F6F C5F6F 8F5AC 35AF8 12345"));
+
+    REQUIRE(chunks.size() == 5);
+
+    SECTION("Ignore first skips a command on the first visit") {
+        REQUIRE(chunks[0].visitedCommands);
+        CHECK(commandTypes(chunks[0].commands) == std::vector{CommandType::Nop, CommandType::Dec, CommandType::Nop});
+        CHECK(commandTypes(*chunks[0].visitedCommands) == std::vector{
+            CommandType::Inc, CommandType::Nop, CommandType::Dec, CommandType::Nop
+        });
+    }
+
+    SECTION("Ignore visited skips a command on later visits") {
+        REQUIRE(chunks[1].visitedCommands);
+        CHECK(commandTypes(chunks[1].commands) == std::vector{
+            CommandType::Inc, CommandType::Nop, CommandType::Dec, CommandType::Nop
+        });
+        CHECK(commandTypes(*chunks[1].visitedCommands) == std::vector{CommandType::Nop, CommandType::Dec, CommandType::Nop});
+    }
+
+    SECTION("Commands after a jump are dropped") {
+        REQUIRE(chunks[2].visitedCommands);
+        CHECK(commandTypes(chunks[2].commands) == std::vector{CommandType::Inc, CommandType::Jump});
+        CHECK(commandTypes(*chunks[2].visitedCommands) == std::vector{CommandType::Nop, CommandType::Inc, CommandType::Jump});
+    }
+
+    SECTION("Chunks that don't depend on being visited aren't split") {
+        CHECK_FALSE(chunks[3].visitedCommands);
+        CHECK(commandTypes(chunks[3].commands) == std::vector{CommandType::Dup, CommandType::Inc, CommandType::Jump});
+
+        CHECK_FALSE(chunks[4].visitedCommands);
+        CHECK(chunks[4].commands.size() == 5);
+    }
+}
+
+TEST_CASE("Both versions of split chunks are optimized", "[optimization]") {
+    auto chunks = xrf::optimizeChunks(xrf::specializeVisits(parseChunks("85AFF 5AFFF")));
+
+    REQUIRE(chunks.size() == 2);
+    REQUIRE(chunks[0].visitedCommands);
+
+    // The first visit jumps straight back to the same chunk, and later visits
+    // add 1 to the top of the stack first
+    CHECK(chunks[0].nextChunk == 0u);
+    CHECK(chunks[0].visitedNextChunk == 1u);
+}
+
+TEST_CASE("Known jumps are followed through chunks with I/O", "[optimization]") {
+    auto chunks = xrf::optimizeProgram(xrf::optimizeChunks(xrf::specializeVisits(parseChunks("5AFFF 315FF 0BFFF"))));
+
+    REQUIRE(chunks.size() == 3);
+
+    // The first chunk runs all three chunks in turn, and so ends by exiting
+    auto types = commandTypes(chunks[0].commands);
+
+    REQUIRE_FALSE(types.empty());
+    CHECK(std::count(types.begin(), types.end(), xrf::CommandType::OutputValue) == 1);
+    CHECK(std::count(types.begin(), types.end(), xrf::CommandType::Input) == 1);
+    CHECK(types.back() == xrf::CommandType::Exit);
+
+    // The chunks it runs through can still be jumped to on their own
+    CHECK(commandTypes(chunks[2].commands).back() == xrf::CommandType::Exit);
+}
+
+TEST_CASE("Silent loops are left spinning", "[optimization]") {
+    auto chunks = xrf::optimizeProgram(xrf::optimizeChunks(xrf::specializeVisits(parseChunks("5FFFF 6FFFF 3153F"))));
+
+    REQUIRE(chunks.size() == 3);
+
+    // The first two chunks jump back and forth without doing any I/O, so
+    // they never have to touch the stack
+    for (unsigned i = 0; i < 2; i++) {
+        CHECK(chunks[i].commands.empty());
+        CHECK(chunks[i].nextChunk == i);
+    }
+
+    // The third chunk outputs something on its way into the loop
+    CHECK(commandTypes(chunks[2].commands).front() == xrf::CommandType::OutputValue);
+}
+
+TEST_CASE("Loops through several chunks are combined into one iteration", "[optimization]") {
+    using xrf::CommandType;
+
+    // Outputs the second value and then increments it, over two chunks
+    auto chunks = xrf::optimizeProgram(xrf::optimizeChunks(xrf::specializeVisits(parseChunks("43145 4546F"))));
+
+    REQUIRE(chunks.size() == 2);
+    CHECK(chunks[0].nextChunk == 0u);
+    REQUIRE(commandTypes(chunks[0].commands) == std::vector{CommandType::OutputValue, CommandType::AddToSecond});
+    CHECK(chunks[0].commands[0].slot == 1);
+    CHECK(chunks[0].commands[1].val == 1);
+}
+
+TEST_CASE("Input that is copied to the output is translated ahead of time", "[optimization]") {
+    using xrf::CommandType;
+
+    // Each chunk other than the first outputs its index and reads the next
+    // chunk to jump to from the input
+    auto chunks = xrf::optimizeProgram(xrf::optimizeChunks(xrf::specializeVisits(parseChunks("0FFFF 3120F 3120F"))));
+
+    REQUIRE(chunks.size() == 3);
+
+    for (auto &chunk: chunks) {
+        REQUIRE(chunk.translation);
+        CHECK(commandTypes(chunk.commands).back() == CommandType::TranslateInput);
+    }
+
+    // Every chunk reads input the same way, so they share one table
+    CHECK(chunks[1].translation == chunks[0].translation);
+    CHECK(chunks[2].translation == chunks[0].translation);
+
+    auto &translation = *chunks[0].translation;
+
+    CHECK(translation[1] == 1);
+    CHECK(translation[2] == 2);
+
+    // The first chunk leaves the byte it jumped with on the stack, and there
+    // is no chunk to jump to for the other bytes
+    CHECK(translation[0] == xrf::TRANSLATE_STOP);
+    CHECK(translation[3] == xrf::TRANSLATE_STOP);
+}
+
+TEST_CASE("Optimizing with several threads gives the same chunks", "[optimization]") {
+    const std::vector<std::string> patterns = {"5AFFF", "3153F", "8B0AF", "10AFF", "6AFFF", "C3A12", "43145", "4546F"};
+
+    std::string code;
+
+    for (size_t i = 0; i < 200; i++) {
+        code += patterns[i % patterns.size()] + ' ';
+    }
+
+    auto chunks = xrf::specializeVisits(parseChunks(code));
+
+    auto serial = xrf::optimizeProgram(xrf::optimizeChunks(chunks), 1);
+    auto parallel = xrf::optimizeProgram(xrf::optimizeChunks(chunks, 4), 4);
+
+    REQUIRE(serial.size() == parallel.size());
+
+    for (size_t i = 0; i < serial.size(); i++) {
+        CHECK(commandTypes(serial[i].commands) == commandTypes(parallel[i].commands));
+        CHECK(serial[i].nextChunk == parallel[i].nextChunk);
+    }
+}
@@ -110,3 +110,36 @@ TEST_CASE("Parser rejects chunk with invalid commands", "[parser]") {
     CHECK(error.col == 2);
     CHECK(error.msg.find("invalid command character") != std::string::npos);
 }
+
+TEST_CASE("Parser parses source that is already in memory", "[parser]") {
+    // Enough whitespace between the chunks that it spans several blocks of
+    // the scanner, with newlines in the middle of it
+    std::string code = "01234" + std::string(20, ' ') + "\n\t\n" + std::string(30, ' ') + "56789\r\n   ABCDG";
+
+    auto parseResult = xrf::parseXrf(std::string_view(code));
+
+    REQUIRE(std::holds_alternative<xrf::ParserErrorList>(parseResult));
+
+    auto errors = std::get<xrf::ParserErrorList>(parseResult);
+
+    REQUIRE(errors.size() == 2);
+
+    CHECK(errors[0].line == 4);
+    CHECK(errors[0].col == 8);
+    CHECK(errors[0].msg.find("invalid command character") != std::string::npos);
+
+    CHECK(errors[1].line == 4);
+    CHECK(errors[1].col == 4);
+    CHECK(errors[1].msg.find("doesn't have enough commands") != std::string::npos);
+
+    auto validResult = xrf::parseXrf(std::string_view(code.substr(0, code.size() - 9)));
+
+    REQUIRE(std::holds_alternative<std::vector<xrf::Chunk>>(validResult));
+
+    auto chunks = std::get<std::vector<xrf::Chunk>>(validResult);
+
+    REQUIRE(chunks.size() == 2);
+    CHECK(chunks[1].line == 3);
+    CHECK(chunks[1].col == 31);
+    CHECK(chunks[1].commands[0].type == xrf::CommandType::Inc);
+}
@@ -0,0 +1,126 @@
+#include "codegen.hpp"
+#include "optimization.hpp"
+#include "parser.hpp"
+#include "profile.hpp"
+
+#include "catch2/catch.hpp"
+
+#include "llvm/IR/Instructions.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace {
+
+std::vector<xrf::Chunk> parseChunks(const std::string &code) {
+    std::stringstream stream{code};
+    xrf::FileReader reader{stream};
+
+    auto parseResult = xrf::parseXrf(reader);
+
+    REQUIRE(std::holds_alternative<std::vector<xrf::Chunk>>(parseResult));
+
+    return std::get<std::vector<xrf::Chunk>>(parseResult);
+}
+
+xrf::Profile parseValidProfile(std::string_view text) {
+    auto profile = xrf::parseProfile(text);
+
+    if (!profile) {
+        FAIL(llvm::toString(profile.takeError()));
+    }
+
+    return std::move(*profile);
+}
+
+} // anonymous namespace
+
+TEST_CASE("Profiles are parsed", "[profile]") {
+    auto profile = parseValidProfile(
+        "xrf-profile 3\n"
+        "0 2 2 1 0 0\n"
+        "2 10 1 9 10 9\n");
+
+    REQUIRE(profile.counts.size() == 3);
+    CHECK(profile.get(0, xrf::ProfileCounter::Runs) == 2);
+    CHECK(profile.get(1, xrf::ProfileCounter::Runs) == 0);
+    CHECK(profile.get(2, xrf::ProfileCounter::JumpsTo) == 9);
+    CHECK(profile.get(2, xrf::ProfileCounter::VisitedHits) == 9);
+}
+
+TEST_CASE("Invalid profiles are rejected", "[profile]") {
+    auto text = GENERATE(
+        "",
+        "5 2 2 1 0 0\n",
+        "xrf-profile 1\n0 2 2 1 0\n",
+        "xrf-profile 1\n1 2 2 1 0 0\n",
+        "xrf-profile 1\n0 2 2 x 0 0\n"
+    );
+
+    CHECK(llvm::errorToBool(xrf::parseProfile(text).takeError()));
+}
+
+TEST_CASE("Hot chunks cover almost all of the runs", "[profile]") {
+    auto profile = parseValidProfile(
+        "xrf-profile 4\n"
+        "0 1 0 0 0 0\n"
+        "1 5000 0 0 0 0\n"
+        "3 9000 0 0 0 0\n");
+
+    CHECK(xrf::findHotChunks(profile) == std::vector<bool>{false, true, false, true});
+    CHECK(xrf::orderHotFirst(profile) == std::vector<size_t>{3, 1, 0, 2});
+}
+
+TEST_CASE("Only hot chunks are split and traced", "[profile]") {
+    // Chunks 0 and 1 both depend on being visited, and jump to chunk 2
+    auto chunks = parseChunks("8F52A 8F51A 5AFFF 6AFFF 5B000");
+    std::vector<bool> hotChunks = {true, false, true, true, true};
+
+    auto specialized = xrf::specializeVisits(chunks, hotChunks);
+
+    CHECK(specialized[0].visitedCommands);
+    CHECK_FALSE(specialized[1].visitedCommands);
+
+    auto exits = [] (const xrf::Chunk &chunk) {
+        return std::any_of(chunk.commands.begin(), chunk.commands.end(), [] (xrf::Command cmd) {
+            return cmd.type == xrf::CommandType::Exit;
+        });
+    };
+
+    // The first chunk runs through the other two chunks to the exit
+    auto program = xrf::optimizeChunks(xrf::specializeVisits(parseChunks("5AFFF 5AFFF 5B000")));
+
+    CHECK(exits(xrf::optimizeProgram(program)[0]));
+
+    auto optimized = xrf::optimizeProgram(program, 1, {false, true, true});
+
+    // The cold chunk still jumps to the next chunk instead of being traced
+    CHECK(optimized[0].nextChunk == 1u);
+    CHECK_FALSE(exits(optimized[0]));
+}
+
+TEST_CASE("Profiles weight the branches of the stack jump", "[profile]") {
+    auto chunks = parseChunks("5AFFF 6AFFF");
+
+    auto profile = parseValidProfile(
+        "xrf-profile 2\n"
+        "0 5 5 4 0 0\n"
+        "1 5 4 5 0 0\n");
+
+    xrf::CodegenOptions options;
+    options.profile = &profile;
+
+    llvm::LLVMContext context;
+    auto module = xrf::generateCode(context, chunks, options);
+
+    const llvm::SwitchInst *stackSwitch = nullptr;
+
+    for (const auto &block: *module->getFunction("main")) {
+        if (auto switchInst = llvm::dyn_cast<llvm::SwitchInst>(block.getTerminator()); switchInst) {
+            stackSwitch = switchInst;
+        }
+    }
+
+    REQUIRE(stackSwitch);
+    CHECK(stackSwitch->getMetadata(llvm::LLVMContext::MD_prof));
+}
@@ -0,0 +1,245 @@
+#include "stack-simulator.hpp"
+
+#include "catch2/catch.hpp"
+
+#include <vector>
+
+namespace {
+
+std::vector<xrf::CommandType> commandTypes(const std::vector<xrf::Command> &commands) {
+    std::vector<xrf::CommandType> types;
+
+    for (auto &command: commands) {
+        types.push_back(command.type);
+    }
+
+    return types;
+}
+
+} // anonymous namespace
+
+TEST_CASE("Known values are subtracted", "[stack-simulator]") {
+    xrf::StackSimulator stack(2);
+
+    stack.inc();
+    stack.dup();
+    stack.inc();
+    stack.inc();
+    stack.sub();
+
+    CHECK(stack.getStackTop() == 2u);
+}
+
+TEST_CASE("Decrementing a known value wraps around", "[stack-simulator]") {
+    xrf::StackSimulator stack(0);
+
+    stack.dec();
+
+    CHECK(stack.getStackTop() == 0xFFFFFFFFu);
+}
+
+TEST_CASE("Known values are output without using the stack", "[stack-simulator]") {
+    using xrf::CommandType;
+
+    xrf::StackSimulator stack(3);
+
+    stack.dup();
+    stack.output();
+    stack.inc();
+
+    auto commands = stack.getCommands();
+
+    REQUIRE(commands);
+    CHECK(commandTypes(*commands) == std::vector{CommandType::OutputValue, CommandType::SetTop});
+    CHECK((*commands)[0].val == 3);
+    CHECK((*commands)[0].multiple == 0);
+    CHECK((*commands)[1].val == 4);
+    CHECK(stack.getStackTop() == 4u);
+}
+
+TEST_CASE("Values deeper in the stack are shuffled", "[stack-simulator]") {
+    using xrf::CommandType;
+
+    xrf::StackSimulator stack(5);
+
+    // Swap the second and third values, and double the new second value
+    stack.pop();
+    stack.swap();
+    stack.dup();
+    stack.add();
+    stack.inc();
+    stack.dec();
+    stack.swap();
+    stack.swap();
+
+    auto commands = stack.getCommands();
+
+    REQUIRE(commands);
+    REQUIRE(commandTypes(*commands) == std::vector{
+        CommandType::BeginShuffle, CommandType::ShuffleValue, CommandType::ShuffleValue
+    });
+
+    auto &shuffle = (*commands)[0];
+    CHECK(shuffle.slot == 3);
+    CHECK(shuffle.val == 2);
+
+    auto &deeper = (*commands)[1];
+    CHECK(deeper.slot == 1);
+    CHECK(deeper.multiple == 1);
+    CHECK(deeper.val == 0);
+
+    auto &top = (*commands)[2];
+    CHECK(top.slot == 2);
+    CHECK(top.multiple == 2);
+    CHECK(top.val == 0);
+
+    CHECK_FALSE(stack.getStackTop());
+}
+
+TEST_CASE("Unchanged values at the bottom of a shuffle are left alone", "[stack-simulator]") {
+    using xrf::CommandType;
+
+    xrf::StackSimulator stack;
+
+    stack.dup();
+    stack.inc();
+
+    auto commands = stack.getCommands();
+
+    REQUIRE(commands);
+    REQUIRE(commandTypes(*commands) == std::vector{CommandType::BeginShuffle, CommandType::ShuffleValue});
+    CHECK((*commands)[0].slot == 0);
+    CHECK((*commands)[0].val == 1);
+    CHECK((*commands)[1].slot == 0);
+    CHECK((*commands)[1].val == 1);
+}
+
+TEST_CASE("Input can't be represented", "[stack-simulator]") {
+    xrf::StackSimulator stack(1);
+
+    CHECK(stack.isRepresentable());
+
+    stack.input();
+
+    CHECK_FALSE(stack.isRepresentable());
+    CHECK_FALSE(stack.getCommands());
+}
+
+TEST_CASE("Optimized commands can be simulated", "[stack-simulator]") {
+    using xrf::CommandType;
+
+    xrf::StackSimulator stack(1);
+
+    std::vector<xrf::Command> commands{
+        {CommandType::MultiplySecond, 3},
+        {CommandType::AddToSecond, 2},
+        {CommandType::OutputValue, 0, 1, 1},
+        {CommandType::BeginShuffle, 2, 1, 0},
+        {CommandType::ShuffleValue, 0, 1, 1},
+        {CommandType::ShuffleValue, 4, 0, 0},
+    };
+
+    for (size_t i = 0; i < commands.size(); ) {
+        i += stack.simulateOptimized(commands, i);
+    }
+
+    CHECK(stack.getStackTop() == 4u);
+
+    auto simulated = stack.getCommands();
+
+    REQUIRE(simulated);
+
+    // The output and the new second value are both the original second value
+    // times 3 plus 2
+    auto types = commandTypes(*simulated);
+
+    REQUIRE(types.front() == CommandType::OutputValue);
+    CHECK((*simulated)[0].slot == 1);
+    CHECK((*simulated)[0].multiple == 3);
+    CHECK((*simulated)[0].val == 2);
+}
+
+TEST_CASE("Sums of values deeper in the stack are folded", "[stack-simulator]") {
+    using xrf::CommandType;
+
+    xrf::StackSimulator stack;
+
+    // Adds twice the top value to the second value
+    stack.dup();
+    stack.add();
+    stack.add();
+
+    auto commands = stack.getCommands();
+
+    REQUIRE(commands);
+    REQUIRE(commandTypes(*commands) == std::vector{CommandType::BeginShuffle, CommandType::ShuffleValue});
+    CHECK((*commands)[0].slot == 2);
+    CHECK((*commands)[0].val == 1);
+
+    auto &sum = (*commands)[1];
+    CHECK(sum.slot == 0);
+    CHECK(sum.multiple == 2);
+    CHECK(sum.addedSlot == 1);
+    CHECK(sum.addedMultiple == 1);
+    CHECK(sum.val == 0);
+}
+
+TEST_CASE("Values from too many slots can't be represented", "[stack-simulator]") {
+    xrf::StackSimulator stack;
+
+    stack.add();
+
+    CHECK(stack.isRepresentable());
+
+    stack.add();
+
+    CHECK_FALSE(stack.isRepresentable());
+}
+
+TEST_CASE("A value subtracted from itself is 0", "[stack-simulator]") {
+    xrf::StackSimulator stack;
+
+    stack.pop();
+    stack.inc();
+    stack.dup();
+    stack.sub();
+
+    CHECK(stack.getStackTop() == 0u);
+}
+
+TEST_CASE("Optimized commands that add two slots can be simulated", "[stack-simulator]") {
+    using xrf::CommandType;
+
+    xrf::StackSimulator stack;
+
+    std::vector<xrf::Command> commands{
+        {CommandType::BeginShuffle, 1, 2, 0},
+        {CommandType::ShuffleValue, 3, 0, 2, 1, 1},
+        {CommandType::MultiplySecond, 0},
+    };
+
+    for (size_t i = 0; i < commands.size(); ) {
+        i += stack.simulateOptimized(commands, i);
+    }
+
+    // The top value is the original top value times 2, plus the original
+    // second value, plus 3, and the value below it is the original third
+    // value times 0
+    auto simulated = stack.getCommands();
+
+    REQUIRE(simulated);
+    REQUIRE(commandTypes(*simulated) == std::vector{
+        CommandType::BeginShuffle, CommandType::ShuffleValue, CommandType::ShuffleValue
+    });
+
+    auto &second = (*simulated)[1];
+    CHECK(second.multiple == 0);
+    CHECK(second.val == 0);
+
+    auto &top = (*simulated)[2];
+    CHECK(top.slot == 0);
+    CHECK(top.multiple == 2);
+    CHECK(top.addedSlot == 1);
+    CHECK(top.addedMultiple == 1);
+    CHECK(top.val == 3);
+}
@@ -0,0 +1,67 @@
+#include "codegen.hpp"
+#include "optimization.hpp"
+#include "parser.hpp"
+#include "stats.hpp"
+
+#include "catch2/catch.hpp"
+
+#include <sstream>
+
+namespace {
+
+std::vector<xrf::Chunk> parseChunks(const std::string &code) {
+    std::stringstream stream{code};
+    xrf::FileReader reader{stream};
+
+    auto parseResult = xrf::parseXrf(reader);
+
+    REQUIRE(std::holds_alternative<std::vector<xrf::Chunk>>(parseResult));
+
+    return std::get<std::vector<xrf::Chunk>>(parseResult);
+}
+
+} // anonymous namespace
+
+TEST_CASE("Chunk stats count known jumps and fused commands", "[stats]") {
+    // The first chunk jumps to the second, which reads where to jump to
+    auto chunks = xrf::optimizeChunks(xrf::specializeVisits(parseChunks("5FFFF 0AFFF")));
+
+    xrf::CompileStats stats;
+    xrf::countChunkStats(stats, chunks);
+
+    CHECK(stats.chunks == 2);
+    CHECK(stats.knownJumps == 1);
+    CHECK(stats.commands == 2);
+    CHECK(stats.fusedCommands == 1);
+}
+
+TEST_CASE("Dispatch stats count the jumps chosen at runtime", "[stats]") {
+    auto chunks = parseChunks("5FFFF 0AFFF 0AFFF");
+
+    auto dispatchMode = GENERATE(xrf::DispatchMode::Switch, xrf::DispatchMode::Threaded);
+
+    xrf::CodegenOptions options;
+    options.dispatchMode = dispatchMode;
+
+    llvm::LLVMContext context;
+    auto module = xrf::generateCode(context, chunks, options);
+
+    xrf::CompileStats stats;
+    xrf::countDispatchStats(stats, *module);
+
+    // Without optimizing, every chunk jumps based on the top of the stack
+    CHECK(stats.dynamicJumps == 3);
+    CHECK(stats.dispatchEdges == (dispatchMode == xrf::DispatchMode::Switch ? 3 : 9));
+}
+
+TEST_CASE("Stats are written out as JSON", "[stats]") {
+    xrf::CompileStats stats;
+    stats.phases.emplace_back("parse", 0.5);
+    stats.chunks = 3;
+
+    std::stringstream json;
+    xrf::printStatsJson(json, stats);
+
+    CHECK(json.str().find("\"parse\": 0.5") != std::string::npos);
+    CHECK(json.str().find("\"chunks\": 3,") != std::string::npos);
+}